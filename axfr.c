@@ -13,9 +13,236 @@
 #include "dns.h"
 #include "packet.h"
 #include "options.h"
+#include "ixfr.h"
 
 #define AXFR_TSIG_SIGN_EVERY_NTH	96	/* tsig sign every N packets. */
 
+/*
+ * The encoded messages of an AXFR of a zone, kept by a server process
+ * and sent again to the next clients that transfer the zone.  The zone
+ * data does not change in a server process, a reload forks new ones.
+ * The messages are encoded when the first client that needs them asks
+ * for them, so clients that transfer the zone at the same time share
+ * the encoding.  The first message follows the question, the owner
+ * names compress to that, it is the same length for every client.
+ */
+struct axfr_cache_msg {
+	/* the answer section, without header and question */
+	uint8_t* data;
+	uint16_t len;
+	uint16_t ancount;
+	/* if this message has the terminating SOA */
+	int last;
+};
+
+struct axfr_cache {
+	struct axfr_cache* next;
+	/* the message size the stream is made for */
+	uint16_t maxlen;
+	uint16_t reserved_space;
+	/* where the encoding of the next message continues */
+	domain_type* current_domain;
+	rrset_type* current_rrset;
+	uint16_t current_rr;
+	/* encoded messages */
+	struct axfr_cache_msg* msgs;
+	size_t num, capacity;
+};
+
+/* bytes in the AXFR caches of this server process */
+static size_t axfr_cache_bytes = 0;
+
+/*
+ * Add zone RRs from the current position in the AXFR until the answer
+ * is full.  Returns the number of RRs added, and sets done if the
+ * terminating SOA RR was added.
+ */
+static uint16_t
+axfr_add_rrs(struct query *query, int* done)
+{
+	uint16_t total_added = 0;
+	int added;
+
+	assert(query->axfr_current_domain);
+
+	do {
+		if (!query->axfr_current_rrset) {
+			query->axfr_current_rrset = domain_find_any_rrset(
+				query->axfr_current_domain,
+				query->axfr_zone);
+			query->axfr_current_rr = 0;
+		}
+		while (query->axfr_current_rrset) {
+			if (query->axfr_current_rrset != query->axfr_zone->soa_rrset
+			    && query->axfr_current_rrset->zone == query->axfr_zone)
+			{
+				while (query->axfr_current_rr < query->axfr_current_rrset->rr_count) {
+					added = packet_encode_rr(
+						query,
+						query->axfr_current_domain,
+						&query->axfr_current_rrset->rrs[query->axfr_current_rr],
+						query->axfr_current_rrset->rrs[query->axfr_current_rr].ttl);
+					if (!added)
+						return total_added;
+					++total_added;
+					++query->axfr_current_rr;
+				}
+			}
+
+			query->axfr_current_rrset = query->axfr_current_rrset->next;
+			query->axfr_current_rr = 0;
+		}
+		assert(query->axfr_current_domain);
+		query->axfr_current_domain
+			= domain_next(query->axfr_current_domain);
+	}
+	while (query->axfr_current_domain != NULL &&
+			domain_is_subdomain(query->axfr_current_domain,
+					    query->axfr_zone->apex));
+
+	/* Add terminating SOA RR.  */
+	assert(query->axfr_zone->soa_rrset->rr_count == 1);
+	added = packet_encode_rr(query,
+				 query->axfr_zone->apex,
+				 &query->axfr_zone->soa_rrset->rrs[0],
+				 query->axfr_zone->soa_rrset->rrs[0].ttl);
+	if (added) {
+		++total_added;
+		*done = 1;
+	}
+	return total_added;
+}
+
+/*
+ * Find the cached AXFR of the zone for the message size of the query,
+ * or start one.  NULL if it is not cached.
+ */
+static struct axfr_cache*
+axfr_cache_find(struct nsd *nsd, struct query *query)
+{
+	zone_type* zone = query->axfr_zone;
+	struct axfr_cache* c;
+	if (nsd->options->axfr_cache_size == 0)
+		return NULL;
+	for (c = zone->axfr_cache; c; c = c->next) {
+		if (c->maxlen == query->maxlen &&
+			c->reserved_space == query->reserved_space)
+			return c;
+	}
+	if (axfr_cache_bytes >= (size_t)nsd->options->axfr_cache_size)
+		return NULL;
+	c = (struct axfr_cache*)xalloc_zero(sizeof(*c));
+	c->maxlen = query->maxlen;
+	c->reserved_space = query->reserved_space;
+	c->current_domain = zone->apex;
+	c->current_rrset = NULL;
+	c->current_rr = 0;
+	c->next = zone->axfr_cache;
+	zone->axfr_cache = c;
+	return c;
+}
+
+/*
+ * Encode the next message of the cached AXFR in the packet of the query,
+ * that is positioned at the start of the answer section, and store it.
+ */
+static void
+axfr_cache_encode(struct query *query, struct axfr_cache* c)
+{
+	size_t mark = buffer_position(query->packet);
+	struct axfr_cache_msg* m;
+	uint16_t added = 0;
+	int done = 0;
+
+	if (c->num == 0) {
+		zone_type* zone = query->axfr_zone;
+		query_add_compression_domain(query, zone->apex, QHEADERSZ);
+		assert(zone->soa_rrset->rr_count == 1);
+		if (!packet_encode_rr(query, zone->apex,
+			&zone->soa_rrset->rrs[0], zone->soa_rrset->rrs[0].ttl)) {
+			/* XXX: This should never happen... generate error code? */
+			abort();
+		}
+		++added;
+	}
+	query->axfr_current_domain = c->current_domain;
+	query->axfr_current_rrset = c->current_rrset;
+	query->axfr_current_rr = c->current_rr;
+	added += axfr_add_rrs(query, &done);
+	c->current_domain = query->axfr_current_domain;
+	c->current_rrset = query->axfr_current_rrset;
+	c->current_rr = query->axfr_current_rr;
+	query_clear_compression_tables(query);
+
+	if (c->num == c->capacity) {
+		c->capacity = c->capacity ? c->capacity * 2 : 16;
+		c->msgs = (struct axfr_cache_msg*)xrealloc(c->msgs,
+			c->capacity * sizeof(*c->msgs));
+	}
+	m = &c->msgs[c->num++];
+	m->len = (uint16_t)(buffer_position(query->packet) - mark);
+	m->data = (uint8_t*)xalloc(m->len ? m->len : 1);
+	memcpy(m->data, buffer_at(query->packet, mark), m->len);
+	m->ancount = added;
+	m->last = done;
+	axfr_cache_bytes += m->len + sizeof(*m);
+}
+
+/*
+ * See if the next message of the AXFR of the query is in the cache, or
+ * can be encoded into it.  When the cache is full, the query continues
+ * where the cached messages end, and encodes the rest of the transfer
+ * without the cache.
+ */
+static int
+axfr_cache_next(struct nsd *nsd, struct query *query)
+{
+	struct axfr_cache* c = query->axfr_cache;
+	if (query->axfr_cache_msg < c->num ||
+		axfr_cache_bytes < (size_t)nsd->options->axfr_cache_size)
+		return 1;
+	query->axfr_current_domain = c->current_domain;
+	query->axfr_current_rrset = c->current_rrset;
+	query->axfr_current_rr = c->current_rr;
+	query->axfr_cache = NULL;
+	return 0;
+}
+
+/* Add the next message of the AXFR from the cache.  */
+static query_state_type
+query_axfr_cached(struct query *query)
+{
+	struct axfr_cache* c = query->axfr_cache;
+	struct axfr_cache_msg* m;
+
+	if (query->axfr_cache_msg == c->num) {
+		/* the first client to get here encodes it */
+		axfr_cache_encode(query, c);
+	} else {
+		/* it fits, it is made for the same message size */
+		m = &c->msgs[query->axfr_cache_msg];
+		buffer_write(query->packet, m->data, m->len);
+	}
+	m = &c->msgs[query->axfr_cache_msg++];
+	if (m->last) {
+		query->tsig_sign_it = 1; /* sign last packet */
+		query->axfr_is_done = 1;
+	}
+
+	AA_SET(query->packet);
+	ANCOUNT_SET(query->packet, m->ancount);
+	NSCOUNT_SET(query->packet, 0);
+	ARCOUNT_SET(query->packet, 0);
+
+	/* check if it needs tsig signatures */
+	if(query->tsig.status == TSIG_OK) {
+		if(query->tsig.updates_since_last_prepare >= AXFR_TSIG_SIGN_EVERY_NTH) {
+			query->tsig_sign_it = 1;
+		}
+	}
+	return QUERY_IN_AXFR;
+}
+
 query_state_type
 query_axfr(struct nsd *nsd, struct query *query)
 {
@@ -71,6 +298,11 @@ query_axfr(struct nsd *nsd, struct query *query)
 			query->tsig_sign_it = 1; /* sign first packet in stream */
 		}
 
+		query->axfr_cache = axfr_cache_find(nsd, query);
+		query->axfr_cache_msg = 0;
+		if (query->axfr_cache && axfr_cache_next(nsd, query))
+			return query_axfr_cached(query);
+
 		query_add_compression_domain(query, qdomain, QHEADERSZ);
 
 		assert(query->axfr_zone->soa_rrset->rr_count == 1);
@@ -92,45 +324,209 @@ query_axfr(struct nsd *nsd, struct query *query)
 		buffer_set_limit(query->packet, QHEADERSZ);
 		QDCOUNT_SET(query->packet, 0);
 		query_prepare_response(query);
+		if (query->axfr_cache && axfr_cache_next(nsd, query))
+			return query_axfr_cached(query);
 	}
 
 	/* Add zone RRs until answer is full.  */
-	assert(query->axfr_current_domain);
+	total_added += axfr_add_rrs(query, &query->axfr_is_done);
+	if (query->axfr_is_done)
+		query->tsig_sign_it = 1; /* sign last packet */
 
-	do {
-		if (!query->axfr_current_rrset) {
-			query->axfr_current_rrset = domain_find_any_rrset(
-				query->axfr_current_domain,
-				query->axfr_zone);
-			query->axfr_current_rr = 0;
+	AA_SET(query->packet);
+	ANCOUNT_SET(query->packet, total_added);
+	NSCOUNT_SET(query->packet, 0);
+	ARCOUNT_SET(query->packet, 0);
+
+	/* check if it needs tsig signatures */
+	if(query->tsig.status == TSIG_OK) {
+		if(query->tsig.updates_since_last_prepare >= AXFR_TSIG_SIGN_EVERY_NTH) {
+			query->tsig_sign_it = 1;
 		}
-		while (query->axfr_current_rrset) {
-			if (query->axfr_current_rrset != query->axfr_zone->soa_rrset
-			    && query->axfr_current_rrset->zone == query->axfr_zone)
-			{
-				while (query->axfr_current_rr < query->axfr_current_rrset->rr_count) {
-					added = packet_encode_rr(
-						query,
-						query->axfr_current_domain,
-						&query->axfr_current_rrset->rrs[query->axfr_current_rr],
-						query->axfr_current_rrset->rrs[query->axfr_current_rr].ttl);
-					if (!added)
-						goto return_answer;
-					++total_added;
-					++query->axfr_current_rr;
-				}
-			}
+	}
+	query_clear_compression_tables(query);
+	return QUERY_IN_AXFR;
+}
 
-			query->axfr_current_rrset = query->axfr_current_rrset->next;
-			query->axfr_current_rr = 0;
+/* length of the uncompressed wireformat RR at the start of the data,
+ * 0 if it is malformed */
+static size_t
+ixfr_rr_length(const uint8_t* data, size_t len)
+{
+	size_t pos = 0;
+	/* owner name, uncompressed labels */
+	while(pos < len && data[pos] != 0) {
+		if((data[pos] & 0xc0))
+			return 0;
+		pos += data[pos] + 1;
+	}
+	pos++; /* the root label */
+	if(pos + 10 > len)
+		return 0;
+	pos += 10 + read_uint16(data + pos + 8);
+	if(pos > len)
+		return 0;
+	return pos;
+}
+
+/* the change in the journal of the zone that starts at the serial, if the
+ * journal continues from there to the served version, or NULL */
+static struct ixfr_data*
+zone_ixfr_find(zone_type* zone, uint32_t serial, uint32_t current)
+{
+	struct ixfr_data* d;
+	if(!zone->ixfr || !zone->ixfr->newest || !zone->soa_rrset)
+		return NULL;
+	/* the journal must end at the version that is served */
+	if(zone->ixfr->newest->newserial != current)
+		return NULL;
+	/* the changes in the journal follow each other without gaps */
+	for(d = zone->ixfr->oldest; d; d = d->next) {
+		if(d->oldserial == serial)
+			return d;
+	}
+	return NULL;
+}
+
+/* add the current SOA of the zone as the only answer */
+static query_state_type
+query_ixfr_soa_only(struct query *query, zone_type *zone)
+{
+	query_add_compression_domain(query, zone->apex, QHEADERSZ);
+	if(!packet_encode_rr(query, zone->apex, &zone->soa_rrset->rrs[0],
+		zone->soa_rrset->rrs[0].ttl)) {
+		RCODE_SET(query->packet, RCODE_SERVFAIL);
+	} else {
+		AA_SET(query->packet);
+		ANCOUNT_SET(query->packet, 1);
+		NSCOUNT_SET(query->packet, 0);
+		ARCOUNT_SET(query->packet, 0);
+	}
+	query_clear_compression_tables(query);
+	return QUERY_PROCESSED;
+}
+
+/* add uncompressed wireformat RR to the packet, 0 if it does not fit */
+static int
+query_ixfr_add_rr(struct query *query, uint8_t *rr, size_t len)
+{
+	size_t truncation_mark = buffer_position(query->packet);
+	if(!buffer_available(query->packet, len))
+		return 0;
+	buffer_write(query->packet, rr, len);
+	if(query_overflow(query)) {
+		buffer_set_position(query->packet, truncation_mark);
+		return 0;
+	}
+	return 1;
+}
+
+query_state_type
+query_ixfr(struct nsd *nsd, struct query *query)
+{
+	uint16_t total_added = 0;
+	size_t answer_mark = 0;
+	int added;
+
+	if (query->axfr_is_done)
+		return QUERY_PROCESSED;
+
+	if (query->maxlen > AXFR_MAX_MESSAGE_LEN)
+		query->maxlen = AXFR_MAX_MESSAGE_LEN;
+
+	assert(!query_overflow(query));
+
+	if (query->axfr_zone == NULL) {
+		domain_type *closest_match;
+		domain_type *closest_encloser;
+		zone_type *zone;
+		uint32_t serial;
+		int exact;
+		/* Start IXFR.  */
+		exact = namedb_lookup(nsd->db, query->qname, &closest_match,
+			&closest_encloser);
+		zone = domain_find_zone(nsd->db, closest_encloser);
+		if (!exact || zone == NULL || zone->apex != closest_encloser
+			|| zone->soa_rrset == NULL)
+		{
+			/* No SOA no transfer */
+			RCODE_SET(query->packet, RCODE_NOTAUTH);
+			return QUERY_PROCESSED;
 		}
-		assert(query->axfr_current_domain);
-		query->axfr_current_domain
-			= domain_next(query->axfr_current_domain);
+		memcpy(&serial, rdata_atom_data(
+			zone->soa_rrset->rrs[0].rdatas[2]), sizeof(serial));
+		serial = ntohl(serial);
+		if (query->ixfr_has_serial &&
+			compare_serial(query->ixfr_serial, serial) >= 0) {
+			/* the client is up to date */
+			return query_ixfr_soa_only(query, zone);
+		}
+		if (query->ixfr_has_serial)
+			query->ixfr_current = zone_ixfr_find(zone,
+				query->ixfr_serial, serial);
+		if (!query->ixfr_current) {
+			/* not in the journal, over TCP send the full zone,
+			 * over UDP the SOA makes the client retry with TCP */
+			if (query->tcp)
+				return query_axfr(nsd, query);
+			return query_ixfr_soa_only(query, zone);
+		}
+		query->axfr_zone = zone;
+		query->ixfr_current_pos = 0;
+		/* the tsig flags are still those of the query, the first
+		 * packet in the stream is signed */
+
+		answer_mark = buffer_position(query->packet);
+		query_add_compression_domain(query, zone->apex, QHEADERSZ);
+		added = packet_encode_rr(query, zone->apex,
+			&zone->soa_rrset->rrs[0], zone->soa_rrset->rrs[0].ttl);
+		if (!added) {
+			RCODE_SET(query->packet, RCODE_SERVFAIL);
+			query_clear_compression_tables(query);
+			return QUERY_PROCESSED;
+		}
+		++total_added;
+	} else {
+		/* only keep running values for most packets */
+		query->tsig_prepare_it = 0;
+		query->tsig_update_it = 1;
+		if(query->tsig_sign_it) {
+			/* prepare for next updates */
+			query->tsig_prepare_it = 1;
+			query->tsig_sign_it = 0;
+		}
+		/*
+		 * Query name and EDNS need not be repeated after the
+		 * first response packet.
+		 */
+		query->edns.status = EDNS_NOT_PRESENT;
+		buffer_set_limit(query->packet, QHEADERSZ);
+		QDCOUNT_SET(query->packet, 0);
+		query_prepare_response(query);
+	}
+
+	/* Add the difference sequences until answer is full.  */
+	while (query->ixfr_current) {
+		struct ixfr_data *d = query->ixfr_current;
+		while (query->ixfr_current_pos < d->len) {
+			uint8_t *rr = d->data + query->ixfr_current_pos;
+			size_t len = ixfr_rr_length(rr,
+				d->len - query->ixfr_current_pos);
+			if (len == 0) {
+				log_msg(LOG_ERR, "ixfr: malformed journal for "
+					"zone %s", domain_to_string(
+					query->axfr_zone->apex));
+				query->ixfr_current_pos = d->len;
+				break;
+			}
+			if (!query_ixfr_add_rr(query, rr, len))
+				goto return_answer;
+			++total_added;
+			query->ixfr_current_pos += len;
+		}
+		query->ixfr_current = d->next;
+		query->ixfr_current_pos = 0;
 	}
-	while (query->axfr_current_domain != NULL &&
-			domain_is_subdomain(query->axfr_current_domain,
-					    query->axfr_zone->apex));
 
 	/* Add terminating SOA RR.  */
 	assert(query->axfr_zone->soa_rrset->rr_count == 1);
@@ -145,6 +541,29 @@ query_axfr(struct nsd *nsd, struct query *query)
 	}
 
 return_answer:
+	if (!query->tcp) {
+		if (!query->axfr_is_done) {
+			/* does not fit in the UDP response, RFC 1995 says
+			 * to send only the SOA, the client then uses TCP */
+			buffer_set_position(query->packet, answer_mark);
+			query_clear_dname_offsets(query, answer_mark);
+			query->axfr_is_done = 1;
+			return query_ixfr_soa_only(query, query->axfr_zone);
+		}
+		AA_SET(query->packet);
+		ANCOUNT_SET(query->packet, total_added);
+		NSCOUNT_SET(query->packet, 0);
+		ARCOUNT_SET(query->packet, 0);
+		query_clear_compression_tables(query);
+		return QUERY_PROCESSED;
+	}
+	if (total_added == 0) {
+		/* an RR that does not fit in an empty packet */
+		log_msg(LOG_ERR, "ixfr: RR too large for a TCP packet in "
+			"zone %s", domain_to_string(query->axfr_zone->apex));
+		RCODE_SET(query->packet, RCODE_SERVFAIL);
+		query->axfr_is_done = 1;
+	}
 	AA_SET(query->packet);
 	ANCOUNT_SET(query->packet, total_added);
 	NSCOUNT_SET(query->packet, 0);
@@ -157,7 +576,42 @@ return_answer:
 		}
 	}
 	query_clear_compression_tables(query);
-	return QUERY_IN_AXFR;
+	return QUERY_IN_IXFR;
+}
+
+/*
+ * Check the provide-xfr access control list for the zone transfer,
+ * returns 0 and sets the rcode if it is refused.
+ */
+static int
+axfr_ixfr_can_admit(struct nsd *nsd, struct query *q)
+{
+	acl_options_t *acl = NULL;
+	zone_options_t* zone_opt;
+	const char* xfr = (q->qtype == TYPE_AXFR)?"axfr":"ixfr";
+	zone_opt = zone_options_find(nsd->options, q->qname);
+	if(!zone_opt ||
+	   acl_check_incoming(zone_opt->pattern->provide_xfr, q, &acl)==-1)
+	{
+		if (verbosity >= 2) {
+			char a[128];
+			addr2str(&q->addr, a, sizeof(a));
+			VERBOSITY(2, (LOG_INFO, "%s for %s from %s refused, %s",
+				xfr, dname_to_string(q->qname, NULL), a,
+				acl?"blocked":"no acl matches"));
+		}
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "%s refused, %s", xfr,
+			acl?"blocked":"no acl matches"));
+		if (!zone_opt) {
+			RCODE_SET(q->packet, RCODE_NOTAUTH);
+		} else {
+			RCODE_SET(q->packet, RCODE_REFUSE);
+		}
+		return 0;
+	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "%s admitted acl %s %s", xfr,
+		acl->ip_address_spec, acl->key_name?acl->key_name:"NOKEY"));
+	return 1;
 }
 
 /*
@@ -166,39 +620,21 @@ return_answer:
 query_state_type
 answer_axfr_ixfr(struct nsd *nsd, struct query *q)
 {
-	acl_options_t *acl = NULL;
 	/* Is it AXFR? */
 	switch (q->qtype) {
 	case TYPE_AXFR:
 		if (q->tcp) {
-			zone_options_t* zone_opt;
-			zone_opt = zone_options_find(nsd->options, q->qname);
-			if(!zone_opt ||
-			   acl_check_incoming(zone_opt->pattern->provide_xfr, q, &acl)==-1)
-			{
-				if (verbosity >= 2) {
-					char a[128];
-					addr2str(&q->addr, a, sizeof(a));
-					VERBOSITY(2, (LOG_INFO, "axfr for %s from %s refused, %s",
-						dname_to_string(q->qname, NULL), a, acl?"blocked":"no acl matches"));
-				}
-				DEBUG(DEBUG_XFRD,1, (LOG_INFO, "axfr refused, %s",
-					acl?"blocked":"no acl matches"));
-				if (!zone_opt) {
-					RCODE_SET(q->packet, RCODE_NOTAUTH);
-				} else {
-					RCODE_SET(q->packet, RCODE_REFUSE);
-				}
+			if(!axfr_ixfr_can_admit(nsd, q))
 				return QUERY_PROCESSED;
-			}
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "axfr admitted acl %s %s",
-				acl->ip_address_spec, acl->key_name?acl->key_name:"NOKEY"));
 			return query_axfr(nsd, q);
 		}
-		/** Fallthrough: AXFR over UDP queries are discarded. */
-	case TYPE_IXFR:
+		/** AXFR over UDP queries are discarded. */
 		RCODE_SET(q->packet, RCODE_IMPL);
 		return QUERY_PROCESSED;
+	case TYPE_IXFR:
+		if(!axfr_ixfr_can_admit(nsd, q))
+			return QUERY_PROCESSED;
+		return query_ixfr(nsd, q);
 	default:
 		return QUERY_DISCARDED;
 	}
@@ -21,5 +21,6 @@
 
 query_state_type answer_axfr_ixfr(struct nsd *nsd, struct query *q);
 query_state_type query_axfr(struct nsd *nsd, struct query *query);
+query_state_type query_ixfr(struct nsd *nsd, struct query *query);
 
 #endif /* _AXFR_H_ */
@@ -65,9 +65,24 @@ extern config_parser_state_t* cfg_parser;
 %token VAR_CONTROL_KEY_FILE VAR_CONTROL_CERT_FILE VAR_XFRDIR
 %token VAR_RRL_SIZE VAR_RRL_RATELIMIT VAR_RRL_SLIP 
 %token VAR_RRL_IPV4_PREFIX_LENGTH VAR_RRL_IPV6_PREFIX_LENGTH
-%token VAR_RRL_WHITELIST_RATELIMIT VAR_RRL_WHITELIST
+%token VAR_RRL_WHITELIST_RATELIMIT VAR_RRL_WHITELIST VAR_RRL_SHARED
 %token VAR_ZONEFILES_CHECK VAR_ZONEFILES_WRITE VAR_LOG_TIME_ASCII
 %token VAR_ROUND_ROBIN VAR_ZONESTATS
+%token VAR_REUSEPORT VAR_STORE_IXFR VAR_IXFR_NUMBER VAR_IXFR_SIZE
+%token VAR_ANSWER_CACHE_SIZE
+%token VAR_SERVER_THREADS
+%token VAR_ZONEFILES_PARALLEL
+%token VAR_DATABASE_COMPACT_PAUSE
+%token VAR_NSEC3_HASH_THREADS
+%token VAR_UDP_SERVERS
+%token VAR_TCP_SERVERS
+%token VAR_UDP_CPU_AFFINITY
+%token VAR_TCP_CPU_AFFINITY
+%token VAR_AXFR_CACHE_SIZE
+%token VAR_XFRD_TCP_MAX
+%token VAR_XFRD_TCP_MASTER_MAX
+%token VAR_XFRD_UDP_MAX
+%token VAR_XFRD_UDP_NOTIFY_MAX
 
 %%
 toplevelvars: /* empty */ | toplevelvars toplevelvar ;
@@ -95,8 +110,16 @@ content_server: server_ip_address | server_ip_transparent | server_debug_mode |
 	server_zonelistfile | server_xfrdir |
 	server_rrl_size | server_rrl_ratelimit | server_rrl_slip | 
 	server_rrl_ipv4_prefix_length | server_rrl_ipv6_prefix_length | server_rrl_whitelist_ratelimit |
+	server_rrl_shared |
 	server_zonefiles_check | server_do_ip4 | server_do_ip6 |
-	server_zonefiles_write | server_log_time_ascii | server_round_robin;
+	server_zonefiles_write | server_log_time_ascii | server_round_robin |
+	server_reuseport | server_store_ixfr | server_ixfr_number |
+	server_ixfr_size | server_answer_cache_size |
+	server_server_threads | server_zonefiles_parallel |
+	server_database_compact_pause | server_nsec3_hash_threads |
+	server_udp_servers | server_tcp_servers | server_udp_cpu_affinity |
+	server_tcp_cpu_affinity | server_axfr_cache_size | server_xfrd_tcp_max |
+	server_xfrd_tcp_master_max | server_xfrd_udp_max | server_xfrd_udp_notify_max;
 server_ip_address: VAR_IP_ADDRESS STRING 
 	{ 
 		OUTYY(("P(server_ip_address:%s)\n", $2)); 
@@ -438,6 +461,16 @@ server_rrl_whitelist_ratelimit: VAR_RRL_WHITELIST_RATELIMIT STRING
 #endif
 	}
 	;
+server_rrl_shared: VAR_RRL_SHARED STRING
+	{ 
+		OUTYY(("P(server_rrl_shared:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+#ifdef RATELIMIT
+		else cfg_parser->opt->rrl_shared = (strcmp($2, "yes")==0);
+#endif
+	}
+	;
 server_zonefiles_check: VAR_ZONEFILES_CHECK STRING 
 	{ 
 		OUTYY(("P(server_zonefiles_check:%s)\n", $2)); 
@@ -454,6 +487,146 @@ server_zonefiles_write: VAR_ZONEFILES_WRITE STRING
 		else cfg_parser->opt->zonefiles_write = atoi($2);
 	}
 	;
+server_reuseport: VAR_REUSEPORT STRING
+	{ 
+		OUTYY(("P(server_reuseport:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->reuseport = (strcmp($2, "yes")==0);
+	}
+	;
+server_store_ixfr: VAR_STORE_IXFR STRING
+	{ 
+		OUTYY(("P(server_store_ixfr:%s)\n", $2)); 
+		if(strcmp($2, "yes") != 0 && strcmp($2, "no") != 0)
+			yyerror("expected yes or no.");
+		else cfg_parser->opt->store_ixfr = (strcmp($2, "yes")==0);
+	}
+	;
+server_ixfr_number: VAR_IXFR_NUMBER STRING
+	{ 
+		OUTYY(("P(server_ixfr_number:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->ixfr_number = atoi($2);
+	}
+	;
+server_ixfr_size: VAR_IXFR_SIZE STRING
+	{ 
+		OUTYY(("P(server_ixfr_size:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->ixfr_size = atoi($2);
+	}
+	;
+server_answer_cache_size: VAR_ANSWER_CACHE_SIZE STRING
+	{ 
+		OUTYY(("P(server_answer_cache_size:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->answer_cache_size = atoi($2);
+	}
+	;
+server_server_threads: VAR_SERVER_THREADS STRING
+	{ 
+		OUTYY(("P(server_server_threads:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->server_threads = atoi($2);
+	}
+	;
+server_zonefiles_parallel: VAR_ZONEFILES_PARALLEL STRING
+	{ 
+		OUTYY(("P(server_zonefiles_parallel:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->zonefiles_parallel = atoi($2);
+	}
+	;
+server_database_compact_pause: VAR_DATABASE_COMPACT_PAUSE STRING
+	{ 
+		OUTYY(("P(server_database_compact_pause:%s)\n", $2)); 
+		if(atoi($2) < 0 || (atoi($2) == 0 && strcmp($2, "0") != 0))
+			yyerror("number expected");
+		else cfg_parser->opt->database_compact_pause = atoi($2);
+	}
+	;
+server_nsec3_hash_threads: VAR_NSEC3_HASH_THREADS STRING
+	{ 
+		OUTYY(("P(server_nsec3_hash_threads:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->nsec3_hash_threads = atoi($2);
+	}
+	;
+server_udp_servers: VAR_UDP_SERVERS STRING
+	{ 
+		OUTYY(("P(server_udp_servers:%s)\n", $2)); 
+		if(atoi($2) < 0 || (atoi($2) == 0 && strcmp($2, "0") != 0))
+			yyerror("number expected");
+		else cfg_parser->opt->udp_servers = atoi($2);
+	}
+	;
+server_tcp_servers: VAR_TCP_SERVERS STRING
+	{ 
+		OUTYY(("P(server_tcp_servers:%s)\n", $2)); 
+		if(atoi($2) < 0 || (atoi($2) == 0 && strcmp($2, "0") != 0))
+			yyerror("number expected");
+		else cfg_parser->opt->tcp_servers = atoi($2);
+	}
+	;
+server_udp_cpu_affinity: VAR_UDP_CPU_AFFINITY STRING
+	{ 
+		OUTYY(("P(server_udp_cpu_affinity:%s)\n", $2)); 
+		cfg_parser->opt->udp_cpu_affinity = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_tcp_cpu_affinity: VAR_TCP_CPU_AFFINITY STRING
+	{ 
+		OUTYY(("P(server_tcp_cpu_affinity:%s)\n", $2)); 
+		cfg_parser->opt->tcp_cpu_affinity = region_strdup(cfg_parser->opt->region, $2);
+	}
+	;
+server_axfr_cache_size: VAR_AXFR_CACHE_SIZE STRING
+	{ 
+		OUTYY(("P(server_axfr_cache_size:%s)\n", $2)); 
+		if(atoi($2) == 0 && strcmp($2, "0") != 0)
+			yyerror("number expected");
+		else cfg_parser->opt->axfr_cache_size = atoi($2);
+	}
+	;
+server_xfrd_tcp_max: VAR_XFRD_TCP_MAX STRING
+	{ 
+		OUTYY(("P(server_xfrd_tcp_max:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->xfrd_tcp_max = atoi($2);
+	}
+	;
+server_xfrd_tcp_master_max: VAR_XFRD_TCP_MASTER_MAX STRING
+	{ 
+		OUTYY(("P(server_xfrd_tcp_master_max:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->xfrd_tcp_master_max = atoi($2);
+	}
+	;
+server_xfrd_udp_max: VAR_XFRD_UDP_MAX STRING
+	{ 
+		OUTYY(("P(server_xfrd_udp_max:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->xfrd_udp_max = atoi($2);
+	}
+	;
+server_xfrd_udp_notify_max: VAR_XFRD_UDP_NOTIFY_MAX STRING
+	{ 
+		OUTYY(("P(server_xfrd_udp_notify_max:%s)\n", $2)); 
+		if(atoi($2) <= 0)
+			yyerror("number greater than zero expected");
+		else cfg_parser->opt->xfrd_udp_notify_max = atoi($2);
+	}
+	;
 
 rcstart: VAR_REMOTE_CONTROL
 	{
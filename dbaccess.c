@@ -12,7 +12,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <sys/wait.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif /* HAVE_MMAP */
+
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -29,11 +35,14 @@
 #include "zonec.h"
 #include "nsec3.h"
 #include "difffile.h"
+#include "ixfr.h"
 #include "nsd.h"
 
 static time_t udb_time = 0;
 static unsigned long udb_rrsets = 0;
 static unsigned long udb_rrset_count = 0;
+/* file with the zone parsed by a zonefiles-parallel worker, or NULL */
+static const char* zonefile_parsed = NULL;
 
 void
 namedb_close(struct namedb* db)
@@ -104,19 +113,18 @@ apex_rrset_checks(namedb_type* db, rrset_type* rrset, domain_type* domain)
 
 /** read rr */
 static void
-read_rr(namedb_type* db, rr_type* rr, udb_ptr* urr, domain_type* domain)
+read_rr(namedb_type* db, rr_type* rr, struct rr_d* urr, domain_type* domain)
 {
 	buffer_type buffer;
 	ssize_t c;
-	assert(udb_ptr_get_type(urr) == udb_chunk_type_rr);
 	rr->owner = domain;
-	rr->type = RR(urr)->type;
-	rr->klass = RR(urr)->klass;
-	rr->ttl = RR(urr)->ttl;
+	rr->type = urr->type;
+	rr->klass = urr->klass;
+	rr->ttl = urr->ttl;
 
-	buffer_create_from(&buffer, RR(urr)->wire, RR(urr)->len);
+	buffer_create_from(&buffer, urr->wire, urr->len);
 	c = rdata_wireformat_to_rdata_atoms(db->region, db->domains,
-		rr->type, RR(urr)->len, &buffer, &rr->rdatas);
+		rr->type, urr->len, &buffer, &rr->rdatas);
 	if(c == -1) {
 		/* safe on error */
 		rr->rdata_count = 0;
@@ -128,30 +136,28 @@ read_rr(namedb_type* db, rr_type* rr, udb_ptr* urr, domain_type* domain)
 
 /** calculate rr count */
 static uint16_t
-calculate_rr_count(udb_base* udb, udb_ptr* rrset)
+calculate_rr_count(udb_base* udb, struct rrset_d* rrset)
 {
-	udb_ptr rr;
+	udb_void rr = rrset->rrs.data;
 	uint16_t num = 0;
-	udb_ptr_new(&rr, udb, &RRSET(rrset)->rrs);
-	while(rr.data) {
+	while(rr) {
 		num++;
-		udb_ptr_set_rptr(&rr, udb, &RR(&rr)->next);
+		rr = ((struct rr_d*)UDB_REL(udb->base, rr))->next.data;
 	}
-	udb_ptr_unlink(&rr, udb);
 	return num;
 }
 
-/** read rrset */
+/** read rrset.  The udb is only read, so that the chunks do not move and
+ * plain pointers are used, without the cost of linking udb_ptrs. */
 static void
 read_rrset(udb_base* udb, namedb_type* db, zone_type* zone,
-	domain_type* domain, udb_ptr* urrset)
+	domain_type* domain, struct rrset_d* urrset)
 {
 	rrset_type* rrset;
-	udb_ptr urr;
+	udb_void urr;
 	unsigned i;
-	assert(udb_ptr_get_type(urrset) == udb_chunk_type_rrset);
 	/* if no RRs, do not create anything (robust) */
-	if(RRSET(urrset)->rrs.data == 0)
+	if(urrset->rrs.data == 0)
 		return;
 	rrset = (rrset_type *) region_alloc(db->region, sizeof(rrset_type));
 	rrset->zone = zone;
@@ -159,12 +165,12 @@ read_rrset(udb_base* udb, namedb_type* db, zone_type* zone,
 	rrset->rrs = (rr_type *) region_alloc_array(
 		db->region, rrset->rr_count, sizeof(rr_type));
 	/* add the RRs */
-	udb_ptr_new(&urr, udb, &RRSET(urrset)->rrs);
+	urr = urrset->rrs.data;
 	for(i=0; i<rrset->rr_count; i++) {
-		read_rr(db, &rrset->rrs[i], &urr, domain);
-		udb_ptr_set_rptr(&urr, udb, &RR(&urr)->next);
+		struct rr_d* rr = (struct rr_d*)UDB_REL(udb->base, urr);
+		read_rr(db, &rrset->rrs[i], rr, domain);
+		urr = rr->next.data;
 	}
-	udb_ptr_unlink(&urr, udb);
 	domain_add_rrset(domain, rrset);
 	if(domain == zone->apex)
 		apex_rrset_checks(db, rrset, domain);
@@ -176,7 +182,7 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 {
 	const dname_type* dname;
 	domain_type* domain;
-	udb_ptr urrset;
+	udb_void urrset;
 
 	dname = dname_make(dname_region, d->name, 0);
 	if(!dname) return;
@@ -184,11 +190,12 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 	assert(domain); /* domain_table_insert should always return non-NULL */
 
 	/* add rrsets */
-	udb_ptr_init(&urrset, udb);
-	udb_ptr_set_rptr(&urrset, udb, &d->rrsets);
-	while(urrset.data) {
-		read_rrset(udb, db, zone, domain, &urrset);
-		udb_ptr_set_rptr(&urrset, udb, &RRSET(&urrset)->next);
+	urrset = d->rrsets.data;
+	while(urrset) {
+		struct rrset_d* rrset = (struct rrset_d*)UDB_REL(udb->base,
+			urrset);
+		read_rrset(udb, db, zone, domain, rrset);
+		urrset = rrset->next.data;
 
 		if(++udb_rrsets % ZONEC_PCT_COUNT == 0 && time(NULL) > udb_time + ZONEC_PCT_TIME) {
 			udb_time = time(NULL);
@@ -198,7 +205,6 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 		}
 	}
 	region_free_all(dname_region);
-	udb_ptr_unlink(&urrset, udb);
 }
 
 /** recurse read radix from disk. This radix tree is by domain name, so max of
@@ -272,6 +278,8 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 	zone->filename = NULL;
 	zone->logstr = NULL;
 	zone->mtime = 0;
+	zone->ixfr = NULL;
+	zone->axfr_cache = NULL;
 	zone->zonestatid = 0;
 	zone->is_secure = 0;
 	zone->is_changed = 0;
@@ -314,6 +322,7 @@ namedb_zone_delete(namedb_type* db, zone_type* zone)
 	if(zone->logstr)
 		region_recycle(db->region, zone->logstr,
 			strlen(zone->logstr)+1);
+	zone_ixfr_clear(zone);
 	region_recycle(db->region, zone, sizeof(zone_type));
 }
 
@@ -402,7 +411,13 @@ try_read_udb(namedb_type* db, int fd, const char* filename,
 		db->udb = NULL;
 		return 0;
 	}
-	/* read if it can be opened */
+	/* read if it can be opened, the whole file is going to be read,
+	 * so have the pages read in ahead instead of a fault per page.
+	 * The zones are copied into the namedb in memory, the servers do
+	 * not answer from the udb. */
+#ifdef MADV_WILLNEED
+	(void)madvise(db->udb->base, db->udb->base_size, MADV_WILLNEED);
+#endif
 	dname_region = region_create(xalloc, free);
 	/* this operation does not fail, we end up with
 	 * something, even if that is an empty namedb */
@@ -437,6 +452,7 @@ namedb_open (const char* filename, nsd_options_t* opt)
 	db->zonetree = radix_tree_create(db->region);
 	db->diff_skip = 0;
 	db->diff_pos = 0;
+	db->nsec3_hash_threads = opt?opt->nsec3_hash_threads:1;
 	zonec_setup_parser(db);
 
 	if (gettimeofday(&(db->diff_timestamp), NULL) != 0) {
@@ -505,57 +521,277 @@ file_get_mtime(const char* file, time_t* mtime, int* nonexist)
 	return 1;
 }
 
-void
-namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
-	udb_ptr* last_task)
+/*
+ * see if the zonefile has to be read, it is newer than the zone in
+ * memory or it is another file.  Returns 1 if so, 0 if not, and -1 if
+ * the file cannot be accessed.
+ */
+static int
+zonefile_check_mtime(struct nsd* nsd, struct zone* zone, const char* fname,
+	time_t* mtime, int verbose)
 {
-	time_t mtime = 0;
 	int nonexist = 0;
-	unsigned int errors;
-	const char* fname;
-	if(!nsd->db || !zone || !zone->opts || !zone->opts->pattern->zonefile)
-		return;
-	fname = config_make_zonefile(zone->opts, nsd);
-	if(!file_get_mtime(fname, &mtime, &nonexist)) {
-		if(nonexist) {
+	const char* zone_fname = zone->filename;
+	time_t zone_mtime = zone->mtime;
+	if(!file_get_mtime(fname, mtime, &nonexist)) {
+		if(verbose && nonexist) {
 			VERBOSITY(2, (LOG_INFO, "zonefile %s does not exist",
 				fname));
-		} else
+		} else if(verbose)
 			log_msg(LOG_ERR, "zonefile %s: %s",
 				fname, strerror(errno));
-		if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
-		return;
-	} else {
-		const char* zone_fname = zone->filename;
-		time_t zone_mtime = zone->mtime;
-		if(nsd->db->udb) {
-			zone_fname = udb_zone_get_file_str(nsd->db->udb,
-				dname_name(domain_dname(zone->apex)),
-				domain_dname(zone->apex)->name_size);
-			zone_mtime = (time_t)udb_zone_get_mtime(nsd->db->udb,
-				dname_name(domain_dname(zone->apex)),
-				domain_dname(zone->apex)->name_size);
-		}
-		/* if no zone_fname, then it was acquired in zone transfer,
-		 * see if the file is newer than the zone transfer
-		 * (regardless if this is a different file), because the
-		 * zone transfer is a different content source too */
-		if(!zone_fname && zone_mtime >= mtime) {
+		return -1;
+	}
+	if(nsd->db->udb) {
+		zone_fname = udb_zone_get_file_str(nsd->db->udb,
+			dname_name(domain_dname(zone->apex)),
+			domain_dname(zone->apex)->name_size);
+		zone_mtime = (time_t)udb_zone_get_mtime(nsd->db->udb,
+			dname_name(domain_dname(zone->apex)),
+			domain_dname(zone->apex)->name_size);
+	}
+	/* if no zone_fname, then it was acquired in zone transfer,
+	 * see if the file is newer than the zone transfer
+	 * (regardless if this is a different file), because the
+	 * zone transfer is a different content source too */
+	if(!zone_fname && zone_mtime >= *mtime) {
+		if(verbose)
 			VERBOSITY(3, (LOG_INFO, "zonefile %s is older than "
 				"zone transfer in memory", fname));
-			return;
+		return 0;
 
-		/* if zone_fname, then the file was acquired from reading it,
-		 * and see if filename changed or mtime newer to read it */
-		} else if(zone_fname && fname &&
-		   strcmp(zone_fname, fname) == 0 && zone_mtime >= mtime) {
+	/* if zone_fname, then the file was acquired from reading it,
+	 * and see if filename changed or mtime newer to read it */
+	} else if(zone_fname && fname &&
+	   strcmp(zone_fname, fname) == 0 && zone_mtime >= *mtime) {
+		if(verbose)
 			VERBOSITY(3, (LOG_INFO, "zonefile %s is not modified",
 				fname));
-			return;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * The file a zonefiles-parallel worker writes the parsed zone to.  It
+ * starts with the mtime of the zonefile and the number of errors.  Then
+ * the rrsets follow, every one with the length and wireformat of the
+ * owner name, the type, class and number of RRs, and for every RR the
+ * TTL, rdata length and rdata.  Owner length 0 ends the list.
+ */
+
+/** write the parsed zone to file, it is written to fn.tmp and renamed,
+ * so that fn is complete if it exists */
+int
+zonefile_write_parsed(const char* fn, zone_type* zone, time_t mtime,
+	unsigned int errors)
+{
+	uint8_t rdata[MAX_RDLENGTH];
+	uint64_t mt = (uint64_t)mtime;
+	uint32_t err = (uint32_t)errors;
+	uint8_t end = 0;
+	domain_type* walk;
+	rrset_type* rrset;
+	char tmpfn[1024];
+	FILE* out;
+	snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+	out = fopen(tmpfn, "w");
+	if(!out) {
+		log_msg(LOG_ERR, "could not open %s: %s", tmpfn,
+			strerror(errno));
+		return 0;
+	}
+	fwrite(&mt, sizeof(mt), 1, out);
+	fwrite(&err, sizeof(err), 1, out);
+	for(walk=zone->apex; errors == 0 && walk &&
+		domain_is_subdomain(walk, zone->apex);
+		walk=domain_next(walk)) {
+		for(rrset=walk->rrsets; rrset; rrset=rrset->next) {
+			uint16_t type = rrset_rrtype(rrset);
+			uint16_t klass = rrset_rrclass(rrset);
+			uint16_t i;
+			if(rrset->zone != zone)
+				continue;
+			fwrite(&domain_dname(walk)->name_size, 1, 1, out);
+			fwrite(dname_name(domain_dname(walk)), 1,
+				domain_dname(walk)->name_size, out);
+			fwrite(&type, sizeof(type), 1, out);
+			fwrite(&klass, sizeof(klass), 1, out);
+			fwrite(&rrset->rr_count, sizeof(rrset->rr_count), 1,
+				out);
+			for(i=0; i<rrset->rr_count; i++) {
+				uint16_t len = (uint16_t)rr_marshal_rdata(
+					&rrset->rrs[i], rdata, sizeof(rdata));
+				fwrite(&rrset->rrs[i].ttl,
+					sizeof(rrset->rrs[i].ttl), 1, out);
+				fwrite(&len, sizeof(len), 1, out);
+				fwrite(rdata, 1, len, out);
+			}
 		}
 	}
+	fwrite(&end, 1, 1, out);
+	if(ferror(out)) {
+		log_msg(LOG_ERR, "could not write %s: %s", tmpfn,
+			strerror(errno));
+		fclose(out);
+		unlink(tmpfn);
+		return 0;
+	}
+	if(fclose(out) != 0) {
+		log_msg(LOG_ERR, "could not write %s: %s", tmpfn,
+			strerror(errno));
+		unlink(tmpfn);
+		return 0;
+	}
+	if(rename(tmpfn, fn) == -1) {
+		log_msg(LOG_ERR, "could not rename %s to %s: %s", tmpfn, fn,
+			strerror(errno));
+		unlink(tmpfn);
+		return 0;
+	}
+	return 1;
+}
+
+/** read rrset from parsed zone file */
+static int
+zonefile_read_parsed_rrset(namedb_type* db, zone_type* zone,
+	domain_type* domain, FILE* in)
+{
+	uint8_t rdata[MAX_RDLENGTH];
+	uint16_t type, klass, count, len, i;
+	rrset_type* rrset;
+	if(fread(&type, sizeof(type), 1, in) != 1 ||
+		fread(&klass, sizeof(klass), 1, in) != 1 ||
+		fread(&count, sizeof(count), 1, in) != 1 || count == 0)
+		return 0;
+	rrset = (rrset_type *) region_alloc(db->region, sizeof(rrset_type));
+	rrset->zone = zone;
+	rrset->rr_count = count;
+	rrset->rrs = (rr_type *) region_alloc_array(
+		db->region, rrset->rr_count, sizeof(rr_type));
+	for(i=0; i<count; i++) {
+		rr_type* rr = &rrset->rrs[i];
+		buffer_type buffer;
+		ssize_t c;
+		rr->owner = domain;
+		rr->type = type;
+		rr->klass = klass;
+		if(fread(&rr->ttl, sizeof(rr->ttl), 1, in) != 1 ||
+			fread(&len, sizeof(len), 1, in) != 1 ||
+			fread(rdata, 1, len, in) != len)
+			break;
+		buffer_create_from(&buffer, rdata, len);
+		c = rdata_wireformat_to_rdata_atoms(db->region, db->domains,
+			type, len, &buffer, &rr->rdatas);
+		if(c == -1)
+			break;
+		rr->rdata_count = c;
+	}
+	if(i < count) {
+		/* keep the RRs that are read, the zone is deleted and
+		 * that lowers the usage of the domains in their rdata */
+		rrset->rr_count = i;
+		if(i == 0) {
+			region_recycle(db->region, rrset->rrs,
+				sizeof(rr_type)*count);
+			region_recycle(db->region, rrset, sizeof(rrset_type));
+			return 0;
+		}
+		domain_add_rrset(domain, rrset);
+		return 0;
+	}
+	domain_add_rrset(domain, rrset);
+	if(domain == zone->apex)
+		apex_rrset_checks(db, rrset, domain);
+	return 1;
+}
+
+/**
+ * read the zone parsed by a worker into memory.  Returns 0 if the file
+ * does not exist, is for another version of the zonefile or cannot be
+ * read, and then the zonefile has to be read.  The zone is empty again
+ * in that case.  The errors are those of parsing the zonefile.
+ */
+int
+zonefile_read_parsed(namedb_type* db, zone_type* zone, const char* fn,
+	time_t mtime, unsigned int* errors)
+{
+	region_type* dname_region;
+	uint8_t name[MAXDOMAINLEN];
+	uint8_t len;
+	uint64_t mt;
+	uint32_t err;
+	int ok = 1;
+	FILE* in = fopen(fn, "r");
+	if(!in)
+		return 0;
+	if(fread(&mt, sizeof(mt), 1, in) != 1 ||
+		fread(&err, sizeof(err), 1, in) != 1 ||
+		mt != (uint64_t)mtime) {
+		fclose(in);
+		return 0;
+	}
+	*errors = err;
+	dname_region = region_create(xalloc, free);
+	while(err == 0) {
+		const dname_type* dname;
+		if(fread(&len, 1, 1, in) != 1) {
+			ok = 0;
+			break;
+		}
+		if(len == 0)
+			break;
+		if(fread(name, 1, len, in) != len ||
+			!(dname = dname_make(dname_region, name, 0)) ||
+			!zonefile_read_parsed_rrset(db, zone,
+			domain_table_insert(db->domains, dname), in)) {
+			ok = 0;
+			break;
+		}
+		region_free_all(dname_region);
+	}
+	region_destroy(dname_region);
+	fclose(in);
+	if(!ok) {
+		log_msg(LOG_ERR, "zone %s: bad parsed zone in %s, reading "
+			"the zonefile", zone->opts->name, fn);
+#ifdef NSEC3
+		nsec3_hash_tree_clear(zone);
+#endif
+		delete_zone_rrs(db, zone);
+#ifdef NSEC3
+		nsec3_clear_precompile(db, zone);
+		zone->nsec3_param = NULL;
+#endif /* NSEC3 */
+	}
+	return ok;
+}
+
+void
+namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
+	udb_ptr* last_task)
+{
+	time_t mtime = 0;
+	unsigned int errors;
+	const char* fname;
+	struct ixfr_snapshot* snap = NULL;
+	if(!nsd->db || !zone || !zone->opts || !zone->opts->pattern->zonefile)
+		return;
+	fname = config_make_zonefile(zone->opts, nsd);
+	switch(zonefile_check_mtime(nsd, zone, fname, &mtime, 1)) {
+	case -1:
+		if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
+		return;
+	case 0:
+		return;
+	default:
+		break;
+	}
 
 	assert(parser);
+	/* keep the old contents, to journal the changes for IXFR */
+	if(nsd->options && nsd->options->store_ixfr)
+		snap = ixfr_snapshot_create(zone);
 	/* wipe zone from memory */
 #ifdef NSEC3
 	nsec3_hash_tree_clear(zone);
@@ -565,10 +801,13 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 	nsec3_clear_precompile(nsd->db, zone);
 	zone->nsec3_param = NULL;
 #endif /* NSEC3 */
-	errors = zonec_read(zone->opts->name, fname, zone);
+	if(!zonefile_parsed || !zonefile_read_parsed(nsd->db, zone,
+		zonefile_parsed, mtime, &errors))
+		errors = zonec_read(zone->opts->name, fname, zone);
 	if(errors > 0) {
 		log_msg(LOG_ERR, "zone %s file %s read with %u errors",
 			zone->opts->name, fname, errors);
+		ixfr_snapshot_delete(snap);
 		/* wipe (partial) zone from memory */
 		zone->is_ok = 1;
 #ifdef NSEC3
@@ -598,6 +837,7 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 			region_destroy(dname_region);
 			udb_ptr_unlink(&z, nsd->db->udb);
 		} else {
+			zone_ixfr_clear(zone);
 			if(zone->filename)
 				region_recycle(nsd->db->region, zone->filename,
 					strlen(zone->filename)+1);
@@ -612,6 +852,9 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 			zone->opts->name));
 		zone->is_ok = 1;
 		zone->is_changed = 0;
+		if(snap)
+			ixfr_store_zone_diff(zone, snap, nsd->options);
+		else	zone_ixfr_clear(zone);
 		/* store zone into udb */
 		if(nsd->db->udb) {
 			if(!write_zone_to_udb(nsd->db->udb, zone, mtime, fname)) {
@@ -651,13 +894,118 @@ void namedb_check_zonefile(struct nsd* nsd, udb_base* taskudb,
 	namedb_read_zonefile(nsd, zone, taskudb, last_task);
 }
 
+/** name of the file for the parsed zone with the index */
+static void
+zonefile_parsed_name(char* buf, size_t len, nsd_options_t* opt,
+	pid_t parent, int i)
+{
+	snprintf(buf, len, "%s/nsd-zonefile.%u.%d", opt->xfrdir,
+		(unsigned)parent, i);
+}
+
+/** parse the zonefiles with index num modulo count, in a worker.
+ * Returns 0 if a parsed zone could not be written. */
+static int
+zonefile_parse_worker(struct nsd* nsd, nsd_options_t* opt, int num,
+	int count, pid_t parent)
+{
+	zone_options_t* zo;
+	char fn[1024];
+	int i = 0, ok = 1;
+	RBTREE_FOR(zo, zone_options_t*, opt->zone_options) {
+		const dname_type* dname = (const dname_type*)zo->node.key;
+		zone_type* zone;
+		const char* fname;
+		time_t mtime = 0;
+		unsigned int errors;
+		if(i++ % count != num || !zo->pattern->zonefile)
+			continue;
+		zone = namedb_find_zone(nsd->db, dname);
+		if(!zone)
+			zone = namedb_zone_create(nsd->db, dname, zo);
+		fname = config_make_zonefile(zo, nsd);
+		if(zonefile_check_mtime(nsd, zone, fname, &mtime, 0) != 1)
+			continue;
+#ifdef NSEC3
+		nsec3_hash_tree_clear(zone);
+#endif
+		delete_zone_rrs(nsd->db, zone);
+		errors = zonec_read(zo->name, fname, zone);
+		zonefile_parsed_name(fn, sizeof(fn), opt, parent, i-1);
+		if(!zonefile_write_parsed(fn, zone, mtime, errors))
+			ok = 0;
+	}
+	return ok;
+}
+
+/** parse the zonefiles in worker processes, wait until they are done */
+static void
+zonefile_parse_parallel(struct nsd* nsd, nsd_options_t* opt)
+{
+	pid_t* pids = (pid_t*)xalloc_array_zero((size_t)opt->zonefiles_parallel,
+		sizeof(pid_t));
+	pid_t parent = getpid();
+	int i;
+	for(i=0; i<opt->zonefiles_parallel; i++) {
+		switch((pids[i] = fork())) {
+		case -1:
+			log_msg(LOG_ERR, "fork failed: %s", strerror(errno));
+			break;
+		case 0:
+			exit(zonefile_parse_worker(nsd, opt, i,
+				opt->zonefiles_parallel, parent)?0:1);
+		default:
+			break;
+		}
+	}
+	for(i=0; i<opt->zonefiles_parallel; i++) {
+		int status;
+		pid_t ret;
+		if(pids[i] <= 0)
+			continue;
+		while((ret = waitpid(pids[i], &status, 0)) == -1) {
+			if(errno != EINTR) {
+				log_msg(LOG_ERR, "waitpid: %s",
+					strerror(errno));
+				break;
+			}
+		}
+		/* the zones of a failed worker are read here */
+		if(ret == -1)
+			continue;
+		if(WIFSIGNALED(status))
+			log_msg(LOG_ERR, "zonefile parse worker %d killed by "
+				"signal %d", (int)pids[i], WTERMSIG(status));
+		else if(WIFEXITED(status) && WEXITSTATUS(status) != 0)
+			log_msg(LOG_ERR, "zonefile parse worker %d exited with "
+				"status %d", (int)pids[i], WEXITSTATUS(status));
+	}
+	free(pids);
+}
+
 void namedb_check_zonefiles(struct nsd* nsd, nsd_options_t* opt,
 	udb_base* taskudb, udb_ptr* last_task)
 {
 	zone_options_t* zo;
+	char fn[1024];
+	int i = 0, parallel = (opt->zonefiles_parallel > 1);
+	/* parse the zonefiles in parallel, the RRs are then added to
+	 * the main db here, one zone at a time */
+	if(parallel)
+		zonefile_parse_parallel(nsd, opt);
 	/* check all zones in opt, create if not exist in main db */
 	RBTREE_FOR(zo, zone_options_t*, opt->zone_options) {
-		namedb_check_zonefile(nsd, taskudb, last_task, zo);
-		if(nsd->signal_hint_shutdown) break;
+		if(parallel)
+			zonefile_parsed_name(fn, sizeof(fn), opt, getpid(),
+				i++);
+		if(!nsd->signal_hint_shutdown) {
+			zonefile_parsed = parallel?fn:NULL;
+			namedb_check_zonefile(nsd, taskudb, last_task, zo);
+			zonefile_parsed = NULL;
+		}
+		if(parallel)
+			unlink(fn);
+		else if(nsd->signal_hint_shutdown)
+			break;
 	}
 }
@@ -23,6 +23,7 @@
 #include "nsec3.h"
 #include "nsd.h"
 #include "rrl.h"
+#include "ixfr.h"
 
 static int
 write_64(FILE *out, uint64_t val)
@@ -89,7 +90,7 @@ diff_write_packet(const char* zone, const char* pat, uint32_t old_serial,
 		}
 	}
 
-	if(!write_32(df, DIFF_PART_XXFR) ||
+	if(!write_32(df, DIFF_PART_XRRS) ||
 		!write_32(df, len) ||
 		!write_data(df, data, len) ||
 		!write_32(df, len))
@@ -438,7 +439,7 @@ nsec3_delete_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 		return;
 	/* see if the domain was an NSEC3-domain in the chain, but no longer */
 	if(rr->type == TYPE_NSEC3 && rr->owner->nsec3 &&
-		rr->owner->nsec3->nsec3_node.key &&
+		(rr->owner->nsec3->in_index&HASH_INDEX_NSEC3) &&
 		nsec3_rr_uses_params(rr, zone) &&
 		nsec3_in_chain_count(rr->owner, zone) <= 1) {
 		domain_type* prev = nsec3_chain_find_prev(zone, rr->owner);
@@ -449,8 +450,7 @@ nsec3_delete_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 		if(rr->owner == zone->nsec3_last)
 			zone->nsec3_last = prev;
 		/* unlink from the nsec3tree */
-		zone_del_domain_in_hash_tree(zone->nsec3tree,
-			&rr->owner->nsec3->nsec3_node);
+		nsec3_del_nsec3rr(zone, rr->owner);
 		/* add previous NSEC3 to the prehash list */
 		if(prev && prev != rr->owner)
 			prehash_add(db->domains, prev);
@@ -478,7 +478,7 @@ nsec3_rrsets_changed_remove_prehash(domain_type* domain, zone_type* zone)
 	/* see if the domain is no longer precompiled */
 	/* it has a hash_node, but no longer fulfills conditions */
 	if(nsec3_domain_part_of_zone(domain, zone) && domain->nsec3 &&
-		domain->nsec3->hash_node.key &&
+		(domain->nsec3->in_index&HASH_INDEX_HASH) &&
 		!nsec3_condition_hash(domain, zone)) {
 		/* remove precompile */
 		domain->nsec3->nsec3_cover = NULL;
@@ -486,12 +486,12 @@ nsec3_rrsets_changed_remove_prehash(domain_type* domain, zone_type* zone)
 		domain->nsec3->nsec3_is_exact = 0;
 		/* remove it from the hash tree */
 		zone_del_domain_in_hash_tree(zone->hashtree,
-			&domain->nsec3->hash_node);
+			domain->nsec3->nsec3_hash, domain);
 		zone_del_domain_in_hash_tree(zone->wchashtree,
-			&domain->nsec3->wchash_node);
+			domain->nsec3->nsec3_wc_hash, domain);
 	}
 	if(domain != zone->apex && domain->nsec3 &&
-		domain->nsec3->dshash_node.key &&
+		(domain->nsec3->in_index&HASH_INDEX_DS) &&
 		(!domain->parent || nsec3_domain_part_of_zone(domain->parent, zone)) &&
 		!nsec3_condition_dshash(domain, zone)) {
 		/* remove precompile */
@@ -499,7 +499,7 @@ nsec3_rrsets_changed_remove_prehash(domain_type* domain, zone_type* zone)
 		domain->nsec3->nsec3_ds_parent_is_exact = 0;
 		/* remove it from the hash tree */
 		zone_del_domain_in_hash_tree(zone->dshashtree,
-			&domain->nsec3->dshash_node);
+			domain->nsec3->nsec3_ds_parent_hash, domain);
 	}
 }
 
@@ -510,13 +510,13 @@ nsec3_rrsets_changed_add_prehash(namedb_type* db, domain_type* domain,
 {
 	if(!zone->nsec3_param)
 		return;
-	if((!domain->nsec3 || !domain->nsec3->hash_node.key)
+	if((!domain->nsec3 || !(domain->nsec3->in_index&HASH_INDEX_HASH))
 		&& nsec3_condition_hash(domain, zone)) {
 		region_type* tmpregion = region_create(xalloc, free);
 		nsec3_precompile_domain(db, domain, zone, tmpregion);
 		region_destroy(tmpregion);
 	}
-	if((!domain->nsec3 || !domain->nsec3->dshash_node.key)
+	if((!domain->nsec3 || !(domain->nsec3->in_index&HASH_INDEX_DS))
 		&& nsec3_condition_dshash(domain, zone)) {
 		nsec3_precompile_domain_ds(db, domain, zone);
 	}
@@ -553,7 +553,7 @@ nsec3_add_rr_trigger(namedb_type* db, rr_type* rr, zone_type* zone,
 	/* the RR has been added in full, also to UDB (and thus NSEC3PARAM 
 	 * in the udb has been adjusted) */
 	if(zone->nsec3_param && rr->type == TYPE_NSEC3 &&
-		(!rr->owner->nsec3 || !rr->owner->nsec3->nsec3_node.key)
+		(!rr->owner->nsec3 || !(rr->owner->nsec3->in_index&HASH_INDEX_NSEC3))
 		&& nsec3_rr_uses_params(rr, zone)) {
 		/* added NSEC3 into the chain */
 		nsec3_precompile_nsec3rr(db, rr->owner, zone);
@@ -955,30 +955,45 @@ delete_zone_rrs(namedb_type* db, zone_type* zone)
 	assert(zone->is_secure == 0);
 }
 
+/*
+ * Read the owner name of an RR in a transfer file part, it is compressed
+ * or DIFF_OWNER_PREV for the owner of the RR before it.  NULL on error.
+ */
+static const dname_type*
+diff_read_owner(region_type* region, buffer_type* packet,
+	const dname_type* prev)
+{
+	if(!buffer_available(packet, 1))
+		return NULL;
+	if(buffer_current(packet)[0] == DIFF_OWNER_PREV) {
+		buffer_skip(packet, 1);
+		return prev;
+	}
+	return dname_make_from_packet(region, packet, 1, 1);
+}
+
 /* return value 0: syntaxerror,badIXFR, 1:OK, 2:done_and_skip_it */
 static int
 apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 	nsd_options_t* opt, uint32_t seq_nr, uint32_t seq_total,
 	int* is_axfr, int* delete_mode, int* rr_count,
 	udb_ptr* udbz, struct zone** zone_res, const char* patname, int* bytes,
-	int* softfail)
+	int* softfail, struct ixfr_store* ixfr_store)
 {
-	uint32_t msglen, checklen, pkttype;
-	int qcount, ancount, counter;
+	uint32_t msglen, checklen, pkttype, count, counter;
 	buffer_type* packet;
 	region_type* region;
-	int i;
 	uint16_t rrlen;
-	const dname_type *dname_zone, *dname;
+	const dname_type *dname_zone, *dname = NULL;
 	zone_type* zone_db;
 
 	/* note that errors could not really happen due to format of the
-	 * packet since xfrd has checked all dnames and RRs before commit,
+	 * RRs since xfrd has checked all dnames and RRs before commit,
 	 * this is why the errors are fatal (exit process), it must be
 	 * something internal or a bad disk or something. */
 
-	/* read ixfr packet RRs and apply to in memory db */
-	if(!diff_read_32(in, &pkttype) || pkttype != DIFF_PART_XXFR) {
+	/* read the RRs of the ixfr packet and apply to in memory db */
+	if(!diff_read_32(in, &pkttype) || pkttype != DIFF_PART_XRRS) {
 		log_msg(LOG_ERR, "could not read type or wrong type");
 		return 0;
 	}
@@ -988,23 +1003,23 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 		return 0;
 	}
 
-	if(msglen < QHEADERSZ) {
+	if(msglen < sizeof(uint32_t)) {
 		log_msg(LOG_ERR, "msg too short");
 		return 0;
 	}
+	if(msglen > DIFF_PART_XRRS_MAX) {
+		log_msg(LOG_ERR, "msg too long (%u)", (unsigned)msglen);
+		return 0;
+	}
 
 	region = region_create(xalloc, free);
 	if(!region) {
 		log_msg(LOG_ERR, "out of memory");
 		return 0;
 	}
-	packet = buffer_create(region, QIOBUFSZ);
-	if(msglen > QIOBUFSZ) {
-		log_msg(LOG_ERR, "msg too long");
-		region_destroy(region);
-		return 0;
-	}
-	buffer_clear(packet);
+	/* the RRs can be larger than the packet, if they are compressed
+	 * less well */
+	packet = buffer_create(region, msglen);
 	if(fread(buffer_begin(packet), msglen, 1, in) != 1) {
 		log_msg(LOG_ERR, "short fread: %s", strerror(errno));
 		region_destroy(region);
@@ -1016,6 +1031,7 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 	 * random garbage */
 	if(!diff_read_32(in, &checklen) || checklen != msglen) {
 		log_msg(LOG_ERR, "transfer part has incorrect checkvalue");
+		region_destroy(region);
 		return 0;
 	}
 	*bytes += msglen;
@@ -1029,27 +1045,17 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 	}
 	*zone_res = zone_db;
 
-	/* only answer section is really used, question, additional and
-	   authority section RRs are skipped */
-	qcount = QDCOUNT(packet);
-	ancount = ANCOUNT(packet);
-	buffer_skip(packet, QHEADERSZ);
-
-	/* skip queries */
-	for(i=0; i<qcount; ++i)
-		if(!packet_skip_rr(packet, 1)) {
-			log_msg(LOG_ERR, "bad RR in question section");
-			region_destroy(region);
-			return 0;
-		}
+	/* xfrd has written the RRs of the answer section only */
+	count = buffer_read_u32(packet);
 
 	DEBUG(DEBUG_XFRD,2, (LOG_INFO, "diff: started packet for zone %s",
 			dname_to_string(dname_zone, 0)));
 	/* first RR: check if SOA and correct zone & serialno */
 	if(*rr_count == 0) {
+		size_t rdpos;
 		DEBUG(DEBUG_XFRD,2, (LOG_INFO, "diff: %s parse first RR",
 			dname_to_string(dname_zone, 0)));
-		dname = dname_make_from_packet(region, packet, 1, 1);
+		dname = diff_read_owner(region, packet, NULL);
 		if(!dname) {
 			log_msg(LOG_ERR, "could not parse dname");
 			region_destroy(region);
@@ -1075,9 +1081,12 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 			return 0;
 		}
 		buffer_skip(packet, sizeof(uint32_t)); /* ttl */
-		if(!buffer_available(packet, buffer_read_u16(packet)) ||
+		rrlen = buffer_read_u16(packet);
+		rdpos = buffer_position(packet);
+		if(!buffer_available(packet, rrlen) ||
 			!packet_skip_dname(packet) /* skip prim_ns */ ||
-			!packet_skip_dname(packet) /* skip email */) {
+			!packet_skip_dname(packet) /* skip email */ ||
+			!buffer_available(packet, sizeof(uint32_t))) {
 			log_msg(LOG_ERR, "bad SOA RR");
 			region_destroy(region);
 			return 0;
@@ -1089,7 +1098,7 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 			region_destroy(region);
 			return 0;
 		}
-		buffer_skip(packet, sizeof(uint32_t)*4);
+		buffer_set_position(packet, rdpos + rrlen);
 		counter = 1;
 		*rr_count = 1;
 		*is_axfr = 0;
@@ -1099,12 +1108,12 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 	}
 	else  counter = 0;
 
-	for(; counter < ancount; ++counter,++(*rr_count))
+	for(; counter < count; ++counter,++(*rr_count))
 	{
 		uint16_t type, klass;
 		uint32_t ttl;
 
-		if(!(dname=dname_make_from_packet(region, packet, 1,1))) {
+		if(!(dname=diff_read_owner(region, packet, dname))) {
 			log_msg(LOG_ERR, "bad xfr RR dname %d", *rr_count);
 			region_destroy(region);
 			return 0;
@@ -1205,10 +1214,13 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 			dname_to_string(dname,0), rrtype_to_string(type)));
 		if(*delete_mode) {
 			/* delete this rr */
-			if(!*is_axfr && type == TYPE_SOA && counter==ancount-1
+			if(!*is_axfr && type == TYPE_SOA && counter==count-1
 				&& seq_nr == seq_total-1) {
 				continue; /* do not delete final SOA RR for IXFR */
 			}
+			if(ixfr_store && !*is_axfr)
+				ixfr_store_add_rr_packet(ixfr_store, dname,
+					type, klass, ttl, packet, rrlen);
 			if(!delete_RR(db, dname, type, klass, packet,
 				rrlen, zone_db, region, udbz, softfail)) {
 				region_destroy(region);
@@ -1218,6 +1230,9 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 		else
 		{
 			/* add this rr */
+			if(ixfr_store && !*is_axfr)
+				ixfr_store_add_rr_packet(ixfr_store, dname,
+					type, klass, ttl, packet, rrlen);
 			if(!add_RR(db, dname, type, klass, ttl, packet,
 				rrlen, zone_db, udbz, softfail)) {
 				region_destroy(region);
@@ -1322,6 +1337,7 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 	{
 		int is_axfr=0, delete_mode=0, rr_count=0, softfail=0;
 		const dname_type* apex = zonedb->apex->dname;
+		struct ixfr_store* ixfr_store = NULL;
 		udb_ptr z;
 
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "processing xfr: %s", zone_buf));
@@ -1346,6 +1362,9 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 			/* set the udb dirty until we are finished applying changes */
 			udb_base_set_userflags(nsd->db->udb, 1);
 		}
+		/* journal the changes, to serve IXFR from */
+		if(opt->store_ixfr)
+			ixfr_store = ixfr_store_start(zonedb, new_serial);
 		/* read and apply all of the parts */
 		for(i=0; i<num_parts; i++) {
 			int ret;
@@ -1353,16 +1372,26 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 			ret = apply_ixfr(nsd->db, in, zone_buf, new_serial, opt,
 				i, num_parts, &is_axfr, &delete_mode,
 				&rr_count, (nsd->db->udb?&z:NULL), &zonedb,
-				patname_buf, &num_bytes, &softfail);
+				patname_buf, &num_bytes, &softfail, ixfr_store);
 			if(ret == 0) {
 				log_msg(LOG_ERR, "bad ixfr packet part %d in diff file for %s", (int)i, zone_buf);
 				xfrd_unlink_xfrfile(nsd, xfrfilenr);
 				/* the udb is still dirty, it is bad */
 				exit(1);
 			} else if(ret == 2) {
+				ixfr_store_cancel(ixfr_store);
+				ixfr_store = NULL;
 				break;
 			}
 		}
+		if(is_axfr || softfail) {
+			/* the journal does not connect to the new contents */
+			ixfr_store_cancel(ixfr_store);
+			ixfr_store = NULL;
+			zone_ixfr_clear(zonedb);
+		} else if(ixfr_store) {
+			ixfr_store_finish(ixfr_store, opt);
+		}
 		if(nsd->db->udb)
 			udb_base_set_userflags(nsd->db->udb, 0);
 		/* read the final log_str: but do not fail on it */
@@ -16,10 +16,21 @@
 struct nsd;
 struct nsdst;
 
-#define DIFF_PART_XXFR ('X'<<24 | 'X'<<16 | 'F'<<8 | 'R')
+#define DIFF_PART_XRRS ('X'<<24 | 'R'<<16 | 'R'<<8 | 'S')
 #define DIFF_PART_XFRF ('X'<<24 | 'F'<<16 | 'R'<<8 | 'F')
+/* in a DIFF_PART_XRRS, the owner is that of the RR before it; this is
+   not a label length or a compression pointer */
+#define DIFF_OWNER_PREV 0x80
+/* max length of the RRs of one xfr packet in a DIFF_PART_XRRS; the
+   compression pointers in a packet of 64k expand to names of at most
+   255 octets, less than 256 times larger */
+#define DIFF_PART_XRRS_MAX (65536*256)
 
-/* write an xfr packet data to the diff file, type=IXFR.
+/* write the RRs of an xfr packet to the diff file, type=IXFR.
+   The data is the number of RRs (uint32) and the RRs, checked by xfrd,
+   with the owner as a dname_type, or a zero byte for the owner of the
+   RR before it, then type, class, ttl, rdlength and the rdata with the
+   domain names uncompressed.
    The diff file is created if necessary, with initial header(notcommitted). */
 void diff_write_packet(const char* zone, const char* pat, uint32_t old_serial,
 	uint32_t new_serial, uint32_t seq_nr, uint8_t* data, size_t len,
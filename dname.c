@@ -108,8 +108,12 @@ dname_make_wire_from_packet(uint8_t *buf, buffer_type *packet,
 	size_t dname_length = 0;
 	const uint8_t *label;
 	ssize_t mark = -1;
+	/* the RRs of a transfer file part can be larger than a packet,
+	 * pointers go to the first 16k, so a loop is in the first part */
+	size_t visit_limit = buffer_limit(packet) < MAX_PACKET_SIZE ?
+		buffer_limit(packet) : MAX_PACKET_SIZE;
 
-	memset(visited, 0, (buffer_limit(packet)+7)/8);
+	memset(visited, 0, (visit_limit+7)/8);
 
 	while (!done) {
 		if (!buffer_available(packet, 1)) {
@@ -117,11 +121,13 @@ dname_make_wire_from_packet(uint8_t *buf, buffer_type *packet,
 			return 0;
 		}
 
-		if (get_bit(visited, buffer_position(packet))) {
-/* 			error("dname loops"); */
-			return 0;
+		if (buffer_position(packet) < visit_limit) {
+			if (get_bit(visited, buffer_position(packet))) {
+/* 				error("dname loops"); */
+				return 0;
+			}
+			set_bit(visited, buffer_position(packet));
 		}
-		set_bit(visited, buffer_position(packet));
 
 		label = buffer_current(packet);
 		if (label_is_pointer(label)) {
@@ -35,7 +35,9 @@ ipc_child_quit(struct nsd* nsd)
 {
 	/* call shutdown and quit routines */
 	nsd->mode = NSD_QUIT;
+	server_stop_threads();
 #ifdef	BIND8_STATS
+	server_thread_stats(nsd, &nsd->st);
 	bind8_stats(nsd);
 #endif /* BIND8_STATS */
 
@@ -52,6 +54,9 @@ child_handle_parent_command(int fd, short event, void* arg)
 {
 	sig_atomic_t mode;
 	int len;
+#ifdef BIND8_STATS
+	struct nsdst st;
+#endif
 	struct ipc_handler_conn_data *data =
 		(struct ipc_handler_conn_data *) arg;
 	if (!(event & EV_READ)) {
@@ -92,7 +97,9 @@ child_handle_parent_command(int fd, short event, void* arg)
 		if(!write_socket(fd, &mode, sizeof(mode))) {
 			log_msg(LOG_ERR, "cannot write quitwst to parent");
 		}
-		if(!write_socket(fd, &data->nsd->st, sizeof(data->nsd->st))) {
+		server_stop_threads();
+		server_thread_stats(data->nsd, &st);
+		if(!write_socket(fd, &st, sizeof(st))) {
 			log_msg(LOG_ERR, "cannot write stats to parent");
 		}
 		fsync(fd);
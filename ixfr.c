@@ -0,0 +1,341 @@
+/*
+ * ixfr.c -- journal of zone changes, to answer IXFR requests from.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ixfr.h"
+#include "options.h"
+#include "rdata.h"
+#include "util.h"
+
+/* initial size of the buffer for the data of a change */
+#define IXFR_STORE_INITIAL_SIZE 4096
+
+/* a reference to an RR in the snapshot data */
+struct ixfr_rrref {
+	uint8_t* rr;
+	size_t len;
+};
+
+struct ixfr_snapshot {
+	region_type* region;
+	uint32_t serial;
+	/* the SOA at the start, then the other RRs, in wireformat */
+	buffer_type* data;
+	size_t soa_len;
+	/* the RRs (without the SOA), sorted */
+	struct ixfr_rrref* rrs;
+	size_t count;
+};
+
+static uint32_t
+ixfr_soa_serial(rr_type* rr)
+{
+	uint32_t serial;
+	memcpy(&serial, rdata_atom_data(rr->rdatas[2]), sizeof(serial));
+	return ntohl(serial);
+}
+
+/* append uncompressed wireformat RR to the buffer */
+static void
+ixfr_write_rr_wire(buffer_type* buf, const dname_type* owner, uint16_t type,
+	uint16_t klass, uint32_t ttl, uint8_t* rdata, size_t rdlen)
+{
+	buffer_reserve(buf, owner->name_size + 10 + rdlen);
+	buffer_write(buf, dname_name(owner), owner->name_size);
+	buffer_write_u16(buf, type);
+	buffer_write_u16(buf, klass);
+	buffer_write_u32(buf, ttl);
+	buffer_write_u16(buf, rdlen);
+	buffer_write(buf, rdata, rdlen);
+}
+
+static void
+ixfr_write_rr(buffer_type* buf, rr_type* rr)
+{
+	uint8_t rdata[MAX_RDLENGTH];
+	size_t rdlen = rr_marshal_rdata(rr, rdata, sizeof(rdata));
+	ixfr_write_rr_wire(buf, domain_dname(rr->owner), rr->type, rr->klass,
+		rr->ttl, rdata, rdlen);
+}
+
+static void
+zone_ixfr_remove_oldest(struct zone_ixfr* ixfr)
+{
+	struct ixfr_data* d = ixfr->oldest;
+	assert(d);
+	ixfr->oldest = d->next;
+	if(ixfr->newest == d)
+		ixfr->newest = NULL;
+	ixfr->num--;
+	ixfr->size -= d->len;
+	free(d->data);
+	free(d);
+}
+
+void
+zone_ixfr_clear(zone_type* zone)
+{
+	if(!zone->ixfr)
+		return;
+	while(zone->ixfr->oldest)
+		zone_ixfr_remove_oldest(zone->ixfr);
+	free(zone->ixfr);
+	zone->ixfr = NULL;
+}
+
+static struct ixfr_store*
+ixfr_store_create(zone_type* zone, uint32_t oldserial, uint32_t newserial)
+{
+	region_type* region = region_create(xalloc, free);
+	struct ixfr_store* ixfr_store = (struct ixfr_store*)region_alloc(
+		region, sizeof(*ixfr_store));
+	ixfr_store->zone = zone;
+	ixfr_store->oldserial = oldserial;
+	ixfr_store->newserial = newserial;
+	ixfr_store->region = region;
+	ixfr_store->domains = NULL;
+	ixfr_store->data = buffer_create(region, IXFR_STORE_INITIAL_SIZE);
+	ixfr_store->failed = 0;
+	return ixfr_store;
+}
+
+struct ixfr_store*
+ixfr_store_start(zone_type* zone, uint32_t newserial)
+{
+	if(!zone->soa_rrset)
+		return NULL;
+	return ixfr_store_create(zone,
+		ixfr_soa_serial(&zone->soa_rrset->rrs[0]), newserial);
+}
+
+void
+ixfr_store_cancel(struct ixfr_store* ixfr_store)
+{
+	if(!ixfr_store)
+		return;
+	region_destroy(ixfr_store->region);
+}
+
+void
+ixfr_store_add_rr_packet(struct ixfr_store* ixfr_store,
+	const dname_type* owner, uint16_t type, uint16_t klass, uint32_t ttl,
+	buffer_type* packet, uint16_t rdlen)
+{
+	size_t pos = buffer_position(packet);
+	uint8_t rdata[MAX_RDLENGTH];
+	ssize_t rdata_num;
+	rr_type rr;
+	rrtype_descriptor_type* descriptor = rrtype_descriptor_by_type(type);
+	int i;
+	if(ixfr_store->failed)
+		return;
+	/* rdata without domain names has no compression pointers */
+	for(i=0; i<descriptor->maximum; i++)
+		if(rdata_atom_is_domain(type, i))
+			break;
+	if(i == descriptor->maximum) {
+		ixfr_write_rr_wire(ixfr_store->data, owner, type, klass, ttl,
+			buffer_current(packet), rdlen);
+		return;
+	}
+	/* decompress the dnames in the rdata, the domains are entered
+	 * in a scratch table, not in the namedb */
+	if(!ixfr_store->domains)
+		ixfr_store->domains = domain_table_create(ixfr_store->region);
+	rdata_num = rdata_wireformat_to_rdata_atoms(ixfr_store->region,
+		ixfr_store->domains, type, rdlen, packet, &rr.rdatas);
+	buffer_set_position(packet, pos);
+	if(rdata_num == -1) {
+		log_msg(LOG_ERR, "ixfr store: bad rdata for %s, no IXFR "
+			"journal for this change", dname_to_string(owner, 0));
+		ixfr_store->failed = 1;
+		return;
+	}
+	rr.owner = NULL;
+	rr.ttl = ttl;
+	rr.type = type;
+	rr.klass = klass;
+	rr.rdata_count = rdata_num;
+	ixfr_write_rr_wire(ixfr_store->data, owner, type, klass, ttl, rdata,
+		rr_marshal_rdata(&rr, rdata, sizeof(rdata)));
+}
+
+void
+ixfr_store_finish(struct ixfr_store* ixfr_store, struct nsd_options* opt)
+{
+	zone_type* zone = ixfr_store->zone;
+	struct ixfr_data* d;
+	if(ixfr_store->failed) {
+		zone_ixfr_clear(zone);
+		ixfr_store_cancel(ixfr_store);
+		return;
+	}
+	/* the journal must continue from the previous change */
+	if(zone->ixfr && zone->ixfr->newest &&
+		zone->ixfr->newest->newserial != ixfr_store->oldserial)
+		zone_ixfr_clear(zone);
+	if(!zone->ixfr)
+		zone->ixfr = (struct zone_ixfr*)xalloc_zero(
+			sizeof(struct zone_ixfr));
+
+	d = (struct ixfr_data*)xalloc_zero(sizeof(struct ixfr_data));
+	d->oldserial = ixfr_store->oldserial;
+	d->newserial = ixfr_store->newserial;
+	d->len = buffer_position(ixfr_store->data);
+	d->data = (uint8_t*)xalloc(d->len?d->len:1);
+	memcpy(d->data, buffer_begin(ixfr_store->data), d->len);
+	if(zone->ixfr->newest)
+		zone->ixfr->newest->next = d;
+	else	zone->ixfr->oldest = d;
+	zone->ixfr->newest = d;
+	zone->ixfr->num++;
+	zone->ixfr->size += d->len;
+	ixfr_store_cancel(ixfr_store);
+
+	/* remove the oldest changes to keep within the limits */
+	while(zone->ixfr->oldest && (
+		zone->ixfr->num > (size_t)(opt->ixfr_number>0?
+			opt->ixfr_number:0) ||
+		(opt->ixfr_size > 0 &&
+		 zone->ixfr->size > (size_t)opt->ixfr_size)))
+		zone_ixfr_remove_oldest(zone->ixfr);
+	if(zone->ixfr->num == 0)
+		zone_ixfr_clear(zone);
+	else VERBOSITY(2, (LOG_INFO, "zone %s ixfr journal has %d changes "
+		"of %d bytes", domain_to_string(zone->apex),
+		(int)zone->ixfr->num, (int)zone->ixfr->size));
+}
+
+static int
+ixfr_rrref_cmp(const void* a, const void* b)
+{
+	const struct ixfr_rrref* x = (const struct ixfr_rrref*)a;
+	const struct ixfr_rrref* y = (const struct ixfr_rrref*)b;
+	int c = memcmp(x->rr, y->rr, x->len<y->len?x->len:y->len);
+	if(c != 0)
+		return c;
+	if(x->len < y->len)
+		return -1;
+	if(x->len > y->len)
+		return 1;
+	return 0;
+}
+
+struct ixfr_snapshot*
+ixfr_snapshot_create(zone_type* zone)
+{
+	region_type* region;
+	struct ixfr_snapshot* snap;
+	buffer_type* offsets;
+	domain_type* domain;
+	size_t i;
+	if(!zone->soa_rrset)
+		return NULL;
+	region = region_create(xalloc, free);
+	snap = (struct ixfr_snapshot*)region_alloc(region, sizeof(*snap));
+	snap->region = region;
+	snap->serial = ixfr_soa_serial(&zone->soa_rrset->rrs[0]);
+	snap->data = buffer_create(region, IXFR_STORE_INITIAL_SIZE);
+	ixfr_write_rr(snap->data, &zone->soa_rrset->rrs[0]);
+	snap->soa_len = buffer_position(snap->data);
+
+	/* the buffer moves when it grows, note the offsets of the RRs */
+	offsets = buffer_create(region, IXFR_STORE_INITIAL_SIZE);
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		rrset_type* rrset;
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone != zone || rrset == zone->soa_rrset)
+				continue;
+			for(i = 0; i < rrset->rr_count; i++) {
+				size_t pos = buffer_position(snap->data);
+				buffer_reserve(offsets, sizeof(pos));
+				buffer_write(offsets, &pos, sizeof(pos));
+				ixfr_write_rr(snap->data, &rrset->rrs[i]);
+			}
+		}
+	}
+	snap->count = buffer_position(offsets) / sizeof(size_t);
+	snap->rrs = (struct ixfr_rrref*)region_alloc_array(region,
+		snap->count?snap->count:1, sizeof(struct ixfr_rrref));
+	for(i = 0; i < snap->count; i++) {
+		size_t pos, end;
+		buffer_read_at(offsets, i*sizeof(size_t), &pos, sizeof(pos));
+		if(i+1 < snap->count)
+			buffer_read_at(offsets, (i+1)*sizeof(size_t), &end,
+				sizeof(end));
+		else	end = buffer_position(snap->data);
+		snap->rrs[i].rr = buffer_at(snap->data, pos);
+		snap->rrs[i].len = end - pos;
+	}
+	qsort(snap->rrs, snap->count, sizeof(struct ixfr_rrref),
+		ixfr_rrref_cmp);
+	return snap;
+}
+
+void
+ixfr_snapshot_delete(struct ixfr_snapshot* snap)
+{
+	if(!snap)
+		return;
+	region_destroy(snap->region);
+}
+
+void
+ixfr_store_zone_diff(zone_type* zone, struct ixfr_snapshot* snap,
+	struct nsd_options* opt)
+{
+	struct ixfr_snapshot* cur;
+	struct ixfr_store* ixfr_store;
+	size_t i, j;
+	cur = ixfr_snapshot_create(zone);
+	if(!cur || compare_serial(snap->serial, cur->serial) >= 0) {
+		/* no new version, cannot be transferred incrementally */
+		zone_ixfr_clear(zone);
+		ixfr_snapshot_delete(cur);
+		ixfr_snapshot_delete(snap);
+		return;
+	}
+	ixfr_store = ixfr_store_create(zone, snap->serial, cur->serial);
+
+	/* old SOA and the deleted RRs */
+	buffer_reserve(ixfr_store->data, snap->soa_len);
+	buffer_write(ixfr_store->data, buffer_begin(snap->data), snap->soa_len);
+	for(i = 0, j = 0; i < snap->count; i++) {
+		int c = 1;
+		while(j < cur->count && (c = ixfr_rrref_cmp(&cur->rrs[j],
+			&snap->rrs[i])) < 0)
+			j++;
+		if(c == 0)
+			continue;
+		buffer_reserve(ixfr_store->data, snap->rrs[i].len);
+		buffer_write(ixfr_store->data, snap->rrs[i].rr,
+			snap->rrs[i].len);
+	}
+	/* new SOA and the added RRs */
+	buffer_reserve(ixfr_store->data, cur->soa_len);
+	buffer_write(ixfr_store->data, buffer_begin(cur->data), cur->soa_len);
+	for(i = 0, j = 0; i < cur->count; i++) {
+		int c = 1;
+		while(j < snap->count && (c = ixfr_rrref_cmp(&snap->rrs[j],
+			&cur->rrs[i])) < 0)
+			j++;
+		if(c == 0)
+			continue;
+		buffer_reserve(ixfr_store->data, cur->rrs[i].len);
+		buffer_write(ixfr_store->data, cur->rrs[i].rr,
+			cur->rrs[i].len);
+	}
+	ixfr_snapshot_delete(cur);
+	ixfr_snapshot_delete(snap);
+	ixfr_store_finish(ixfr_store, opt);
+}
@@ -0,0 +1,114 @@
+/*
+ * ixfr.h -- journal of zone changes, to answer IXFR requests from.
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef _IXFR_H_
+#define _IXFR_H_
+
+#include "namedb.h"
+#include "buffer.h"
+struct nsd_options;
+
+/*
+ * One change of the zone, from oldserial to newserial.  The data is the
+ * IXFR difference sequence in uncompressed wireformat: the old SOA, the
+ * deleted RRs, the new SOA and the added RRs.  If the change was
+ * received in an IXFR that spans several versions, there are several
+ * of these sequences after another.
+ */
+struct ixfr_data {
+	/* the next, newer, change of the zone */
+	struct ixfr_data* next;
+	uint32_t oldserial;
+	uint32_t newserial;
+	uint8_t* data;
+	size_t len;
+};
+
+/*
+ * The journal of a zone, with the changes from oldest to newest.
+ * It is kept in memory (malloced) and the server processes inherit it
+ * when they are forked after a reload.
+ */
+struct zone_ixfr {
+	struct ixfr_data* oldest;
+	struct ixfr_data* newest;
+	/* number of changes in the list */
+	size_t num;
+	/* bytes of wireformat data in the list */
+	size_t size;
+};
+
+/*
+ * A change that is being built up while an update is applied to the
+ * zone.  When the update is done it is added to the journal.
+ */
+struct ixfr_store {
+	zone_type* zone;
+	uint32_t oldserial;
+	uint32_t newserial;
+	/* region for the data buffer and temporary rdata parse results */
+	region_type* region;
+	/* domains referenced by parsed rdata, scratch table */
+	domain_table_type* domains;
+	buffer_type* data;
+	/* set if an RR could not be stored, the change is not kept */
+	int failed;
+};
+
+/* delete the journal of the zone, if any */
+void zone_ixfr_clear(zone_type* zone);
+
+/*
+ * Start to store a change to the zone.  The zone must have a SOA,
+ * its serial is the oldserial.  Returns NULL if the change is not
+ * stored, because there is no SOA.
+ */
+struct ixfr_store* ixfr_store_start(zone_type* zone, uint32_t newserial);
+
+/* stop storing the change and free it, also when store is NULL */
+void ixfr_store_cancel(struct ixfr_store* ixfr_store);
+
+/*
+ * Add an RR from the transfer file to the stored change, the packet is
+ * at the (possibly compressed) rdata of rdlen, and its position is
+ * unchanged.
+ */
+void ixfr_store_add_rr_packet(struct ixfr_store* ixfr_store,
+	const dname_type* owner, uint16_t type, uint16_t klass, uint32_t ttl,
+	buffer_type* packet, uint16_t rdlen);
+
+/*
+ * Add the stored change to the journal of the zone, and remove old
+ * changes to keep within the ixfr-number and ixfr-size limits.
+ * The ixfr_store is freed.
+ */
+void ixfr_store_finish(struct ixfr_store* ixfr_store,
+	struct nsd_options* opt);
+
+/*
+ * The RRs of the zone, sorted, taken before the zone is read from file.
+ * Compared with the contents afterwards to create the change.
+ */
+struct ixfr_snapshot;
+
+/* take a snapshot of the zone contents, NULL if the zone has no SOA */
+struct ixfr_snapshot* ixfr_snapshot_create(zone_type* zone);
+
+/* free a snapshot, also when it is NULL */
+void ixfr_snapshot_delete(struct ixfr_snapshot* snap);
+
+/*
+ * Compare the snapshot with the current contents of the zone and store
+ * the differences in the journal.  If the serial has not increased the
+ * journal is cleared.  The snapshot is freed.
+ */
+void ixfr_store_zone_diff(zone_type* zone, struct ixfr_snapshot* snap,
+	struct nsd_options* opt);
+
+#endif /* _IXFR_H_ */
@@ -58,6 +58,10 @@
 #include <signal.h>
 #include "mini_event.h"
 #include "util.h"
+#ifdef MINI_EVENT_EPOLL
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
 
 /** compare events in tree, based on timevalue, ptr for uniqueness */
 int
@@ -102,6 +106,9 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 	if(!base)
 		return NULL;
 	memset(base, 0, sizeof(*base));
+#ifdef MINI_EVENT_EPOLL
+	base->epfd = -1;
+#endif
 	base->region = region_create(xalloc, free);
 	if(!base->region) {
 		free(base);
@@ -119,7 +126,19 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 		return NULL;
 	}
 	base->capfd = MAX_FDS;
-#ifdef FD_SETSIZE
+#ifdef MINI_EVENT_EPOLL
+	base->epfd = epoll_create(MAX_FDS);
+	if(base->epfd == -1) {
+		event_base_free(base);
+		return NULL;
+	}
+	base->evs = (struct epoll_event*)calloc(MAX_EPOLL_EVENTS,
+		sizeof(struct epoll_event));
+	if(!base->evs) {
+		event_base_free(base);
+		return NULL;
+	}
+#elif defined(FD_SETSIZE)
 	if((int)FD_SETSIZE < base->capfd)
 		base->capfd = (int)FD_SETSIZE;
 #endif
@@ -134,7 +153,7 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 		event_base_free(base);
 		return NULL;
 	}
-#ifndef S_SPLINT_S
+#if !defined(S_SPLINT_S) && !defined(MINI_EVENT_EPOLL)
 	FD_ZERO(&base->reads);
 	FD_ZERO(&base->writes);
 #endif
@@ -148,11 +167,15 @@ event_get_version(void)
 	return "mini-event-"PACKAGE_VERSION;
 }
 
-/** get polling method, select */
+/** get polling method, epoll or select */
 const char *
 event_get_method(void)
 {
+#ifdef MINI_EVENT_EPOLL
+	return "epoll";
+#else
 	return "select";
+#endif
 }
 
 /** call timeouts handlers, and return how long to wait for next one or -1 */
@@ -194,6 +217,70 @@ handle_timeouts(struct event_base* base, struct timeval* now,
 	return tofired;
 }
 
+#ifdef MINI_EVENT_EPOLL
+/** call epoll_wait and callbacks for that */
+static int
+handle_select(struct event_base* base, struct timeval* wait)
+{
+	int ret, i, ms = -1;
+
+#ifndef S_SPLINT_S
+	if(wait->tv_sec!=(time_t)-1)
+		ms = (int)wait->tv_sec*1000 + (int)(wait->tv_usec+999)/1000;
+#endif
+	if((ret = epoll_wait(base->epfd, base->evs, MAX_EPOLL_EVENTS, ms))
+		== -1) {
+		ret = errno;
+		if(settime(base) < 0)
+			return -1;
+		errno = ret;
+		if(ret == EAGAIN || ret == EINTR)
+			return 0;
+		return -1;
+	}
+	if(settime(base) < 0)
+		return -1;
+
+	for(i=0; i<ret; i++) {
+		short bits = 0;
+		int fd = base->evs[i].data.fd;
+		/* the event could have been deleted by an earlier callback */
+		if(fd < 0 || fd >= base->capfd || !base->fds[fd])
+			continue;
+		if((base->evs[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP)))
+			bits |= EV_READ;
+		if((base->evs[i].events & (EPOLLOUT|EPOLLERR|EPOLLHUP)))
+			bits |= EV_WRITE;
+		bits &= base->fds[fd]->ev_flags;
+		if(bits) {
+			(*base->fds[fd]->ev_callback)(base->fds[fd]->ev_fd,
+				bits, base->fds[fd]->ev_arg);
+		}
+	}
+	return 0;
+}
+
+/** grow the fds array to hold the fd */
+static int
+grow_fds(struct event_base* base, int fd)
+{
+	int newcap = base->capfd;
+	struct event** newfds;
+	while(newcap <= fd)
+		newcap *= 2;
+	newfds = (struct event**)realloc(base->fds,
+		(size_t)newcap*sizeof(struct event*));
+	if(!newfds)
+		return 0;
+	memset(newfds+base->capfd, 0,
+		(size_t)(newcap-base->capfd)*sizeof(struct event*));
+	base->fds = newfds;
+	base->capfd = newcap;
+	return 1;
+}
+
+#else /* MINI_EVENT_EPOLL */
+
 /** call select and callbacks for that */
 static int
 handle_select(struct event_base* base, struct timeval* wait)
@@ -244,6 +331,7 @@ handle_select(struct event_base* base, struct timeval* wait)
 	}
 	return 0;
 }
+#endif /* MINI_EVENT_EPOLL */
 
 /** run select once */
 int
@@ -310,6 +398,12 @@ event_base_free(struct event_base* base)
 		free(base->fds);
 	if(base->signals)
 		free(base->signals);
+#ifdef MINI_EVENT_EPOLL
+	if(base->evs)
+		free(base->evs);
+	if(base->epfd != -1)
+		close(base->epfd);
+#endif
 	region_destroy(base->region);
 	free(base);
 }
@@ -342,6 +436,30 @@ event_add(struct event* ev, struct timeval* tv)
 {
 	if(ev->added)
 		event_del(ev);
+#ifdef MINI_EVENT_EPOLL
+	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd &&
+		(ev->ev_flags&(EV_READ|EV_WRITE)) &&
+		!grow_fds(ev->ev_base, ev->ev_fd))
+		return -1;
+	if( (ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
+		struct epoll_event ee;
+		memset(&ee, 0, sizeof(ee));
+		if(ev->ev_flags&EV_READ)
+			ee.events |= EPOLLIN;
+		if(ev->ev_flags&EV_WRITE)
+			ee.events |= EPOLLOUT;
+		if(ev->ev_flags&EV_ET)
+			ee.events |= EPOLLET;
+		ee.data.fd = ev->ev_fd;
+		if(epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_ADD, ev->ev_fd, &ee)
+			== -1 && (errno != EEXIST || epoll_ctl(ev->ev_base->epfd,
+			EPOLL_CTL_MOD, ev->ev_fd, &ee) == -1))
+			return -1;
+		ev->ev_base->fds[ev->ev_fd] = ev;
+		if(ev->ev_fd > ev->ev_base->maxfd)
+			ev->ev_base->maxfd = ev->ev_fd;
+	}
+#else
 	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
 		return -1;
 	if( (ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
@@ -357,6 +475,7 @@ event_add(struct event* ev, struct timeval* tv)
 		if(ev->ev_fd > ev->ev_base->maxfd)
 			ev->ev_base->maxfd = ev->ev_fd;
 	}
+#endif /* MINI_EVENT_EPOLL */
 	if(tv && (ev->ev_flags&EV_TIMEOUT)) {
 #ifndef S_SPLINT_S
 		struct timeval* now = ev->ev_base->time_tv;
@@ -383,10 +502,16 @@ event_del(struct event* ev)
 		(void)rbtree_delete(ev->ev_base->times, &ev->node);
 	if((ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
 		ev->ev_base->fds[ev->ev_fd] = NULL;
+#ifdef MINI_EVENT_EPOLL
+		/* errors ignored, the fd may already be closed */
+		(void)epoll_ctl(ev->ev_base->epfd, EPOLL_CTL_DEL, ev->ev_fd,
+			NULL);
+#else
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->writes);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->content);
+#endif /* MINI_EVENT_EPOLL */
 	}
 	ev->added = 0;
 	return 0;
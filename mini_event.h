@@ -36,14 +36,16 @@
 /**
  * \file
  * This file implements part of the event(3) libevent api.
- * The back end is only select. Max number of fds is limited.
+ * The back end is epoll where available, otherwise select.  With select
+ * the max number of fds is limited.
  * Max number of signals is limited, one handler per signal only.
  * And one handler per fd.
  *
- * Although limited to select() and a max (1024) open fds, it
- * is efficient:
+ * With select() and a max (1024) open fds, it is efficient:
  * o dispatch call caches fd_sets to use. 
  * o handler calling takes time ~ to the number of fds.
+ * With epoll() the fds are not limited and handler calling takes time
+ * ~ to the number of ready fds.  EV_ET asks for edge triggered events.
  * o timeouts are stored in a redblack tree, sorted, so take log(n).
  * Timeouts are only accurate to the second (no subsecond accuracy).
  * To avoid cpu hogging, fractional timeouts are rounded up to a whole second.
@@ -52,6 +54,7 @@
 #ifndef MINI_EVENT_H
 #define MINI_EVENT_H
 struct region;
+struct epoll_event;
 
 #if defined(USE_MINI_EVENT) && !defined(USE_WINSOCK)
 
@@ -69,12 +72,21 @@ struct region;
 #define EV_SIGNAL	0x08
 /** event must persist */
 #define EV_PERSIST	0x10
+/** event is edge triggered, the handler must read until EAGAIN */
+#define EV_ET		0x20
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
+/** use epoll as the back end */
+#define MINI_EVENT_EPOLL 1
+#endif
 
 /* needs our redblack tree */
 #include "rbtree.h"
 
-/** max number of file descriptors to support */
+/** max number of file descriptors to support (with select) */
 #define MAX_FDS 1024
+/** max number of events returned from one epoll_wait */
+#define MAX_EPOLL_EVENTS 128
 /** max number of signals to support */
 #define MAX_SIG 32
 
@@ -89,6 +101,12 @@ struct event_base
 	int maxfd;
 	/** capacity - size of the fds array */
 	int capfd;
+#ifdef MINI_EVENT_EPOLL
+	/** the epoll fd */
+	int epfd;
+	/** array of MAX_EPOLL_EVENTS, for the events returned */
+	struct epoll_event* evs;
+#else
 	/* fdset for read write, for fds ready, and added */
 	fd_set 
 		/** fds for reading */
@@ -99,6 +117,7 @@ struct event_base
 		ready, 
 		/** ready plus newly added events. */
 		content;
+#endif /* MINI_EVENT_EPOLL */
 	/** array of 0 - maxsig of ptr to event for it */
 	struct event** signals;
 	/** if we need to exit */
@@ -140,7 +159,7 @@ struct event {
 void *event_init(time_t* time_secs, struct timeval* time_tv);
 /** get version */
 const char *event_get_version(void);
-/** get polling method, select */
+/** get polling method, epoll or select */
 const char *event_get_method(void);
 /** run select in a loop */
 int event_base_dispatch(struct event_base *);
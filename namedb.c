@@ -73,10 +73,7 @@ allocate_domain_nsec3(domain_table_type* table, domain_type* result)
 	result->nsec3->have_nsec3_ds_parent_hash = 0;
 	result->nsec3->prehash_prev = NULL;
 	result->nsec3->prehash_next = NULL;
-	result->nsec3->nsec3_node.key = NULL;
-	result->nsec3->hash_node.key = NULL;
-	result->nsec3->wchash_node.key = NULL;
-	result->nsec3->dshash_node.key = NULL;
+	result->nsec3->in_index = 0;
 }
 #endif /* NSEC3 */
 
@@ -157,15 +154,273 @@ int domain_is_prehash(domain_table_type* table, domain_type* domain)
 	return (table->prehash_list == domain);
 }
 
-/** remove domain node from NSEC3 tree in hash space */
+/** find the block for the hash, the last block with first entry <= hash,
+ * or 0 if there is none (also if the index is empty) */
+static size_t
+hash_index_find_block(struct hash_index* index, const uint8_t* hash)
+{
+	size_t lo = 0, hi = index->num;
+	/* the first entry of blocks[lo] is <= hash, or lo == 0 */
+	while(hi - lo > 1) {
+		size_t mid = lo + (hi-lo)/2;
+		if(memcmp(index->blocks[mid]->entries[0].hash, hash,
+			NSEC3_HASH_LEN) <= 0)
+			lo = mid;
+		else	hi = mid;
+	}
+	return lo;
+}
+
+/** number of entries in the block that are <= hash */
+static size_t
+hash_block_upper(struct hash_block* b, const uint8_t* hash)
+{
+	size_t lo = 0, hi = b->count;
+	while(lo < hi) {
+		size_t mid = lo + (hi-lo)/2;
+		if(memcmp(b->entries[mid].hash, hash, NSEC3_HASH_LEN) <= 0)
+			lo = mid+1;
+		else	hi = mid;
+	}
+	return lo;
+}
+
+/** insert a block in the blocks array at position i */
+static struct hash_block*
+hash_index_add_block(struct hash_index* index, size_t i)
+{
+	struct hash_block* b;
+	if(index->num == index->capacity) {
+		size_t newcap = index->capacity?index->capacity*2:4;
+		struct hash_block** a = (struct hash_block**)region_alloc_array(
+			index->region, newcap, sizeof(*a));
+		if(index->num)
+			memcpy(a, index->blocks, index->num*sizeof(*a));
+		region_recycle(index->region, index->blocks,
+			index->capacity*sizeof(*a));
+		index->blocks = a;
+		index->capacity = newcap;
+	}
+	b = (struct hash_block*)region_alloc(index->region, sizeof(*b));
+	b->count = 0;
+	memmove(&index->blocks[i+1], &index->blocks[i],
+		(index->num-i)*sizeof(struct hash_block*));
+	index->blocks[i] = b;
+	index->num++;
+	return b;
+}
+
+/** remove the block at position i from the blocks array and free it */
+static void
+hash_index_del_block(struct hash_index* index, size_t i)
+{
+	region_recycle(index->region, index->blocks[i],
+		sizeof(struct hash_block));
+	memmove(&index->blocks[i], &index->blocks[i+1],
+		(index->num-i-1)*sizeof(struct hash_block*));
+	index->num--;
+}
+
+struct hash_index*
+hash_tree_create(region_type* region, uint8_t flag)
+{
+	struct hash_index* index = (struct hash_index*)region_alloc_zero(
+		region, sizeof(*index));
+	index->flag = flag;
+	index->region = region;
+	return index;
+}
+
+/** add domain to hash index */
+void zone_add_domain_in_hash_tree(region_type* region,
+	struct hash_index** index, uint8_t flag, const uint8_t* hash,
+	domain_type* domain)
+{
+	struct hash_index* x = *index;
+	struct hash_block* b;
+	size_t i, pos;
+	if(!x)
+		x = *index = hash_tree_create(region, flag);
+	assert(domain->nsec3 && !(domain->nsec3->in_index & x->flag));
+	if(x->num == 0)
+		(void)hash_index_add_block(x, 0);
+	i = hash_index_find_block(x, hash);
+	b = x->blocks[i];
+	pos = hash_block_upper(b, hash);
+	if(b->count == HASH_INDEX_BLOCK) {
+		/* split the block, but an append at the end starts a new
+		 * block, so that entries added in order fill the blocks */
+		struct hash_block* n = hash_index_add_block(x, i+1);
+		if(pos == HASH_INDEX_BLOCK && i+2 == x->num) {
+			b = n;
+			pos = 0;
+		} else {
+			n->count = HASH_INDEX_BLOCK/2;
+			b->count = HASH_INDEX_BLOCK - n->count;
+			memcpy(&n->entries[0], &b->entries[b->count],
+				n->count*sizeof(struct hash_entry));
+			if(pos > b->count) {
+				pos -= b->count;
+				b = n;
+			}
+		}
+	}
+	memmove(&b->entries[pos+1], &b->entries[pos],
+		(b->count-pos)*sizeof(struct hash_entry));
+	memcpy(b->entries[pos].hash, hash, NSEC3_HASH_LEN);
+	b->entries[pos].domain = domain;
+	b->count++;
+	x->count++;
+	domain->nsec3->in_index |= x->flag;
+}
+
+/** remove domain from hash index */
+void
+zone_del_domain_in_hash_tree(struct hash_index* index, const uint8_t* hash,
+	domain_type* domain)
+{
+	struct hash_pos p;
+	struct hash_block* b;
+	if(!index || !domain->nsec3 || !(domain->nsec3->in_index&index->flag))
+		return;
+	/* find it amongst the entries with this hash */
+	if(hash_index_find_less_equal(index, hash, &p)) {
+		while(hash_index_domain(index, &p) != domain) {
+			hash_index_prev(index, &p);
+			if(p.block >= index->num || memcmp(index->blocks[
+				p.block]->entries[p.idx].hash, hash,
+				NSEC3_HASH_LEN) != 0)
+				break;
+		}
+	}
+	/* note that domain is no longer in the index */
+	domain->nsec3->in_index &= ~index->flag;
+	if(hash_index_domain(index, &p) != domain) {
+		log_msg(LOG_ERR, "internal error: domain not in nsec3 hash "
+			"index");
+		return;
+	}
+	b = index->blocks[p.block];
+	memmove(&b->entries[p.idx], &b->entries[p.idx+1],
+		(b->count-p.idx-1)*sizeof(struct hash_entry));
+	b->count--;
+	index->count--;
+	if(b->count == 0) {
+		hash_index_del_block(index, p.block);
+	} else if(p.block+1 < index->num && b->count +
+		index->blocks[p.block+1]->count <= HASH_INDEX_BLOCK/2) {
+		/* merge the next block into this one */
+		struct hash_block* n = index->blocks[p.block+1];
+		memcpy(&b->entries[b->count], &n->entries[0],
+			n->count*sizeof(struct hash_entry));
+		b->count += n->count;
+		hash_index_del_block(index, p.block+1);
+	}
+}
+
+int
+hash_index_find_less_equal(struct hash_index* index, const uint8_t* hash,
+	struct hash_pos* pos)
+{
+	struct hash_block* b;
+	size_t n;
+	if(!index || index->num == 0) {
+		pos->block = 0;
+		pos->idx = 0;
+		return 0;
+	}
+	pos->block = hash_index_find_block(index, hash);
+	b = index->blocks[pos->block];
+	n = hash_block_upper(b, hash);
+	if(n == 0) {
+		/* smaller than all entries */
+		pos->block = index->num;
+		pos->idx = 0;
+		return 0;
+	}
+	pos->idx = n-1;
+	return memcmp(b->entries[pos->idx].hash, hash, NSEC3_HASH_LEN) == 0;
+}
+
+void
+hash_index_first(struct hash_index* ATTR_UNUSED(index), struct hash_pos* pos)
+{
+	/* if the index is empty, this is not an entry */
+	pos->block = 0;
+	pos->idx = 0;
+}
+
 void
-zone_del_domain_in_hash_tree(rbtree_t* tree, rbnode_t* node)
+hash_index_last(struct hash_index* index, struct hash_pos* pos)
 {
-	if(!node->key)
+	if(!index || index->num == 0) {
+		pos->block = 0;
+		pos->idx = 0;
 		return;
-	rbtree_delete(tree, node->key);
-	/* note that domain is no longer in the tree */
-	node->key = NULL;
+	}
+	pos->block = index->num-1;
+	pos->idx = index->blocks[pos->block]->count-1;
+}
+
+void
+hash_index_next(struct hash_index* index, struct hash_pos* pos)
+{
+	if(!index || pos->block >= index->num)
+		return;
+	if(++pos->idx >= index->blocks[pos->block]->count) {
+		pos->block++;
+		pos->idx = 0;
+	}
+}
+
+void
+hash_index_prev(struct hash_index* index, struct hash_pos* pos)
+{
+	if(!index || pos->block >= index->num)
+		return;
+	if(pos->idx > 0) {
+		pos->idx--;
+	} else if(pos->block > 0) {
+		pos->block--;
+		pos->idx = index->blocks[pos->block]->count-1;
+	} else {
+		pos->block = index->num;
+	}
+}
+
+/** clear hash index */
+void
+hash_tree_clear(struct hash_index* index)
+{
+	size_t i, j;
+	if(!index) return;
+
+	/* note that elements are no longer in the index */
+	for(i=0; i<index->num; i++) {
+		struct hash_block* b = index->blocks[i];
+		for(j=0; j<b->count; j++)
+			b->entries[j].domain->nsec3->in_index &= ~index->flag;
+		region_recycle(index->region, b, sizeof(*b));
+	}
+	region_recycle(index->region, index->blocks,
+		index->capacity*sizeof(struct hash_block*));
+	index->blocks = NULL;
+	index->num = 0;
+	index->capacity = 0;
+	index->count = 0;
+}
+
+void hash_tree_delete(region_type* region, struct hash_index* index)
+{
+	size_t i;
+	if(!index) return;
+	/* the domains can be deleted already, do not touch them */
+	for(i=0; i<index->num; i++)
+		region_recycle(index->region, index->blocks[i],
+			sizeof(struct hash_block));
+	region_recycle(index->region, index->blocks,
+		index->capacity*sizeof(struct hash_block*));
+	region_recycle(region, index, sizeof(*index));
 }
 
 /** clear the prehash list */
@@ -227,18 +482,18 @@ do_deldomain(namedb_type* db, domain_type* domain)
 
 	/* see if nsec3-nodes are used */
 	if(domain->nsec3) {
-		if(domain->nsec3->nsec3_node.key)
+		if((domain->nsec3->in_index & HASH_INDEX_NSEC3))
+			nsec3_del_nsec3rr(nsec3_tree_zone(db, domain), domain);
+		if((domain->nsec3->in_index & HASH_INDEX_HASH))
 			zone_del_domain_in_hash_tree(nsec3_tree_zone(db, domain)
-				->nsec3tree, &domain->nsec3->nsec3_node);
-		if(domain->nsec3->hash_node.key)
+				->hashtree, domain->nsec3->nsec3_hash, domain);
+		if((domain->nsec3->in_index & HASH_INDEX_WC))
 			zone_del_domain_in_hash_tree(nsec3_tree_zone(db, domain)
-				->hashtree, &domain->nsec3->hash_node);
-		if(domain->nsec3->wchash_node.key)
-			zone_del_domain_in_hash_tree(nsec3_tree_zone(db, domain)
-				->wchashtree, &domain->nsec3->wchash_node);
-		if(domain->nsec3->dshash_node.key)
+				->wchashtree, domain->nsec3->nsec3_wc_hash, domain);
+		if((domain->nsec3->in_index & HASH_INDEX_DS))
 			zone_del_domain_in_hash_tree(nsec3_tree_dszone(db, domain)
-				->dshashtree, &domain->nsec3->dshash_node);
+				->dshashtree, domain->nsec3->nsec3_ds_parent_hash,
+				domain);
 		region_recycle(db->domains->region, domain->nsec3,
 			sizeof(struct nsec3_domain_data));
 	}
@@ -269,38 +524,6 @@ domain_table_deldomain(namedb_type* db, domain_type* domain)
 	}
 }
 
-/** clear hash tree */
-void
-hash_tree_clear(rbtree_t* tree)
-{
-	rbnode_t* n;
-	if(!tree) return;
-
-	/* note that elements are no longer in the tree */
-	for(n=rbtree_first(tree); n!=RBTREE_NULL; n=rbtree_next(n)) {
-		n->key = NULL;
-	}
-	tree->count = 0;
-	tree->root = RBTREE_NULL;
-}
-
-void hash_tree_delete(region_type* region, rbtree_t* tree)
-{
-	region_recycle(region, tree, sizeof(rbtree_t));
-}
-
-/** add domain nsec3 node to hashedspace tree */
-void zone_add_domain_in_hash_tree(region_type* region, rbtree_t** tree,
-	int (*cmpf)(const void*, const void*),
-	domain_type* domain, rbnode_t* node)
-{
-	if(!*tree)
-		*tree = rbtree_create(region, cmpf);
-	memset(node, 0, sizeof(rbnode_t));
-	node->key = domain;
-	rbtree_insert(*tree, node);
-}
-
 domain_table_type *
 domain_table_create(region_type* region)
 {
@@ -17,6 +17,8 @@
 #include "radtree.h"
 #include "rbtree.h"
 struct zone_options;
+struct zone_ixfr;
+struct axfr_cache;
 struct nsd_options;
 struct udb_base;
 struct udb_ptr;
@@ -58,14 +60,6 @@ struct nsec3_domain_data {
 	domain_type* nsec3_ds_parent_cover;
 	/* NSEC3 domains to prehash, prev and next on the list or cleared */
 	domain_type* prehash_prev, *prehash_next;
-	/* entry in the nsec3tree (for NSEC3s in the chain in use) */
-	rbnode_t nsec3_node;
-	/* entry in the hashtree (for precompiled domains) */
-	rbnode_t hash_node;
-	/* entry in the wchashtree (the wildcard precompile) */
-	rbnode_t wchash_node;
-	/* entry in the dshashtree (the parent ds precompile) */
-	rbnode_t dshash_node;
 
 	/* nsec3 hash */
 	uint8_t nsec3_hash[NSEC3_HASH_LEN];
@@ -81,6 +75,55 @@ struct nsec3_domain_data {
 	unsigned     nsec3_is_exact : 1;
 	/* same but on parent side */
 	unsigned     nsec3_ds_parent_is_exact : 1;
+	/* the hash indexes of the zone that have an entry for the domain,
+	 * HASH_INDEX_NSEC3 for the nsec3tree (NSEC3s in the chain in use),
+	 * HASH_INDEX_HASH for the hashtree (precompiled domains),
+	 * HASH_INDEX_WC for the wchashtree (the wildcard precompile),
+	 * HASH_INDEX_DS for the dshashtree (the parent ds precompile) */
+	uint8_t in_index;
+};
+
+#define HASH_INDEX_NSEC3 0x01
+#define HASH_INDEX_HASH 0x02
+#define HASH_INDEX_WC 0x04
+#define HASH_INDEX_DS 0x08
+
+/* number of entries in a block of the hash index */
+#define HASH_INDEX_BLOCK 128
+
+/* entry in the hash index, the domain and its hash */
+struct hash_entry {
+	uint8_t hash[NSEC3_HASH_LEN];
+	domain_type* domain;
+};
+
+/* block of entries of the hash index, sorted by hash */
+struct hash_block {
+	size_t count;
+	struct hash_entry entries[HASH_INDEX_BLOCK];
+};
+
+/*
+ * Index of the domains of a zone sorted by an NSEC3 hash.  It is a sorted
+ * array of blocks, that each hold a sorted array of entries.  The hashes
+ * are stored in the entries, a lookup does not visit the domains.
+ */
+struct hash_index {
+	/* the blocks, sorted, none of them is empty */
+	struct hash_block** blocks;
+	/* number of blocks and allocated size of the blocks array */
+	size_t num, capacity;
+	/* number of entries */
+	size_t count;
+	/* the HASH_INDEX_ flag for nsec3_domain_data.in_index */
+	uint8_t flag;
+	/* region for the allocations */
+	region_type* region;
+};
+
+/* position in a hash index, block == num if it is not an entry */
+struct hash_pos {
+	size_t block, idx;
 };
 #endif /* NSEC3 */
 
@@ -118,16 +161,18 @@ struct zone
 #ifdef NSEC3
 	rr_type* nsec3_param; /* NSEC3PARAM RR of chain in use or NULL */
 	domain_type* nsec3_last; /* last domain with nsec3, wraps */
-	/* in these trees, the root contains an elem ptr to the radtree* */
-	rbtree_t* nsec3tree; /* tree with relevant NSEC3 domains */
-	rbtree_t* hashtree; /* tree, hashed NSEC3precompiled domains */
-	rbtree_t* wchashtree; /* tree, wildcard hashed domains */
-	rbtree_t* dshashtree; /* tree, ds-parent-hash domains */
+	/* these indexes are sorted by hash, NULL until first use */
+	struct hash_index* nsec3tree; /* relevant NSEC3 domains */
+	struct hash_index* hashtree; /* hashed NSEC3precompiled domains */
+	struct hash_index* wchashtree; /* wildcard hashed domains */
+	struct hash_index* dshashtree; /* ds-parent-hash domains */
 #endif
 	struct zone_options* opts;
 	char*        filename; /* set if read from file, which file */
 	char*        logstr; /* set for zone xfer, the log string */
 	time_t       mtime; /* time of last modification */
+	struct zone_ixfr* ixfr; /* journal of changes to serve IXFR, or NULL */
+	struct axfr_cache* axfr_cache; /* encoded AXFR of a server process */
 	unsigned     zonestatid; /* array index for zone stats */
 	unsigned     is_secure : 1; /* zone uses DNSSEC */
 	unsigned     is_ok : 1; /* zone has not expired. */
@@ -210,13 +255,35 @@ domain_type* domain_table_find(domain_table_type* table,
 domain_type *domain_table_insert(domain_table_type *table,
 				 const dname_type  *dname);
 
-/* put domain into nsec3 hash space tree */
-void zone_add_domain_in_hash_tree(region_type* region, rbtree_t** tree,
-	int (*cmpf)(const void*, const void*), domain_type* domain,
-	rbnode_t* node);
-void zone_del_domain_in_hash_tree(rbtree_t* tree, rbnode_t* node);
-void hash_tree_clear(rbtree_t* tree);
-void hash_tree_delete(region_type* region, rbtree_t* tree);
+#ifdef NSEC3
+/* put domain into nsec3 hash space index, created if NULL */
+void zone_add_domain_in_hash_tree(region_type* region,
+	struct hash_index** index, uint8_t flag, const uint8_t* hash,
+	domain_type* domain);
+void zone_del_domain_in_hash_tree(struct hash_index* index,
+	const uint8_t* hash, domain_type* domain);
+struct hash_index* hash_tree_create(region_type* region, uint8_t flag);
+void hash_tree_clear(struct hash_index* index);
+void hash_tree_delete(region_type* region, struct hash_index* index);
+/* find the last entry with hash smaller or equal, true if equal.
+ * pos is not an entry if all entries are larger. */
+int hash_index_find_less_equal(struct hash_index* index,
+	const uint8_t* hash, struct hash_pos* pos);
+/* first and last entry, and move to next or previous entry.  The pos is
+ * not an entry (block == num) at the end. */
+void hash_index_first(struct hash_index* index, struct hash_pos* pos);
+void hash_index_last(struct hash_index* index, struct hash_pos* pos);
+void hash_index_next(struct hash_index* index, struct hash_pos* pos);
+void hash_index_prev(struct hash_index* index, struct hash_pos* pos);
+/* the domain at the position, NULL if not an entry */
+static inline domain_type*
+hash_index_domain(struct hash_index* index, struct hash_pos* pos)
+{
+	if(!index || pos->block >= index->num)
+		return NULL;
+	return index->blocks[pos->block]->entries[pos->idx].domain;
+}
+#endif /* NSEC3 */
 void prehash_clear(domain_table_type* table);
 void prehash_add(domain_table_type* table, domain_type* domain);
 void prehash_del(domain_table_type* table, domain_type* domain);
@@ -288,6 +355,10 @@ struct namedb
 	/* if diff_skip=1, diff_pos contains the nsd.diff place to continue */
 	uint8_t		  diff_skip;
 	off_t		  diff_pos;
+	/* number of threads that compute the NSEC3 hashes of a zone, set
+	 * from nsec3-hash-threads when the db is opened at startup, the
+	 * reloads keep it */
+	int		  nsec3_hash_threads;
 };
 
 static inline int rdata_atom_is_domain(uint16_t type, size_t index);
@@ -346,6 +417,11 @@ void namedb_check_zonefile(struct nsd* nsd, struct udb_base* taskudb,
 /** zone one zonefile into memory and revert on parse error, write to udb */
 void namedb_read_zonefile(struct nsd* nsd, struct zone* zone,
 	struct udb_base* taskudb, struct udb_ptr* last_task);
+/** for unit test, write and read the file of a zonefiles-parallel worker */
+int zonefile_write_parsed(const char* fn, zone_type* zone, time_t mtime,
+	unsigned int errors);
+int zonefile_read_parsed(namedb_type* db, zone_type* zone, const char* fn,
+	time_t mtime, unsigned int* errors);
 void apex_rrset_checks(struct namedb* db, rrset_type* rrset,
 	domain_type* domain);
 zone_type* namedb_zone_create(namedb_type* db, const dname_type* dname,
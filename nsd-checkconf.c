@@ -348,9 +348,27 @@ config_print_zone(nsd_options_t* opt, const char* k, int s, const char *o,
 		SERV_GET_BIN(zonefiles_check, o);
 		SERV_GET_BIN(log_time_ascii, o);
 		SERV_GET_BIN(round_robin, o);
+		SERV_GET_BIN(reuseport, o);
+		SERV_GET_BIN(store_ixfr, o);
+		SERV_GET_INT(ixfr_number, o);
+		SERV_GET_INT(ixfr_size, o);
+		SERV_GET_INT(answer_cache_size, o);
+		SERV_GET_INT(server_threads, o);
+		SERV_GET_INT(zonefiles_parallel, o);
+		SERV_GET_INT(database_compact_pause, o);
+		SERV_GET_INT(nsec3_hash_threads, o);
+		SERV_GET_INT(udp_servers, o);
+		SERV_GET_INT(tcp_servers, o);
 		/* str */
 		SERV_GET_PATH(final, database, o);
 		SERV_GET_STR(identity, o);
+		SERV_GET_STR(udp_cpu_affinity, o);
+		SERV_GET_STR(tcp_cpu_affinity, o);
+		SERV_GET_INT(axfr_cache_size, o);
+		SERV_GET_INT(xfrd_tcp_max, o);
+		SERV_GET_INT(xfrd_tcp_master_max, o);
+		SERV_GET_INT(xfrd_udp_max, o);
+		SERV_GET_INT(xfrd_udp_notify_max, o);
 		SERV_GET_STR(nsid, o);
 		SERV_GET_PATH(final, logfile, o);
 		SERV_GET_PATH(final, pidfile, o);
@@ -378,6 +396,7 @@ config_print_zone(nsd_options_t* opt, const char* k, int s, const char *o,
 		SERV_GET_INT(rrl_ipv4_prefix_length, o);
 		SERV_GET_INT(rrl_ipv6_prefix_length, o);
 		SERV_GET_INT(rrl_whitelist_ratelimit, o);
+		SERV_GET_BIN(rrl_shared, o);
 #endif
 		SERV_GET_INT(zonefiles_write, o);
 		/* remote control */
@@ -465,6 +484,24 @@ config_test_print_server(nsd_options_t* opt)
 	printf("\txfrd_reload_timeout: %d\n", opt->xfrd_reload_timeout);
 	printf("\tlog-time-ascii: %s\n", opt->log_time_ascii?"yes":"no");
 	printf("\tround-robin: %s\n", opt->round_robin?"yes":"no");
+	printf("\treuseport: %s\n", opt->reuseport?"yes":"no");
+	printf("\tstore-ixfr: %s\n", opt->store_ixfr?"yes":"no");
+	printf("\tixfr-number: %d\n", (int)opt->ixfr_number);
+	printf("\tixfr-size: %d\n", (int)opt->ixfr_size);
+	printf("\tanswer-cache-size: %d\n", (int)opt->answer_cache_size);
+	printf("\tserver-threads: %d\n", (int)opt->server_threads);
+	printf("\tzonefiles-parallel: %d\n", (int)opt->zonefiles_parallel);
+	printf("\tdatabase-compact-pause: %d\n", (int)opt->database_compact_pause);
+	printf("\tnsec3-hash-threads: %d\n", (int)opt->nsec3_hash_threads);
+	printf("\tudp-servers: %d\n", (int)opt->udp_servers);
+	printf("\ttcp-servers: %d\n", (int)opt->tcp_servers);
+	print_string_var("udp-cpu-affinity:", opt->udp_cpu_affinity);
+	print_string_var("tcp-cpu-affinity:", opt->tcp_cpu_affinity);
+	printf("\taxfr-cache-size: %d\n", (int)opt->axfr_cache_size);
+	printf("\txfrd-tcp-max: %d\n", (int)opt->xfrd_tcp_max);
+	printf("\txfrd-tcp-master-max: %d\n", (int)opt->xfrd_tcp_master_max);
+	printf("\txfrd-udp-max: %d\n", (int)opt->xfrd_udp_max);
+	printf("\txfrd-udp-notify-max: %d\n", (int)opt->xfrd_udp_notify_max);
 	printf("\tverbosity: %d\n", opt->verbosity);
 	for(ip = opt->ip_addresses; ip; ip=ip->next)
 	{
@@ -477,6 +514,7 @@ config_test_print_server(nsd_options_t* opt)
 	printf("\trrl-ipv4-prefix-length: %d\n", (int)opt->rrl_ipv4_prefix_length);
 	printf("\trrl-ipv6-prefix-length: %d\n", (int)opt->rrl_ipv6_prefix_length);
 	printf("\trrl-whitelist-ratelimit: %d\n", (int)opt->rrl_whitelist_ratelimit);
+	printf("\trrl-shared: %s\n", opt->rrl_shared?"yes":"no");
 #endif
 	printf("\tzonefiles-check: %s\n", opt->zonefiles_check?"yes":"no");
 	printf("\tzonefiles-write: %d\n", opt->zonefiles_write);
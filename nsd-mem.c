@@ -87,8 +87,6 @@ struct tot_mem {
 	size_t opt_data;
 	/* unused in options region */
 	size_t opt_unused;
-	/* dname compression table */
-	size_t compresstable;
 #ifdef RATELIMIT
 	/* size of rrl tables */
 	size_t rrl;
@@ -138,23 +136,36 @@ print_zone_mem(struct zone_mem* z)
 	pretty_mem(z->udb_overhead, "overhead in nsd.db");
 }
 
+#ifdef RATELIMIT
+/* number of server processes, counted like nsd.c forks them */
+static size_t
+server_processes(nsd_options_t* opt)
+{
+	/* separate pools of UDP and TCP servers replace server-count */
+	if(opt->udp_servers > 0 || opt->tcp_servers > 0)
+		return (size_t)(opt->udp_servers > 0?opt->udp_servers:1) +
+			(size_t)(opt->tcp_servers > 0?opt->tcp_servers:1);
+	return (size_t)opt->server_count;
+}
+#endif
+
 static void
 account_total(nsd_options_t* opt, struct tot_mem* t)
 {
 	t->opt_data = region_get_mem(opt->region);
 	t->opt_unused = region_get_mem_unused(opt->region);
-	t->compresstable = sizeof(uint16_t) *
-		(t->domaincount + 1 + EXTRA_DOMAIN_NUMBERS);
-	t->compresstable *= opt->server_count;
 
 #ifdef RATELIMIT
 #define SIZE_RRL_BUCKET (8 + 4 + 4 + 4 + 4 + 2)
-	t->rrl = opt->rrl_size * SIZE_RRL_BUCKET;
-	t->rrl *= opt->server_count;
+#define SIZE_RRL_SHARED_BUCKET (8 + 8)
+	if(opt->rrl_shared)
+		t->rrl = opt->rrl_size * SIZE_RRL_SHARED_BUCKET;
+	else	t->rrl = opt->rrl_size * SIZE_RRL_BUCKET *
+		server_processes(opt) * (size_t)(opt->server_threads > 1 ?
+		opt->server_threads : 1);
 #endif
 
-	t->ram = t->data + t->data_unused + t->opt_data + t->opt_unused +
-		t->compresstable;
+	t->ram = t->data + t->data_unused + t->opt_data + t->opt_unused;
 #ifdef RATELIMIT
 	t->ram += t->rrl;
 #endif
@@ -169,9 +180,8 @@ print_tot_mem(struct tot_mem* t)
 	pretty_mem(t->data_unused, "unused space (due to alignment)");
 	pretty_mem(t->opt_data, "options");
 	pretty_mem(t->opt_unused, "options unused space (due to alignment)");
-	pretty_mem(t->compresstable, "name table (depends on servercount)");
 #ifdef RATELIMIT
-	pretty_mem(t->rrl, "RRL table (depends on servercount)");
+	pretty_mem(t->rrl, "RRL table (depends on number of servers)");
 #endif
 	pretty_mem(t->udb_data, "data in nsd.db");
 	pretty_mem(t->udb_overhead, "overhead in nsd.db");
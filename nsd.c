@@ -398,7 +398,7 @@ main(int argc, char *argv[])
 	/* Scratch variables... */
 	int c;
 	pid_t	oldpid;
-	size_t i;
+	size_t i, numsockets, udp_servers = 0, tcp_servers = 0;
 	struct sigaction action;
 #ifdef HAVE_GETPWNAM
 	struct passwd *pwd = NULL;
@@ -408,6 +408,7 @@ main(int argc, char *argv[])
 	/* static so it can get very big without overflowing the stack */
 	static struct addrinfo hints[MAX_INTERFACES];
 	static const char *nodes[MAX_INTERFACES];
+	static const char *services[MAX_INTERFACES];
 	const char *udp_port = 0;
 	const char *tcp_port = 0;
 
@@ -429,6 +430,7 @@ main(int argc, char *argv[])
 		hints[i].ai_family = DEFAULT_AI_FAMILY;
 		hints[i].ai_flags = AI_PASSIVE;
 		nodes[i] = NULL;
+		services[i] = NULL;
 	}
 
 	nsd.identity	= 0;
@@ -742,11 +744,33 @@ main(int argc, char *argv[])
 	edns_init_nsid(&nsd.edns_ipv6, nsd.nsid_len);
 #endif /* defined(INET6) */
 
+	/* Separate pools of UDP and TCP servers replace server-count */
+	if(nsd.options->udp_servers > 0 || nsd.options->tcp_servers > 0) {
+		udp_servers = (nsd.options->udp_servers > 0)?
+			(size_t)nsd.options->udp_servers:1;
+		tcp_servers = (nsd.options->tcp_servers > 0)?
+			(size_t)nsd.options->tcp_servers:1;
+		nsd.child_count = udp_servers + tcp_servers;
+	}
+
 	/* Number of child servers to fork.  */
 	nsd.children = (struct nsd_child *) region_alloc_array(
 		nsd.region, nsd.child_count, sizeof(struct nsd_child));
 	for (i = 0; i < nsd.child_count; ++i) {
-		nsd.children[i].kind = NSD_SERVER_BOTH;
+		if(udp_servers == 0) {
+			nsd.children[i].kind = NSD_SERVER_BOTH;
+			nsd.children[i].kind_num = i;
+			nsd.children[i].kind_count = nsd.child_count;
+		} else if(i < udp_servers) {
+			nsd.children[i].kind = NSD_SERVER_UDP;
+			nsd.children[i].kind_num = i;
+			nsd.children[i].kind_count = udp_servers;
+		} else {
+			nsd.children[i].kind = NSD_SERVER_TCP;
+			nsd.children[i].kind_num = i - udp_servers;
+			nsd.children[i].kind_count = tcp_servers;
+		}
+		nsd.children[i].child_num = i;
 		nsd.children[i].pid = -1;
 		nsd.children[i].child_fd = -1;
 		nsd.children[i].parent_fd = -1;
@@ -789,19 +813,48 @@ main(int argc, char *argv[])
 #endif /* INET6 */
 	}
 
+	/* With reuseport, every child gets a socket for every interface,
+	 * with UDP and TCP pools, the UDP and TCP children share sets */
+	nsd.reuseport = 0;
+	if(nsd.options->reuseport) {
+#ifdef SO_REUSEPORT
+		if(udp_servers == 0)
+			nsd.reuseport = nsd.child_count;
+		else	nsd.reuseport = (udp_servers > tcp_servers)?
+				udp_servers:tcp_servers;
+#else
+		log_msg(LOG_WARNING, "reuseport: yes is not supported on this "
+			"system, sockets are shared by the server processes");
+#endif /* SO_REUSEPORT */
+	}
+	numsockets = nsd.ifs * (nsd.reuseport?nsd.reuseport:1);
+	nsd.udp = (struct nsd_socket*)region_alloc_array(nsd.region,
+		numsockets, sizeof(struct nsd_socket));
+	nsd.tcp = (struct nsd_socket*)region_alloc_array(nsd.region,
+		numsockets, sizeof(struct nsd_socket));
+	memset(nsd.udp, 0, numsockets*sizeof(struct nsd_socket));
+	memset(nsd.tcp, 0, numsockets*sizeof(struct nsd_socket));
+
 	/* Set up the address info structures with real interface/port data */
-	for (i = 0; i < nsd.ifs; ++i) {
+	for (i = 0; i < numsockets; ++i) {
 		int r;
 		const char* node = NULL;
 		const char* service = NULL;
+		/* the interface this socket listens on */
+		size_t ifn = i % nsd.ifs;
 
 		/* We don't perform name-lookups */
-		if (nodes[i] != NULL)
-			hints[i].ai_flags |= AI_NUMERICHOST;
-		get_ip_port_frm_str(nodes[i], &node, &service);
-
-		hints[i].ai_socktype = SOCK_DGRAM;
-		if ((r=getaddrinfo(node, (service?service:udp_port), &hints[i], &nsd.udp[i].addr)) != 0) {
+		if (nodes[ifn] != NULL)
+			hints[ifn].ai_flags |= AI_NUMERICHOST;
+		/* parse once, it splits the ip@port string in place */
+		if (i < nsd.ifs)
+			get_ip_port_frm_str(nodes[ifn], &nodes[ifn],
+				&services[ifn]);
+		node = nodes[ifn];
+		service = services[ifn];
+
+		hints[ifn].ai_socktype = SOCK_DGRAM;
+		if ((r=getaddrinfo(node, (service?service:udp_port), &hints[ifn], &nsd.udp[i].addr)) != 0) {
 #ifdef INET6
 			if(nsd.grab_ip6_optional && hints[0].ai_family == AF_INET6) {
 				log_msg(LOG_WARNING, "No IPv6, fallback to IPv4. getaddrinfo: %s",
@@ -810,19 +863,20 @@ main(int argc, char *argv[])
 			}
 #endif
 			error("cannot parse address '%s': getaddrinfo: %s %s",
-				nodes[i]?nodes[i]:"(null)",
+				nodes[ifn]?nodes[ifn]:"(null)",
 				gai_strerror(r),
 				r==EAI_SYSTEM?strerror(errno):"");
 		}
 
-		hints[i].ai_socktype = SOCK_STREAM;
-		if ((r=getaddrinfo(node, (service?service:tcp_port), &hints[i], &nsd.tcp[i].addr)) != 0) {
+		hints[ifn].ai_socktype = SOCK_STREAM;
+		if ((r=getaddrinfo(node, (service?service:tcp_port), &hints[ifn], &nsd.tcp[i].addr)) != 0) {
 			error("cannot parse address '%s': getaddrinfo: %s %s",
-				nodes[i]?nodes[i]:"(null)",
+				nodes[ifn]?nodes[ifn]:"(null)",
 				gai_strerror(r),
 				r==EAI_SYSTEM?strerror(errno):"");
 		}
 	}
+	nsd.ifs = numsockets;
 
 	/* Parse the username into uid and gid */
 	nsd.gid = getgid();
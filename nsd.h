@@ -90,14 +90,22 @@ typedef	unsigned long stc_t;
 #endif /* BIND8_STATS */
 
 #ifdef USE_ZONE_STATS
+/* the zone statistics are shared by the server threads of a process, with
+ * server-threads they are incremented with an atomic add */
+#ifdef HAVE_SYNC_COMPARE_AND_SWAP
+#define ZTATINC(nsd, c) ((nsd)->options->server_threads > 1 ? \
+	__sync_fetch_and_add(&(c), 1) : (c)++)
+#else
+#define ZTATINC(nsd, c) ((c)++)
+#endif
 /* increment zone statistic, checks if zone-nonNULL and zone array bounds */
 #define ZTATUP(nsd, zone, stc) ( \
 	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
-		nsd->zonestatnow[zone->zonestatid].stc++ \
+		ZTATINC(nsd, nsd->zonestatnow[zone->zonestatid].stc) \
 		: 0)
 #define	ZTATUP2(nsd, zone, stc, i) ( \
 	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
-		(nsd->zonestatnow[zone->zonestatid].stc[(i) <= (LASTELEM(nsd->zonestatnow[zone->zonestatid].stc) - 1) ? i : LASTELEM(nsd->zonestatnow[zone->zonestatid].stc)]++ ) \
+		ZTATINC(nsd, nsd->zonestatnow[zone->zonestatid].stc[(i) <= (LASTELEM(nsd->zonestatnow[zone->zonestatid].stc) - 1) ? i : LASTELEM(nsd->zonestatnow[zone->zonestatid].stc)]) \
 		: 0)
 #else /* USE_ZONE_STATS */
 #define	ZTATUP(nsd, zone, stc) /* Nothing */
@@ -115,6 +123,13 @@ struct nsd_child
 	 /* The type of child process (UDP or TCP handler). */
 	int   kind;
 
+	/* The index of this child in the nsd->children array. */
+	int child_num;
+
+	/* The index of this child amongst the children of its kind, and
+	 * the number of children of that kind. */
+	int kind_num, kind_count;
+
 	/* The child's process id.  */
 	pid_t pid;
 
@@ -198,15 +213,19 @@ struct	nsd
 	unsigned char   *nsid;
 	uint8_t 		file_rotation_ok;
 
-	/* number of interfaces, ifs < MAX_INTERFACES */
+	/* number of sockets in the udp and tcp arrays.  Without reuseport
+	 * this is the number of interfaces (< MAX_INTERFACES), with
+	 * reuseport there is a set of that many sockets per child */
 	size_t	ifs;
 	uint8_t grab_ip6_optional;
+	/* number of socket sets with SO_REUSEPORT (one per child), or 0 */
+	size_t reuseport;
 
-	/* TCP specific configuration */
-	struct nsd_socket tcp[MAX_INTERFACES];
+	/* TCP specific configuration (array size ifs) */
+	struct nsd_socket* tcp;
 
-	/* UDP specific configuration */
-	struct nsd_socket udp[MAX_INTERFACES];
+	/* UDP specific configuration (array size ifs) */
+	struct nsd_socket* udp;
 
 	edns_data_type edns_ipv4;
 #if defined(INET6)
@@ -219,6 +238,10 @@ struct	nsd
 	int tcp_timeout;
 	size_t ipv4_edns_size;
 	size_t ipv6_edns_size;
+	/* cache of encoded answers to UDP queries, in server processes */
+	struct answer_cache* answer_cache;
+	/* ratelimit table of a server thread, NULL for that of the process */
+	struct rrl_bucket* rrl_table;
 
 #ifdef	BIND8_STATS
 
@@ -268,6 +291,12 @@ void server_main(struct nsd *nsd);
 void server_child(struct nsd *nsd);
 void server_shutdown(struct nsd *nsd);
 void server_close_all_sockets(struct nsd_socket sockets[], size_t n);
+/* stop the server threads of this process and wait for them */
+void server_stop_threads(void);
+#ifdef BIND8_STATS
+/* the statistics of a server process, added up over its threads */
+void server_thread_stats(struct nsd *nsd, struct nsdst *st);
+#endif
 struct event_base* nsd_child_event_base(void);
 /* extra domain numbers for temporary domains */
 #define EXTRA_DOMAIN_NUMBERS 1024
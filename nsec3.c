@@ -10,6 +10,11 @@
 #ifdef NSEC3
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "nsec3.h"
 #include "iterated_hash.h"
@@ -21,59 +26,16 @@
 
 #define NSEC3_RDATA_BITMAP 5
 
-/* compare nsec3 hashes in nsec3 tree */
-static int
-cmp_hash_tree(const void* x, const void* y)
-{
-	const domain_type* a = (const domain_type*)x;
-	const domain_type* b = (const domain_type*)y;
-	return memcmp(a->nsec3->nsec3_hash, b->nsec3->nsec3_hash,
-		NSEC3_HASH_LEN);
-}
-
-/* compare nsec3 hashes in nsec3 wc tree */
-static int
-cmp_wchash_tree(const void* x, const void* y)
-{
-	const domain_type* a = (const domain_type*)x;
-	const domain_type* b = (const domain_type*)y;
-	return memcmp(a->nsec3->nsec3_wc_hash, b->nsec3->nsec3_wc_hash,
-		NSEC3_HASH_LEN);
-}
-
-/* compare nsec3 hashes in nsec3 ds tree */
-static int
-cmp_dshash_tree(const void* x, const void* y)
-{
-	const domain_type* a = (const domain_type*)x;
-	const domain_type* b = (const domain_type*)y;
-	return memcmp(a->nsec3->nsec3_ds_parent_hash,
-		b->nsec3->nsec3_ds_parent_hash, NSEC3_HASH_LEN);
-}
-
-/* compare base32-encoded nsec3 hashes in nsec3 rr tree, they are
- * stored in the domain name of the node */
-static int
-cmp_nsec3_tree(const void* x, const void* y)
-{
-	const domain_type* a = (const domain_type*)x;
-	const domain_type* b = (const domain_type*)y;
-	/* labelcount + 32long label */
-	assert(dname_name(a->dname)[0] == 32);
-	assert(dname_name(b->dname)[0] == 32);
-	return memcmp(dname_name(a->dname), dname_name(b->dname), 33);
-}
-
 void nsec3_zone_trees_create(struct region* region, zone_type* zone)
 {
 	if(!zone->nsec3tree)
-		zone->nsec3tree = rbtree_create(region, cmp_nsec3_tree);
+		zone->nsec3tree = hash_tree_create(region, HASH_INDEX_NSEC3);
 	if(!zone->hashtree)
-		zone->hashtree = rbtree_create(region, cmp_hash_tree);
+		zone->hashtree = hash_tree_create(region, HASH_INDEX_HASH);
 	if(!zone->wchashtree)
-		zone->wchashtree = rbtree_create(region, cmp_wchash_tree);
+		zone->wchashtree = hash_tree_create(region, HASH_INDEX_WC);
 	if(!zone->dshashtree)
-		zone->dshashtree = rbtree_create(region, cmp_dshash_tree);
+		zone->dshashtree = hash_tree_create(region, HASH_INDEX_DS);
 }
 
 void nsec3_hash_tree_clear(struct zone* zone)
@@ -335,17 +297,54 @@ nsec3_in_chain_count(domain_type* domain, zone_type* zone)
 	return count;
 }
 
+static void
+parse_nsec3_name(const dname_type* dname, uint8_t* hash, size_t buflen)
+{
+	/* first label must be the match, */
+	size_t lablen = (buflen-1) * 8 / 5;
+	const uint8_t* wire = dname_name(dname);
+	assert(lablen == 32 && buflen == NSEC3_HASH_LEN+1);
+	/* labels of length 32 for SHA1, and must have space+1 for convert */
+	if(wire[0] != lablen) {
+		/* not NSEC3 */
+		memset(hash, 0, buflen);
+		return;
+	}
+	(void)b32_pton((char*)wire+1, hash, buflen);
+}
+
+/* find the nsec3 domain in the nsec3tree */
+static void
+nsec3_chain_find(struct zone* zone, struct domain* domain, struct hash_pos* p)
+{
+	uint8_t hash[NSEC3_HASH_LEN+1];
+	parse_nsec3_name(domain_dname(domain), hash, sizeof(hash));
+	if(!hash_index_find_less_equal(zone->nsec3tree, hash, p)) {
+		p->block = zone->nsec3tree?zone->nsec3tree->num:0;
+		return;
+	}
+	/* step back over other domains with the same hash */
+	while(hash_index_domain(zone->nsec3tree, p) != domain) {
+		hash_index_prev(zone->nsec3tree, p);
+		if(!hash_index_domain(zone->nsec3tree, p) || memcmp(
+			zone->nsec3tree->blocks[p->block]->entries[p->idx].hash,
+			hash, NSEC3_HASH_LEN) != 0) {
+			p->block = zone->nsec3tree->num;
+			return;
+		}
+	}
+}
+
 struct domain*
 nsec3_chain_find_prev(struct zone* zone, struct domain* domain)
 {
-	if(domain->nsec3 && domain->nsec3->nsec3_node.key) {
+	if(domain->nsec3 && (domain->nsec3->in_index & HASH_INDEX_NSEC3)) {
 		/* see if there is a prev */
-		rbnode_t* r = rbtree_previous(&domain->nsec3->nsec3_node);
-		if(r != RBTREE_NULL) {
-			/* found a previous, which is not the root-node in
-			 * the prehash tree (and thus points to the tree) */
-			return (domain_type*)r->key;
-		}
+		struct hash_pos p;
+		nsec3_chain_find(zone, domain, &p);
+		hash_index_prev(zone->nsec3tree, &p);
+		if(hash_index_domain(zone->nsec3tree, &p))
+			return hash_index_domain(zone->nsec3tree, &p);
 	}
 	if(zone->nsec3_last)
 		return zone->nsec3_last;
@@ -370,21 +369,17 @@ nsec3_clear_precompile(struct namedb* db, zone_type* zone)
 	while(walk && domain_is_subdomain(walk, zone->apex)) {
 		if(walk->nsec3) {
 			if(nsec3_domain_part_of_zone(walk, zone)) {
-				walk->nsec3->nsec3_node.key = NULL;
 				walk->nsec3->nsec3_cover = NULL;
 				walk->nsec3->nsec3_wcard_child_cover = NULL;
 				walk->nsec3->nsec3_is_exact = 0;
 				walk->nsec3->have_nsec3_hash = 0;
 				walk->nsec3->have_nsec3_wc_hash = 0;
-				walk->nsec3->hash_node.key = NULL;
-				walk->nsec3->wchash_node.key = NULL;
 			}
 			if(!walk->parent ||
 				nsec3_domain_part_of_zone(walk->parent, zone)) {
 				walk->nsec3->nsec3_ds_parent_cover = NULL;
 				walk->nsec3->nsec3_ds_parent_is_exact = 0;
 				walk->nsec3->have_nsec3_ds_parent_hash = 0;
-				walk->nsec3->dshash_node.key = NULL;
 			}
 		}
 		walk = domain_next(walk);
@@ -458,29 +453,19 @@ int
 nsec3_find_cover(zone_type* zone, uint8_t* hash, size_t hashlen,
 	domain_type** result)
 {
-	rbnode_t* r = NULL;
+	struct hash_pos p;
 	int exact;
-	domain_type d;
-	uint8_t n[48];
-
-	/* nsec3tree is sorted by b32 encoded domain name of the NSEC3 */
-	b32_ntop(hash, hashlen, (char*)(n+5), sizeof(n)-5);
-	d.dname = (dname_type*)n;
-	n[0] = 34; /* name_size */
-	n[1] = 2; /* label_count */
-	n[2] = 0; /* label_offset[0] */
-	n[3] = 0; /* label_offset[1] */
-	n[4] = 32; /* label-size[0] */
 
+	/* nsec3tree is sorted by the hash in the domain name of the NSEC3 */
 	assert(result);
 	assert(zone->nsec3_param && zone->nsec3tree);
+	assert(hashlen == NSEC3_HASH_LEN);
+	(void)hashlen;
 
-	exact = rbtree_find_less_equal(zone->nsec3tree, &d, &r);
-	if(r) {
-		*result = (domain_type*)r->key;
-	} else {
+	exact = hash_index_find_less_equal(zone->nsec3tree, hash, &p);
+	*result = hash_index_domain(zone->nsec3tree, &p);
+	if(!*result)
 		*result = zone->nsec3_last;
-	}
 	return exact;
 }
 
@@ -497,9 +482,9 @@ nsec3_precompile_domain(struct namedb* db, struct domain* domain,
 
 	/* add into tree */
 	zone_add_domain_in_hash_tree(db->region, &zone->hashtree,
-		cmp_hash_tree, domain, &domain->nsec3->hash_node);
+		HASH_INDEX_HASH, domain->nsec3->nsec3_hash, domain);
 	zone_add_domain_in_hash_tree(db->region, &zone->wchashtree,
-		cmp_wchash_tree, domain, &domain->nsec3->wchash_node);
+		HASH_INDEX_WC, domain->nsec3->nsec3_wc_hash, domain);
 
 	/* lookup in tree cover ptr (or exact) */
 	exact = nsec3_find_cover(zone, domain->nsec3->nsec3_hash,
@@ -535,71 +520,168 @@ nsec3_precompile_domain_ds(struct namedb* db, struct domain* domain,
 	domain->nsec3->nsec3_ds_parent_cover = result;
 	/* add into tree */
 	zone_add_domain_in_hash_tree(db->region, &zone->dshashtree,
-		cmp_dshash_tree, domain, &domain->nsec3->dshash_node);
-}
-
-static void
-parse_nsec3_name(const dname_type* dname, uint8_t* hash, size_t buflen)
-{
-	/* first label must be the match, */
-	size_t lablen = (buflen-1) * 8 / 5;
-	const uint8_t* wire = dname_name(dname);
-	assert(lablen == 32 && buflen == NSEC3_HASH_LEN+1);
-	/* labels of length 32 for SHA1, and must have space+1 for convert */
-	if(wire[0] != lablen) {
-		/* not NSEC3 */
-		memset(hash, 0, buflen);
-		return;
-	}
-	(void)b32_pton((char*)wire+1, hash, buflen);
+		HASH_INDEX_DS, domain->nsec3->nsec3_ds_parent_hash, domain);
 }
 
 void
 nsec3_precompile_nsec3rr(namedb_type* db, struct domain* domain,
 	struct zone* zone)
 {
+	uint8_t hash[NSEC3_HASH_LEN+1];
+	struct hash_pos p;
 	allocate_domain_nsec3(db->domains, domain);
 	/* add into nsec3tree */
+	parse_nsec3_name(domain_dname(domain), hash, sizeof(hash));
 	zone_add_domain_in_hash_tree(db->region, &zone->nsec3tree,
-		cmp_nsec3_tree, domain, &domain->nsec3->nsec3_node);
+		HASH_INDEX_NSEC3, hash, domain);
 	/* fixup the last in the zone */
-	if(rbtree_last(zone->nsec3tree)->key == domain) {
+	hash_index_last(zone->nsec3tree, &p);
+	if(hash_index_domain(zone->nsec3tree, &p) == domain) {
 		zone->nsec3_last = domain;
 	}
 }
 
+void
+nsec3_del_nsec3rr(struct zone* zone, struct domain* domain)
+{
+	uint8_t hash[NSEC3_HASH_LEN+1];
+	parse_nsec3_name(domain_dname(domain), hash, sizeof(hash));
+	zone_del_domain_in_hash_tree(zone->nsec3tree, hash, domain);
+}
+
+/* below this number of names, the hashes are computed without threads */
+#define NSEC3_HASH_THREAD_MIN 1024
+
+/* part of the names of a zone that is hashed by one thread */
+struct nsec3_hash_work {
+	zone_type* zone;
+	/* the names, allocated nsec3 data, to hash */
+	domain_type** list;
+	size_t start, end;
+#ifdef HAVE_PTHREAD
+	pthread_t id;
+#endif
+};
+
+/* compute the hashes of the names in the work, and store them in the
+ * nsec3 data of the domains; it does not change the zone otherwise */
+static void*
+nsec3_hash_work(void* arg)
+{
+	struct nsec3_hash_work* w = (struct nsec3_hash_work*)arg;
+	region_type* tmpregion = region_create(xalloc, free);
+	size_t i;
+	for(i=w->start; i<w->end; i++) {
+		domain_type* walk = w->list[i];
+		if(nsec3_condition_hash(walk, w->zone)) {
+			nsec3_lookup_hash_and_wc(w->zone, domain_dname(walk),
+				walk, tmpregion);
+			region_free_all(tmpregion);
+		}
+		if(nsec3_condition_dshash(walk, w->zone))
+			nsec3_lookup_hash_ds(w->zone, domain_dname(walk), walk);
+	}
+	region_destroy(tmpregion);
+	return NULL;
+}
+
+/* compute the hashes of the names in the list with nsec3-hash-threads */
+static void
+nsec3_hash_list(namedb_type* db, zone_type* zone, domain_type** list,
+	size_t num)
+{
+	struct nsec3_hash_work* work;
+	size_t i, n = 1;
+#ifdef HAVE_PTHREAD
+	sigset_t all, old;
+	size_t started;
+	int r;
+	if(db->nsec3_hash_threads > 1 && num >= NSEC3_HASH_THREAD_MIN)
+		n = (size_t)db->nsec3_hash_threads;
+#else
+	(void)db;
+#endif
+	work = (struct nsec3_hash_work*)xalloc_array_zero(n, sizeof(*work));
+	for(i=0; i<n; i++) {
+		work[i].zone = zone;
+		work[i].list = list;
+		work[i].start = num*i/n;
+		work[i].end = num*(i+1)/n;
+	}
+#ifdef HAVE_PTHREAD
+	/* signals are delivered to the process itself */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	/* the first part is hashed by the process, the others by threads */
+	for(i=1; i<n; i++) {
+		if((r = pthread_create(&work[i].id, NULL, nsec3_hash_work,
+			&work[i])) != 0) {
+			log_msg(LOG_ERR, "pthread_create failed: %s",
+				strerror(r));
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	started = i;
+	(void)nsec3_hash_work(&work[0]);
+	for(i=1; i<started; i++)
+		pthread_join(work[i].id, NULL);
+	/* the parts of threads that could not be started */
+	for(i=started; i<n; i++)
+		(void)nsec3_hash_work(&work[i]);
+#else
+	(void)nsec3_hash_work(&work[0]);
+#endif
+	free(work);
+}
+
 void
 nsec3_precompile_newparam(namedb_type* db, zone_type* zone)
 {
 	region_type* tmpregion = region_create(xalloc, free);
 	domain_type* walk;
+	domain_type** list;
 	time_t s = time(NULL);
-	unsigned long n = 0, c = 0;
+	size_t c, num = 0, max = 1024;
 
-	/* add nsec3s of chain to nsec3tree */
+	/* add nsec3s of chain to nsec3tree, and list the names to hash */
+	list = (domain_type**)xmallocarray(max, sizeof(*list));
 	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
 		walk = domain_next(walk)) {
-		n++;
 		if(nsec3_in_chain_count(walk, zone) != 0) {
 			nsec3_precompile_nsec3rr(db, walk, zone);
 		}
+		if(nsec3_condition_hash(walk, zone) ||
+			nsec3_condition_dshash(walk, zone)) {
+			allocate_domain_nsec3(db->domains, walk);
+			if(num == max) {
+				max *= 2;
+				list = (domain_type**)xrealloc(list,
+					max*sizeof(*list));
+			}
+			list[num++] = walk;
+		}
 	}
-	/* hash and precompile zone */
-	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
-		walk = domain_next(walk)) {
+	/* hash the names, in parallel */
+	nsec3_hash_list(db, zone, list, num);
+	/* precompile zone with the hashes */
+	for(c=0; c<num; c++) {
+		walk = list[c];
 		if(nsec3_condition_hash(walk, zone)) {
 			nsec3_precompile_domain(db, walk, zone, tmpregion);
 			region_free_all(tmpregion);
 		}
 		if(nsec3_condition_dshash(walk, zone))
 			nsec3_precompile_domain_ds(db, walk, zone);
-		if(++c % ZONEC_PCT_COUNT == 0 && time(NULL) > s + ZONEC_PCT_TIME) {
+		if((c+1) % ZONEC_PCT_COUNT == 0 &&
+			time(NULL) > s + ZONEC_PCT_TIME) {
 			s = time(NULL);
 			VERBOSITY(1, (LOG_INFO, "nsec3 %s %d %%",
 				zone->opts->name,
-				(int)(c*((unsigned long)100)/n)));
+				(int)(c*((unsigned long)100)/num)));
 		}
 	}
+	free(list);
 	region_destroy(tmpregion);
 }
 
@@ -632,71 +714,60 @@ prehash_zone_complete(struct namedb* db, struct zone* zone)
 	nsec3_precompile_newparam(db, zone);
 }
 
-static void
-init_lookup_key_hash_tree(domain_type* d, uint8_t* hash)
-{ memcpy(d->nsec3->nsec3_hash, hash, NSEC3_HASH_LEN); }
-
-static void
-init_lookup_key_wc_tree(domain_type* d, uint8_t* hash)
-{ memcpy(d->nsec3->nsec3_wc_hash, hash, NSEC3_HASH_LEN); }
-
-static void
-init_lookup_key_ds_tree(domain_type* d, uint8_t* hash)
-{ memcpy(d->nsec3->nsec3_ds_parent_hash, hash, NSEC3_HASH_LEN); }
-
-/* find first in the tree and true if the first to process it */
+/* find first in the index and true if the first to process it */
 static int
-process_first(rbtree_t* tree, uint8_t* hash, rbnode_t** p,
-	void (*init)(domain_type*, uint8_t*))
+process_first(struct hash_index* index, uint8_t* hash, struct hash_pos* p)
 {
-	domain_type d;
-	struct nsec3_domain_data n;
-	if(!tree) {
-		*p = RBTREE_NULL;
-		return 0;
-	}
-	d.nsec3 = &n;
-	init(&d, hash);
-	if(rbtree_find_less_equal(tree, &d, p)) {
+	if(hash_index_find_less_equal(index, hash, p)) {
 		/* found an exact match */
 		return 1;
 	}
-	if(!*p) /* before first, go from first */
-		*p = rbtree_first(tree);
+	if(!hash_index_domain(index, p)) /* before first, go from first */
+		hash_index_first(index, p);
 	/* the inexact, smaller, match we found, does not itself need to
 	 * be edited */
 	else
-		*p = rbtree_next(*p); /* if this becomes NULL, nothing to do */
+		hash_index_next(index, p); /* if this ends, nothing to do */
 	return 0;
 }
 
-/* set end pointer if possible */
+/* set end position if possible */
 static void
-process_end(rbtree_t* tree, uint8_t* hash, rbnode_t** p,
-	void (*init)(domain_type*, uint8_t*))
+process_end(struct hash_index* index, uint8_t* hash, struct hash_pos* p)
 {
-	domain_type d;
-	struct nsec3_domain_data n;
-	if(!tree) {
-		*p = RBTREE_NULL;
-		return;
-	}
-	d.nsec3 = &n;
-	init(&d, hash);
-	if(rbtree_find_less_equal(tree, &d, p)) {
+	if(hash_index_find_less_equal(index, hash, p)) {
 		/* an exact match, fine, because this one does not get
 		 * processed */
 		return;
 	}
-	/* inexact element, but if NULL, until first element in tree */
-	if(!*p) {
-		*p = rbtree_first(tree);
+	/* inexact element, but if none, until first element in index */
+	if(!hash_index_domain(index, p)) {
+		hash_index_first(index, p);
 		return;
 	}
 	/* inexact match, use next element, if possible, the smaller
 	 * element is part of the range */
-	*p = rbtree_next(*p);
-	/* if next returns null, we go until the end of the tree */
+	hash_index_next(index, p);
+	/* if next ends, we go until the end of the index */
+}
+
+/* set position to the start of the index, and end position to its end */
+static void
+process_all(struct hash_index* index, struct hash_pos* p,
+	struct hash_pos* p_end)
+{
+	hash_index_first(index, p);
+	p_end->block = index?index->num:0;
+	p_end->idx = 0;
+}
+
+/* see if the position is not at the end position of the range */
+static int
+process_more(struct hash_index* index, struct hash_pos* p,
+	struct hash_pos* p_end)
+{
+	return hash_index_domain(index, p) &&
+		(p->block != p_end->block || p->idx != p_end->idx);
 }
 
 /* prehash domains in hash range start to end */
@@ -704,64 +775,60 @@ static void
 process_range(zone_type* zone, domain_type* start,
 	domain_type* end, domain_type* nsec3)
 {
-	/* start NULL means from first in tree */
-	/* end NULL means to last in tree */
-	rbnode_t *p = RBTREE_NULL, *pwc = RBTREE_NULL, *pds = RBTREE_NULL;
-	rbnode_t *p_end = RBTREE_NULL, *pwc_end = RBTREE_NULL, *pds_end = RBTREE_NULL;
+	/* start NULL means from first in index */
+	/* end NULL means to last in index */
+	struct hash_pos p, pwc, pds, p_end, pwc_end, pds_end;
+	domain_type* d;
 	/* because the nodes are on the prehashlist, the domain->nsec3 is
 	 * already allocated, and we need not allocate it here */
+	process_all(zone->hashtree, &p, &p_end);
+	process_all(zone->wchashtree, &pwc, &pwc_end);
+	process_all(zone->dshashtree, &pds, &pds_end);
 	/* set start */
 	if(start) {
 		uint8_t hash[NSEC3_HASH_LEN+1];
 		parse_nsec3_name(domain_dname(start), hash, sizeof(hash));
 		/* if exact match on first, set is_exact */
-		if(process_first(zone->hashtree, hash, &p, init_lookup_key_hash_tree)) {
-			((domain_type*)(p->key))->nsec3->nsec3_cover = nsec3;
-			((domain_type*)(p->key))->nsec3->nsec3_is_exact = 1;
-			p = rbtree_next(p);
+		if(process_first(zone->hashtree, hash, &p)) {
+			d = hash_index_domain(zone->hashtree, &p);
+			d->nsec3->nsec3_cover = nsec3;
+			d->nsec3->nsec3_is_exact = 1;
+			hash_index_next(zone->hashtree, &p);
 		}
-		(void)process_first(zone->wchashtree, hash, &pwc, init_lookup_key_wc_tree);
-		if(process_first(zone->dshashtree, hash, &pds, init_lookup_key_ds_tree)){
-			((domain_type*)(pds->key))->nsec3->
-				nsec3_ds_parent_cover = nsec3;
-			((domain_type*)(pds->key))->nsec3->
-				nsec3_ds_parent_is_exact = 1;
-			pds = rbtree_next(pds);
+		(void)process_first(zone->wchashtree, hash, &pwc);
+		if(process_first(zone->dshashtree, hash, &pds)){
+			d = hash_index_domain(zone->dshashtree, &pds);
+			d->nsec3->nsec3_ds_parent_cover = nsec3;
+			d->nsec3->nsec3_ds_parent_is_exact = 1;
+			hash_index_next(zone->dshashtree, &pds);
 		}
-	} else {
-		if(zone->hashtree)
-			p = rbtree_first(zone->hashtree);
-		if(zone->wchashtree)
-			pwc = rbtree_first(zone->wchashtree);
-		if(zone->dshashtree)
-			pds = rbtree_first(zone->dshashtree);
 	}
 	/* set end */
 	if(end) {
 		uint8_t hash[NSEC3_HASH_LEN+1];
 		parse_nsec3_name(domain_dname(end), hash, sizeof(hash));
-		process_end(zone->hashtree, hash, &p_end, init_lookup_key_hash_tree);
-		process_end(zone->wchashtree, hash, &pwc_end, init_lookup_key_wc_tree);
-		process_end(zone->dshashtree, hash, &pds_end, init_lookup_key_ds_tree);
+		process_end(zone->hashtree, hash, &p_end);
+		process_end(zone->wchashtree, hash, &pwc_end);
+		process_end(zone->dshashtree, hash, &pds_end);
 	}
 
 	/* precompile */
-	while(p != RBTREE_NULL && p != p_end) {
-		((domain_type*)(p->key))->nsec3->nsec3_cover = nsec3;
-		((domain_type*)(p->key))->nsec3->nsec3_is_exact = 0;
-		p = rbtree_next(p);
+	while(process_more(zone->hashtree, &p, &p_end)) {
+		d = hash_index_domain(zone->hashtree, &p);
+		d->nsec3->nsec3_cover = nsec3;
+		d->nsec3->nsec3_is_exact = 0;
+		hash_index_next(zone->hashtree, &p);
 	}
-	while(pwc != RBTREE_NULL && pwc != pwc_end) {
-		((domain_type*)(pwc->key))->nsec3->
-			nsec3_wcard_child_cover = nsec3;
-		pwc = rbtree_next(pwc);
+	while(process_more(zone->wchashtree, &pwc, &pwc_end)) {
+		d = hash_index_domain(zone->wchashtree, &pwc);
+		d->nsec3->nsec3_wcard_child_cover = nsec3;
+		hash_index_next(zone->wchashtree, &pwc);
 	}
-	while(pds != RBTREE_NULL && pds != pds_end) {
-		((domain_type*)(pds->key))->nsec3->
-			nsec3_ds_parent_cover = nsec3;
-		((domain_type*)(pds->key))->nsec3->
-			nsec3_ds_parent_is_exact = 0;
-		pds = rbtree_next(pds);
+	while(process_more(zone->dshashtree, &pds, &pds_end)) {
+		d = hash_index_domain(zone->dshashtree, &pds);
+		d->nsec3->nsec3_ds_parent_cover = nsec3;
+		d->nsec3->nsec3_ds_parent_is_exact = 0;
+		hash_index_next(zone->dshashtree, &pds);
 	}
 }
 
@@ -773,20 +840,22 @@ process_prehash_domain(domain_type* domain, zone_type* zone)
 	 * and set precompile pointers to point to this domain (or is_exact),
 	 * the first domain can be is_exact. If it is the last NSEC3, also
 	 * process the initial part (before the first) */
-	rbnode_t* nx;
+	struct hash_pos nx;
 
 	/* this domain is part of the prehash list and therefore the
 	 * domain->nsec3 is allocated and need not be allocated here */
-	assert(domain->nsec3 && domain->nsec3->nsec3_node.key);
-	nx = rbtree_next(&domain->nsec3->nsec3_node);
-	if(nx != RBTREE_NULL) {
+	assert(domain->nsec3 && (domain->nsec3->in_index&HASH_INDEX_NSEC3));
+	nsec3_chain_find(zone, domain, &nx);
+	hash_index_next(zone->nsec3tree, &nx);
+	if(hash_index_domain(zone->nsec3tree, &nx)) {
 		/* process until next nsec3 */
-		domain_type* end = (domain_type*)nx->key;
+		domain_type* end = hash_index_domain(zone->nsec3tree, &nx);
 		process_range(zone, domain, end, domain);
 	} else {
 		/* first is root, but then comes the first nsec3 */
-		domain_type* first = (domain_type*)(rbtree_first(
-			zone->nsec3tree)->key);
+		domain_type* first;
+		hash_index_first(zone->nsec3tree, &nx);
+		first = hash_index_domain(zone->nsec3tree, &nx);
 		/* last in zone */
 		process_range(zone, domain, NULL, domain);
 		/* also process before first in zone */
@@ -102,6 +102,8 @@ void nsec3_precompile_domain_ds(struct namedb* db, struct domain* domain,
 /* put nsec3 into nsec3tree and adjust zonelast */
 void nsec3_precompile_nsec3rr(struct namedb* db, struct domain* domain,
 	struct zone* zone);
+/* remove nsec3 from nsec3tree */
+void nsec3_del_nsec3rr(struct zone* zone, struct domain* domain);
 /* precompile entire zone, assumes all is null at start */
 void nsec3_precompile_newparam(struct namedb* db, struct zone* zone);
 /* create b32.zone for a hash, allocated in the region */
@@ -59,6 +59,24 @@ nsd_options_create(region_type* region)
 	opt->logfile = 0;
 	opt->log_time_ascii = 1;
 	opt->round_robin = 0; /* also packet.h::round_robin */
+	opt->reuseport = 0;
+	opt->store_ixfr = 0;
+	opt->ixfr_number = 5;
+	opt->ixfr_size = 1048576;
+	opt->answer_cache_size = 0;
+	opt->server_threads = 1;
+	opt->zonefiles_parallel = 1;
+	opt->database_compact_pause = 100;
+	opt->nsec3_hash_threads = 1;
+	opt->udp_servers = 0;
+	opt->tcp_servers = 0;
+	opt->udp_cpu_affinity = NULL;
+	opt->tcp_cpu_affinity = NULL;
+	opt->axfr_cache_size = 0;
+	opt->xfrd_tcp_max = 32;
+	opt->xfrd_tcp_master_max = 128;
+	opt->xfrd_udp_max = 64;
+	opt->xfrd_udp_notify_max = 64;
 	opt->server_count = 1;
 	opt->tcp_count = 100;
 	opt->tcp_query_count = 0;
@@ -82,6 +100,7 @@ nsd_options_create(region_type* region)
 	opt->rrl_ipv4_prefix_length = RRL_IPV4_PREFIX_LENGTH;
 	opt->rrl_ipv6_prefix_length = RRL_IPV6_PREFIX_LENGTH;
 	opt->rrl_whitelist_ratelimit = RRL_WLIST_LIMIT/2;
+	opt->rrl_shared = 0;
 #endif
 	opt->zonefiles_check = 1;
 	if(opt->database == NULL || opt->database[0] == 0)
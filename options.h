@@ -89,6 +89,39 @@ struct nsd_options {
 	int zonefiles_write;
 	int log_time_ascii;
 	int round_robin;
+	int reuseport;
+	/** keep a journal of zone changes to serve IXFR from */
+	int store_ixfr;
+	int ixfr_number;
+	int ixfr_size;
+	/** number of encoded UDP answers cached per server process, 0 is off */
+	int answer_cache_size;
+	/** number of threads per server process that answer UDP queries */
+	int server_threads;
+	/** number of processes that parse zonefiles at startup and reload */
+	int zonefiles_parallel;
+	/** msec that a step of the compaction of the database may take, 0 is no limit */
+	int database_compact_pause;
+	/** number of threads that compute the NSEC3 hashes of a zone */
+	int nsec3_hash_threads;
+	/** number of server processes that answer only UDP, 0 for server-count */
+	int udp_servers;
+	/** number of server processes that answer only TCP, 0 for server-count */
+	int tcp_servers;
+	/** cpus of the udp-servers processes, like "0-3,6" */
+	const char* udp_cpu_affinity;
+	/** cpus of the tcp-servers processes */
+	const char* tcp_cpu_affinity;
+	/** bytes of encoded AXFR messages a server process keeps, 0 is none */
+	int axfr_cache_size;
+	/** number of TCP connections of xfrd for zone transfers */
+	int xfrd_tcp_max;
+	/** upper bound of the adaptive number of transfers from a master */
+	int xfrd_tcp_master_max;
+	/** number of UDP sockets of xfrd for IXFR and SOA queries */
+	int xfrd_udp_max;
+	/** number of UDP sockets of xfrd for NOTIFY */
+	int xfrd_udp_notify_max;
 
         /** remote control section. enable toggle. */
 	int control_enable;
@@ -117,6 +150,8 @@ struct nsd_options {
 	size_t rrl_ipv6_prefix_length;
 	/** max qps for whitelisted queries, 0 is nolimit */
 	size_t rrl_whitelist_ratelimit;
+	/** one table for all server processes */
+	int rrl_shared;
 #endif
 
 	region_type* region;
@@ -36,6 +36,7 @@
 #include "options.h"
 #include "nsec3.h"
 #include "tsig.h"
+#include "lookup3.h"
 
 /* [Bug #253] Adding unnecessary NS RRset may lead to undesired truncation.
  * This function determines if the final response packet needs the NS RRset
@@ -66,9 +67,53 @@ static void answer_lookup_zone(struct nsd *nsd, struct query *q,
 			       domain_type *closest_encloser,
 			       const dname_type *qname);
 
+/* find the slot for the domain number in the compression table */
+static size_t
+query_dname_slot(struct compressed_dname *table, size_t size, size_t number)
+{
+	size_t mask = size - 1;
+	size_t i = (number * 2654435761U) & mask;
+	while (table[i].offset != 0 && table[i].number != number)
+		i = (i + 1) & mask;
+	return i;
+}
+
+/*
+ * Double the size of the compression table.  The entries are added to
+ * the new table in the order they were added in, so that removing the
+ * last added entries never breaks a probe sequence.
+ */
+static void
+query_grow_dname_table(struct query *q)
+{
+	size_t size = q->compressed_dnames_size * 2;
+	struct compressed_dname *table = (struct compressed_dname *)
+		region_alloc_array_zero(q->region, size,
+		sizeof(struct compressed_dname));
+	uint16_t i;
+
+	for (i = 0; i < q->compressed_dname_count; ++i) {
+		struct compressed_dname *e =
+			&q->compressed_dnames[q->compressed_dname_slots[i]];
+		size_t s = query_dname_slot(table, size, e->number);
+		table[s] = *e;
+		q->compressed_dname_slots[i] = (uint16_t)s;
+	}
+	if (q->compressed_dnames != q->compressed_dnames_initial)
+		region_recycle(q->region, q->compressed_dnames,
+			q->compressed_dnames_size *
+			sizeof(struct compressed_dname));
+	else	memset(q->compressed_dnames_initial, 0,
+			sizeof(q->compressed_dnames_initial));
+	q->compressed_dnames = table;
+	q->compressed_dnames_size = size;
+}
+
 void
 query_put_dname_offset(struct query *q, domain_type *domain, uint16_t offset)
 {
+	size_t s;
+
 	assert(q);
 	assert(domain);
 	assert(domain->number > 0);
@@ -78,8 +123,16 @@ query_put_dname_offset(struct query *q, domain_type *domain, uint16_t offset)
 	if (q->compressed_dname_count >= MAX_COMPRESSED_DNAMES)
 		return;
 
-	q->compressed_dname_offsets[domain->number] = offset;
-	q->compressed_dnames[q->compressed_dname_count] = domain;
+	/* keep the table at most half full */
+	if ((size_t)(q->compressed_dname_count + 1) * 2
+		> q->compressed_dnames_size)
+		query_grow_dname_table(q);
+
+	s = query_dname_slot(q->compressed_dnames, q->compressed_dnames_size,
+		domain->number);
+	q->compressed_dnames[s].number = domain->number;
+	q->compressed_dnames[s].offset = offset;
+	q->compressed_dname_slots[q->compressed_dname_count] = (uint16_t)s;
 	++q->compressed_dname_count;
 }
 
@@ -87,10 +140,10 @@ void
 query_clear_dname_offsets(struct query *q, size_t max_offset)
 {
 	while (q->compressed_dname_count > 0
-	       && (q->compressed_dname_offsets[q->compressed_dnames[q->compressed_dname_count - 1]->number]
+	       && (q->compressed_dnames[q->compressed_dname_slots[q->compressed_dname_count - 1]].offset
 		   >= max_offset))
 	{
-		q->compressed_dname_offsets[q->compressed_dnames[q->compressed_dname_count - 1]->number] = 0;
+		q->compressed_dnames[q->compressed_dname_slots[q->compressed_dname_count - 1]].offset = 0;
 		--q->compressed_dname_count;
 	}
 }
@@ -101,8 +154,7 @@ query_clear_compression_tables(struct query *q)
 	uint16_t i;
 
 	for (i = 0; i < q->compressed_dname_count; ++i) {
-		assert(q->compressed_dnames);
-		q->compressed_dname_offsets[q->compressed_dnames[i]->number] = 0;
+		q->compressed_dnames[q->compressed_dname_slots[i]].offset = 0;
 	}
 	q->compressed_dname_count = 0;
 }
@@ -164,18 +216,17 @@ query_cleanup(void *data)
 }
 
 query_type *
-query_create(region_type *region, uint16_t *compressed_dname_offsets,
-	size_t compressed_dname_size)
+query_create(region_type *region)
 {
 	query_type *query
 		= (query_type *) region_alloc_zero(region, sizeof(query_type));
 	/* create region with large block size, because the initial chunk
 	   saves many mallocs in the server */
 	query->region = region_create_custom(xalloc, free, 16384, 16384/8, 32, 0);
-	query->compressed_dname_offsets = compressed_dname_offsets;
+	query->compressed_dnames = query->compressed_dnames_initial;
+	query->compressed_dnames_size = COMPRESSION_TABLE_SIZE;
 	query->packet = buffer_create(region, QIOBUFSZ);
 	region_add_cleanup(region, query_cleanup, query);
-	query->compressed_dname_offsets_size = compressed_dname_size;
 	tsig_create_record(&query->tsig, region);
 	query->tsig_prepare_it = 1;
 	query->tsig_update_it = 1;
@@ -196,8 +247,12 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	 *   o wildcard expansion for additional section domain_type.
 	 *   o nsec3 hashed name(s) (3 dnames for a nonexist_proof,
 	 *     one proof per wildcard and for nx domain).
+	 *   o the dname compression table, if it grew.
 	 */
+	query_clear_compression_tables(q);
 	region_free_all(q->region);
+	q->compressed_dnames = q->compressed_dnames_initial;
+	q->compressed_dnames_size = COMPRESSION_TABLE_SIZE;
 	q->addrlen = sizeof(q->addr);
 	q->maxlen = maxlen;
 	q->reserved_space = 0;
@@ -216,7 +271,6 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->cname_count = 0;
 	q->delegation_domain = NULL;
 	q->delegation_rrset = NULL;
-	q->compressed_dname_count = 0;
 	q->number_temporary_domains = 0;
 
 	q->axfr_is_done = 0;
@@ -224,24 +278,31 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->axfr_current_domain = NULL;
 	q->axfr_current_rrset = NULL;
 	q->axfr_current_rr = 0;
+	q->axfr_cache = NULL;
+	q->axfr_cache_msg = 0;
+	q->ixfr_has_serial = 0;
+	q->ixfr_serial = 0;
+	q->ixfr_current = NULL;
+	q->ixfr_current_pos = 0;
 
 #ifdef RATELIMIT
 	q->wildcard_domain = NULL;
 #endif
 }
 
-/* get a temporary domain number (or 0=failure) */
+/* get a temporary domain number (or 0=failure), it lives in the query
+ * region so that server threads do not share them */
 static domain_type*
 query_get_tempdomain(struct query *q)
 {
-	static domain_type d[EXTRA_DOMAIN_NUMBERS];
+	domain_type* d;
 	if(q->number_temporary_domains >= EXTRA_DOMAIN_NUMBERS)
 		return 0;
 	q->number_temporary_domains ++;
-	memset(&d[q->number_temporary_domains-1], 0, sizeof(domain_type));
-	d[q->number_temporary_domains-1].number = q->compressed_dname_offsets_size +
-		q->number_temporary_domains - 1;
-	return &d[q->number_temporary_domains-1];
+	d = (domain_type*)region_alloc_zero(q->region, sizeof(domain_type));
+	/* numbers from the top, the namedb numbers domains from 1 up */
+	d->number = ((size_t)-1) - q->number_temporary_domains;
+	return d;
 }
 
 static void
@@ -294,6 +355,29 @@ process_query_section(query_type *query)
 	return 1;
 }
 
+/*
+ * Read the serial from the SOA in the authority section of an IXFR
+ * request, this is the version the client has.  The packet position is
+ * unchanged; if there is no SOA, QUERY->ixfr_has_serial stays 0.
+ */
+static void
+process_ixfr_soa(query_type *query)
+{
+	size_t pos = buffer_position(query->packet);
+	if(packet_skip_dname(query->packet) &&
+		buffer_available(query->packet, 10) &&
+		buffer_read_u16(query->packet) == TYPE_SOA) {
+		buffer_skip(query->packet, 8); /* class, ttl, rdlength */
+		if(packet_skip_dname(query->packet) /* prim_ns */ &&
+			packet_skip_dname(query->packet) /* email */ &&
+			buffer_available(query->packet, sizeof(uint32_t))) {
+			query->ixfr_serial = buffer_read_u32(query->packet);
+			query->ixfr_has_serial = 1;
+		}
+	}
+	buffer_set_position(query->packet, pos);
+}
+
 
 /*
  * Process an optional EDNS OPT record.  Sets QUERY->EDNS to 0 if
@@ -1248,6 +1332,159 @@ answer_query(struct nsd *nsd, struct query *q)
 	query_clear_compression_tables(q);
 }
 
+/* an encoded answer in the answer cache */
+struct answer_cache_entry {
+	/* the normalized query name, followed by the answer data after
+	 * the question section; NULL if the entry is not in use */
+	uint8_t *data;
+	size_t qname_len;
+	size_t answer_len;
+	/* the query it answers */
+	uint16_t qtype;
+	uint16_t qclass;
+	size_t maxlen;
+	size_t reserved_space;
+	int dnssec_ok;
+	int ip6;
+	/* the header of the answer, the RD flag is not stored */
+	uint16_t flags;
+	uint16_t ancount;
+	uint16_t nscount;
+	uint16_t arcount;
+	/* lookup results, used for statistics and rate limiting */
+	zone_type *zone;
+	domain_type *delegation_domain;
+#ifdef RATELIMIT
+	domain_type *wildcard_domain;
+#endif
+};
+
+struct answer_cache {
+	size_t size;
+	struct answer_cache_entry *entries;
+};
+
+struct answer_cache *
+answer_cache_create(size_t size)
+{
+	struct answer_cache *cache = (struct answer_cache *)xalloc(
+		sizeof(struct answer_cache));
+	cache->size = size;
+	cache->entries = (struct answer_cache_entry *)xalloc_array_zero(
+		size, sizeof(struct answer_cache_entry));
+	return cache;
+}
+
+/*
+ * See if the answer can be taken from or stored in the cache.  Answers
+ * that depend on more than the query name, type, class and the EDNS
+ * buffer size and DO flag are not cached.
+ */
+static int
+answer_cache_usable(struct nsd *nsd, struct query *q)
+{
+	return nsd->answer_cache != NULL && !q->tcp && !round_robin
+		&& q->tsig.status == TSIG_NOT_PRESENT
+		&& q->edns.status != EDNS_ERROR
+		&& buffer_position(q->packet) ==
+			QHEADERSZ + q->qname->name_size + 4;
+}
+
+static int
+query_is_ip6(struct query *q)
+{
+#ifdef INET6
+	return q->addr.ss_family == AF_INET6;
+#else
+	(void)q;
+	return 0;
+#endif
+}
+
+/* the entry for the query, it may hold the answer to another query */
+static struct answer_cache_entry *
+answer_cache_entry(struct answer_cache *cache, struct query *q)
+{
+	uint32_t h = hashlittle(dname_name(q->qname), q->qname->name_size,
+		((uint32_t)q->qtype<<16) | q->qclass);
+	h = hashlittle(&q->maxlen, sizeof(q->maxlen), h);
+	h = hashlittle(&q->reserved_space, sizeof(q->reserved_space), h);
+	h ^= (q->edns.dnssec_ok?1:0) | (query_is_ip6(q)?2:0);
+	return &cache->entries[h % cache->size];
+}
+
+static int
+answer_cache_match(struct answer_cache_entry *e, struct query *q)
+{
+	return e->data != NULL
+		&& e->qtype == q->qtype
+		&& e->qclass == q->qclass
+		&& e->maxlen == q->maxlen
+		&& e->reserved_space == q->reserved_space
+		&& e->dnssec_ok == (q->edns.dnssec_ok?1:0)
+		&& e->ip6 == query_is_ip6(q)
+		&& e->qname_len == q->qname->name_size
+		&& memcmp(e->data, dname_name(q->qname), e->qname_len) == 0;
+}
+
+/*
+ * Answer the query from the cache.  The ID, RD flag and the question
+ * section, with the case of the query name, are kept from the query.
+ * Returns false if the answer is not in the cache.
+ */
+static int
+answer_cache_lookup(struct nsd *nsd, struct query *q)
+{
+	struct answer_cache_entry *e = answer_cache_entry(nsd->answer_cache, q);
+	if (!answer_cache_match(e, q))
+		return 0;
+
+	buffer_write(q->packet, e->data + e->qname_len, e->answer_len);
+	FLAGS_SET(q->packet, (FLAGS(q->packet) & 0x0100U) | e->flags);
+	ANCOUNT_SET(q->packet, e->ancount);
+	NSCOUNT_SET(q->packet, e->nscount);
+	ARCOUNT_SET(q->packet, e->arcount);
+	q->zone = e->zone;
+	q->delegation_domain = e->delegation_domain;
+#ifdef RATELIMIT
+	q->wildcard_domain = e->wildcard_domain;
+#endif
+	ZTATUP2(nsd, q->zone, opcode, q->opcode);
+	ZTATUP2(nsd, q->zone, qtype, q->qtype);
+	ZTATUP2(nsd, q->zone, qclass, q->qclass);
+	return 1;
+}
+
+/* Store the answer that starts at position start in the cache. */
+static void
+answer_cache_store(struct nsd *nsd, struct query *q, size_t start)
+{
+	struct answer_cache_entry *e = answer_cache_entry(nsd->answer_cache, q);
+	size_t len = buffer_position(q->packet) - start;
+
+	free(e->data);
+	e->data = (uint8_t *)xalloc(q->qname->name_size + len);
+	memcpy(e->data, dname_name(q->qname), q->qname->name_size);
+	memcpy(e->data + q->qname->name_size, buffer_at(q->packet, start), len);
+	e->qname_len = q->qname->name_size;
+	e->answer_len = len;
+	e->qtype = q->qtype;
+	e->qclass = q->qclass;
+	e->maxlen = q->maxlen;
+	e->reserved_space = q->reserved_space;
+	e->dnssec_ok = q->edns.dnssec_ok?1:0;
+	e->ip6 = query_is_ip6(q);
+	e->flags = FLAGS(q->packet) & ~0x0100U;
+	e->ancount = ANCOUNT(q->packet);
+	e->nscount = NSCOUNT(q->packet);
+	e->arcount = ARCOUNT(q->packet);
+	e->zone = q->zone;
+	e->delegation_domain = q->delegation_domain;
+#ifdef RATELIMIT
+	e->wildcard_domain = q->wildcard_domain;
+#endif
+}
+
 void
 query_prepare_response(query_type *q)
 {
@@ -1284,6 +1521,7 @@ query_process(query_type *q, nsd_type *nsd)
 	nsd_rc_type rc;
 	query_state_type query_state;
 	uint16_t arcount;
+	size_t ixfr_soa_pos = 0;
 
 	/* Sanity checks */
 	if (buffer_limit(q->packet) < QHEADERSZ) {
@@ -1300,6 +1538,9 @@ query_process(query_type *q, nsd_type *nsd)
 		return query_formerr(q);
 	}
 
+#ifdef NSEC3
+#endif
+
 	/* Update statistics.  */
 	STATUP2(nsd, opcode, q->opcode);
 	STATUP2(nsd, qtype, q->qtype);
@@ -1328,6 +1569,8 @@ query_process(query_type *q, nsd_type *nsd)
 	}
 	if(q->qtype==TYPE_IXFR && NSCOUNT(q->packet) > 0) {
 		int i; /* skip ixfr soa information data here */
+		ixfr_soa_pos = buffer_position(q->packet);
+		process_ixfr_soa(q);
 		for(i=0; i< NSCOUNT(q->packet); i++)
 			if(!packet_skip_rr(q->packet, 0))
 				return query_formerr(q);
@@ -1390,6 +1633,12 @@ query_process(query_type *q, nsd_type *nsd)
 		 * Thus RCODE = NOERROR = NSD_RC_OK. */
 		return query_error(q, NSD_RC_OK);
 	}
+	if (ixfr_soa_pos) {
+		/* the answer goes where the SOA of the client was, after
+		 * the tsig of the query is verified over it */
+		buffer_set_limit(q->packet, ixfr_soa_pos);
+		NSCOUNT_SET(q->packet, 0);
+	}
 
 	query_prepare_response(q);
 
@@ -1402,10 +1651,20 @@ query_process(query_type *q, nsd_type *nsd)
 	}
 
 	query_state = answer_axfr_ixfr(nsd, q);
-	if (query_state == QUERY_PROCESSED || query_state == QUERY_IN_AXFR) {
+	if (query_state == QUERY_PROCESSED || query_state == QUERY_IN_AXFR ||
+		query_state == QUERY_IN_IXFR) {
 		return query_state;
 	}
 
+	if (answer_cache_usable(nsd, q)) {
+		size_t start = buffer_position(q->packet);
+		if (!answer_cache_lookup(nsd, q)) {
+			answer_query(nsd, q);
+			answer_cache_store(nsd, q, start);
+		}
+		return QUERY_PROCESSED;
+	}
+
 	answer_query(nsd, q);
 
 	return QUERY_PROCESSED;
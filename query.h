@@ -21,10 +21,22 @@
 enum query_state {
 	QUERY_PROCESSED,
 	QUERY_DISCARDED,
-	QUERY_IN_AXFR
+	QUERY_IN_AXFR,
+	QUERY_IN_IXFR
 };
 typedef enum query_state query_state_type;
 
+/* Entry in the dname compression table of a query. */
+struct compressed_dname {
+	/* number of the domain, 0 is the query name */
+	size_t number;
+	/* offset in the packet, 0 if the entry is not in use */
+	uint16_t offset;
+};
+
+/* Initial size of the dname compression table, a power of two. */
+#define COMPRESSION_TABLE_SIZE 64
+
 /* Query as we pass it around */
 typedef struct query query_type;
 struct query {
@@ -94,16 +106,19 @@ struct query {
 	 */
 	int cname_count;
 
-	/* Used for dname compression.  */
+	/*
+	 * Used for dname compression.  A hash table with linear probing
+	 * on domain->number, it grows with the names put in the packet.
+	 * The slots are also listed in the order they were added in, so
+	 * that the last added entries can be removed.  Number 0 is the
+	 * query name, at the start of the question section.
+	 */
 	uint16_t     compressed_dname_count;
-	domain_type *compressed_dnames[MAXRRSPP];
-
-	 /*
-	  * Indexed by domain->number, index 0 is reserved for the
-	  * query name when generated from a wildcard record.
-	  */
-	uint16_t    *compressed_dname_offsets;
-	size_t compressed_dname_offsets_size;
+	uint16_t     compressed_dname_slots[MAX_COMPRESSED_DNAMES];
+	struct compressed_dname *compressed_dnames;
+	size_t       compressed_dnames_size;
+	struct compressed_dname
+		compressed_dnames_initial[COMPRESSION_TABLE_SIZE];
 
 	/* number of temporary domains used for the query */
 	size_t number_temporary_domains;
@@ -116,6 +131,18 @@ struct query {
 	domain_type *axfr_current_domain;
 	rrset_type  *axfr_current_rrset;
 	uint16_t     axfr_current_rr;
+	/* the cached AXFR that is sent and the next message in it */
+	struct axfr_cache *axfr_cache;
+	size_t       axfr_cache_msg;
+
+	/*
+	 * Used for IXFR processing, the serial from the SOA in the
+	 * request and the change from the journal that is being sent.
+	 */
+	int          ixfr_has_serial;
+	uint32_t     ixfr_serial;
+	struct ixfr_data *ixfr_current;
+	size_t       ixfr_current_pos;
 
 #ifdef RATELIMIT
 	/* if we encountered a wildcard, its domain */
@@ -142,7 +169,17 @@ void query_put_dname_offset(struct query *query,
 static inline
 uint16_t query_get_dname_offset(struct query *query, domain_type *domain)
 {
-	return query->compressed_dname_offsets[domain->number];
+	size_t mask = query->compressed_dnames_size - 1;
+	size_t i;
+	if (domain->number == 0)
+		return QHEADERSZ;
+	i = (domain->number * 2654435761U) & mask;
+	while (query->compressed_dnames[i].offset != 0) {
+		if (query->compressed_dnames[i].number == domain->number)
+			return query->compressed_dnames[i].offset;
+		i = (i + 1) & mask;
+	}
+	return 0;
 }
 
 /*
@@ -170,9 +207,7 @@ void query_add_compression_domain(struct query *query,
 /*
  * Create a new query structure.
  */
-query_type *query_create(region_type *region,
-			 uint16_t *compressed_dname_offsets,
-			 size_t compressed_dname_size);
+query_type *query_create(region_type *region);
 
 /*
  * Reset a query structure so it is ready for receiving and processing
@@ -204,6 +239,14 @@ void query_add_optional(query_type *q, nsd_type *nsd);
  */
 query_state_type query_error(query_type *q, nsd_rc_type rcode);
 
+/*
+ * Create the cache of encoded answers to UDP queries, with size entries.
+ * Every server process has its own cache.  The processes are forked
+ * again after a reload, so the cache never holds answers from old data.
+ * The cache is stored in nsd->answer_cache and used by query_process.
+ */
+struct answer_cache *answer_cache_create(size_t size);
+
 static inline int
 query_overflow(query_type *q)
 {
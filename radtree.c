@@ -31,6 +31,13 @@ void radix_tree_init(struct radtree* rt)
 	rt->count = 0;
 }
 
+/** free the additional string of a radsel, if it is not inline */
+static void radsel_str_free(struct region* region, struct radsel* r)
+{
+	if(r->len > RADSEL_INLINE_LEN)
+		region_recycle(region, radsel_str(r), r->len);
+}
+
 /** delete radnodes in postorder recursion */
 static void radnode_del_postorder(struct region* region, struct radnode* n)
 {
@@ -38,7 +45,7 @@ static void radnode_del_postorder(struct region* region, struct radnode* n)
 	if(!n) return;
 	for(i=0; i<n->len; i++) {
 		radnode_del_postorder(region, n->array[i].node);
-		region_recycle(region, n->array[i].str, n->array[i].len);
+		radsel_str_free(region, &n->array[i]);
 	}
 	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
 	region_recycle(region, n, sizeof(*n));
@@ -126,6 +133,42 @@ radnode_find_prev_from_idx(struct radnode* n, unsigned from)
 	return NULL;
 }
 
+/**
+ * Find the lookup array entry for the byte.
+ * @param n: node to look in.
+ * @param byte: the selection byte.
+ * @param idx: returns the index of the entry.  If there is no entry, it is
+ * 	the number of entries that sort before the byte.
+ * @return false if there is no entry for the byte.  A dense array can
+ * 	return an entry without a node.
+ */
+static int
+radnode_find_idx(struct radnode* n, uint8_t byte, unsigned* idx)
+{
+	unsigned i;
+	if(!n->sparse) {
+		if(byte < n->offset) {
+			*idx = 0;
+			return 0;
+		}
+		*idx = byte - n->offset;
+		if(*idx >= n->len) {
+			*idx = n->len;
+			return 0;
+		}
+		return 1;
+	}
+	/* the sparse array is short, and sorted */
+	for(i=0; i<n->len; i++) {
+		if(n->array[i].byte >= byte) {
+			*idx = i;
+			return (n->array[i].byte == byte);
+		}
+	}
+	*idx = n->len;
+	return 0;
+}
+
 /** 
  * Find a prefix of the key, in whole-nodes.
  * Finds the longest prefix that corresponds to a whole radnode entry.
@@ -141,7 +184,7 @@ static int radix_find_prefix_node(struct radtree* rt, uint8_t* k,
 {
 	struct radnode* n = rt->root;
 	radstrlen_t pos = 0;
-	uint8_t byte;
+	unsigned idx;
 	*respos = 0;
 	*result = n;
 	if(!n) return 0;
@@ -149,27 +192,22 @@ static int radix_find_prefix_node(struct radtree* rt, uint8_t* k,
 		if(pos == len) {
 			return 1;
 		}
-		byte = k[pos];
-		if(byte < n->offset) {
-			return 1;
-		}
-		byte -= n->offset;
-		if(byte >= n->len) {
+		if(!radnode_find_idx(n, k[pos], &idx)) {
 			return 1;
 		}
 		pos++;
-		if(n->array[byte].len != 0) {
+		if(n->array[idx].len != 0) {
 			/* must match additional string */
-			if(pos+n->array[byte].len > len) {
+			if(pos+n->array[idx].len > len) {
 				return 1;
 			}
-			if(memcmp(&k[pos], n->array[byte].str,
-				n->array[byte].len) != 0) {
+			if(memcmp(&k[pos], radsel_str(&n->array[idx]),
+				n->array[idx].len) != 0) {
 				return 1;
 			}
-			pos += n->array[byte].len;
+			pos += n->array[idx].len;
 		}
-		n = n->array[byte].node;
+		n = n->array[idx].node;
 		if(!n) return 1;
 		*respos = pos;
 		*result = n;
@@ -187,6 +225,7 @@ radnode_array_grow(struct region* region, struct radnode* n, unsigned want)
 	if(want > ns)
 		ns = want;
 	if(ns > 256) ns = 256;
+	if(n->sparse && ns > RADNODE_SPARSE_MAX) ns = RADNODE_SPARSE_MAX;
 	/* we do not use realloc, because we want to keep the old array
 	 * in case alloc fails, so that the tree is still usable */
 	a = (struct radsel*)region_alloc_array(region, ns, sizeof(struct radsel));
@@ -200,9 +239,96 @@ radnode_array_grow(struct region* region, struct radnode* n, unsigned want)
 	return 1;
 }
 
-/** make space in radnode array for another byte */
+/** turn the sparse array into a dense array that also spans the byte */
+static int
+radnode_array_make_dense(struct region* region, struct radnode* n,
+	uint8_t byte)
+{
+	unsigned idx, lo = byte, hi = byte;
+	struct radsel* a;
+	assert(n->sparse && n->len > 0);
+	if(n->array[0].byte < lo) lo = n->array[0].byte;
+	if(n->array[n->len-1].byte > hi) hi = n->array[n->len-1].byte;
+	a = (struct radsel*)region_alloc_array_zero(region, hi-lo+1,
+		sizeof(struct radsel));
+	if(!a) return 0;
+	for(idx = 0; idx < n->len; idx++) {
+		unsigned i = n->array[idx].byte - lo;
+		a[i] = n->array[idx];
+		a[i].byte = 0;
+		if(a[i].node)
+			a[i].node->pidx = i;
+	}
+	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
+	n->array = a;
+	n->len = hi-lo+1;
+	n->capacity = hi-lo+1;
+	n->offset = lo;
+	n->sparse = 0;
+	return 1;
+}
+
+/** turn the dense array into a sparse array, if it has few children */
+static void
+radnode_array_make_sparse(struct region* region, struct radnode* n)
+{
+	unsigned idx, num = 0;
+	struct radsel* a;
+	assert(!n->sparse);
+	for(idx = 0; idx < n->len; idx++)
+		if(n->array[idx].node)
+			num++;
+	if(num == 0 || num == n->len || num > RADNODE_SPARSE_MAX/2)
+		return;
+	/* on alloc failure, the node stays dense */
+	a = (struct radsel*)region_alloc_array(region, num,
+		sizeof(struct radsel));
+	if(!a) return;
+	num = 0;
+	for(idx = 0; idx < n->len; idx++) {
+		if(!n->array[idx].node)
+			continue;
+		a[num] = n->array[idx];
+		a[num].byte = n->offset + idx;
+		a[num].node->pidx = num;
+		num++;
+	}
+	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
+	n->array = a;
+	n->len = num;
+	n->capacity = num;
+	n->offset = 0;
+	n->sparse = 1;
+}
+
+/** make space in a sparse array for another byte, inserted in order */
+static int
+radnode_array_space_sparse(struct region* region, struct radnode* n,
+	uint8_t byte, unsigned* idx)
+{
+	unsigned i;
+	if(radnode_find_idx(n, byte, idx))
+		return 1; /* already there */
+	if(n->len == n->capacity) {
+		if(!radnode_array_grow(region, n, n->len+1))
+			return 0;
+	}
+	/* shift the later entries up */
+	memmove(&n->array[*idx+1], &n->array[*idx],
+		(n->len-*idx)*sizeof(struct radsel));
+	n->len++;
+	for(i = *idx+1; i < n->len; i++)
+		if(n->array[i].node)
+			n->array[i].node->pidx = i;
+	memset(&n->array[*idx], 0, sizeof(struct radsel));
+	n->array[*idx].byte = byte;
+	return 1;
+}
+
+/** make space in radnode array for another byte, returns its index */
 static int
-radnode_array_space(struct region* region, struct radnode* n, uint8_t byte)
+radnode_array_space(struct region* region, struct radnode* n, uint8_t byte,
+	unsigned* ret_idx)
 {
 	/* is there an array? */
 	if(!n->array || n->capacity == 0) {
@@ -210,14 +336,34 @@ radnode_array_space(struct region* region, struct radnode* n, uint8_t byte)
 			sizeof(struct radsel));
 		if(!n->array) return 0;
 		memset(&n->array[0], 0, sizeof(struct radsel));
+		n->array[0].byte = byte;
 		n->len = 1;
 		n->capacity = 1;
-		n->offset = byte;
+		n->offset = 0;
+		n->sparse = 1;
+		*ret_idx = 0;
+		return 1;
 	/* is the array unused? */
 	} else if(n->len == 0 && n->capacity != 0) {
 		n->len = 1;
-		n->offset = byte;
+		n->offset = 0;
+		n->sparse = 1;
 		memset(&n->array[0], 0, sizeof(struct radsel));
+		n->array[0].byte = byte;
+		*ret_idx = 0;
+		return 1;
+	} else if(n->sparse) {
+		unsigned lo = n->array[0].byte, hi = n->array[n->len-1].byte;
+		if(radnode_find_idx(n, byte, ret_idx))
+			return 1;
+		if(byte < lo) lo = byte;
+		if(byte > hi) hi = byte;
+		/* stay sparse, unless full or a dense array is as small */
+		if(n->len < RADNODE_SPARSE_MAX && hi-lo+1 > (unsigned)n->len+1)
+			return radnode_array_space_sparse(region, n, byte,
+				ret_idx);
+		if(!radnode_array_make_dense(region, n, byte))
+			return 0;
 	/* is it below the offset? */
 	} else if(byte < n->offset) {
 		/* is capacity enough? */
@@ -254,19 +400,28 @@ radnode_array_space(struct region* region, struct radnode* n, uint8_t byte)
 		/* grow length */
 		n->len += need;
 	}
+	*ret_idx = byte - n->offset;
 	return 1;
 }
 
-/** create a prefix in the array strs */
+/** set the additional string of a radsel, inline or allocated */
 static int
-radsel_str_create(struct region* region, struct radsel* r, uint8_t* k,
-	radstrlen_t pos, radstrlen_t len)
+radsel_str_set(struct region* region, struct radsel* r, uint8_t* s,
+	radstrlen_t len)
 {
-	r->str = (uint8_t*)region_alloc(region, sizeof(uint8_t)*(len-pos));
-	if(!r->str)
+	uint8_t* p;
+	r->len = len;
+	if(len <= RADSEL_INLINE_LEN) {
+		memmove(r->str, s, len);
+		return 1;
+	}
+	p = (uint8_t*)region_alloc(region, sizeof(uint8_t)*len);
+	if(!p) {
+		r->len = 0;
 		return 0; /* out of memory */
-	memmove(r->str, k+pos, len-pos);
-	r->len = len-pos;
+	}
+	memmove(p, s, len);
+	memcpy(r->str, &p, sizeof(p));
 	return 1;
 }
 
@@ -308,21 +463,6 @@ bstr_common_ext(uint8_t* x, radstrlen_t xlen, uint8_t* y, radstrlen_t ylen)
 	return bstr_common(x, xlen, y, ylen);
 }
 
-/** allocate remainder from prefixes for a split:
- * plen: len prefix, l: longer bstring, llen: length of l. */
-static int
-radsel_prefix_remainder(struct region* region, radstrlen_t plen,
-	uint8_t* l, radstrlen_t llen,
-	uint8_t** s, radstrlen_t* slen)
-{
-	*slen = llen - plen;
-	*s = (uint8_t*)region_alloc(region, (*slen)*sizeof(uint8_t));
-	if(!*s)
-		return 0;
-	memmove(*s, l+plen, llen-plen);
-	return 1;
-}
-
 /** radsel create a split when two nodes have shared prefix.
  * @param r: radsel that gets changed, it contains a node.
  * @param k: key byte string
@@ -338,9 +478,10 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 {
 	uint8_t* addstr = k+pos;
 	radstrlen_t addlen = len-pos;
-	if(bstr_is_prefix(addstr, addlen, r->str, r->len)) {
-		uint8_t* split_str=NULL, *dupstr=NULL;
-		radstrlen_t split_len=0;
+	uint8_t* rstr = radsel_str(r);
+	unsigned idx;
+	if(bstr_is_prefix(addstr, addlen, rstr, r->len)) {
+		struct radsel split, dup;
 		/* 'add' is a prefix of r.node */
 		/* also for empty addstr */
 		/* set it up so that the 'add' node has r.node as child */
@@ -349,139 +490,131 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 		 * key name */
 		assert(addlen != r->len);
 		assert(addlen < r->len);
-		if(r->len-addlen > 1) {
-			/* shift one because a char is in the lookup array */
-			if(!radsel_prefix_remainder(region, addlen+1, r->str,
-				r->len, &split_str, &split_len))
-				return 0;
-		}
-		if(addlen != 0) {
-			dupstr = (uint8_t*)region_alloc(region,
-				addlen*sizeof(uint8_t));
-			if(!dupstr) {
-				region_recycle(region, split_str, split_len);
-				return 0;
-			}
-			memcpy(dupstr, addstr, addlen);
+		memset(&split, 0, sizeof(split));
+		memset(&dup, 0, sizeof(dup));
+		/* shift one because a char is in the lookup array */
+		if(!radsel_str_set(region, &split, rstr+addlen+1,
+			r->len-addlen-1))
+			return 0;
+		if(!radsel_str_set(region, &dup, addstr, addlen)) {
+			radsel_str_free(region, &split);
+			return 0;
 		}
-		if(!radnode_array_space(region, add, r->str[addlen])) {
-			region_recycle(region, split_str, split_len);
-			region_recycle(region, dupstr, addlen);
+		if(!radnode_array_space(region, add, rstr[addlen], &idx)) {
+			radsel_str_free(region, &split);
+			radsel_str_free(region, &dup);
 			return 0;
 		}
 		/* alloc succeeded, now link it in */
 		add->parent = r->node->parent;
 		add->pidx = r->node->pidx;
-		add->array[0].node = r->node;
-		add->array[0].str = split_str;
-		add->array[0].len = split_len;
+		split.node = r->node;
+		split.byte = add->array[idx].byte;
+		add->array[idx] = split;
 		r->node->parent = add;
-		r->node->pidx = 0;
-
-		r->node = add;
-		region_recycle(region, r->str, r->len);
-		r->str = dupstr;
-		r->len = addlen;
-	} else if(bstr_is_prefix(r->str, r->len, addstr, addlen)) {
-		uint8_t* split_str = NULL;
-		radstrlen_t split_len = 0;
+		r->node->pidx = idx;
+
+		radsel_str_free(region, r);
+		dup.node = add;
+		dup.byte = r->byte;
+		*r = dup;
+	} else if(bstr_is_prefix(rstr, r->len, addstr, addlen)) {
+		struct radsel split;
 		/* r.node is a prefix of 'add' */
 		/* set it up so that the 'r.node' has 'add' as child */
 		/* and basically, r.node is already completely fine,
 		 * we only need to create a node as its child */
 		assert(addlen != r->len);
 		assert(r->len < addlen);
-		if(addlen-r->len > 1) {
-			/* shift one because a character goes into array */
-			if(!radsel_prefix_remainder(region, r->len+1, addstr,
-				addlen, &split_str, &split_len))
-				return 0;
-		}
-		if(!radnode_array_space(region, r->node, addstr[r->len])) {
-			region_recycle(region, split_str, split_len);
+		memset(&split, 0, sizeof(split));
+		/* shift one because a character goes into array */
+		if(!radsel_str_set(region, &split, addstr+r->len+1,
+			addlen-r->len-1))
+			return 0;
+		if(!radnode_array_space(region, r->node, addstr[r->len],
+			&idx)) {
+			radsel_str_free(region, &split);
 			return 0;
 		}
 		/* alloc succeeded, now link it in */
 		add->parent = r->node;
-		add->pidx = addstr[r->len] - r->node->offset;
-		r->node->array[add->pidx].node = add;
-		r->node->array[add->pidx].str = split_str;
-		r->node->array[add->pidx].len = split_len;
+		add->pidx = idx;
+		split.node = add;
+		split.byte = r->node->array[idx].byte;
+		r->node->array[idx] = split;
 	} else {
 		/* okay we need to create a new node that chooses between 
 		 * the nodes 'add' and r.node
 		 * We do this so that r.node stays the same pointer for its
 		 * key name. */
 		struct radnode* com;
-		uint8_t* common_str=NULL, *s1_str=NULL, *s2_str=NULL;
-		radstrlen_t common_len, s1_len=0, s2_len=0;
-		common_len = bstr_common(r->str, r->len, addstr, addlen);
+		struct radsel common, s1, s2;
+		radstrlen_t common_len;
+		unsigned idx1, idx2;
+		common_len = bstr_common(rstr, r->len, addstr, addlen);
 		assert(common_len < r->len);
 		assert(common_len < addlen);
+		memset(&common, 0, sizeof(common));
+		memset(&s1, 0, sizeof(s1));
+		memset(&s2, 0, sizeof(s2));
 
 		/* create the new node for choice */
 		com = (struct radnode*)region_alloc_zero(region, sizeof(*com));
 		if(!com) return 0; /* out of memory */
 
 		/* create the two substrings for subchoices */
-		if(r->len-common_len > 1) {
-			/* shift by one char because it goes in lookup array */
-			if(!radsel_prefix_remainder(region, common_len+1,
-				r->str, r->len, &s1_str, &s1_len)) {
-				region_recycle(region, com, sizeof(*com));
-				return 0;
-			}
+		/* shift by one char because it goes in lookup array */
+		if(!radsel_str_set(region, &s1, rstr+common_len+1,
+			r->len-common_len-1)) {
+			region_recycle(region, com, sizeof(*com));
+			return 0;
 		}
-		if(addlen-common_len > 1) {
-			if(!radsel_prefix_remainder(region, common_len+1,
-				addstr, addlen, &s2_str, &s2_len)) {
-				region_recycle(region, com, sizeof(*com));
-				region_recycle(region, s1_str, s1_len);
-				return 0;
-			}
+		if(!radsel_str_set(region, &s2, addstr+common_len+1,
+			addlen-common_len-1)) {
+			region_recycle(region, com, sizeof(*com));
+			radsel_str_free(region, &s1);
+			return 0;
 		}
 
 		/* create the shared prefix to go in r */
-		if(common_len > 0) {
-			common_str = (uint8_t*)region_alloc(region,
-				common_len*sizeof(uint8_t));
-			if(!common_str) {
-				region_recycle(region, com, sizeof(*com));
-				region_recycle(region, s1_str, s1_len);
-				region_recycle(region, s2_str, s2_len);
-				return 0;
-			}
-			memcpy(common_str, addstr, common_len);
+		if(!radsel_str_set(region, &common, addstr, common_len)) {
+			region_recycle(region, com, sizeof(*com));
+			radsel_str_free(region, &s1);
+			radsel_str_free(region, &s2);
+			return 0;
 		}
 
 		/* make space in the common node array */
-		if(!radnode_array_space(region, com, r->str[common_len]) ||
-			!radnode_array_space(region, com, addstr[common_len])) {
+		if(!radnode_array_space(region, com, rstr[common_len], &idx1) ||
+			!radnode_array_space(region, com, addstr[common_len],
+			&idx2)) {
 			region_recycle(region, com->array, com->capacity*sizeof(struct radsel));
 			region_recycle(region, com, sizeof(*com));
-			region_recycle(region, common_str, common_len);
-			region_recycle(region, s1_str, s1_len);
-			region_recycle(region, s2_str, s2_len);
+			radsel_str_free(region, &common);
+			radsel_str_free(region, &s1);
+			radsel_str_free(region, &s2);
 			return 0;
 		}
+		/* the second byte can have moved the first */
+		(void)radnode_find_idx(com, rstr[common_len], &idx1);
 
 		/* allocs succeeded, proceed to link it all up */
 		com->parent = r->node->parent;
 		com->pidx = r->node->pidx;
 		r->node->parent = com;
-		r->node->pidx = r->str[common_len]-com->offset;
+		r->node->pidx = idx1;
 		add->parent = com;
-		add->pidx = addstr[common_len]-com->offset;
-		com->array[r->node->pidx].node = r->node;
-		com->array[r->node->pidx].str = s1_str;
-		com->array[r->node->pidx].len = s1_len;
-		com->array[add->pidx].node = add;
-		com->array[add->pidx].str = s2_str;
-		com->array[add->pidx].len = s2_len;
-		region_recycle(region, r->str, r->len);
-		r->str = common_str;
-		r->len = common_len;
-		r->node = com;
+		add->pidx = idx2;
+		s1.node = r->node;
+		s1.byte = com->array[idx1].byte;
+		com->array[idx1] = s1;
+		s2.node = add;
+		s2.byte = com->array[idx2].byte;
+		com->array[idx2] = s2;
+		radsel_str_free(region, r);
+		common.node = com;
+		common.byte = r->byte;
+		*r = common;
 	}
 	return 1;
 }
@@ -505,10 +638,11 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 			rt->root = add;
 		} else {
 			/* add a root to point to new node */
+			unsigned idx;
 			n = (struct radnode*)region_alloc_zero(rt->region,
 				sizeof(*n));
 			if(!n) return NULL;
-			if(!radnode_array_space(rt->region, n, k[0])) {
+			if(!radnode_array_space(rt->region, n, k[0], &idx)) {
 				region_recycle(rt->region, n->array,
 					n->capacity*sizeof(struct radsel));
 				region_recycle(rt->region, n, sizeof(*n));
@@ -516,11 +650,11 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 				return NULL;
 			}
 			add->parent = n;
-			add->pidx = 0;
-			n->array[0].node = add;
+			add->pidx = idx;
+			n->array[idx].node = add;
 			if(len > 1) {
-				if(!radsel_prefix_remainder(rt->region, 1, k, len,
-					&n->array[0].str, &n->array[0].len)) {
+				if(!radsel_str_set(rt->region, &n->array[idx],
+					k+1, len-1)) {
 					region_recycle(rt->region, n->array,
 						n->capacity*sizeof(struct radsel));
 					region_recycle(rt->region, n, sizeof(*n));
@@ -542,54 +676,41 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k, radstrlen_t len,
 		add = n;
 	} else {
 		/* n is a node which can accomodate */
-		uint8_t byte;
+		unsigned idx;
 		assert(pos < len);
-		byte = k[pos];
 
-		/* see if it falls outside of array */
-		if(byte < n->offset || byte-n->offset >= n->len) {
-			/* make space in the array for it; adjusts offset */
-			if(!radnode_array_space(rt->region, n, byte)) {
-				region_recycle(rt->region, add, sizeof(*add));
-				return NULL;
-			}
-			assert(byte>=n->offset && byte-n->offset<n->len);
-			byte -= n->offset;
+		/* see if it falls outside of array, or in an empty bucket */
+		if(!radnode_find_idx(n, k[pos], &idx) ||
+			n->array[idx].node == NULL) {
+			struct radsel r;
+			memset(&r, 0, sizeof(r));
 			/* see if more prefix needs to be split off */
 			if(pos+1 < len) {
-				if(!radsel_str_create(rt->region, &n->array[byte],
-					k, pos+1, len)) {
+				if(!radsel_str_set(rt->region, &r, k+pos+1,
+					len-pos-1)) {
 					region_recycle(rt->region, add, sizeof(*add));
 					return NULL;
 				}
 			}
-			/* insert the new node in the new bucket */
-			add->parent = n;
-			add->pidx = byte;
-			n->array[byte].node = add;
-		/* so a bucket exists and byte falls in it */
-		} else if(n->array[byte-n->offset].node == NULL) {
-			/* use existing bucket */
-			byte -= n->offset;
-			if(pos+1 < len) {
-				/* split off more prefix */
-				if(!radsel_str_create(rt->region, &n->array[byte],
-					k, pos+1, len)) {
-					region_recycle(rt->region, add, sizeof(*add));
-					return NULL;
-				}
+			/* make space in the array for it; adjusts offset */
+			if(!radnode_array_space(rt->region, n, k[pos], &idx)) {
+				radsel_str_free(rt->region, &r);
+				region_recycle(rt->region, add, sizeof(*add));
+				return NULL;
 			}
 			/* insert the new node in the new bucket */
 			add->parent = n;
-			add->pidx = byte;
-			n->array[byte].node = add;
+			add->pidx = idx;
+			r.node = add;
+			r.byte = n->array[idx].byte;
+			n->array[idx] = r;
 		} else {
 			/* use bucket but it has a shared prefix,
 			 * split that out and create a new intermediate
 			 * node to split out between the two.
 			 * One of the two might exactmatch the new 
 			 * intermediate node */
-			if(!radsel_split(rt->region, &n->array[byte-n->offset],
+			if(!radsel_split(rt->region, &n->array[idx],
 				k, pos+1, len, add)) {
 				region_recycle(rt->region, add, sizeof(*add));
 				return NULL;
@@ -607,8 +728,7 @@ static void radnode_delete(struct region* region, struct radnode* n)
 	unsigned i;
 	if(!n) return;
 	for(i=0; i<n->len; i++) {
-		/* safe to free NULL str */
-		region_recycle(region, n->array[i].str, n->array[i].len);
+		radsel_str_free(region, &n->array[i]);
 	}
 	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
 	region_recycle(region, n, sizeof(*n));
@@ -619,6 +739,7 @@ static int
 radnode_cleanup_onechild(struct region* region, struct radnode* n,
 	struct radnode* par)
 {
+	uint8_t buf[RADSEL_INLINE_LEN];
 	uint8_t* join;
 	radstrlen_t joinlen;
 	uint8_t pidx = n->pidx;
@@ -629,21 +750,24 @@ radnode_cleanup_onechild(struct region* region, struct radnode* n,
 	/* at parent, append child->str to array str */
 	assert(pidx < par->len);
 	joinlen = par->array[pidx].len + n->array[0].len + 1;
-	join = (uint8_t*)region_alloc(region, joinlen*sizeof(uint8_t));
+	if(joinlen <= RADSEL_INLINE_LEN)
+		join = buf;
+	else	join = (uint8_t*)region_alloc(region, joinlen*sizeof(uint8_t));
 	if(!join) {
 		/* cleanup failed due to out of memory */
 		/* the tree is inefficient, with node n still existing */
 		return 0;
 	}
-	/* we know that .str and join are malloced, thus aligned */
-	memcpy(join, par->array[pidx].str, par->array[pidx].len);
+	memcpy(join, radsel_str(&par->array[pidx]), par->array[pidx].len);
 	/* the array lookup is gone, put its character in the lookup string*/
-	join[par->array[pidx].len] = child->pidx + n->offset;
-	/* but join+len may not be aligned */
-	memmove(join+par->array[pidx].len+1, n->array[0].str, n->array[0].len);
-	region_recycle(region, par->array[pidx].str, par->array[pidx].len);
-	par->array[pidx].str = join;
+	join[par->array[pidx].len] = radnode_idx_byte(n, 0);
+	memmove(join+par->array[pidx].len+1, radsel_str(&n->array[0]),
+		n->array[0].len);
+	radsel_str_free(region, &par->array[pidx]);
 	par->array[pidx].len = joinlen;
+	if(join == buf)
+		memcpy(par->array[pidx].str, buf, joinlen);
+	else	memcpy(par->array[pidx].str, &join, sizeof(join));
 	/* and set the node to our child. */
 	par->array[pidx].node = child;
 	child->parent = par;
@@ -745,8 +869,7 @@ radnode_cleanup_leaf(struct region* region, struct radnode* n,
 
 	/* set parent+idx entry to NULL str and node.*/
 	assert(pidx < par->len);
-	region_recycle(region, par->array[pidx].str, par->array[pidx].len);
-	par->array[pidx].str = NULL;
+	radsel_str_free(region, &par->array[pidx]);
 	par->array[pidx].len = 0;
 	par->array[pidx].node = NULL;
 
@@ -754,12 +877,26 @@ radnode_cleanup_leaf(struct region* region, struct radnode* n,
 	if(par->len == 1) {
 		/* removed final element from array */
 		radnode_array_clean_all(region, par);
-	} else if(pidx == 0) {
-		/* removed first element from array */
-		radnode_array_clean_front(region, par);
-	} else if(pidx == par->len-1) {
-		/* removed last element from array */
-		radnode_array_clean_end(region, par);
+	} else if(par->sparse) {
+		/* remove the entry from the sparse array */
+		unsigned i;
+		memmove(&par->array[pidx], &par->array[pidx+1],
+			(par->len-pidx-1)*sizeof(struct radsel));
+		par->len--;
+		for(i = pidx; i < par->len; i++)
+			par->array[i].node->pidx = i;
+		radnode_array_reduce_if_needed(region, par);
+	} else {
+		if(pidx == 0) {
+			/* removed first element from array */
+			radnode_array_clean_front(region, par);
+		} else if(pidx == par->len-1) {
+			/* removed last element from array */
+			radnode_array_clean_end(region, par);
+		}
+		/* see if few children are left */
+		if(par->len != 0)
+			radnode_array_make_sparse(region, par);
 	}
 }
 
@@ -815,27 +952,23 @@ struct radnode* radix_search(struct radtree* rt, uint8_t* k, radstrlen_t len)
 {
 	struct radnode* n = rt->root;
 	radstrlen_t pos = 0;
-	uint8_t byte;
+	unsigned idx;
 	while(n) {
 		if(pos == len)
 			return n->elem?n:NULL;
-		byte = k[pos];
-		if(byte < n->offset)
-			return NULL;
-		byte -= n->offset;
-		if(byte >= n->len)
+		if(!radnode_find_idx(n, k[pos], &idx))
 			return NULL;
 		pos++;
-		if(n->array[byte].len != 0) {
+		if(n->array[idx].len != 0) {
 			/* must match additional string */
-			if(pos+n->array[byte].len > len)
+			if(pos+n->array[idx].len > len)
 				return NULL; /* no match */
-			if(memcmp(&k[pos], n->array[byte].str,
-				n->array[byte].len) != 0)
+			if(memcmp(&k[pos], radsel_str(&n->array[idx]),
+				n->array[idx].len) != 0)
 				return NULL; /* no match */
-			pos += n->array[byte].len;
+			pos += n->array[idx].len;
 		}
-		n = n->array[byte].node;
+		n = n->array[idx].node;
 	}
 	return NULL;
 }
@@ -854,7 +987,8 @@ int radix_find_less_equal(struct radtree* rt, uint8_t* k, radstrlen_t len,
 {
 	struct radnode* n = rt->root;
 	radstrlen_t pos = 0;
-	uint8_t byte;
+	unsigned idx;
+	struct radsel* sel;
 	int r;
 	if(!n) {
 		/* empty tree */
@@ -862,68 +996,56 @@ int radix_find_less_equal(struct radtree* rt, uint8_t* k, radstrlen_t len,
 		return 0;
 	}
 	while(pos < len) {
-		byte = k[pos];
-		if(byte < n->offset) {
-			/* so the previous is the element itself */
-			/* or something before this element */
-			return ret_self_or_prev(n, result);
-		}
-		byte -= n->offset;
-		if(byte >= n->len) {
-			/* so, the previous is the last of array, or itself */
-			/* or something before this element */
-			if((*result=radnode_last_in_subtree_incl_self(n))==0)
-				*result = radix_prev(n);
-			return 0;
-		}
-		pos++;
-		if(!n->array[byte].node) {
+		if(!radnode_find_idx(n, k[pos], &idx) ||
+			!n->array[idx].node) {
 			/* no match */
-			/* Find an entry in arrays from byte-1 to 0 */
-			*result = radnode_find_prev_from_idx(n, byte);
+			/* Find an entry in arrays from idx-1 to 0 */
+			*result = radnode_find_prev_from_idx(n, idx);
 			if(*result)
 				return 0;
 			/* this entry or something before it */
 			return ret_self_or_prev(n, result);
 		}
-		if(n->array[byte].len != 0) {
+		pos++;
+		sel = &n->array[idx];
+		if(sel->len != 0) {
 			/* must match additional string */
-			if(pos+n->array[byte].len > len) {
+			if(pos+sel->len > len) {
 				/* the additional string is longer than key*/
-				if( (memcmp(&k[pos], n->array[byte].str,
+				if( (memcmp(&k[pos], radsel_str(sel),
 					len-pos)) <= 0) {
 				  /* and the key is before this node */
-				  *result = radix_prev(n->array[byte].node);
+				  *result = radix_prev(sel->node);
 				} else {
 					/* the key is after the additional
 					 * string, thus everything in that
 					 * subtree is smaller. */
-				  	*result=radnode_last_in_subtree_incl_self(n->array[byte].node);
+				  	*result=radnode_last_in_subtree_incl_self(sel->node);
 					/* if somehow that is NULL,
 					 * then we have an inefficient tree:
 					 * byte+1 is larger than us, so find
 					 * something in byte-1 and before */
 					if(!*result)
-						*result = radix_prev(n->array[byte].node);
+						*result = radix_prev(sel->node);
 				}
 				return 0; /* no match */
 			}
-			if( (r=memcmp(&k[pos], n->array[byte].str,
-				n->array[byte].len)) < 0) {
-				*result = radix_prev(n->array[byte].node);
+			if( (r=memcmp(&k[pos], radsel_str(sel),
+				sel->len)) < 0) {
+				*result = radix_prev(sel->node);
 				return 0; /* no match */
 			} else if(r > 0) {
 				/* the key is larger than the additional
 				 * string, thus everything in that subtree
 				 * is smaller */
-				*result=radnode_last_in_subtree_incl_self(n->array[byte].node);
+				*result=radnode_last_in_subtree_incl_self(sel->node);
 				/* if we have an inefficient tree */
-				if(!*result) *result = radix_prev(n->array[byte].node);
+				if(!*result) *result = radix_prev(sel->node);
 				return 0; /* no match */
 			}
-			pos += n->array[byte].len;
+			pos += sel->len;
 		}
-		n = n->array[byte].node;
+		n = sel->node;
 	}
 	if(n->elem) {
 		/* exact match */
@@ -1187,6 +1309,7 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 	unsigned int lab, dpos, lpos;
 	struct radnode* n = rt->root;
 	uint8_t byte;
+	unsigned idx;
 	radstrlen_t i;
 	uint8_t b;
 
@@ -1232,15 +1355,13 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 			byte = 0;
 		}
 		/* find that byte in the array */
-		if(byte < n->offset)
-			return NULL;
-		byte -= n->offset;
-		if(byte >= n->len)
+		if(!radnode_find_idx(n, byte, &idx))
 			return NULL;
-		if(n->array[byte].len != 0) {
+		if(n->array[idx].len != 0) {
+			uint8_t* str = radsel_str(&n->array[idx]);
 			/* must match additional string */
 			/* see how many bytes we need and start matching them*/
-			for(i=0; i<n->array[byte].len; i++) {
+			for(i=0; i<n->array[idx].len; i++) {
 				/* next byte to match */
 				if(lpos < *labstart[lab])
 					b = char_d2r(labstart[lab][++lpos]);
@@ -1254,11 +1375,11 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 					lab--;
 					b = 0;
 				}
-				if(n->array[byte].str[i] != b)
+				if(str[i] != b)
 					return NULL; /* not matched */
 			}
 		}
-		n = n->array[byte].node;
+		n = n->array[idx].node;
 	}
 	return NULL;
 }
@@ -1272,6 +1393,8 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 	unsigned int lab, dpos, lpos;
 	struct radnode* n = rt->root;
 	uint8_t byte;
+	unsigned idx;
+	struct radsel* sel;
 	radstrlen_t i;
 	uint8_t b;
 
@@ -1344,32 +1467,21 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 			byte = 0;
 		}
 		/* find that byte in the array */
-		if(byte < n->offset)
-			/* so the previous is the element itself */
-			/* or something before this element */
-			return ret_self_or_prev(n, result);
-		byte -= n->offset;
-		if(byte >= n->len) {
-			/* so, the previous is the last of array, or itself */
-			/* or something before this element */
-			*result = radnode_last_in_subtree_incl_self(n);
-			if(!*result)
-				*result = radix_prev(n);
-			return 0;
-		}
-		if(!n->array[byte].node) {
+		if(!radnode_find_idx(n, byte, &idx) || !n->array[idx].node) {
 			/* no match */
-			/* Find an entry in arrays from byte-1 to 0 */
-			*result = radnode_find_prev_from_idx(n, byte);
+			/* Find an entry in arrays from idx-1 to 0 */
+			*result = radnode_find_prev_from_idx(n, idx);
 			if(*result)
 				return 0;
 			/* this entry or something before it */
 			return ret_self_or_prev(n, result);
 		}
-		if(n->array[byte].len != 0) {
+		sel = &n->array[idx];
+		if(sel->len != 0) {
+			uint8_t* str = radsel_str(sel);
 			/* must match additional string */
 			/* see how many bytes we need and start matching them*/
-			for(i=0; i<n->array[byte].len; i++) {
+			for(i=0; i<sel->len; i++) {
 				/* next byte to match */
 				if(lpos < *labstart[lab])
 					b = char_d2r(labstart[lab][++lpos]);
@@ -1380,7 +1492,7 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 						/* dname ended, thus before
 						 * this array element */
 						*result =radix_prev(
-							n->array[byte].node);
+							sel->node);
 						return 0; 
 					}
 					/* next label, search for byte 00 */
@@ -1388,24 +1500,24 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 					lab--;
 					b = 0;
 				}
-				if(b < n->array[byte].str[i]) {
+				if(b < str[i]) {
 					*result =radix_prev(
-						n->array[byte].node);
+						sel->node);
 					return 0; 
-				} else if(b > n->array[byte].str[i]) {
+				} else if(b > str[i]) {
 					/* the key is after the additional,
 					 * so everything in its subtree is
 					 * smaller */
-					*result = radnode_last_in_subtree_incl_self(n->array[byte].node);
+					*result = radnode_last_in_subtree_incl_self(sel->node);
 					/* if that is NULL, we have an
 					 * inefficient tree, find in byte-1*/
 					if(!*result)
-						*result = radix_prev(n->array[byte].node);
+						*result = radix_prev(sel->node);
 					return 0;
 				}
 			}
 		}
-		n = n->array[byte].node;
+		n = sel->node;
 	}
 	/* ENOTREACH */
 	return 0;
@@ -5,6 +5,7 @@
  */
 #ifndef RADTREE_H
 #define RADTREE_H
+#include <string.h>
 
 struct radnode;
 struct region;
@@ -33,6 +34,9 @@ struct radtree {
 /**
  * A radix tree lookup node.
  * The array is malloced separately from the radnode.
+ * A node with few children has a sparse array, that holds only the
+ * children, sorted by their selection byte.  A node with more children
+ * has a dense array, indexed by [byte-offset], that can have NULL entries.
  */
 struct radnode {
 	/** data element associated with the binary string up to this node */
@@ -41,28 +45,60 @@ struct radnode {
 	struct radnode* parent;
 	/** index in the parent lookup array */
 	uint8_t pidx;
-	/** offset of the lookup array, add to [i] for lookups */
+	/** offset of the lookup array, add to [i] for lookups (dense only) */
 	uint8_t offset;
 	/** length of the lookup array */
 	uint16_t len;
 	/** capacity of the lookup array (can be larger than length) */
 	uint16_t capacity;
-	/** the lookup array by [byte-offset] */
+	/** if the lookup array is sparse, sorted by radsel byte */
+	uint8_t sparse;
+	/** the lookup array by [byte-offset], or sorted if sparse */
 	struct radsel* array; 
 };
 
+/** max number of children in a sparse lookup array */
+#define RADNODE_SPARSE_MAX 16
+
+/** additional strings up to this length are stored in the radsel itself */
+#define RADSEL_INLINE_LEN 13
+
 /**
  * radix select edge in array
  */
 struct radsel {
-	/** additional string after the selection-byte for this edge. */
-	uint8_t* str;
-	/** length of the additional string for this edge */
-	radstrlen_t len;
 	/** node that deals with byte+str */
 	struct radnode* node;
+	/** length of the additional string for this edge */
+	radstrlen_t len;
+	/** the selection byte for this edge (sparse arrays only) */
+	uint8_t byte;
+	/** additional string after the selection-byte for this edge,
+	 * if it is longer than RADSEL_INLINE_LEN, this holds a pointer to
+	 * the allocated string.  Use radsel_str() to access it. */
+	uint8_t str[RADSEL_INLINE_LEN];
 };
 
+/** the additional string of the radix select edge */
+static inline uint8_t*
+radsel_str(struct radsel* r)
+{
+	uint8_t* p;
+	if(r->len <= RADSEL_INLINE_LEN)
+		return r->str;
+	memcpy(&p, r->str, sizeof(p));
+	return p;
+}
+
+/** the selection byte of the entry at idx in the node lookup array */
+static inline uint8_t
+radnode_idx_byte(struct radnode* n, unsigned idx)
+{
+	if(n->sparse)
+		return n->array[idx].byte;
+	return (uint8_t)(n->offset + idx);
+}
+
 /**
  * Create new radix tree
  * @param region: where to allocate the tree.
@@ -57,8 +57,36 @@ static uint32_t rrl_whitelist_ratelimit = RRL_WLIST_LIMIT; /* 2x qps */
 static void** rrl_maps = NULL;
 static size_t rrl_maps_num = 0;
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYNC_COMPARE_AND_SWAP)
+#define RRL_SHARED 1
+/**
+ * The bucket in the table that is shared by all children.  It is updated
+ * with atomic operations, and packs the key and the rate in 16 bytes.
+ */
+struct rrl_shared_bucket {
+	/* hash<<32 | flags<<16 | 1, or 0 if the bucket is not in use */
+	uint64_t key;
+	/* stamp<<44 | counter<<22 | rate, the stamp is the low part of
+	 * the time, the counter and rate saturate at RRL_SHARED_MAX. */
+	uint64_t state;
+};
+/** number of buckets in a set, a set fills one cacheline of 64 bytes */
+#define RRL_SET_SIZE 4
+/** the buckets that a hash value can use */
+struct rrl_shared_set {
+	struct rrl_shared_bucket b[RRL_SET_SIZE];
+};
+#define RRL_STAMP_BITS 20
+#define RRL_STAMP_MASK ((1<<RRL_STAMP_BITS)-1)
+#define RRL_SHARED_MAX ((1<<22)-1)
+
+/* the shared table, if used the children do not have their own table */
+static struct rrl_shared_set* rrl_shared = NULL;
+static size_t rrl_shared_num = 0;
+#endif /* HAVE_MMAP && HAVE_SYNC_COMPARE_AND_SWAP */
+
 void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
-	size_t plf, size_t pls)
+	size_t plf, size_t pls, int shared)
 {
 #ifdef HAVE_MMAP
 	size_t i;
@@ -76,6 +104,32 @@ void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
 			(((uint64_t)0xffffffff)<<32);
 	}
 	rrl_whitelist_ratelimit = wlm*2;
+#ifdef RRL_SHARED
+	if(shared) {
+		/* one table in a memory map for all children, it is
+		 * preserved across reforks */
+		rrl_shared_num = rrl_array_size / RRL_SET_SIZE;
+		if(rrl_shared_num == 0)
+			rrl_shared_num = 1;
+		rrl_shared = mmap(NULL,
+			sizeof(struct rrl_shared_set)*rrl_shared_num,
+			PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(rrl_shared == MAP_FAILED) {
+			log_msg(LOG_ERR, "rrl: mmap failed: %s",
+				strerror(errno));
+			exit(1);
+		}
+		memset(rrl_shared, 0,
+			sizeof(struct rrl_shared_set)*rrl_shared_num);
+		rrl_maps_num = 0;
+		rrl_maps = NULL;
+		return;
+	}
+#else
+	if(shared)
+		log_msg(LOG_WARNING, "rrl: rrl-shared is not supported on "
+			"this system, using a table per server process");
+#endif
 #ifdef HAVE_MMAP
 	/* allocate the ratelimit hashtable in a memory map so it is
 	 * preserved across reforks (every child its own table) */
@@ -109,6 +163,10 @@ void rrl_set_limit(size_t lm, size_t wlm, size_t sm)
 
 void rrl_init(size_t ch)
 {
+#ifdef RRL_SHARED
+	if(rrl_shared)
+		return;
+#endif
 	if(!rrl_maps || ch >= rrl_maps_num)
 	    rrl_array = xalloc_array_zero(sizeof(struct rrl_bucket),
 	    	rrl_array_size);
@@ -117,6 +175,23 @@ void rrl_init(size_t ch)
 #endif
 }
 
+struct rrl_bucket* rrl_thread_init(size_t ch, size_t numch, size_t thr)
+{
+#ifdef RRL_SHARED
+	if(rrl_shared)
+		return NULL;
+#endif
+	/* the maps of the threads follow those of the children */
+	if(!rrl_maps || numch*thr+ch >= rrl_maps_num)
+		return (struct rrl_bucket*)xalloc_array_zero(
+			sizeof(struct rrl_bucket), rrl_array_size);
+#ifdef HAVE_MMAP
+	return (struct rrl_bucket*)rrl_maps[numch*thr+ch];
+#else
+	return NULL;
+#endif
+}
+
 /** return the source netblock of the query, this is the genuine source
  * for genuine queries and the target for reflected packets */
 static uint64_t rrl_get_source(query_type* query, uint16_t* c2)
@@ -350,39 +425,11 @@ used_to_block(uint32_t rate, uint32_t counter, uint32_t lm)
 	return rate >= lm || counter+rate/2 >= lm;
 }
 
-/** update the rate in a ratelimit bucket, return actual rate */
-uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
-	uint16_t flags, int32_t now, uint32_t lm)
+/** age the bucket to the current time and count the query, the bucket
+ * holds the rate for the source of the query.  Return actual rate. */
+static uint32_t rrl_step(query_type* query, struct rrl_bucket* b,
+	int32_t now, uint32_t lm)
 {
-	struct rrl_bucket* b = &rrl_array[hash % rrl_array_size];
-
-	DEBUG(DEBUG_QUERY, 1, (LOG_INFO, "source %llx hash %x oldrate %d oldcount %d stamp %d",
-		(long long unsigned)source, hash, b->rate, b->counter, b->stamp));
-
-	/* check if different source */
-	if(b->source != source || b->flags != flags || b->hash != hash) {
-		/* initialise */
-		/* potentially the wrong limit here, used lower nonwhitelim */
-		if(verbosity >= 1 &&
-			used_to_block(b->rate, b->counter, rrl_ratelimit)) {
-			char address[128];
-			addr2str(&query->addr, address, sizeof(address));
-			log_msg(LOG_INFO, "ratelimit unblock ~ type %s target %s query %s %s (%s collision)",
-				rrltype2str(b->flags),
-				rrlsource2str(b->source, b->flags),
-				address, rrtype_to_string(query->qtype),
-				(b->hash!=hash?"bucket":"hash"));
-		}
-		b->hash = hash;
-		b->source = source;
-		b->flags = flags;
-		b->counter = 1;
-		b->rate = 0;
-		b->stamp = now;
-		return 1;
-	}
-	/* this is the same source */
-
 	/* check if old, zero or smooth it */
 	/* circular arith for time */
 	if(now - b->stamp == 1) {
@@ -425,7 +472,164 @@ uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
 	return b->rate;
 }
 
-int rrl_process_query(query_type* query)
+#ifdef RRL_SHARED
+/** get the shared bucket state, the stamp is the time nearest to now
+ * that has the stored low part */
+static void rrl_shared_unpack(uint64_t state, int32_t now, struct rrl_bucket* b)
+{
+	int32_t elapsed = (int32_t)(((uint32_t)now -
+		(uint32_t)(state>>44)) & RRL_STAMP_MASK);
+	if(elapsed >= (1<<(RRL_STAMP_BITS-1)))
+		elapsed -= (1<<RRL_STAMP_BITS);
+	b->stamp = now - elapsed;
+	b->counter = (uint32_t)(state>>22) & RRL_SHARED_MAX;
+	b->rate = (uint32_t)state & RRL_SHARED_MAX;
+}
+
+/** pack the bucket state for the shared table */
+static uint64_t rrl_shared_pack(struct rrl_bucket* b)
+{
+	uint32_t counter = b->counter, rate = b->rate;
+	if(counter > RRL_SHARED_MAX)
+		counter = RRL_SHARED_MAX;
+	if(rate > RRL_SHARED_MAX)
+		rate = RRL_SHARED_MAX;
+	return ((uint64_t)((uint32_t)b->stamp & RRL_STAMP_MASK) << 44) |
+		((uint64_t)counter << 22) | (uint64_t)rate;
+}
+
+/** the rate of the bucket if it were aged to now */
+static uint32_t rrl_shared_rate(uint64_t state, int32_t now)
+{
+	struct rrl_bucket b;
+	int32_t elapsed;
+	rrl_shared_unpack(state, now, &b);
+	elapsed = now - b.stamp;
+	if(elapsed == 0)
+		return b.counter + b.rate/2;
+	if(elapsed < 0 || elapsed > 16)
+		return 0;
+	return (b.rate>>elapsed) + (b.counter>>(elapsed-1));
+}
+
+/** update the rate in the shared table, return actual rate.  A new
+ * source replaces the least busy bucket of the set, so that busy
+ * sources are not reset by hash collisions. */
+static uint32_t rrl_update_shared(query_type* query, uint32_t hash,
+	uint16_t flags, int32_t now, uint32_t lm)
+{
+	struct rrl_shared_set* set = &rrl_shared[hash % rrl_shared_num];
+	uint64_t key = ((uint64_t)hash<<32) | ((uint64_t)flags<<16) | 1;
+	struct rrl_shared_bucket* b = NULL;
+	struct rrl_bucket cur;
+	uint64_t oldstate, newstate;
+	uint32_t rate;
+	int i;
+
+	for(i=0; i<RRL_SET_SIZE; i++) {
+		if(set->b[i].key == key) {
+			b = &set->b[i];
+			break;
+		}
+	}
+	if(!b) {
+		/* take the free bucket or the least busy bucket */
+		uint32_t low = 0, r;
+		uint64_t oldkey;
+		for(i=0; i<RRL_SET_SIZE; i++) {
+			if(set->b[i].key == 0) {
+				b = &set->b[i];
+				break;
+			}
+			r = rrl_shared_rate(set->b[i].state, now);
+			if(!b || r < low) {
+				b = &set->b[i];
+				low = r;
+			}
+		}
+		oldkey = b->key;
+		if(oldkey != 0 && verbosity >= 1 && low >= rrl_ratelimit) {
+			char address[128];
+			addr2str(&query->addr, address, sizeof(address));
+			log_msg(LOG_INFO, "ratelimit unblock ~ type %s query %s %s (bucket collision)",
+				rrltype2str((uint16_t)(oldkey>>16)),
+				address, rrtype_to_string(query->qtype));
+		}
+		if(!__sync_bool_compare_and_swap(&b->key, oldkey, key)) {
+			/* another server process took the bucket at the
+			 * same time, this query is not counted */
+			return 1;
+		}
+		cur.counter = 0;
+		cur.rate = 0;
+		cur.stamp = now;
+		newstate = rrl_shared_pack(&cur);
+		do {
+			oldstate = b->state;
+		} while(!__sync_bool_compare_and_swap(&b->state, oldstate,
+			newstate));
+	}
+
+	do {
+		oldstate = b->state;
+		rrl_shared_unpack(oldstate, now, &cur);
+		rate = rrl_step(query, &cur, now, lm);
+		newstate = rrl_shared_pack(&cur);
+	} while(!__sync_bool_compare_and_swap(&b->state, oldstate, newstate));
+	return rate;
+}
+#endif /* RRL_SHARED */
+
+/** update the rate in a bucket of the table, return actual rate */
+static uint32_t rrl_update_table(struct rrl_bucket* table, query_type* query,
+	uint32_t hash, uint64_t source, uint16_t flags, int32_t now,
+	uint32_t lm)
+{
+	struct rrl_bucket* b;
+#ifdef RRL_SHARED
+	if(rrl_shared)
+		return rrl_update_shared(query, hash, flags, now, lm);
+#endif
+	b = &table[hash % rrl_array_size];
+
+	DEBUG(DEBUG_QUERY, 1, (LOG_INFO, "source %llx hash %x oldrate %d oldcount %d stamp %d",
+		(long long unsigned)source, hash, b->rate, b->counter, b->stamp));
+
+	/* check if different source */
+	if(b->source != source || b->flags != flags || b->hash != hash) {
+		/* initialise */
+		/* potentially the wrong limit here, used lower nonwhitelim */
+		if(verbosity >= 1 &&
+			used_to_block(b->rate, b->counter, rrl_ratelimit)) {
+			char address[128];
+			addr2str(&query->addr, address, sizeof(address));
+			log_msg(LOG_INFO, "ratelimit unblock ~ type %s target %s query %s %s (%s collision)",
+				rrltype2str(b->flags),
+				rrlsource2str(b->source, b->flags),
+				address, rrtype_to_string(query->qtype),
+				(b->hash!=hash?"bucket":"hash"));
+		}
+		b->hash = hash;
+		b->source = source;
+		b->flags = flags;
+		b->counter = 1;
+		b->rate = 0;
+		b->stamp = now;
+		return 1;
+	}
+	/* this is the same source */
+	return rrl_step(query, b, now, lm);
+}
+
+/** update the rate in a ratelimit bucket, return actual rate */
+uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
+	uint16_t flags, int32_t now, uint32_t lm)
+{
+	return rrl_update_table(rrl_array, query, hash, source, flags, now,
+		lm);
+}
+
+int rrl_process_query(query_type* query, struct rrl_bucket* table)
 {
 	uint64_t source;
 	uint32_t hash;
@@ -443,7 +647,8 @@ int rrl_process_query(query_type* query)
 		return 0; /* no limit for this */
 
 	/* update rate */
-	return (rrl_update(query, hash, source, flags, now, lm) >= lm);
+	return (rrl_update_table(table?table:rrl_array, query, hash, source,
+		flags, now, lm) >= lm);
 }
 
 query_state_type rrl_slip(query_type* query)
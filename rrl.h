@@ -6,6 +6,7 @@
 #ifndef RRL_H
 #define RRL_H
 #include "query.h"
+struct rrl_bucket;
 
 /** the classification types for the rrl */
 enum rrl_type {
@@ -42,21 +43,32 @@ enum rrl_type {
  * Initialize for n children (optional, otherwise no mmaps used)
  * ratelimits lm and wlm are in qps (this routines x2s them for internal use).
  * plf and pls are in prefix lengths.
+ * If shared, one table is used by all children, updated with atomic
+ * operations, if the system supports that.
  */
 void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
-	size_t plf, size_t pls);
+	size_t plf, size_t pls, int shared);
 
 /**
  * Initialize rate limiting (for this child server process)
  */
 void rrl_init(size_t ch);
 
+/**
+ * The table for server thread thr (from 1) of child ch, of numch children.
+ * The threads of a child each use their own table, in the maps after
+ * those of the children if rrl_mmap_init made enough of them.
+ * Returns NULL if the children share one table.
+ */
+struct rrl_bucket* rrl_thread_init(size_t ch, size_t numch, size_t thr);
+
 /**
  * Process query that happens, the query structure contains the
  * information about the query and the answer.
+ * The table is that of the thread, or NULL for the one of rrl_init.
  * returns true if the query is ratelimited.
  */
-int rrl_process_query(query_type* query);
+int rrl_process_query(query_type* query, struct rrl_bucket* table);
 
 /**
  * Deny the query, with slip.
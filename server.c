@@ -36,6 +36,14 @@
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
 #endif /* HAVE_MMAP */
+#if defined(HAVE_PTHREAD) && defined(HAVE_SYNC_COMPARE_AND_SWAP)
+/* server-threads also needs the atomic add for the zone statistics */
+#define SERVER_THREADS 1
+#include <pthread.h>
+#endif
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
 #include <openssl/rand.h>
 #ifndef USE_MINI_EVENT
 #  ifdef HAVE_EVENT_H
@@ -65,6 +73,23 @@
 
 #define RELOAD_SYNC_TIMEOUT 25 /* seconds */
 
+#ifndef NONBLOCKING_IS_BROKEN
+#  define NUM_RECV_PER_SELECT 100
+#endif
+
+#if (!defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG))
+/*
+ * The messages and queries for recvmmsg and sendmmsg.  The UDP handlers
+ * of a thread share one batch.
+ */
+struct udp_batch
+{
+	struct mmsghdr msgs[NUM_RECV_PER_SELECT];
+	struct iovec iovecs[NUM_RECV_PER_SELECT];
+	struct query *queries[NUM_RECV_PER_SELECT];
+};
+#endif
+
 /*
  * Data for the UDP handlers.
  */
@@ -73,6 +98,9 @@ struct udp_handler_data
 	struct nsd        *nsd;
 	struct nsd_socket *socket;
 	query_type        *query;
+#if (!defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG))
+	struct udp_batch  *batch;
+#endif
 };
 
 struct tcp_accept_handler_data {
@@ -93,14 +121,47 @@ static struct tcp_accept_handler_data*	tcp_accept_handlers;
 static struct event slowaccept_event;
 static int slowaccept;
 
-#ifndef NONBLOCKING_IS_BROKEN
-#  define NUM_RECV_PER_SELECT 100
+#ifdef SERVER_THREADS
+/*
+ * A thread that answers UDP queries next to the main thread of a server
+ * process, with server-threads.  It has a copy of the nsd structure, for
+ * its own statistics and caches, and its own event base and queries.
+ * The namedb is not changed in a server process, the threads share it.
+ */
+struct server_thread
+{
+	pthread_t id;
+	struct nsd nsd;
+	struct event_base* event_base;
+	/* pipe that wakes the thread up to stop, and its event */
+	int wake[2];
+	struct event wake_event;
+	int stopped;
+#ifdef USE_MINI_EVENT
+	time_t secs;
+	struct timeval now;
 #endif
+};
 
-#if (!defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG))
-struct mmsghdr msgs[NUM_RECV_PER_SELECT];
-struct iovec iovecs[NUM_RECV_PER_SELECT];
-struct query *queries[NUM_RECV_PER_SELECT];
+static struct server_thread* server_threads;
+static size_t server_thread_count;
+#endif /* SERVER_THREADS */
+
+/*
+ * The accept handler, and the UDP handler when it uses recvmmsg and
+ * sendmmsg, read until the socket is drained if the event base supports
+ * edge triggered events, and then ask for them.
+ */
+#ifdef EV_ET
+#  define ACCEPT_EVENT_TYPES (EV_PERSIST | EV_READ | EV_ET)
+#  if defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG)
+#    define UDP_EVENT_TYPES (EV_PERSIST | EV_READ | EV_ET)
+#  endif
+#else
+#  define ACCEPT_EVENT_TYPES (EV_PERSIST | EV_READ)
+#endif
+#ifndef UDP_EVENT_TYPES
+#  define UDP_EVENT_TYPES (EV_PERSIST | EV_READ)
 #endif
 
 /*
@@ -159,8 +220,38 @@ struct tcp_handler_data
 	 * The number of queries handled by this specific TCP connection.
 	 */
 	int					query_count;
+
+	/*
+	 * Bytes read ahead from the connection, the queries that a
+	 * client pipelines after the current one.  rbuf_pos is the
+	 * first byte that is not yet used.
+	 */
+	uint8_t*			rbuf;
+	size_t				rbuf_pos, rbuf_len;
+
+	/*
+	 * Responses, with their length bytes, to pipelined queries that
+	 * are written together with the current response.
+	 */
+	uint8_t*			obuf;
+	size_t				obuf_sent, obuf_len;
 };
 
+/*
+ * The number of bytes read ahead from a TCP connection, and the size of
+ * the responses to pipelined queries that are written at once.
+ */
+#define TCP_READ_AHEAD 4096
+#define TCP_PIPELINE_BUFSIZE 16384
+
+/*
+ * Set by the TCP write handler, when it is called by the read handler and
+ * the response is written at once, and more queries are read ahead.  The
+ * read handler then continues with them, instead of a recursive call.
+ */
+static struct tcp_handler_data* tcp_read_again;
+static int tcp_writing_from_reading;
+
 /*
  * Handle incoming queries on the UDP server sockets.
  */
@@ -208,10 +299,6 @@ static void set_children_stats(struct nsd* nsd);
  */
 static void configure_handler_event_types(short event_types);
 
-static uint16_t *compressed_dname_offsets = 0;
-static uint32_t compression_table_capacity = 0;
-static uint32_t compression_table_size = 0;
-
 /*
  * Remove the specified pid from the list of child pids.  Returns -1 if
  * the pid is not in the list, child_num otherwise.  The field is set to 0.
@@ -515,37 +602,6 @@ server_zonestat_switch(struct nsd* nsd)
 }
 #endif /* USE_ZONE_STATS */
 
-static void
-cleanup_dname_compression_tables(void *ptr)
-{
-	free(ptr);
-	compressed_dname_offsets = NULL;
-	compression_table_capacity = 0;
-}
-
-static void
-initialize_dname_compression_tables(struct nsd *nsd)
-{
-	size_t needed = domain_table_count(nsd->db->domains) + 1;
-	needed += EXTRA_DOMAIN_NUMBERS;
-	if(compression_table_capacity < needed) {
-		if(compressed_dname_offsets) {
-			region_remove_cleanup(nsd->db->region,
-				cleanup_dname_compression_tables,
-				compressed_dname_offsets);
-			free(compressed_dname_offsets);
-		}
-		compressed_dname_offsets = (uint16_t *) xmallocarray(
-			needed, sizeof(uint16_t));
-		region_add_cleanup(nsd->db->region, cleanup_dname_compression_tables,
-			compressed_dname_offsets);
-		compression_table_capacity = needed;
-		compression_table_size=domain_table_count(nsd->db->domains)+1;
-	}
-	memset(compressed_dname_offsets, 0, needed * sizeof(uint16_t));
-	compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
-}
-
 /*
  * Initialize the server, create and bind the sockets.
  *
@@ -554,7 +610,7 @@ int
 server_init(struct nsd *nsd)
 {
 	size_t i;
-#if defined(SO_REUSEADDR) || (defined(INET6) && (defined(IPV6_V6ONLY) || defined(IPV6_USE_MIN_MTU) || defined(IPV6_MTU) || defined(IP_TRANSPARENT)))
+#if defined(SO_REUSEADDR) || defined(SO_REUSEPORT) || (defined(INET6) && (defined(IPV6_V6ONLY) || defined(IPV6_USE_MIN_MTU) || defined(IPV6_MTU) || defined(IP_TRANSPARENT)))
 	int on = 1;
 #endif
 
@@ -578,6 +634,17 @@ server_init(struct nsd *nsd)
 			return -1;
 		}
 
+#ifdef SO_REUSEPORT
+		/* every child binds its own socket on the address, the
+		 * kernel distributes the packets over those sockets */
+		if (nsd->reuseport && setsockopt(nsd->udp[i].s, SOL_SOCKET,
+			SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., SO_REUSEPORT, ...) "
+				"failed: %s", strerror(errno));
+			return -1;
+		}
+#endif /* SO_REUSEPORT */
+
 #if defined(SO_RCVBUF) || defined(SO_SNDBUF)
 	if(1) {
 	int rcv = 1*1024*1024;
@@ -749,6 +816,14 @@ server_init(struct nsd *nsd)
 			log_msg(LOG_ERR, "setsockopt(..., SO_REUSEADDR, ...) failed: %s", strerror(errno));
 		}
 #endif /* SO_REUSEADDR */
+#ifdef SO_REUSEPORT
+		if (nsd->reuseport && setsockopt(nsd->tcp[i].s, SOL_SOCKET,
+			SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			log_msg(LOG_ERR, "setsockopt(..., SO_REUSEPORT, ...) "
+				"failed: %s", strerror(errno));
+			return -1;
+		}
+#endif /* SO_REUSEPORT */
 
 #if defined(INET6)
 		if (nsd->tcp[i].addr->ai_family == AF_INET6) {
@@ -835,12 +910,14 @@ server_prepare(struct nsd *nsd)
 		hash_set_raninit(v);
 	else	hash_set_raninit(random());
 #endif
-	rrl_mmap_init(nsd->child_count, nsd->options->rrl_size,
+	rrl_mmap_init(nsd->child_count * (nsd->options->server_threads > 1 ?
+		nsd->options->server_threads : 1), nsd->options->rrl_size,
 		nsd->options->rrl_ratelimit,
 		nsd->options->rrl_whitelist_ratelimit,
 		nsd->options->rrl_slip,
 		nsd->options->rrl_ipv4_prefix_length,
-		nsd->options->rrl_ipv6_prefix_length);
+		nsd->options->rrl_ipv6_prefix_length,
+		nsd->options->rrl_shared);
 #endif /* RATELIMIT */
 
 	/* Open the database... */
@@ -864,9 +941,6 @@ server_prepare(struct nsd *nsd)
 		namedb_check_zonefiles(nsd, nsd->options, NULL, NULL);
 	zonestatid_tree_set(nsd);
 
-	compression_table_capacity = 0;
-	initialize_dname_compression_tables(nsd);
-
 #ifdef	BIND8_STATS
 	/* Initialize times... */
 	time(&nsd->st.boot);
@@ -893,6 +967,21 @@ server_start_children(struct nsd *nsd, region_type* region, netio_type* netio,
 	return restart_child_servers(nsd, region, netio, xfrd_sock_p);
 }
 
+/* close the sockets [from, to) but keep their address info, used by a
+ * child to drop the sockets of the other children with reuseport */
+static void
+server_close_socket_range(struct nsd_socket sockets[], size_t from,
+	size_t to)
+{
+	size_t i;
+	for (i = from; i < to; ++i) {
+		if (sockets[i].s != -1) {
+			close(sockets[i].s);
+			sockets[i].s = -1;
+		}
+	}
+}
+
 void
 server_close_all_sockets(struct nsd_socket sockets[], size_t n)
 {
@@ -918,6 +1007,8 @@ server_shutdown(struct nsd *nsd)
 {
 	size_t i;
 
+	/* CHILD: the threads use the sockets */
+	server_stop_threads();
 	server_close_all_sockets(nsd->udp, nsd->ifs);
 	server_close_all_sockets(nsd->tcp, nsd->ifs);
 	/* CHILD: close command channel to parent */
@@ -1328,7 +1419,8 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	udb_compact_inhibited(nsd->db->udb, 1);
 	reload_process_tasks(nsd, &last_task, cmdsocket);
 	udb_compact_inhibited(nsd->db->udb, 0);
-	udb_compact(nsd->db->udb);
+	/* a large compaction is continued in steps by server_main */
+	udb_compact_step(nsd->db->udb, nsd->options->database_compact_pause);
 
 #ifndef NDEBUG
 	if(nsd_debug_level >= 1)
@@ -1337,8 +1429,6 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	/* sync to disk (if needed) */
 	udb_base_sync(nsd->db->udb, 0);
 
-	initialize_dname_compression_tables(nsd);
-
 #ifdef BIND8_STATS
 	/* Restart dumping stats if required.  */
 	time(&nsd->st.boot);
@@ -1530,6 +1620,10 @@ server_main(struct nsd *nsd)
 					if(reload_listener.fd != -1) close(reload_listener.fd);
 					reload_listener.fd = -1;
 					reload_listener.event_types = NETIO_EVENT_NONE;
+					/* the database may be changed by the
+					 * reload, leave its compaction to the
+					 * next reload */
+					udb_compact_inhibited(nsd->db->udb, 1);
 					task_process_sync(nsd->task[nsd->mytask]);
 					/* inform xfrd reload attempt ended */
 					if(!write_socket(nsd->xfrd_listener->fd,
@@ -1567,6 +1661,10 @@ server_main(struct nsd *nsd)
 			/* timeout to collect processes. In case no sigchild happens. */
 			timeout_spec.tv_sec = 60;
 			timeout_spec.tv_nsec = 0;
+			/* do not wait if there is database compaction left,
+			 * the reload process owns the database while it runs */
+			if(reload_pid == -1 && udb_compact_pending(nsd->db->udb))
+				timeout_spec.tv_sec = 0;
 
 			/* listen on ports, timeout for collecting terminated children */
 			if(netio_dispatch(netio, &timeout_spec, 0) == -1) {
@@ -1579,6 +1677,11 @@ server_main(struct nsd *nsd)
 					&nsd->xfrd_listener->fd);
 				nsd->restart_children = 0;
 			}
+			if(reload_pid == -1 && udb_compact_pending(nsd->db->udb)) {
+				udb_compact_step(nsd->db->udb,
+					nsd->options->database_compact_pause);
+				udb_base_sync(nsd->db->udb, 0);
+			}
 			if(nsd->reload_failed) {
 				sig_atomic_t cmd = NSD_RELOAD_DONE;
 				pid_t mypid;
@@ -1590,6 +1693,7 @@ server_main(struct nsd *nsd)
 				if(reload_listener.fd != -1) close(reload_listener.fd);
 				reload_listener.fd = -1;
 				reload_listener.event_types = NETIO_EVENT_NONE;
+				udb_compact_inhibited(nsd->db->udb, 1);
 				task_process_sync(nsd->task[nsd->mytask]);
 				/* inform xfrd reload attempt ended */
 				if(!write_socket(nsd->xfrd_listener->fd,
@@ -1746,6 +1850,11 @@ server_main(struct nsd *nsd)
 #endif
 	send_children_quit_and_wait(nsd);
 
+	/* without a database the zone transfers are only in memory, write
+	 * the changed zones to their zonefiles, to read them on start */
+	if(nsd->db && !nsd->db->udb && nsd->options->zonefiles_write)
+		namedb_write_zonefiles(nsd, nsd->options);
+
 	/* Unlink it if possible... */
 	unlinkpid(nsd->pidfile);
 	unlink(nsd->task[0]->fname);
@@ -1810,7 +1919,7 @@ server_process_query_udp(struct nsd *nsd, struct query *query)
 {
 #ifdef RATELIMIT
 	if(query_process(query, nsd) != QUERY_DISCARDED) {
-		if(rrl_process_query(query))
+		if(rrl_process_query(query, nsd->rrl_table))
 			return rrl_slip(query);
 		else	return QUERY_PROCESSED;
 	}
@@ -1844,16 +1953,264 @@ nsd_child_event_base(void)
 	return base;
 }
 
+/*
+ * Add the UDP handlers for the sockets from..from+numifs to the event
+ * base, with the queries to receive into.
+ */
+static void
+server_add_udp_handlers(struct nsd *nsd, region_type *region,
+	struct event_base *event_base, size_t from, size_t numifs)
+{
+	size_t i;
+	query_type *udp_query;
+#if (defined(NONBLOCKING_IS_BROKEN) || !defined(HAVE_RECVMMSG))
+	udp_query = query_create(region);
+#else
+	struct udp_batch *batch = (struct udp_batch *) region_alloc_zero(
+		region, sizeof(struct udp_batch));
+	udp_query = NULL;
+	for (i = 0; i < NUM_RECV_PER_SELECT; i++) {
+		batch->queries[i] = query_create(region);
+		query_reset(batch->queries[i], UDP_MAX_MESSAGE_LEN, 0);
+		batch->iovecs[i].iov_base = buffer_begin(batch->queries[i]->packet);
+		batch->iovecs[i].iov_len = buffer_remaining(batch->queries[i]->packet);
+		batch->msgs[i].msg_hdr.msg_iov     = &batch->iovecs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen  = 1;
+		batch->msgs[i].msg_hdr.msg_name    = &batch->queries[i]->addr;
+		batch->msgs[i].msg_hdr.msg_namelen = batch->queries[i]->addrlen;
+	}
+#endif
+	for (i = from; i < from+numifs; ++i) {
+		struct udp_handler_data *data;
+		struct event *handler;
+
+		data = (struct udp_handler_data *) region_alloc(
+			region, sizeof(struct udp_handler_data));
+		data->query = udp_query;
+#if (!defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG))
+		data->batch = batch;
+#endif
+		data->nsd = nsd;
+		data->socket = &nsd->udp[i];
+
+		handler = (struct event*) region_alloc(
+			region, sizeof(*handler));
+		event_set(handler, nsd->udp[i].s, UDP_EVENT_TYPES,
+			handle_udp, data);
+		if(event_base_set(event_base, handler) != 0)
+			log_msg(LOG_ERR, "nsd udp: event_base_set failed");
+		if(event_add(handler, NULL) != 0)
+			log_msg(LOG_ERR, "nsd udp: event_add failed");
+	}
+}
+
+#ifdef SERVER_THREADS
+/* serve the UDP handlers of the thread until the process exits */
+static void *
+server_thread_main(void *arg)
+{
+	struct server_thread *thread = (struct server_thread *) arg;
+	if(event_base_dispatch(thread->event_base) == -1)
+		log_msg(LOG_ERR, "server thread dispatch failed: %s",
+			strerror(errno));
+	return NULL;
+}
+
+/* the main thread wants the server thread to stop */
+static void
+server_thread_wake(int ATTR_UNUSED(fd), short ATTR_UNUSED(event), void* arg)
+{
+	struct server_thread *thread = (struct server_thread *) arg;
+	event_base_loopexit(thread->event_base, NULL);
+}
+
+/* the event base for a server thread, NULL if it cannot be made */
+static struct event_base*
+server_thread_event_base(struct server_thread *thread)
+{
+#ifdef USE_MINI_EVENT
+	return (struct event_base*)event_init(&thread->secs, &thread->now);
+#elif defined(HAVE_EV_LOOP) || defined(HAVE_EV_DEFAULT_LOOP)
+	(void)thread;
+	return (struct event_base*)ev_loop_new(EVFLAG_AUTO);
+#elif defined(HAVE_EVENT_BASE_NEW)
+	(void)thread;
+	return event_base_new();
+#else
+	/* event_init sets the global base of libevent */
+	(void)thread;
+	return NULL;
+#endif
+}
+
+/*
+ * Start server-threads - 1 threads that answer UDP queries, on the
+ * same sockets as the main thread of the server process.  The main
+ * thread also handles TCP, signals and the commands from the parent.
+ */
+static void
+server_start_threads(struct nsd *nsd, region_type *region, size_t from,
+	size_t numifs)
+{
+	sigset_t all, old;
+	size_t i;
+	int r;
+
+	server_threads = (struct server_thread *) region_alloc_array_zero(
+		region, (size_t)nsd->options->server_threads - 1,
+		sizeof(struct server_thread));
+	/* signals are delivered to the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < (size_t)nsd->options->server_threads - 1; i++) {
+		struct server_thread *thread = &server_threads[i];
+		thread->nsd = *nsd;
+#ifdef BIND8_STATS
+		memset(&thread->nsd.st, 0, sizeof(thread->nsd.st));
+		thread->nsd.st.db_disk = nsd->st.db_disk;
+		thread->nsd.st.db_mem = nsd->st.db_mem;
+#endif
+		if (nsd->answer_cache)
+			thread->nsd.answer_cache = answer_cache_create(
+				(size_t)nsd->options->answer_cache_size);
+#ifdef RATELIMIT
+		thread->nsd.rrl_table = rrl_thread_init(nsd->this_child?
+			(size_t)nsd->this_child->child_num:nsd->child_count,
+			nsd->child_count, i+1);
+#endif
+		thread->event_base = server_thread_event_base(thread);
+		if (!thread->event_base) {
+			log_msg(LOG_ERR, "server thread could not create "
+				"event base");
+			break;
+		}
+		if (pipe(thread->wake) == -1) {
+			log_msg(LOG_ERR, "server thread pipe: %s",
+				strerror(errno));
+			break;
+		}
+		event_set(&thread->wake_event, thread->wake[0], EV_READ,
+			server_thread_wake, thread);
+		if(event_base_set(thread->event_base, &thread->wake_event) != 0)
+			log_msg(LOG_ERR, "server thread: event_base_set failed");
+		if(event_add(&thread->wake_event, NULL) != 0)
+			log_msg(LOG_ERR, "server thread: event_add failed");
+		server_add_udp_handlers(&thread->nsd, region,
+			thread->event_base, from, numifs);
+		if ((r = pthread_create(&thread->id, NULL, server_thread_main,
+			thread)) != 0) {
+			log_msg(LOG_ERR, "pthread_create failed: %s",
+				strerror(r));
+			break;
+		}
+		server_thread_count++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+#endif /* SERVER_THREADS */
+
+void
+server_stop_threads(void)
+{
+#ifdef SERVER_THREADS
+	size_t i;
+	int r;
+	for (i = 0; i < server_thread_count; i++) {
+		struct server_thread *thread = &server_threads[i];
+		if (thread->stopped)
+			continue;
+		thread->stopped = 1;
+		if (write(thread->wake[1], "", 1) == -1) {
+			log_msg(LOG_ERR, "cannot stop server thread: %s",
+				strerror(errno));
+			continue;
+		}
+		if ((r = pthread_join(thread->id, NULL)) != 0)
+			log_msg(LOG_ERR, "pthread_join failed: %s",
+				strerror(r));
+	}
+#endif
+}
+
+#ifdef BIND8_STATS
+void
+server_thread_stats(struct nsd *nsd, struct nsdst *st)
+{
+#ifdef SERVER_THREADS
+	size_t i;
+#endif
+	*st = nsd->st;
+#ifdef SERVER_THREADS
+	for (i = 0; i < server_thread_count; i++)
+		stats_add(st, &server_threads[i].nsd.st);
+#endif
+}
+
+/* log the statistics of the server process, with those of its threads */
+static void
+server_child_stats(struct nsd *nsd)
+{
+	struct nsdst st = nsd->st;
+	server_thread_stats(nsd, &nsd->st);
+	bind8_stats(nsd);
+	nsd->st = st;
+}
+#endif /* BIND8_STATS */
+
+/*
+ * Bind the process to the cpus in the list, like "0-3,6".
+ */
+static void
+server_set_cpu_affinity(const char* cpus)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t set;
+	const char* p = cpus;
+	char* end;
+	long first, last;
+
+	CPU_ZERO(&set);
+	while (*p) {
+		if (*p == ',' || isspace((unsigned char)*p)) {
+			p++;
+			continue;
+		}
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0 || first >= CPU_SETSIZE)
+			break;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p+1, &end, 10);
+			if (end == p+1 || last < first || last >= CPU_SETSIZE)
+				break;
+			p = end;
+		}
+		for (; first <= last; first++)
+			CPU_SET((int)first, &set);
+	}
+	if (*p) {
+		log_msg(LOG_ERR, "cannot parse cpu list '%s'", cpus);
+		return;
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) == -1)
+		log_msg(LOG_ERR, "sched_setaffinity(%s) failed: %s", cpus,
+			strerror(errno));
+#else
+	log_msg(LOG_WARNING, "cpu affinity '%s' is not supported on this "
+		"system", cpus);
+#endif /* HAVE_SCHED_SETAFFINITY */
+}
+
 /*
  * Serve DNS requests.
  */
 void
 server_child(struct nsd *nsd)
 {
-	size_t i;
+	size_t i, from = 0, numifs = nsd->ifs;
 	region_type *server_region = region_create(xalloc, free);
 	struct event_base* event_base = nsd_child_event_base();
-	query_type *udp_query;
 	sig_atomic_t mode;
 
 	if(!event_base) {
@@ -1862,11 +2219,18 @@ server_child(struct nsd *nsd)
 	}
 
 #ifdef RATELIMIT
-	rrl_init((nsd->this_child - nsd->children)/sizeof(nsd->children[0]));
+	rrl_init(nsd->this_child?(size_t)nsd->this_child->child_num:
+		nsd->child_count);
 #endif
 
 	assert(nsd->server_kind != NSD_SERVER_MAIN);
 	DEBUG(DEBUG_IPC, 2, (LOG_INFO, "child process started"));
+	if (nsd->server_kind == NSD_SERVER_UDP &&
+		nsd->options->udp_cpu_affinity)
+		server_set_cpu_affinity(nsd->options->udp_cpu_affinity);
+	else if (nsd->server_kind == NSD_SERVER_TCP &&
+		nsd->options->tcp_cpu_affinity)
+		server_set_cpu_affinity(nsd->options->tcp_cpu_affinity);
 
 	if (!(nsd->server_kind & NSD_SERVER_TCP)) {
 		server_close_all_sockets(nsd->tcp, nsd->ifs);
@@ -1874,6 +2238,29 @@ server_child(struct nsd *nsd)
 	if (!(nsd->server_kind & NSD_SERVER_UDP)) {
 		server_close_all_sockets(nsd->udp, nsd->ifs);
 	}
+	if (nsd->reuseport) {
+		/* use the socket sets of this child, the other sets are
+		 * served by the other children of its kind */
+		size_t setsize = nsd->ifs / nsd->reuseport;
+		size_t first = nsd->reuseport * nsd->this_child->kind_num /
+			nsd->this_child->kind_count;
+		size_t last = nsd->reuseport * (nsd->this_child->kind_num+1) /
+			nsd->this_child->kind_count;
+		numifs = setsize * (last - first);
+		from = setsize * first;
+		if (numifs == 0 || from + numifs > nsd->ifs) {
+			/* should not happen */
+			from = 0;
+			numifs = nsd->ifs;
+		} else {
+			server_close_socket_range(nsd->udp, 0, from);
+			server_close_socket_range(nsd->udp, from+numifs,
+				nsd->ifs);
+			server_close_socket_range(nsd->tcp, 0, from);
+			server_close_socket_range(nsd->tcp, from+numifs,
+				nsd->ifs);
+		}
+	}
 
 	if (nsd->this_child && nsd->this_child->parent_fd != -1) {
 		struct event *handler;
@@ -1894,43 +2281,18 @@ server_child(struct nsd *nsd)
 	}
 
 	if (nsd->server_kind & NSD_SERVER_UDP) {
-#if (defined(NONBLOCKING_IS_BROKEN) || !defined(HAVE_RECVMMSG))
-		udp_query = query_create(server_region,
-			compressed_dname_offsets, compression_table_size);
+		if (nsd->options->answer_cache_size > 0)
+			nsd->answer_cache = answer_cache_create(
+				(size_t)nsd->options->answer_cache_size);
+		server_add_udp_handlers(nsd, server_region, event_base,
+			from, numifs);
+		if (nsd->options->server_threads > 1) {
+#ifdef SERVER_THREADS
+			server_start_threads(nsd, server_region, from, numifs);
 #else
-		udp_query = NULL;
-		memset(msgs, 0, sizeof(msgs));
-		for (i = 0; i < NUM_RECV_PER_SELECT; i++) {
-			queries[i] = query_create(server_region,
-				compressed_dname_offsets, compression_table_size);
-			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
-			iovecs[i].iov_base          = buffer_begin(queries[i]->packet);
-			iovecs[i].iov_len           = buffer_remaining(queries[i]->packet);;
-			msgs[i].msg_hdr.msg_iov     = &iovecs[i];
-			msgs[i].msg_hdr.msg_iovlen  = 1;
-			msgs[i].msg_hdr.msg_name    = &queries[i]->addr;
-			msgs[i].msg_hdr.msg_namelen = queries[i]->addrlen;
-		}
+			log_msg(LOG_WARNING, "server-threads is not supported "
+				"on this system, using one thread");
 #endif
-		for (i = 0; i < nsd->ifs; ++i) {
-			struct udp_handler_data *data;
-			struct event *handler;
-
-			data = (struct udp_handler_data *) region_alloc(
-				server_region,
-				sizeof(struct udp_handler_data));
-			data->query = udp_query;
-			data->nsd = nsd;
-			data->socket = &nsd->udp[i];
-
-			handler = (struct event*) region_alloc(
-				server_region, sizeof(*handler));
-			event_set(handler, nsd->udp[i].s, EV_PERSIST|EV_READ,
-				handle_udp, data);
-			if(event_base_set(event_base, handler) != 0)
-				log_msg(LOG_ERR, "nsd udp: event_base_set failed");
-			if(event_add(handler, NULL) != 0)
-				log_msg(LOG_ERR, "nsd udp: event_add failed");
 		}
 	}
 
@@ -1939,19 +2301,19 @@ server_child(struct nsd *nsd)
 	 * and disable them based on the current number of active TCP
 	 * connections.
 	 */
-	tcp_accept_handler_count = nsd->ifs;
+	tcp_accept_handler_count = numifs;
 	tcp_accept_handlers = (struct tcp_accept_handler_data*)
 		region_alloc_array(server_region,
-		nsd->ifs, sizeof(*tcp_accept_handlers));
+		numifs, sizeof(*tcp_accept_handlers));
 	if (nsd->server_kind & NSD_SERVER_TCP) {
-		for (i = 0; i < nsd->ifs; ++i) {
+		for (i = 0; i < numifs; ++i) {
 			struct event *handler = &tcp_accept_handlers[i].event;
 			struct tcp_accept_handler_data* data =
 				&tcp_accept_handlers[i];
 			data->nsd = nsd;
-			data->socket = &nsd->tcp[i];
-			event_set(handler, nsd->tcp[i].s, EV_PERSIST|EV_READ,
-				handle_tcp_accept, data);
+			data->socket = &nsd->tcp[from+i];
+			event_set(handler, nsd->tcp[from+i].s,
+				ACCEPT_EVENT_TYPES, handle_tcp_accept, data);
 			if(event_base_set(event_base, handler) != 0)
 				log_msg(LOG_ERR, "nsd tcp: event_base_set failed");
 			if(event_add(handler, NULL) != 0)
@@ -1970,7 +2332,7 @@ server_child(struct nsd *nsd)
 			int p = nsd->st.period;
 			nsd->st.period = 1; /* force stats printout */
 			/* Dump the statistics */
-			bind8_stats(nsd);
+			server_child_stats(nsd);
 			nsd->st.period = p;
 #else /* !BIND8_STATS */
 			log_msg(LOG_NOTICE, "Statistics support not enabled at compile time.");
@@ -2010,8 +2372,9 @@ server_child(struct nsd *nsd)
 		}
 	}
 
+	server_stop_threads();
 #ifdef	BIND8_STATS
-	bind8_stats(nsd);
+	server_child_stats(nsd);
 #endif /* BIND8_STATS */
 
 #if 0 /* OS collects memory pages */
@@ -2022,28 +2385,39 @@ server_child(struct nsd *nsd)
 }
 
 #if defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG)
-static void
-handle_udp(int fd, short event, void* arg)
+/* number of receive errors in a row before the socket is left alone */
+#define UDP_RECV_RETRIES 8
+
+/* receive and answer a batch of queries, returns the number received,
+ * 0 if there are no more, or -1 if the receive has to be tried again */
+static int
+handle_udp_batch(int fd, struct udp_handler_data *data)
 {
-	struct udp_handler_data *data = (struct udp_handler_data *) arg;
-	int received, sent, recvcount, i;
+	int received, sent, recvcount, batchcount, i;
 	struct query *q;
+	struct mmsghdr *msgs = data->batch->msgs;
+	struct iovec *iovecs = data->batch->iovecs;
+	struct query **queries = data->batch->queries;
 
-	if (!(event & EV_READ)) {
-		return;
-	}
 	recvcount = recvmmsg(fd, msgs, NUM_RECV_PER_SELECT, 0, NULL);
 	/* this printf strangely gave a performance increase on Linux */
 	/* printf("recvcount %d \n", recvcount); */
 	if (recvcount == -1) {
-		if (errno != EAGAIN && errno != EINTR) {
+		if (errno == EINTR) {
+			/* interrupted, the queries are still waiting */
+			return -1;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
 			log_msg(LOG_ERR, "recvmmsg failed: %s", strerror(errno));
 			STATUP(data->nsd, rxerr);
 			/* No zone statup */
+			/* the error is taken off the socket, try again */
+			return -1;
 		}
 		/* Simply no data available */
-		return;
+		return 0;
 	}
+	batchcount = recvcount;
 	for (i = 0; i < recvcount; i++) {
 	loopstart:
 		received = msgs[i].msg_len;
@@ -2143,6 +2517,31 @@ handle_udp(int fd, short event, void* arg)
 		query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
 		iovecs[i].iov_len = buffer_remaining(queries[i]->packet);
 	}
+	return batchcount;
+}
+
+static void
+handle_udp(int fd, short event, void* arg)
+{
+#ifdef EV_ET
+	int n, retries = 0;
+#endif
+	if (!(event & EV_READ)) {
+		return;
+	}
+#ifdef EV_ET
+	/* edge triggered: a full batch means more queries may be waiting,
+	 * and after an interrupt or error (-1) they may be waiting too.
+	 * A socket that keeps failing is left for the next event. */
+	do {
+		n = handle_udp_batch(fd, (struct udp_handler_data *) arg);
+		if(n != -1)
+			retries = 0;
+	} while(n == NUM_RECV_PER_SELECT ||
+		(n == -1 && ++retries < UDP_RECV_RETRIES));
+#else
+	(void)handle_udp_batch(fd, (struct udp_handler_data *) arg);
+#endif
 }
 
 #else /* defined(HAVE_SENDMMSG) && !defined(NONBLOCKING_IS_BROKEN) && defined(HAVE_RECVMMSG) */
@@ -2155,6 +2554,8 @@ handle_udp(int fd, short event, void* arg)
 #ifndef NONBLOCKING_IS_BROKEN
 #ifdef HAVE_RECVMMSG
 	int recvcount;
+	struct mmsghdr *msgs = data->batch->msgs;
+	struct query **queries = data->batch->queries;
 #endif /* HAVE_RECVMMSG */
 	int i;
 #endif /* NONBLOCKING_IS_BROKEN */
@@ -2299,7 +2700,7 @@ cleanup_tcp_handler(struct tcp_handler_data* data)
 	 * of TCP connections.
 	 */
 	if (slowaccept || data->nsd->current_tcp_count == data->nsd->maximum_tcp_count) {
-		configure_handler_event_types(EV_READ|EV_PERSIST);
+		configure_handler_event_types(ACCEPT_EVENT_TYPES);
 		slowaccept = 0;
 	}
 	--data->nsd->current_tcp_count;
@@ -2308,6 +2709,92 @@ cleanup_tcp_handler(struct tcp_handler_data* data)
 	region_destroy(data->region);
 }
 
+/*
+ * Read from the TCP connection, from the bytes read ahead if there are
+ * any.  Small reads fill the read ahead buffer, which picks up the
+ * queries that the client pipelines.
+ */
+static ssize_t
+tcp_read(struct tcp_handler_data* data, int fd, void* buf, size_t len)
+{
+	ssize_t received;
+	if (data->rbuf_pos == data->rbuf_len) {
+		if (len >= TCP_READ_AHEAD)
+			return read(fd, buf, len);
+		received = read(fd, data->rbuf, TCP_READ_AHEAD);
+		if (received <= 0)
+			return received;
+		data->rbuf_pos = 0;
+		data->rbuf_len = (size_t)received;
+	}
+	if (len > data->rbuf_len - data->rbuf_pos)
+		len = data->rbuf_len - data->rbuf_pos;
+	memcpy(buf, data->rbuf + data->rbuf_pos, len);
+	data->rbuf_pos += len;
+	return (ssize_t)len;
+}
+
+/*
+ * See if a complete query is read ahead.
+ */
+static int
+tcp_query_read_ahead(struct tcp_handler_data* data)
+{
+	size_t avail = data->rbuf_len - data->rbuf_pos;
+	return avail >= sizeof(uint16_t) && avail >= sizeof(uint16_t) +
+		read_uint16(data->rbuf + data->rbuf_pos);
+}
+
+/*
+ * Queue the response in the query packet, to be written later with the
+ * responses to the queries after it.  Returns 0 if there is no space.
+ */
+static int
+tcp_queue_response(struct tcp_handler_data* data)
+{
+	size_t len = buffer_remaining(data->query->packet);
+	if (data->obuf_len + sizeof(uint16_t) + len > TCP_PIPELINE_BUFSIZE)
+		return 0;
+	if (!data->obuf)
+		data->obuf = (uint8_t*)region_alloc(data->region,
+			TCP_PIPELINE_BUFSIZE);
+	write_uint16(data->obuf + data->obuf_len, (uint16_t)len);
+	memcpy(data->obuf + data->obuf_len + sizeof(uint16_t),
+		buffer_begin(data->query->packet), len);
+	data->obuf_len += sizeof(uint16_t) + len;
+	return 1;
+}
+
+/*
+ * Close the connection, but write the queued responses to the pipelined
+ * queries before the current one first.  The current query gets no
+ * response, the writer closes the connection when the queue is written.
+ */
+static void
+cleanup_tcp_handler_flush(struct tcp_handler_data* data, int fd)
+{
+	struct event_base* ev_base;
+	struct timeval timeout;
+
+	if (data->obuf_sent == data->obuf_len) {
+		cleanup_tcp_handler(data);
+		return;
+	}
+	data->query_state = QUERY_DISCARDED;
+
+	timeout.tv_sec = data->nsd->tcp_timeout;
+	timeout.tv_usec = 0L;
+	ev_base = data->event.ev_base;
+	event_del(&data->event);
+	event_set(&data->event, fd, EV_PERSIST | EV_WRITE | EV_TIMEOUT,
+		handle_tcp_writing, data);
+	if(event_base_set(ev_base, &data->event) != 0)
+		log_msg(LOG_ERR, "event base set tcpf failed");
+	if(event_add(&data->event, &timeout) != 0)
+		log_msg(LOG_ERR, "event add tcpf failed");
+	handle_tcp_writing(fd, EV_WRITE, data);
+}
+
 static void
 handle_tcp_reading(int fd, short event, void* arg)
 {
@@ -2322,10 +2809,11 @@ handle_tcp_reading(int fd, short event, void* arg)
 		return;
 	}
 
+next_query:
 	if (data->nsd->tcp_query_count > 0 &&
 		data->query_count >= data->nsd->tcp_query_count) {
 		/* No more queries allowed on this tcp connection.  */
-		cleanup_tcp_handler(data);
+		cleanup_tcp_handler_flush(data, fd);
 		return;
 	}
 
@@ -2339,7 +2827,7 @@ handle_tcp_reading(int fd, short event, void* arg)
 	 * Check if we received the leading packet length bytes yet.
 	 */
 	if (data->bytes_transmitted < sizeof(uint16_t)) {
-		received = read(fd,
+		received = tcp_read(data, fd,
 				(char *) &data->query->tcplen
 				+ data->bytes_transmitted,
 				sizeof(uint16_t) - data->bytes_transmitted);
@@ -2389,13 +2877,13 @@ handle_tcp_reading(int fd, short event, void* arg)
 		 */
 		if (data->query->tcplen < QHEADERSZ + 1 + sizeof(uint16_t) + sizeof(uint16_t)) {
 			VERBOSITY(2, (LOG_WARNING, "packet too small, dropping tcp connection"));
-			cleanup_tcp_handler(data);
+			cleanup_tcp_handler_flush(data, fd);
 			return;
 		}
 
 		if (data->query->tcplen > data->query->maxlen) {
 			VERBOSITY(2, (LOG_WARNING, "insufficient tcp buffer, dropping connection"));
-			cleanup_tcp_handler(data);
+			cleanup_tcp_handler_flush(data, fd);
 			return;
 		}
 
@@ -2405,7 +2893,7 @@ handle_tcp_reading(int fd, short event, void* arg)
 	assert(buffer_remaining(data->query->packet) > 0);
 
 	/* Read the (remaining) query data.  */
-	received = read(fd,
+	received = tcp_read(data, fd,
 			buffer_current(data->query->packet),
 			buffer_remaining(data->query->packet));
 	if (received == -1) {
@@ -2467,7 +2955,7 @@ handle_tcp_reading(int fd, short event, void* arg)
 		/* Drop the packet and the entire connection... */
 		STATUP(data->nsd, dropped);
 		ZTATUP(data->nsd, data->query->zone, dropped);
-		cleanup_tcp_handler(data);
+		cleanup_tcp_handler_flush(data, fd);
 		return;
 	}
 
@@ -2499,6 +2987,15 @@ handle_tcp_reading(int fd, short event, void* arg)
 	data->query->tcplen = buffer_remaining(data->query->packet);
 	data->bytes_transmitted = 0;
 
+	/* If the client has pipelined the next query, answer it first, and
+	 * write the responses together.  */
+	if (data->query_state == QUERY_PROCESSED &&
+		tcp_query_read_ahead(data) &&
+		!(data->nsd->tcp_query_count > 0 &&
+		data->query_count >= data->nsd->tcp_query_count) &&
+		tcp_queue_response(data))
+		goto next_query;
+
 	timeout.tv_sec = data->nsd->tcp_timeout;
 	timeout.tv_usec = 0L;
 
@@ -2511,7 +3008,15 @@ handle_tcp_reading(int fd, short event, void* arg)
 	if(event_add(&data->event, &timeout) != 0)
 		log_msg(LOG_ERR, "event add tcpr failed");
 	/* see if we can write the answer right away(usually so,EAGAIN ifnot)*/
+	tcp_read_again = NULL;
+	tcp_writing_from_reading = 1;
 	handle_tcp_writing(fd, EV_WRITE, data);
+	tcp_writing_from_reading = 0;
+	if (tcp_read_again == data) {
+		/* written, and more queries are read ahead */
+		tcp_read_again = NULL;
+		goto next_query;
+	}
 }
 
 static void
@@ -2531,6 +3036,67 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	assert((event & EV_WRITE));
 
+	if (data->obuf_sent < data->obuf_len) {
+		/* Writing the responses to pipelined queries, they are
+		 * followed by the current response, if it is not
+		 * discarded.  */
+		size_t queued = data->obuf_len - data->obuf_sent;
+#ifdef HAVE_WRITEV
+		uint16_t n_tcplen = htons(q->tcplen);
+		struct iovec iov[3];
+		assert(data->bytes_transmitted == 0);
+		iov[0].iov_base = data->obuf + data->obuf_sent;
+		iov[0].iov_len = queued;
+		iov[1].iov_base = (uint8_t*)&n_tcplen;
+		iov[1].iov_len = sizeof(n_tcplen);
+		iov[2].iov_base = buffer_begin(q->packet);
+		iov[2].iov_len = buffer_limit(q->packet);
+		sent = writev(fd, iov,
+			data->query_state == QUERY_DISCARDED?1:3);
+#else /* HAVE_WRITEV */
+		sent = write(fd, data->obuf + data->obuf_sent, queued);
+#endif /* HAVE_WRITEV */
+		if (sent == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				/*
+				 * Write would block, wait until
+				 * socket becomes writable again.
+				 */
+				return;
+			} else {
+#ifdef ECONNRESET
+				if(verbosity >= 2 || errno != ECONNRESET)
+#endif /* ECONNRESET */
+#ifdef EPIPE
+				  if(verbosity >= 2 || errno != EPIPE)
+#endif /* EPIPE 'broken pipe' */
+				    log_msg(LOG_ERR, "failed writing to tcp: %s", strerror(errno));
+				cleanup_tcp_handler(data);
+				return;
+			}
+		}
+		if ((size_t)sent < queued) {
+			data->obuf_sent += sent;
+			return;
+		}
+		data->obuf_sent = 0;
+		data->obuf_len = 0;
+		if (data->query_state == QUERY_DISCARDED) {
+			/* the queue is written, close the connection */
+			cleanup_tcp_handler(data);
+			return;
+		}
+#ifdef HAVE_WRITEV
+		/* the part of the current response that is written */
+		sent -= queued;
+		data->bytes_transmitted = sent;
+		if (data->bytes_transmitted < sizeof(q->tcplen))
+			return;
+		sent -= sizeof(n_tcplen);
+		goto packet_could_be_done;
+#endif /* HAVE_WRITEV */
+	}
+
 	if (data->bytes_transmitted < sizeof(q->tcplen)) {
 		/* Writing the response packet length.  */
 		uint16_t n_tcplen = htons(q->tcplen);
@@ -2620,10 +3186,13 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	assert(data->bytes_transmitted == q->tcplen + sizeof(q->tcplen));
 
-	if (data->query_state == QUERY_IN_AXFR) {
+	if (data->query_state == QUERY_IN_AXFR ||
+		data->query_state == QUERY_IN_IXFR) {
 		/* Continue processing AXFR and writing back results.  */
 		buffer_clear(q->packet);
-		data->query_state = query_axfr(data->nsd, q);
+		if(data->query_state == QUERY_IN_IXFR)
+			data->query_state = query_ixfr(data->nsd, q);
+		else	data->query_state = query_axfr(data->nsd, q);
 		if (data->query_state != QUERY_PROCESSED) {
 			query_add_optional(data->query, data->nsd);
 
@@ -2673,6 +3242,16 @@ handle_tcp_writing(int fd, short event, void* arg)
 		log_msg(LOG_ERR, "event base set tcpw failed");
 	if(event_add(&data->event, &timeout) != 0)
 		log_msg(LOG_ERR, "event add tcpw failed");
+
+	/*
+	 * Queries that are read ahead do not make the socket readable,
+	 * continue with them now.
+	 */
+	if (data->rbuf_pos < data->rbuf_len) {
+		if (tcp_writing_from_reading)
+			tcp_read_again = data;
+		else	handle_tcp_reading(fd, EV_READ, data);
+	}
 }
 
 
@@ -2681,7 +3260,7 @@ handle_slowaccept_timeout(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
 	void* ATTR_UNUSED(arg))
 {
 	if(slowaccept) {
-		configure_handler_event_types(EV_PERSIST | EV_READ);
+		configure_handler_event_types(ACCEPT_EVENT_TYPES);
 		slowaccept = 0;
 	}
 }
@@ -2690,12 +3269,11 @@ handle_slowaccept_timeout(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
  * Handle an incoming TCP connection.  The connection is accepted and
  * a new TCP reader event handler is added.  The TCP handler
  * is responsible for cleanup when the connection is closed.
+ * Returns 0 when no more connections are to be accepted now.
  */
-static void
-handle_tcp_accept(int fd, short event, void* arg)
+static int
+handle_tcp_accept_one(int fd, struct tcp_accept_handler_data *data)
 {
-	struct tcp_accept_handler_data *data
-		= (struct tcp_accept_handler_data *) arg;
 	int s;
 	struct tcp_handler_data *tcp_data;
 	region_type *tcp_region;
@@ -2707,12 +3285,8 @@ handle_tcp_accept(int fd, short event, void* arg)
 	socklen_t addrlen;
 	struct timeval timeout;
 
-	if (!(event & EV_READ)) {
-		return;
-	}
-
 	if (data->nsd->current_tcp_count >= data->nsd->maximum_tcp_count) {
-		return;
+		return 0;
 	}
 
 	/* Accept it... */
@@ -2723,8 +3297,19 @@ handle_tcp_accept(int fd, short event, void* arg)
 		 * EMFILE and ENFILE is a signal that the limit of open
 		 * file descriptors has been reached. Pause accept().
 		 * EINTR is a signal interrupt. The others are various OS ways
-		 * of saying that the client has closed the connection.
+		 * of saying that the client has closed the connection, the
+		 * connections behind it in the queue can still be accepted.
 		 */
+		if (errno == EINTR
+#ifdef ECONNABORTED
+			|| errno == ECONNABORTED
+#endif /* ECONNABORTED */
+#ifdef EPROTO
+			|| errno == EPROTO
+#endif /* EPROTO */
+			) {
+			return 1;
+		}
 		if (errno == EMFILE || errno == ENFILE) {
 			if (!slowaccept) {
 				/* disable accept events */
@@ -2740,24 +3325,18 @@ handle_tcp_accept(int fd, short event, void* arg)
 				slowaccept = 1;
 				/* We don't want to spam the logs here */
 			}
-		} else if (errno != EINTR
-			&& errno != EWOULDBLOCK
-#ifdef ECONNABORTED
-			&& errno != ECONNABORTED
-#endif /* ECONNABORTED */
-#ifdef EPROTO
-			&& errno != EPROTO
-#endif /* EPROTO */
-			) {
+		} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			/* not a problem of one connection, do not retry
+			 * until the next accept event */
 			log_msg(LOG_ERR, "accept failed: %s", strerror(errno));
 		}
-		return;
+		return 0;
 	}
 
 	if (fcntl(s, F_SETFL, O_NONBLOCK) == -1) {
 		log_msg(LOG_ERR, "fcntl failed: %s", strerror(errno));
 		close(s);
-		return;
+		return 1;
 	}
 
 	/*
@@ -2768,13 +3347,18 @@ handle_tcp_accept(int fd, short event, void* arg)
 	tcp_data = (struct tcp_handler_data *) region_alloc(
 		tcp_region, sizeof(struct tcp_handler_data));
 	tcp_data->region = tcp_region;
-	tcp_data->query = query_create(tcp_region, compressed_dname_offsets,
-		compression_table_size);
+	tcp_data->query = query_create(tcp_region);
 	tcp_data->nsd = data->nsd;
 	tcp_data->query_count = 0;
 
 	tcp_data->query_state = QUERY_PROCESSED;
 	tcp_data->bytes_transmitted = 0;
+	tcp_data->rbuf = (uint8_t*)region_alloc(tcp_region, TCP_READ_AHEAD);
+	tcp_data->rbuf_pos = 0;
+	tcp_data->rbuf_len = 0;
+	tcp_data->obuf = NULL;
+	tcp_data->obuf_sent = 0;
+	tcp_data->obuf_len = 0;
 	memcpy(&tcp_data->query->addr, &addr, addrlen);
 	tcp_data->query->addrlen = addrlen;
 
@@ -2787,13 +3371,13 @@ handle_tcp_accept(int fd, short event, void* arg)
 		log_msg(LOG_ERR, "cannot set tcp event base");
 		close(s);
 		region_destroy(tcp_region);
-		return;
+		return 1;
 	}
 	if(event_add(&tcp_data->event, &timeout) != 0) {
 		log_msg(LOG_ERR, "cannot add tcp to event base");
 		close(s);
 		region_destroy(tcp_region);
-		return;
+		return 1;
 	}
 
 	/*
@@ -2804,7 +3388,26 @@ handle_tcp_accept(int fd, short event, void* arg)
 	++data->nsd->current_tcp_count;
 	if (data->nsd->current_tcp_count == data->nsd->maximum_tcp_count) {
 		configure_handler_event_types(0);
+		return 0;
 	}
+	return 1;
+}
+
+static void
+handle_tcp_accept(int fd, short event, void* arg)
+{
+	if (!(event & EV_READ)) {
+		return;
+	}
+#ifdef EV_ET
+	/* edge triggered: accept until there are no more connections */
+	while(handle_tcp_accept_one(fd,
+		(struct tcp_accept_handler_data *) arg))
+		;
+#else
+	(void)handle_tcp_accept_one(fd,
+		(struct tcp_accept_handler_data *) arg);
+#endif
 }
 
 static void
@@ -13,13 +13,17 @@
 #include "tpkg/cutest/cutest.h"
 #include "region-allocator.h"
 #include "dname.h"
+#include "buffer.h"
+#include "packet.h"
 
 static void dname_1(CuTest *tc);
+static void dname_packet(CuTest *tc);
 
 CuSuite* reg_cutest_dname(void)
 {
 	CuSuite* suite = CuSuiteNew();
 	SUITE_ADD_TEST(suite, dname_1);
+	SUITE_ADD_TEST(suite, dname_packet);
 	return suite;
 }
 
@@ -110,3 +114,32 @@ dname_1(CuTest *tc)
 
 	region_destroy(region);
 }
+
+/* compression pointers in a buffer that is larger than a packet, like
+ * the RRs of a part of a transfer file */
+static void
+dname_packet(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	size_t size = MAX_PACKET_SIZE*2;
+	buffer_type* packet = buffer_create(region, size);
+	const dname_type* dname;
+	memset(buffer_begin(packet), 0, size);
+	buffer_set_limit(packet, size);
+	memcpy(buffer_at(packet, 12), "\003www\007example\003com", 17);
+	/* a name after the first 64k that points to the start */
+	memcpy(buffer_at(packet, size-100), "\004mail\300\020", 7);
+	buffer_set_position(packet, size-100);
+	dname = dname_make_from_packet(region, packet, 1, 1);
+	CuAssertTrue(tc, dname != NULL);
+	CuAssertTrue(tc, dname_compare(dname, dname_parse(region,
+		"mail.example.com.")) == 0);
+	CuAssertTrue(tc, buffer_position(packet) == size-100+7);
+
+	/* pointers that loop */
+	memcpy(buffer_at(packet, 200), "\300\312\300\310", 4);
+	memcpy(buffer_at(packet, size-50), "\001a\300\310", 4);
+	buffer_set_position(packet, size-50);
+	CuAssertTrue(tc, dname_make_from_packet(region, packet, 1, 1) == NULL);
+	region_destroy(region);
+}
@@ -17,6 +17,7 @@
 #include "options.h"
 #include "namedb.h"
 #include "nsec3.h"
+#include "iterated_hash.h"
 #include "udb.h"
 #include "udbzone.h"
 #include "difffile.h"
@@ -28,6 +29,8 @@ static void namedb_2(CuTest *tc);
 #ifdef NSEC3
 static void namedb_3(CuTest *tc);
 static void namedb_4(CuTest *tc);
+static void namedb_5(CuTest *tc);
+static void namedb_6(CuTest *tc);
 #endif /* NSEC3 */
 static int v = 0; /* verbosity */
 
@@ -43,6 +46,8 @@ CuSuite* reg_cutest_namedb(void)
 #ifdef NSEC3
 	SUITE_ADD_TEST(suite, namedb_3);
 	SUITE_ADD_TEST(suite, namedb_4);
+	SUITE_ADD_TEST(suite, namedb_5);
+	SUITE_ADD_TEST(suite, namedb_6);
 #endif /* NSEC3 */
 	return suite;
 }
@@ -1755,4 +1760,427 @@ static void namedb_4(CuTest *tc)
 	namedb_close(db);
 	region_destroy(region);
 }
+
+/* number of keys in the hash index test, 8 full blocks */
+#define HX_NUM (8*HASH_INDEX_BLOCK)
+/* the keys are 0..HX_KEYS-1, the test starts with the even keys */
+#define HX_KEYS (2*HX_NUM+4)
+
+/* hash for a key, the key in the first bytes, the rest is zero */
+static void
+hx_hash(uint8_t* hash, unsigned k)
+{
+	memset(hash, 0, NSEC3_HASH_LEN);
+	hash[0] = (k>>24)&0xff;
+	hash[1] = (k>>16)&0xff;
+	hash[2] = (k>>8)&0xff;
+	hash[3] = k&0xff;
+}
+
+/* key of an entry in the hash index */
+static unsigned
+hx_key(struct hash_index* x, struct hash_pos* p)
+{
+	uint8_t* h = x->blocks[p->block]->entries[p->idx].hash;
+	return ((unsigned)h[0]<<24) | ((unsigned)h[1]<<16) |
+		((unsigned)h[2]<<8) | (unsigned)h[3];
+}
+
+/* domain for a hash index entry, the index only uses the nsec3 data */
+static domain_type*
+hx_domain(region_type* region)
+{
+	domain_type* d = (domain_type*)region_alloc_zero(region, sizeof(*d));
+	d->nsec3 = (struct nsec3_domain_data*)region_alloc_zero(region,
+		sizeof(*d->nsec3));
+	return d;
+}
+
+static void
+hx_add(struct hash_index** x, region_type* region, domain_type** domains,
+	unsigned k)
+{
+	uint8_t h[NSEC3_HASH_LEN];
+	hx_hash(h, k);
+	zone_add_domain_in_hash_tree(region, x, HASH_INDEX_NSEC3, h,
+		domains[k]);
+}
+
+static void
+hx_del(struct hash_index* x, domain_type** domains, unsigned k)
+{
+	uint8_t h[NSEC3_HASH_LEN];
+	hx_hash(h, k);
+	zone_del_domain_in_hash_tree(x, h, domains[k]);
+}
+
+/* check the hash index against the keys that are in it */
+static void
+hx_check(CuTest* tc, struct hash_index* x, domain_type** domains)
+{
+	struct hash_pos p;
+	size_t i, j, n = 0;
+	unsigned k = 0;
+	for(k=0; k<HX_KEYS; k++)
+		if(domains[k]->nsec3->in_index & HASH_INDEX_NSEC3)
+			n++;
+	CuAssertTrue(tc, x->count == n);
+	/* the blocks are not empty and sorted, and have the keys */
+	k = 0;
+	for(i=0; i<x->num; i++) {
+		CuAssertTrue(tc, x->blocks[i]->count > 0);
+		CuAssertTrue(tc, x->blocks[i]->count <= HASH_INDEX_BLOCK);
+		for(j=0; j<x->blocks[i]->count; j++) {
+			p.block = i;
+			p.idx = j;
+			while(k < HX_KEYS && !(domains[k]->nsec3->in_index &
+				HASH_INDEX_NSEC3))
+				k++;
+			CuAssertTrue(tc, k < HX_KEYS);
+			CuAssertTrue(tc, hx_key(x, &p) == k);
+			CuAssertTrue(tc, hash_index_domain(x, &p) == domains[k]);
+			k++;
+		}
+	}
+	/* walk forwards and backwards */
+	j = 0;
+	for(hash_index_first(x, &p); hash_index_domain(x, &p);
+		hash_index_next(x, &p))
+		j++;
+	CuAssertTrue(tc, j == n);
+	for(hash_index_last(x, &p); hash_index_domain(x, &p);
+		hash_index_prev(x, &p))
+		j--;
+	CuAssertTrue(tc, j == 0);
+}
+
+/* check the predecessor lookup at every block boundary */
+static void
+hx_check_boundaries(CuTest* tc, struct hash_index* x)
+{
+	struct hash_pos p, q;
+	uint8_t h[NSEC3_HASH_LEN];
+	size_t i;
+	unsigned first, last;
+	for(i=1; i<x->num; i++) {
+		p.block = i;
+		p.idx = 0;
+		first = hx_key(x, &p);
+		p.block = i-1;
+		p.idx = x->blocks[i-1]->count-1;
+		last = hx_key(x, &p);
+		/* the first entry of the block itself */
+		hx_hash(h, first);
+		CuAssertTrue(tc, hash_index_find_less_equal(x, h, &q));
+		CuAssertTrue(tc, q.block == i && q.idx == 0);
+		/* just before it is the last entry of the previous block */
+		hx_hash(h, first-1);
+		CuAssertTrue(tc, hash_index_find_less_equal(x, h, &q) ==
+			(last == first-1));
+		CuAssertTrue(tc, q.block == i-1 &&
+			q.idx == x->blocks[i-1]->count-1);
+		hash_index_next(x, &q);
+		CuAssertTrue(tc, q.block == i && q.idx == 0);
+		hash_index_prev(x, &q);
+		CuAssertTrue(tc, q.block == i-1 &&
+			q.idx == x->blocks[i-1]->count-1);
+	}
+}
+
+static void namedb_5(CuTest *tc)
+{
+	/* test _5 : the nsec3 hash index, split and merge of blocks */
+	region_type* region = region_create(xalloc, free);
+	domain_type* domains[HX_KEYS];
+	struct hash_index* x = NULL;
+	struct hash_pos p;
+	uint8_t h[NSEC3_HASH_LEN];
+	unsigned k, i;
+	size_t num;
+	if(v) printf("test namedb-hash-index start\n");
+	for(k=0; k<HX_KEYS; k++)
+		domains[k] = hx_domain(region);
+
+	/* insert in order fills the blocks */
+	for(k=2; k<2*HX_NUM+2; k+=2)
+		hx_add(&x, region, domains, k);
+	CuAssertTrue(tc, x->num == HX_NUM/HASH_INDEX_BLOCK);
+	for(i=0; i<x->num; i++)
+		CuAssertTrue(tc, x->blocks[i]->count == HASH_INDEX_BLOCK);
+	hx_check(tc, x, domains);
+	hx_check_boundaries(tc, x);
+
+	/* smaller than all entries, and larger than all entries */
+	hx_hash(h, 1);
+	CuAssertTrue(tc, !hash_index_find_less_equal(x, h, &p));
+	CuAssertTrue(tc, p.block == x->num && !hash_index_domain(x, &p));
+	hx_hash(h, HX_KEYS);
+	CuAssertTrue(tc, !hash_index_find_less_equal(x, h, &p));
+	CuAssertTrue(tc, hash_index_domain(x, &p) == domains[2*HX_NUM]);
+
+	/* insert in a full block splits it in halves */
+	num = x->num;
+	hx_add(&x, region, domains, 21);
+	CuAssertTrue(tc, x->num == num+1);
+	CuAssertTrue(tc, x->blocks[0]->count == HASH_INDEX_BLOCK/2+1);
+	CuAssertTrue(tc, x->blocks[1]->count == HASH_INDEX_BLOCK/2);
+	hx_check(tc, x, domains);
+	hx_check_boundaries(tc, x);
+	/* append after the last entry, the last block is full, starts a
+	 * new block */
+	hx_add(&x, region, domains, 2*HX_NUM+3);
+	CuAssertTrue(tc, x->num == num+2);
+	CuAssertTrue(tc, x->blocks[x->num-1]->count == 1);
+	hx_check(tc, x, domains);
+	/* insert in the second half of a full block */
+	hx_add(&x, region, domains, 2*HX_NUM-1);
+	CuAssertTrue(tc, x->num == num+3);
+	CuAssertTrue(tc, x->blocks[x->num-3]->count == HASH_INDEX_BLOCK/2);
+	CuAssertTrue(tc, x->blocks[x->num-2]->count == HASH_INDEX_BLOCK/2+1);
+	hx_check(tc, x, domains);
+	hx_check_boundaries(tc, x);
+
+	/* delete from two neighbour blocks until they merge */
+	num = x->num;
+	p.block = 3;
+	p.idx = 0;
+	k = hx_key(x, &p);
+	while(x->blocks[3]->count > HASH_INDEX_BLOCK/4) {
+		hx_del(x, domains, k);
+		k += 2;
+	}
+	CuAssertTrue(tc, x->num == num);
+	p.block = 2;
+	p.idx = 0;
+	k = hx_key(x, &p);
+	while(x->num == num) {
+		CuAssertTrue(tc, x->blocks[2]->count > HASH_INDEX_BLOCK/4);
+		hx_del(x, domains, k);
+		k += 2;
+	}
+	CuAssertTrue(tc, x->num == num-1);
+	CuAssertTrue(tc, x->blocks[2]->count == HASH_INDEX_BLOCK/2);
+	hx_check(tc, x, domains);
+	hx_check_boundaries(tc, x);
+	/* deleting all entries of a block removes it */
+	num = x->num;
+	while(x->blocks[x->num-1]->count > 0 && x->num == num) {
+		hash_index_last(x, &p);
+		hx_del(x, domains, hx_key(x, &p));
+	}
+	CuAssertTrue(tc, x->num == num-1);
+	hx_check(tc, x, domains);
+
+	/* insert and delete random keys */
+	for(i=0; i<20*HX_NUM; i++) {
+		k = (unsigned)(random() % HX_KEYS);
+		if(domains[k]->nsec3->in_index & HASH_INDEX_NSEC3)
+			hx_del(x, domains, k);
+		else	hx_add(&x, region, domains, k);
+		if(i%HASH_INDEX_BLOCK == 0) {
+			hx_check(tc, x, domains);
+			hx_check_boundaries(tc, x);
+		}
+	}
+	hx_check(tc, x, domains);
+	hx_check_boundaries(tc, x);
+	for(k=0; k<HX_KEYS; k++)
+		if(domains[k]->nsec3->in_index & HASH_INDEX_NSEC3)
+			hx_del(x, domains, k);
+	CuAssertTrue(tc, x->num == 0 && x->count == 0);
+	hx_check(tc, x, domains);
+
+	/* the same hash for many domains, over several blocks, the delete
+	 * removes the domain that is asked for */
+	hx_hash(h, 7);
+	for(k=0; k<3*HASH_INDEX_BLOCK; k++)
+		zone_add_domain_in_hash_tree(region, &x, HASH_INDEX_NSEC3, h,
+			domains[k]);
+	CuAssertTrue(tc, x->num == 3);
+	for(k=HASH_INDEX_BLOCK-2; k<2*HASH_INDEX_BLOCK+2; k++) {
+		zone_del_domain_in_hash_tree(x, h, domains[k]);
+		CuAssertTrue(tc, !(domains[k]->nsec3->in_index &
+			HASH_INDEX_NSEC3));
+		CuAssertTrue(tc, x->count == 3*HASH_INDEX_BLOCK-
+			(k-HASH_INDEX_BLOCK+3));
+	}
+	num = 0;
+	for(hash_index_first(x, &p); hash_index_domain(x, &p);
+		hash_index_next(x, &p)) {
+		domain_type* d = hash_index_domain(x, &p);
+		CuAssertTrue(tc, d->nsec3->in_index & HASH_INDEX_NSEC3);
+		num++;
+	}
+	CuAssertTrue(tc, num == x->count);
+	hash_tree_clear(x);
+	CuAssertTrue(tc, x->num == 0 && x->count == 0);
+	for(k=0; k<HX_KEYS; k++)
+		CuAssertTrue(tc, !(domains[k]->nsec3->in_index &
+			HASH_INDEX_NSEC3));
+	hash_tree_delete(region, x);
+
+	if(v) printf("test namedb-hash-index end\n");
+	region_destroy(region);
+}
+
+/* number of names in the zone of namedb_6, more than a thread gets */
+#define NH_NUM 2000
+
+/* the NSEC3 hash of the name, salt abcd and 1 iteration, in base32 */
+static void
+nh_hash(const char* name, uint8_t* hash, char* b32)
+{
+	region_type* region = region_create(xalloc, free);
+	const dname_type* dname = dname_parse(region, name);
+	uint8_t salt[2] = {0xab, 0xcd};
+	(void)iterated_hash(hash, salt, sizeof(salt), dname_name(dname),
+		dname->name_size, 1);
+	if(b32)
+		(void)b32_ntop(hash, NSEC3_HASH_LEN, b32, 64);
+	region_destroy(region);
+}
+
+static int
+nh_cmp(const void* a, const void* b)
+{
+	return memcmp(a, b, NSEC3_HASH_LEN);
+}
+
+/* the zone with a complete NSEC3 chain, a tenth of the names are
+ * delegations */
+static char*
+nh_zone(void)
+{
+	uint8_t (*hashes)[NSEC3_HASH_LEN] = xalloc_array_zero(NH_NUM+1,
+		NSEC3_HASH_LEN);
+	size_t max = 200*(NH_NUM+1), len = 0;
+	char* z = xalloc(max);
+	char name[64], b32[64], next[64];
+	int i;
+	len += snprintf(z+len, max-len,
+		"nsec3.test. IN SOA ns.example.com. hostmaster.example.com. 1 28800 7200 604800 3600\n"
+		"nsec3.test. IN NS ns.example.com.\n"
+		"nsec3.test. IN NSEC3PARAM 1 0 1 abcd\n");
+	nh_hash("nsec3.test.", hashes[NH_NUM], NULL);
+	for(i=0; i<NH_NUM; i++) {
+		snprintf(name, sizeof(name), "%c%d.nsec3.test.",
+			(i%10==0?'d':'h'), i);
+		if(i%10 == 0)
+			len += snprintf(z+len, max-len,
+				"%s IN NS ns.example.com.\n", name);
+		else	len += snprintf(z+len, max-len,
+				"%s IN A 10.0.%d.%d\n", name, i/250, i%250);
+		nh_hash(name, hashes[i], NULL);
+	}
+	qsort(hashes, NH_NUM+1, NSEC3_HASH_LEN, nh_cmp);
+	for(i=0; i<NH_NUM+1; i++) {
+		(void)b32_ntop(hashes[i], NSEC3_HASH_LEN, b32, sizeof(b32));
+		(void)b32_ntop(hashes[(i+1)%(NH_NUM+1)], NSEC3_HASH_LEN, next,
+			sizeof(next));
+		len += snprintf(z+len, max-len,
+			"%s.nsec3.test. IN NSEC3 1 0 1 abcd %s A NS SOA\n", b32,
+			next);
+	}
+	free(hashes);
+	return z;
+}
+
+/* the precompiled NSEC3 data of a domain */
+struct nh_state {
+	domain_type* domain;
+	struct nsec3_domain_data nsec3;
+};
+
+/* store the NSEC3 data of the domains in the zone */
+static size_t
+nh_store(zone_type* zone, struct nh_state* st, size_t max)
+{
+	domain_type* walk;
+	size_t n = 0;
+	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
+		walk = domain_next(walk)) {
+		if(!walk->nsec3 || n == max)
+			continue;
+		st[n].domain = walk;
+		st[n].nsec3 = *walk->nsec3;
+		n++;
+	}
+	return n;
+}
+
+static void namedb_6(CuTest *tc)
+{
+	/* test _6 : the NSEC3 chain hashed with nsec3-hash-threads 1 and 4
+	 * is the same */
+	region_type* region = region_create(xalloc, free);
+	size_t max = 3*NH_NUM, n1, n4, i, exact = 0;
+	struct nh_state* st1 = xalloc_array_zero(max, sizeof(*st1));
+	struct nh_state* st4 = xalloc_array_zero(max, sizeof(*st4));
+	char* ztxt = nh_zone();
+	uint8_t hash[NSEC3_HASH_LEN];
+	struct nsec3_domain_data* a, *b;
+	namedb_type* db;
+	zone_type* zone;
+	if(v) printf("test namedb-hash-threads start\n");
+	db = create_and_read_db(tc, region, "nsec3.test.", ztxt);
+	free(ztxt);
+	zone = find_zone(db, "nsec3.test.");
+	CuAssertTrue(tc, zone && zone->nsec3_param);
+	CuAssertTrue(tc, db->nsec3_hash_threads == 1);
+	n1 = nh_store(zone, st1, max);
+
+	/* hash the zone again with threads */
+	db->nsec3_hash_threads = 4;
+	prehash_zone_complete(db, zone);
+	CuAssertTrue(tc, zone->nsec3_param != NULL);
+	n4 = nh_store(zone, st4, max);
+	CuAssertTrue(tc, n1 == n4 && n1 > NH_NUM);
+	for(i=0; i<n1 && i<n4; i++) {
+		a = &st1[i].nsec3;
+		b = &st4[i].nsec3;
+		CuAssertTrue(tc, st1[i].domain == st4[i].domain);
+		CuAssertTrue(tc, a->nsec3_cover == b->nsec3_cover);
+		CuAssertTrue(tc, a->nsec3_wcard_child_cover ==
+			b->nsec3_wcard_child_cover);
+		CuAssertTrue(tc, a->nsec3_ds_parent_cover ==
+			b->nsec3_ds_parent_cover);
+		CuAssertTrue(tc, a->nsec3_is_exact == b->nsec3_is_exact);
+		CuAssertTrue(tc, a->nsec3_ds_parent_is_exact ==
+			b->nsec3_ds_parent_is_exact);
+		CuAssertTrue(tc, a->have_nsec3_hash == b->have_nsec3_hash);
+		CuAssertTrue(tc, a->have_nsec3_wc_hash ==
+			b->have_nsec3_wc_hash);
+		CuAssertTrue(tc, a->have_nsec3_ds_parent_hash ==
+			b->have_nsec3_ds_parent_hash);
+		if(a->have_nsec3_hash)
+			CuAssertTrue(tc, memcmp(a->nsec3_hash, b->nsec3_hash,
+				NSEC3_HASH_LEN) == 0);
+		if(a->have_nsec3_wc_hash)
+			CuAssertTrue(tc, memcmp(a->nsec3_wc_hash,
+				b->nsec3_wc_hash, NSEC3_HASH_LEN) == 0);
+		if(a->have_nsec3_ds_parent_hash)
+			CuAssertTrue(tc, memcmp(a->nsec3_ds_parent_hash,
+				b->nsec3_ds_parent_hash, NSEC3_HASH_LEN) == 0);
+		if(b->nsec3_is_exact || b->nsec3_ds_parent_is_exact)
+			exact++;
+	}
+	/* the chain is complete, the names have their own NSEC3, for the
+	 * delegations on the parent side */
+	CuAssertTrue(tc, exact == NH_NUM+1);
+	nh_hash("h7.nsec3.test.", hash, NULL);
+	for(i=0; i<n4; i++) {
+		if(strcmp(dname_to_string(domain_dname(st4[i].domain), NULL),
+			"h7.nsec3.test.") == 0)
+			CuAssertTrue(tc, st4[i].nsec3.have_nsec3_hash &&
+				memcmp(st4[i].nsec3.nsec3_hash, hash,
+				NSEC3_HASH_LEN) == 0);
+	}
+
+	if(v) printf("test namedb-hash-threads end\n");
+	free(st1);
+	free(st4);
+	unlink(db->udb->fname);
+	namedb_close(db);
+	region_destroy(region);
+}
 #endif /* NSEC3 */
@@ -63,16 +63,24 @@ static size_t test_check_invariants(struct radnode* n)
 	} else {
 		unsigned idx;
 		CuAssert(tc, "invariant nonempty cap", n->capacity != 0);
+		if(n->sparse) {
+			CuAssert(tc, "invariant sparse len",
+				n->len <= RADNODE_SPARSE_MAX);
+			CuAssert(tc, "invariant sparse offset", n->offset == 0);
+		}
 		for(idx=0; idx<n->len; idx++) {
 			struct radsel* r = &n->array[idx];
+			if(n->sparse && idx > 0) {
+				CuAssert(tc, "invariant sparse sorted",
+					n->array[idx-1].byte < r->byte);
+			}
 			if(r->node == NULL) {
-				CuAssert(tc, "empty node", r->str == NULL);
+				CuAssert(tc, "empty node", !n->sparse);
 				CuAssert(tc, "empty node", r->len == 0);
 			} else {
-				if(r->len == 0) {
-					CuAssert(tc, "emptystr", r->str == NULL);
-				} else {
-					CuAssert(tc, "filledstr", r->str != NULL);
+				if(r->len != 0) {
+					CuAssert(tc, "filledstr",
+						radsel_str(r) != NULL);
 				}
 				CuAssert(tc, "invariant parent", r->node->parent == n);
 				CuAssert(tc, "invariant pidx", r->node->pidx == idx);
@@ -109,10 +117,10 @@ test_check_list_keys(struct radnode* n, struct teststr** all, size_t* all_idx,
 			continue;
 		/* lengthen fullkey with the character and r->str */
 		CuAssert(tc, "testkey len", newlen+1 < fullkey_max);
-		fullkey[newlen++] = idx + n->offset;
+		fullkey[newlen++] = radnode_idx_byte(n, idx);
 		if(r->len != 0) {
 			CuAssert(tc, "testkey len", newlen+r->len < fullkey_max);
-			memmove(fullkey+newlen, r->str, r->len);
+			memmove(fullkey+newlen, radsel_str(r), r->len);
 			newlen += r->len;
 		}
 		test_check_list_keys(r->node, all, all_idx, all_num, fullkey,
@@ -470,13 +478,14 @@ static void test_node_print(struct radnode* n, int depth)
 	for(i=0; i<depth; i++) fprintf(stderr, " ");
 	if(n->parent)
 		fprintf(stderr, "%c node=%p.", 
-			n->pidx+n->parent->offset?n->pidx+n->parent->offset:'.',
-			n);
+			radnode_idx_byte(n->parent, n->pidx)?
+			radnode_idx_byte(n->parent, n->pidx):'.', n);
 	else
 		fprintf(stderr, "rootnode=%p.", n);
-	fprintf(stderr, " pidx=%d off=%d(%c) len=%d cap=%d parent=%p\n",
-		n->pidx, n->offset, isprint(n->offset)?n->offset:'.',
-		n->len, n->capacity, n->parent);
+	fprintf(stderr, " pidx=%d off=%d(%c) len=%d cap=%d sparse=%d "
+		"parent=%p\n", n->pidx, n->offset,
+		isprint(n->offset)?n->offset:'.', n->len, n->capacity,
+		n->sparse, n->parent);
 	for(i=0; i<depth; i++) fprintf(stderr, " ");
 	if(n->elem) {
 		/* for test setup */
@@ -489,20 +498,16 @@ static void test_node_print(struct radnode* n, int depth)
 	for(idx=0; idx<n->len; idx++) {
 		struct radsel* d = &n->array[idx];
 		if(!d->node) {
-			CuAssert(tc, "print", d->str == NULL);
 			CuAssert(tc, "print", d->len == 0);
 			continue;
 		}
 		for(i=0; i<depth; i++) fprintf(stderr, " ");
-		if(n->offset+idx == 0) fprintf(stderr, "[.]");
-		else fprintf(stderr, "[%c]", n->offset + idx);
-		if(d->str) {
+		if(radnode_idx_byte(n, idx) == 0) fprintf(stderr, "[.]");
+		else fprintf(stderr, "[%c]", radnode_idx_byte(n, idx));
+		if(d->len != 0) {
 			fprintf(stderr, "+'");
-			test_print_str(d->str, d->len);
+			test_print_str(radsel_str(d), d->len);
 			fprintf(stderr, "'");
-			CuAssert(tc, "print", d->len != 0);
-		} else {
-			CuAssert(tc, "print", d->len == 0);
 		}
 		if(d->node) {
 			fprintf(stderr, " node=%p\n", d->node);
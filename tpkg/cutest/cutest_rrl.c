@@ -15,12 +15,18 @@
 
 #ifdef RATELIMIT
 static void rrl_1(CuTest *tc);
+#if defined(HAVE_MMAP) && defined(HAVE_SYNC_COMPARE_AND_SWAP)
+static void rrl_shared_1(CuTest *tc);
+#endif
 
 CuSuite* reg_cutest_rrl(void)
 {
         CuSuite* suite = CuSuiteNew();
 
 	SUITE_ADD_TEST(suite, rrl_1);
+#if defined(HAVE_MMAP) && defined(HAVE_SYNC_COMPARE_AND_SWAP)
+	SUITE_ADD_TEST(suite, rrl_shared_1);
+#endif
 	return suite;
 }
 
@@ -70,4 +76,49 @@ static void rrl_1(CuTest *tc)
 	now += 1;
 	CuAssert(tc, "rrl time check", rate/4+1 == rrl_update(&q, hash, source, c, now, m));
 }
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYNC_COMPARE_AND_SWAP)
+static void rrl_shared_1(CuTest *tc)
+{
+	query_type q;
+	uint64_t source = 0x100;
+	uint32_t now = 123;
+	uint32_t hash = 0x743;
+	uint16_t c = rrl_type_nxdomain;
+	uint32_t i;
+	uint32_t rate = 200;
+	uint32_t m = 400; /* ratelimit */
+	memset(&q, 0, sizeof(q));
+
+	/* 16 buckets, in 4 sets */
+	rrl_mmap_init(2, 16, 200, 2000, 2, 24, 64, 1);
+	rrl_init(0);
+
+	CuAssert(tc, "rrl 1st query", 1 == rrl_update(&q, hash, source, c, now, m));
+	for(i=1; i<rate; i++) {
+		CuAssert(tc, "rrl rate check", i+1 == rrl_update(&q, hash, source, c, now, m));
+	}
+
+	/* next second, again that many queries. */
+	now++;
+	for(i=0; i<rate-1; i++) {
+		rrl_update(&q, hash, source, c, now, m);
+	}
+	CuAssert(tc, "rrl rate(t+1) check", rate+rate/2 == rrl_update(&q, hash, source, c, now, m));
+
+	/* the other children use the same table */
+	rrl_init(1);
+	CuAssert(tc, "rrl shared check", rate+rate/2+1 == rrl_update(&q, hash, source, c, now, m));
+
+	/* other sources in the same set do not reset the busy bucket */
+	for(i=1; i<=8; i++) {
+		CuAssert(tc, "rrl set check", 1 == rrl_update(&q, hash+i*4, source+i, c, now, m));
+	}
+	CuAssert(tc, "rrl busy check", rate+rate/2+2 == rrl_update(&q, hash, source, c, now, m));
+
+	/* three seconds pass /8 rate */
+	now += 3;
+	CuAssert(tc, "rrl rate(t+4) check", rate/8+(rate+2)/4 == rrl_update(&q, hash, source, c, now, m));
+}
+#endif
 #endif /* RATELIMIT */
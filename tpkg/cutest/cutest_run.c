@@ -24,6 +24,8 @@ CuSuite * reg_cutest_region(void);
 CuSuite * reg_cutest_udb(void);
 CuSuite * reg_cutest_udb_radtree(void);
 CuSuite * reg_cutest_namedb(void);
+CuSuite * reg_cutest_xfrd_disk(void);
+CuSuite * reg_cutest_zonec(void);
 #ifdef RATELIMIT
 CuSuite * reg_cutest_rrl(void);
 #endif
@@ -66,10 +68,12 @@ int runalltests(void)
 	CuSuiteAddSuite(suite, reg_cutest_rbtree());
 	CuSuiteAddSuite(suite, reg_cutest_util());
 	CuSuiteAddSuite(suite, reg_cutest_iterated_hash());
+	CuSuiteAddSuite(suite, reg_cutest_zonec());
 #ifdef HAVE_MMAP
 	CuSuiteAddSuite(suite, reg_cutest_udb());
 	CuSuiteAddSuite(suite, reg_cutest_udb_radtree());
 	CuSuiteAddSuite(suite, reg_cutest_namedb());
+	CuSuiteAddSuite(suite, reg_cutest_xfrd_disk());
 #endif
 #ifdef RATELIMIT
 	CuSuiteAddSuite(suite, reg_cutest_rrl());
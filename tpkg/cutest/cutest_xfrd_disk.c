@@ -0,0 +1,453 @@
+/*
+	test xfrd-disk.h, the xfrd state file
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tpkg/cutest/cutest.h"
+#include "xfrd.h"
+#include "xfrd-disk.h"
+#include "options.h"
+#include "nsd.h"
+
+static void xfrd_disk_1(CuTest *tc);
+static void xfrd_disk_2(CuTest *tc);
+static void xfrd_disk_3(CuTest *tc);
+static void xfrd_disk_4(CuTest *tc);
+static void xfrd_disk_5(CuTest *tc);
+static void xfrd_disk_6(CuTest *tc);
+
+CuSuite* reg_cutest_xfrd_disk(void)
+{
+	CuSuite* suite = CuSuiteNew();
+	SUITE_ADD_TEST(suite, xfrd_disk_1); /* write and read back */
+	SUITE_ADD_TEST(suite, xfrd_disk_2); /* append and rewrite */
+	SUITE_ADD_TEST(suite, xfrd_disk_3); /* truncated last record */
+	SUITE_ADD_TEST(suite, xfrd_disk_4); /* corrupt record */
+	SUITE_ADD_TEST(suite, xfrd_disk_5); /* text file to binary */
+	SUITE_ADD_TEST(suite, xfrd_disk_6); /* write in place */
+	return suite;
+}
+
+#define NUM_ZONES 3
+static const char* zone_names[NUM_ZONES] = {
+	"example.com.", "example.net.", "sub.example.org." };
+
+static struct nsd xnsd;
+/* the time of the tests, the same for all of them */
+static time_t test_now = 0;
+
+/* the size of the state file, or -1 if it does not exist */
+static long
+state_file_size(const char* statefile)
+{
+	struct stat st;
+	if(stat(statefile, &st) == -1)
+		return -1;
+	return (long)st.st_size;
+}
+
+/* create an xfrd with the test zones, as if the SOAs from NSD are
+ * received and the state file is about to be read */
+static void
+fake_xfrd(region_type* region, const char* statefile)
+{
+	pattern_options_t* pat;
+	int i;
+	memset(&xnsd, 0, sizeof(xnsd));
+	xnsd.options = nsd_options_create(region);
+	xnsd.options->xfrdfile = statefile;
+	pat = pattern_options_create(region);
+	pat->pname = "testpattern";
+	(void)nsd_options_insert_pattern(xnsd.options, pat);
+	for(i=0; i<NUM_ZONES; i++) {
+		zone_options_t* zopt = zone_options_create(region);
+		zopt->name = zone_names[i];
+		zopt->pattern = pat;
+		(void)nsd_options_insert_zone(xnsd.options, zopt);
+	}
+
+	xfrd = (xfrd_state_t*)region_alloc_zero(region, sizeof(xfrd_state_t));
+	xfrd->region = region;
+	xfrd->nsd = &xnsd;
+	/* the event base is not freed, events of earlier tests point to
+	 * their freed regions */
+	xfrd->event_base = nsd_child_event_base();
+	if(!test_now)
+		test_now = time(NULL);
+	xfrd->current_time = test_now;
+	xfrd->got_time = 1;
+	xfrd->wheel = (struct xfrd_wheel*)region_alloc_zero(region,
+		sizeof(struct xfrd_wheel));
+	xfrd->wheel->now = xfrd_time();
+	xfrd->state_rewrite = 1;
+	xfrd->zones = rbtree_create(region,
+		(int (*)(const void *, const void *)) dname_compare);
+	xfrd->notify_zones = rbtree_create(region,
+		(int (*)(const void *, const void *)) dname_compare);
+	for(i=0; i<NUM_ZONES; i++) {
+		xfrd_zone_t* zone;
+		const dname_type* d = dname_parse(region, zone_names[i]);
+		xfrd_init_slave_zone(xfrd, (zone_options_t*)rbtree_search(
+			xnsd.options->zone_options, d));
+		zone = (xfrd_zone_t*)rbtree_search(xfrd->zones, d);
+		/* the zone is loaded in NSD with serial 10+i */
+		zone->soa_nsd.type = htons(TYPE_SOA);
+		zone->soa_nsd.klass = htons(CLASS_IN);
+		zone->soa_nsd.serial = htonl(10+i);
+		zone->soa_nsd.refresh = htonl(3600);
+		zone->soa_nsd.retry = htonl(600);
+		zone->soa_nsd.expire = htonl(864000);
+		zone->soa_nsd_acquired = xfrd_time() - 10;
+	}
+	/* the init of the zones has marked them changed */
+	while(xfrd->state_dirty_first)
+		xfrd_state_clean(xfrd->state_dirty_first);
+}
+
+static xfrd_zone_t*
+find_zone(const char* name)
+{
+	return (xfrd_zone_t*)rbtree_search(xfrd->zones,
+		dname_parse(xfrd->region, name));
+}
+
+/* give the zone a disk SOA and a notified SOA, derived from n */
+static void
+set_zone_state(xfrd_zone_t* zone, uint32_t n)
+{
+	zone->soa_disk = zone->soa_nsd;
+	zone->soa_disk.serial = htonl(n);
+	zone->soa_disk.email[0] = 5;
+	memcpy(zone->soa_disk.email+1, "\003abc\000", 5);
+	zone->soa_disk_acquired = xfrd_time() - 5;
+	zone->soa_notified = zone->soa_disk;
+	zone->soa_notified.serial = htonl(n+1);
+	zone->soa_notified_acquired = xfrd_time() - 2;
+	zone->round_num = (int)n;
+}
+
+/* check that the zone has the disk and notified SOA derived from n */
+static void
+check_zone_state(CuTest* tc, xfrd_zone_t* zone, uint32_t n)
+{
+	CuAssert(tc, "soa_disk serial", ntohl(zone->soa_disk.serial) == n);
+	CuAssert(tc, "soa_disk email", zone->soa_disk.email[0] == 5 &&
+		memcmp(zone->soa_disk.email+1, "\003abc\000", 5) == 0);
+	CuAssert(tc, "soa_notified serial",
+		ntohl(zone->soa_notified.serial) == n+1);
+	CuAssert(tc, "soa_notified acquired",
+		zone->soa_notified_acquired == xfrd_time() - 2);
+}
+
+static void
+write_all_zones(region_type* region, const char* statefile)
+{
+	int i;
+	fake_xfrd(region, statefile);
+	for(i=0; i<NUM_ZONES; i++)
+		set_zone_state(find_zone(zone_names[i]), 100+i);
+	xfrd_write_state(xfrd);
+}
+
+static char*
+temp_state_file(void)
+{
+	char buf[1024];
+	snprintf(buf, sizeof(buf), "/tmp/unitxfrdstate%u", (unsigned)getpid());
+	return strdup(buf);
+}
+
+static void
+xfrd_disk_1(CuTest *tc)
+{
+	char* statefile = temp_state_file();
+	region_type* region = region_create(xalloc, free);
+	int i;
+	long sz;
+
+	write_all_zones(region, statefile);
+	CuAssert(tc, "written", xfrd->state_rewrite == 0);
+	CuAssert(tc, "records", xfrd->state_records == NUM_ZONES);
+	sz = state_file_size(statefile);
+	CuAssert(tc, "file size", sz > (long)sizeof(XFRD_BIN_MAGIC));
+	region_destroy(region);
+
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "can append", xfrd->state_rewrite == 0);
+	CuAssert(tc, "records read", xfrd->state_records == NUM_ZONES);
+	for(i=0; i<NUM_ZONES; i++)
+		check_zone_state(tc, find_zone(zone_names[i]), 100+i);
+	CuAssert(tc, "file unchanged", state_file_size(statefile) == sz);
+	region_destroy(region);
+	unlink(statefile);
+	free(statefile);
+}
+
+static void
+xfrd_disk_2(CuTest *tc)
+{
+	char* statefile = temp_state_file();
+	region_type* region = region_create(xalloc, free);
+	xfrd_zone_t* zone;
+	long sz, recsz;
+	uint32_t n;
+
+	write_all_zones(region, statefile);
+	sz = state_file_size(statefile);
+
+	/* a changed zone is appended */
+	zone = find_zone("example.net.");
+	set_zone_state(zone, 200);
+	xfrd_state_dirty(zone);
+	xfrd_write_state(xfrd);
+	recsz = state_file_size(statefile) - sz;
+	CuAssert(tc, "appended", recsz > 0);
+	CuAssert(tc, "append records", xfrd->state_records == NUM_ZONES+1);
+
+	/* until the records of changed zones are more than half the file */
+	for(n = 201; xfrd->state_records + 1 <= 2*NUM_ZONES; n++) {
+		size_t before = xfrd->state_records;
+		set_zone_state(zone, n);
+		xfrd_state_dirty(zone);
+		xfrd_write_state(xfrd);
+		CuAssert(tc, "append more", xfrd->state_records == before+1);
+		CuAssert(tc, "append size", state_file_size(statefile) ==
+			sz + (long)(xfrd->state_records-NUM_ZONES)*recsz);
+	}
+	set_zone_state(zone, n);
+	xfrd_state_dirty(zone);
+	xfrd_write_state(xfrd);
+	CuAssert(tc, "compacted", xfrd->state_records == NUM_ZONES);
+	CuAssert(tc, "compacted size", state_file_size(statefile) == sz);
+	region_destroy(region);
+
+	/* the last record of the zone counts */
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	check_zone_state(tc, find_zone("example.com."), 100);
+	check_zone_state(tc, find_zone("example.net."), n);
+	check_zone_state(tc, find_zone("sub.example.org."), 102);
+	region_destroy(region);
+
+	/* and it also counts when it is appended */
+	region = region_create(xalloc, free);
+	write_all_zones(region, statefile);
+	zone = find_zone("example.com.");
+	set_zone_state(zone, 300);
+	xfrd_state_dirty(zone);
+	xfrd_write_state(xfrd);
+	region_destroy(region);
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "appended records read",
+		xfrd->state_records == NUM_ZONES+1);
+	check_zone_state(tc, find_zone("example.com."), 300);
+	check_zone_state(tc, find_zone("example.net."), 101);
+	region_destroy(region);
+	unlink(statefile);
+	free(statefile);
+}
+
+static void
+xfrd_disk_3(CuTest *tc)
+{
+	char* statefile = temp_state_file();
+	region_type* region = region_create(xalloc, free);
+	xfrd_zone_t* zone;
+	long sz;
+
+	write_all_zones(region, statefile);
+	sz = state_file_size(statefile);
+	zone = find_zone("example.net.");
+	set_zone_state(zone, 400);
+	xfrd_state_dirty(zone);
+	xfrd_write_state(xfrd);
+	CuAssert(tc, "appended", state_file_size(statefile) > sz);
+	region_destroy(region);
+
+	/* the appended record is cut off, as if the write stopped */
+	CuAssert(tc, "truncate", truncate(statefile,
+		(off_t)(state_file_size(statefile) - 3)) == 0);
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "no append after partial record",
+		xfrd->state_rewrite == 1);
+	CuAssert(tc, "complete records", xfrd->state_records == NUM_ZONES);
+	check_zone_state(tc, find_zone("example.net."), 101);
+	check_zone_state(tc, find_zone("example.com."), 100);
+
+	/* the next write replaces the file */
+	xfrd_write_state(xfrd);
+	CuAssert(tc, "rewritten", xfrd->state_rewrite == 0 &&
+		xfrd->state_records == NUM_ZONES);
+	region_destroy(region);
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "rewritten: append", xfrd->state_rewrite == 0 &&
+		xfrd->state_records == NUM_ZONES);
+	CuAssert(tc, "rewritten: notified", ntohl(find_zone("example.net.")->
+		soa_notified.serial) == 101+1);
+	region_destroy(region);
+	unlink(statefile);
+	free(statefile);
+}
+
+static void
+xfrd_disk_4(CuTest *tc)
+{
+	char* statefile = temp_state_file();
+	region_type* region = region_create(xalloc, free);
+	FILE* f;
+	long pos;
+	uint8_t buf[4];
+
+	write_all_zones(region, statefile);
+	region_destroy(region);
+
+	/* the name of the second record gets a label that goes past the
+	 * name length; the zones are in canonical order, the first record
+	 * is example.com. */
+	f = fopen(statefile, "r+");
+	CuAssert(tc, "open", f != NULL);
+	CuAssert(tc, "seek", fseek(f, (long)sizeof(XFRD_BIN_MAGIC)-1,
+		SEEK_SET) == 0);
+	CuAssert(tc, "read", fread(buf, 2, 1, f) == 1);
+	pos = (long)sizeof(XFRD_BIN_MAGIC)-1 + 2 + (buf[0]<<8 | buf[1]);
+	/* the name length byte, then the first label length */
+	CuAssert(tc, "seek2", fseek(f, pos+2+1, SEEK_SET) == 0);
+	buf[0] = 60;
+	CuAssert(tc, "write", fwrite(buf, 1, 1, f) == 1);
+	fclose(f);
+
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "corrupt: no append", xfrd->state_rewrite == 1);
+	CuAssert(tc, "corrupt: records before it", xfrd->state_records == 1);
+	check_zone_state(tc, find_zone("example.com."), 100);
+	CuAssert(tc, "corrupt: not read",
+		find_zone("example.net.")->soa_disk_acquired == 0);
+	region_destroy(region);
+
+	/* a record with a bad name length */
+	region = region_create(xalloc, free);
+	write_all_zones(region, statefile);
+	region_destroy(region);
+	f = fopen(statefile, "r+");
+	CuAssert(tc, "open", f != NULL);
+	CuAssert(tc, "seek", fseek(f, (long)sizeof(XFRD_BIN_MAGIC)-1+2,
+		SEEK_SET) == 0);
+	buf[0] = 3;
+	CuAssert(tc, "write", fwrite(buf, 1, 1, f) == 1);
+	fclose(f);
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "bad len: no append", xfrd->state_rewrite == 1);
+	CuAssert(tc, "bad len: no records", xfrd->state_records == 0);
+	region_destroy(region);
+	unlink(statefile);
+	free(statefile);
+}
+
+static void
+xfrd_disk_5(CuTest *tc)
+{
+	char* statefile = temp_state_file();
+	region_type* region = region_create(xalloc, free);
+	char magic[sizeof(XFRD_BIN_MAGIC)-1];
+	xfrd_zone_t* zone;
+	time_t now;
+	FILE* f;
+
+	/* the text file that older versions write */
+	region_type* tmp = region_create(xalloc, free);
+	fake_xfrd(tmp, statefile);
+	now = xfrd_time();
+	region_destroy(tmp);
+	f = fopen(statefile, "w");
+	CuAssert(tc, "open", f != NULL);
+	fprintf(f, "%s\n", XFRD_FILE_MAGIC);
+	fprintf(f, "# This file is written on exit by nsd xfr daemon.\n");
+	fprintf(f, "filetime: %d\n\n", (int)now);
+	fprintf(f, "numzones: 1\n\n");
+	fprintf(f, "zone: \tname: example.net.\n");
+	fprintf(f, "\tstate: 0\n\tmaster: 0\n\tnext_master: 0\n");
+	fprintf(f, "\tround_num: 7\n\tnext_timeout: 3600\n");
+	fprintf(f, "\tsoa_nsd_acquired: %d\n", (int)now - 10);
+	fprintf(f, "\tsoa_nsd: 6 1 3600 7 . . 11 3600 600 864000 3600\n");
+	fprintf(f, "\tsoa_disk_acquired: %d\n", (int)now - 5);
+	fprintf(f, "\tsoa_disk: 6 1 3600 7 . abc. 500 3600 600 864000 "
+		"3600\n");
+	fprintf(f, "\tsoa_notify_acquired: %d\n", (int)now - 2);
+	fprintf(f, "\tsoa_notify: 6 1 3600 7 . abc. 501 3600 600 864000 "
+		"3600\n");
+	fprintf(f, "\n%s\n", XFRD_FILE_MAGIC);
+	fclose(f);
+
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	check_zone_state(tc, find_zone("example.net."), 500);
+	CuAssert(tc, "text: rewrite", xfrd->state_rewrite == 1);
+
+	/* the first write converts it to the binary format */
+	xfrd_write_state(xfrd);
+	f = fopen(statefile, "r");
+	CuAssert(tc, "open", f != NULL);
+	CuAssert(tc, "magic", fread(magic, sizeof(magic), 1, f) == 1 &&
+		memcmp(magic, XFRD_BIN_MAGIC, sizeof(magic)) == 0);
+	fclose(f);
+	region_destroy(region);
+
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "binary: append", xfrd->state_rewrite == 0);
+	/* the disk SOA was not acquired again, it is not written, the
+	 * notified SOA is kept */
+	zone = find_zone("example.net.");
+	CuAssert(tc, "binary: notified", ntohl(zone->soa_notified.serial)
+		== 501 && zone->soa_notified_acquired == xfrd_time() - 2);
+	region_destroy(region);
+	unlink(statefile);
+	free(statefile);
+}
+
+static void
+xfrd_disk_6(CuTest *tc)
+{
+	char* statefile = temp_state_file();
+	char tmpfile[1024];
+	region_type* region = region_create(xalloc, free);
+	int i;
+
+	/* the new file cannot be created, the file is written in place */
+	snprintf(tmpfile, sizeof(tmpfile), "%s.new", statefile);
+	CuAssert(tc, "mkdir", mkdir(tmpfile, 0700) == 0);
+	write_all_zones(region, statefile);
+	CuAssert(tc, "in place: written", xfrd->state_rewrite == 0 &&
+		xfrd->state_records == NUM_ZONES);
+	region_destroy(region);
+	CuAssert(tc, "rmdir", rmdir(tmpfile) == 0);
+
+	region = region_create(xalloc, free);
+	fake_xfrd(region, statefile);
+	xfrd_read_state(xfrd);
+	CuAssert(tc, "in place: append", xfrd->state_rewrite == 0);
+	for(i=0; i<NUM_ZONES; i++)
+		check_zone_state(tc, find_zone(zone_names[i]), 100+i);
+	region_destroy(region);
+	unlink(statefile);
+	free(statefile);
+}
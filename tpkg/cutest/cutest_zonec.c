@@ -0,0 +1,519 @@
+/*
+	test zone file parse, zlexer.c and zparser.y
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tpkg/cutest/cutest.h"
+#include "region-allocator.h"
+#include "options.h"
+#include "namedb.h"
+#include "rdata.h"
+#include "zonec.h"
+#include "nsd.h"
+
+static void zonec_escapes(CuTest *tc);
+static void zonec_include(CuTest *tc);
+static void zonec_parens(CuTest *tc);
+static void zonec_quoted(CuTest *tc);
+static void zonec_eof(CuTest *tc);
+static void zonec_chunks(CuTest *tc);
+static void zonec_parsed(CuTest *tc);
+
+/** get a temporary file name */
+char* udbtest_get_temp_file(char* suffix);
+
+CuSuite* reg_cutest_zonec(void)
+{
+	CuSuite* suite = CuSuiteNew();
+
+	SUITE_ADD_TEST(suite, zonec_escapes);
+	SUITE_ADD_TEST(suite, zonec_include);
+	SUITE_ADD_TEST(suite, zonec_parens);
+	SUITE_ADD_TEST(suite, zonec_quoted);
+	SUITE_ADD_TEST(suite, zonec_eof);
+	SUITE_ADD_TEST(suite, zonec_chunks);
+	SUITE_ADD_TEST(suite, zonec_parsed);
+	return suite;
+}
+
+/** write text to a file */
+static void
+write_file(const char* fname, const char* txt)
+{
+	FILE* out = fopen(fname, "w");
+	if(!out) {
+		printf("failed to write %s: %s\n", fname, strerror(errno));
+		exit(1);
+	}
+	fprintf(out, "%s", txt);
+	fclose(out);
+}
+
+/** create an empty db with the zone */
+static zone_type*
+open_zone(struct nsd* nsd, const char* name)
+{
+	const dname_type* dname;
+	zone_options_t* zo;
+
+	nsd->options = nsd_options_create(region_create(xalloc, free));
+	nsd->db = namedb_open("", nsd->options);
+	dname = dname_parse(nsd->options->region, name);
+	zo = zone_options_create(nsd->options->region);
+	memset(zo, 0, sizeof(*zo));
+	zo->node.key = dname;
+	zo->name = name;
+	return namedb_zone_create(nsd->db, dname, zo);
+}
+
+/** parse the zone file, like nsd-checkzone, returns number of errors */
+static unsigned
+read_zone(struct nsd* nsd, const char* name, const char* zonefile,
+	zone_type** zone)
+{
+	*zone = open_zone(nsd, name);
+	return zonec_read(name, zonefile, *zone);
+}
+
+/** parse the zone text, with the file ending as given */
+static unsigned
+read_zone_text(struct nsd* nsd, const char* name, const char* ztxt,
+	zone_type** zone)
+{
+	char* zonefile = udbtest_get_temp_file("zonec.zone");
+	unsigned errors;
+	write_file(zonefile, ztxt);
+	errors = read_zone(nsd, name, zonefile, zone);
+	unlink(zonefile);
+	free(zonefile);
+	return errors;
+}
+
+static void
+close_zone(struct nsd* nsd)
+{
+	region_type* region = nsd->options->region;
+	namedb_close(nsd->db);
+	region_destroy(region);
+	nsd->db = NULL;
+	nsd->options = NULL;
+}
+
+/** check that owner has an RR of the type with the rdata in text */
+static void
+check_rr(CuTest* tc, struct nsd* nsd, zone_type* zone, const char* owner,
+	uint16_t type, const char* rdata)
+{
+	region_type* region = region_create(xalloc, free);
+	buffer_type* buf = buffer_create(region, MAX_RDLENGTH*4);
+	const dname_type* dname = dname_parse(region, owner);
+	domain_type* domain;
+	rrset_type* rrset;
+	size_t i;
+	int found = 0;
+	CuAssertTrue(tc, dname != NULL);
+	domain = domain_table_find(nsd->db->domains, dname);
+	if(!domain) {
+		printf("no domain %s\n", owner);
+		CuAssertTrue(tc, 0);
+	}
+	rrset = domain_find_rrset(domain, zone, type);
+	if(!rrset) {
+		printf("no type %d at %s\n", (int)type, owner);
+		CuAssertTrue(tc, 0);
+	}
+	for(i = 0; i < rrset->rr_count; i++) {
+		buffer_clear(buf);
+		CuAssertTrue(tc, print_rdata(buf,
+			rrtype_descriptor_by_type(type), &rrset->rrs[i]));
+		buffer_write_u8(buf, 0);
+		/* skip the tab that print_rdata starts with */
+		if(strcmp((char*)buffer_at(buf, 1), rdata) == 0)
+			found = 1;
+	}
+	if(!found) {
+		printf("%s type %d has no rdata '%s'\n", owner, (int)type,
+			rdata);
+		for(i = 0; i < rrset->rr_count; i++) {
+			buffer_clear(buf);
+			(void)print_rdata(buf, rrtype_descriptor_by_type(type),
+				&rrset->rrs[i]);
+			buffer_write_u8(buf, 0);
+			printf("  has '%s'\n", (char*)buffer_at(buf, 1));
+		}
+	}
+	CuAssertTrue(tc, found);
+	region_destroy(region);
+}
+
+static void
+zonec_escapes(CuTest *tc)
+{
+	struct nsd nsd;
+	zone_type* zone;
+	memset(&nsd, 0, sizeof(nsd));
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"$TTL 3600\n"
+		"@ IN SOA ns host\\.master 1 3600 900 86400 300\n"
+		"a\\.b TXT \"q\\\"uote\" back\\\\slash \\065\\066C\n"
+		"sp\\032ace\\; A 192.0.2.1\n"
+		"semi TXT a\\;b ;real comment\n"
+		"par TXT a\\(b\\) \"c;d\"\n",
+		&zone) == 0);
+	check_rr(tc, &nsd, zone, "example.com.", TYPE_SOA,
+		"ns.example.com. host\\.master.example.com. (\n"
+		"\t\t1 3600 900 86400 300 )");
+	check_rr(tc, &nsd, zone, "a\\.b.example.com.", TYPE_TXT,
+		"\"q\\\"uote\" \"back\\\\slash\" \"ABC\"");
+	check_rr(tc, &nsd, zone, "sp\\032ace\\;.example.com.", TYPE_A,
+		"192.0.2.1");
+	check_rr(tc, &nsd, zone, "semi.example.com.", TYPE_TXT, "\"a;b\"");
+	check_rr(tc, &nsd, zone, "par.example.com.", TYPE_TXT,
+		"\"a(b)\" \"c;d\"");
+	close_zone(&nsd);
+}
+
+static void
+zonec_include(CuTest *tc)
+{
+	struct nsd nsd;
+	zone_type* zone;
+	char* inc1 = udbtest_get_temp_file("zonec.inc1");
+	char* inc2 = udbtest_get_temp_file("zonec.inc2");
+	char ztxt[1024];
+	memset(&nsd, 0, sizeof(nsd));
+	write_file(inc1, "host A 192.0.2.3\n"
+		"$ORIGIN deeper.example.com.\n"
+		"x A 192.0.2.4\n");
+	/* without the newline at the end of the included file */
+	write_file(inc2, "@ A 192.0.2.5");
+	snprintf(ztxt, sizeof(ztxt),
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n"
+		"$INCLUDE %s sub.example.com.\n"
+		"www A 192.0.2.2\n"
+		"$INCLUDE %s ; the origin stays\n"
+		"after A 192.0.2.6\n", inc1, inc2);
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com", ztxt, &zone)
+		== 0);
+	check_rr(tc, &nsd, zone, "host.sub.example.com.", TYPE_A,
+		"192.0.2.3");
+	check_rr(tc, &nsd, zone, "x.deeper.example.com.", TYPE_A,
+		"192.0.2.4");
+	/* origin is restored after the include */
+	check_rr(tc, &nsd, zone, "www.example.com.", TYPE_A, "192.0.2.2");
+	check_rr(tc, &nsd, zone, "example.com.", TYPE_A, "192.0.2.5");
+	check_rr(tc, &nsd, zone, "after.example.com.", TYPE_A, "192.0.2.6");
+	close_zone(&nsd);
+
+	/* a missing include file is an error */
+	unlink(inc2);
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com", ztxt, &zone)
+		!= 0);
+	close_zone(&nsd);
+	unlink(inc1);
+	free(inc1);
+	free(inc2);
+}
+
+static void
+zonec_parens(CuTest *tc)
+{
+	struct nsd nsd;
+	zone_type* zone;
+	memset(&nsd, 0, sizeof(nsd));
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"$TTL 3600\n"
+		"@ IN SOA ns.example.com. admin.example.com. (\n"
+		"\t\t2014010101 ; serial\n"
+		"\t\t3600       ; refresh (with parens in the comment)\n"
+		"\n"
+		"\t\t900 86400\n"
+		"\t\t300 )\n"
+		"txt TXT ( \"first\" ; comment\n"
+		"\t\"second\"\n"
+		"\t)\n"
+		"paren A ( 192.0.2.7 )\n"
+		"after A 192.0.2.8\n",
+		&zone) == 0);
+	check_rr(tc, &nsd, zone, "example.com.", TYPE_SOA,
+		"ns.example.com. admin.example.com. (\n"
+		"\t\t2014010101 3600 900 86400 300 )");
+	check_rr(tc, &nsd, zone, "txt.example.com.", TYPE_TXT,
+		"\"first\" \"second\"");
+	check_rr(tc, &nsd, zone, "paren.example.com.", TYPE_A, "192.0.2.7");
+	check_rr(tc, &nsd, zone, "after.example.com.", TYPE_A, "192.0.2.8");
+	close_zone(&nsd);
+
+	/* a close without open, and an open that is not closed at the end */
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n"
+		"bad A 192.0.2.1 )\n", &zone) != 0);
+	close_zone(&nsd);
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n"
+		"bad TXT ( \"open\"\n", &zone) != 0);
+	close_zone(&nsd);
+}
+
+static void
+zonec_quoted(CuTest *tc)
+{
+	struct nsd nsd;
+	zone_type* zone;
+	memset(&nsd, 0, sizeof(nsd));
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"$TTL 3600\n"
+		"@ IN SOA ns admin 1 2 3 4 5\n"
+		"q TXT \"with space; not a comment\" \"(not a paren)\" \"\"\n"
+		"q2 TXT \"two\n"
+		"lines\"\n"
+		"\"quoted.owner\" A 192.0.2.9\n"
+		"q3 TXT\t\"tab\tinside\" x\n",
+		&zone) == 0);
+	check_rr(tc, &nsd, zone, "q.example.com.", TYPE_TXT,
+		"\"with space; not a comment\" \"(not a paren)\" \"\"");
+	check_rr(tc, &nsd, zone, "q2.example.com.", TYPE_TXT,
+		"\"two\\010lines\"");
+	/* a quoted owner is one label, the dot is in the label */
+	check_rr(tc, &nsd, zone, "quoted\\.owner.example.com.", TYPE_A,
+		"192.0.2.9");
+	check_rr(tc, &nsd, zone, "q3.example.com.", TYPE_TXT,
+		"\"tab\\009inside\" \"x\"");
+	close_zone(&nsd);
+
+	/* a quoted string that is not closed at the end of the file */
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n"
+		"bad TXT \"open\n", &zone) != 0);
+	close_zone(&nsd);
+}
+
+static void
+zonec_eof(CuTest *tc)
+{
+	struct nsd nsd;
+	zone_type* zone;
+	memset(&nsd, 0, sizeof(nsd));
+
+	/* the last RR without a newline */
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n"
+		"last A 192.0.2.10", &zone) == 0);
+	check_rr(tc, &nsd, zone, "last.example.com.", TYPE_A, "192.0.2.10");
+	close_zone(&nsd);
+
+	/* a quoted string last */
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n"
+		"last TXT \"end\"", &zone) == 0);
+	check_rr(tc, &nsd, zone, "last.example.com.", TYPE_TXT, "\"end\"");
+	close_zone(&nsd);
+
+	/* a comment last */
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n"
+		"last A 192.0.2.11 ; comment", &zone) == 0);
+	check_rr(tc, &nsd, zone, "last.example.com.", TYPE_A, "192.0.2.11");
+	close_zone(&nsd);
+
+	/* a closing paren last */
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin ( 1 2 3 4 5 )", &zone) == 0);
+	check_rr(tc, &nsd, zone, "example.com.", TYPE_SOA,
+		"ns.example.com. admin.example.com. (\n"
+		"\t\t1 2 3 4 5 )");
+	close_zone(&nsd);
+
+	/* the SOA alone without a newline, an incomplete RR is an error */
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4", &zone) != 0);
+	close_zone(&nsd);
+}
+
+/* the size of the reads of zlexer.c */
+#define ZONEC_CHUNK (1024*1024)
+
+/* the tokens across the end of the first read from the zone file */
+static void
+zonec_chunks(CuTest *tc)
+{
+	struct nsd nsd;
+	zone_type* zone;
+	const char* head = "$ORIGIN example.com.\n"
+		"@ 3600 IN SOA ns admin 1 2 3 4 5\n";
+	const char* tail = "$TTL 7200\n"
+		"w1   A 192.0.2.20 ; a comment\n"
+		"w2 TXT \"quoted\nstring\" word\\032x\n"
+		"w3 IN 300 AAAA 2001:db8::20";
+	size_t headlen = strlen(head), taillen = strlen(tail);
+	char* ztxt = (char*)xalloc(ZONEC_CHUNK + taillen + 1);
+	size_t shift, fill, len;
+	memset(&nsd, 0, sizeof(nsd));
+
+	for(shift = 0; shift <= taillen; shift++) {
+		/* comment lines up to the start of the tail */
+		memcpy(ztxt, head, headlen);
+		len = headlen;
+		fill = ZONEC_CHUNK - shift - headlen;
+		while(fill > 0) {
+			size_t line = (fill%64 ? fill%64 : 64);
+			if(line > 1) {
+				ztxt[len] = ';';
+				memset(ztxt+len+1, 'x', line-2);
+			}
+			ztxt[len+line-1] = '\n';
+			len += line;
+			fill -= line;
+		}
+		memcpy(ztxt+len, tail, taillen+1);
+		if(read_zone_text(&nsd, "example.com", ztxt, &zone) != 0) {
+			printf("zone with the tail %u bytes before the end of "
+				"the chunk has errors\n", (unsigned)shift);
+			CuAssertTrue(tc, 0);
+		}
+		check_rr(tc, &nsd, zone, "w1.example.com.", TYPE_A,
+			"192.0.2.20");
+		check_rr(tc, &nsd, zone, "w2.example.com.", TYPE_TXT,
+			"\"quoted\\010string\" \"word x\"");
+		check_rr(tc, &nsd, zone, "w3.example.com.", TYPE_AAAA,
+			"2001:db8::20");
+		close_zone(&nsd);
+	}
+	free(ztxt);
+}
+
+/** check the RRs of the zone of zonec_parsed */
+static void
+check_parsed_zone(CuTest* tc, struct nsd* nsd, zone_type* zone)
+{
+	check_rr(tc, nsd, zone, "example.com.", TYPE_SOA,
+		"ns.example.com. admin.example.com. (\n"
+		"\t\t7 3600 900 86400 300 )");
+	check_rr(tc, nsd, zone, "example.com.", TYPE_NS, "ns.example.com.");
+	check_rr(tc, nsd, zone, "example.com.", TYPE_MX,
+		"10 mail.example.com.");
+	check_rr(tc, nsd, zone, "ns.example.com.", TYPE_A, "192.0.2.1");
+	check_rr(tc, nsd, zone, "www.example.com.", TYPE_A, "192.0.2.2");
+	check_rr(tc, nsd, zone, "www.example.com.", TYPE_A, "192.0.2.3");
+	check_rr(tc, nsd, zone, "www.example.com.", TYPE_TXT,
+		"\"two\" \"strings\"");
+	check_rr(tc, nsd, zone, "a.b.c.example.com.", TYPE_AAAA,
+		"2001:db8::1");
+}
+
+/** write the first len bytes of data to the file */
+static void
+write_prefix(const char* fname, const uint8_t* data, size_t len)
+{
+	FILE* out = fopen(fname, "w");
+	if(!out) {
+		printf("failed to write %s: %s\n", fname, strerror(errno));
+		exit(1);
+	}
+	if(len > 0 && fwrite(data, 1, len, out) != len) {
+		printf("failed to write %s: %s\n", fname, strerror(errno));
+		exit(1);
+	}
+	fclose(out);
+}
+
+/* the file of a zonefiles-parallel worker, read back, and cut short */
+static void
+zonec_parsed(CuTest *tc)
+{
+	struct nsd nsd;
+	zone_type* zone;
+	char* fn = udbtest_get_temp_file("zonec.parsed");
+	char tmpfn[1024];
+	uint8_t data[4096];
+	size_t size, len;
+	unsigned int errors = 0;
+	FILE* in;
+	memset(&nsd, 0, sizeof(nsd));
+	snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+
+	CuAssertTrue(tc, read_zone_text(&nsd, "example.com",
+		"$ORIGIN example.com.\n"
+		"$TTL 3600\n"
+		"@ IN SOA ns admin 7 3600 900 86400 300\n"
+		"@ NS ns\n"
+		"@ MX 10 mail\n"
+		"ns A 192.0.2.1\n"
+		"www A 192.0.2.2\n"
+		"www A 192.0.2.3\n"
+		"www TXT two strings\n"
+		"a.b.c AAAA 2001:db8::1\n", &zone) == 0);
+	CuAssertTrue(tc, zonefile_write_parsed(fn, zone, 1234, 0));
+	CuAssertTrue(tc, access(tmpfn, F_OK) == -1);
+	close_zone(&nsd);
+
+	/* round trip */
+	zone = open_zone(&nsd, "example.com");
+	CuAssertTrue(tc, zonefile_read_parsed(nsd.db, zone, fn, 1234,
+		&errors));
+	CuAssertTrue(tc, errors == 0);
+	check_parsed_zone(tc, &nsd, zone);
+	close_zone(&nsd);
+
+	/* for another version of the zonefile */
+	zone = open_zone(&nsd, "example.com");
+	CuAssertTrue(tc, !zonefile_read_parsed(nsd.db, zone, fn, 1235,
+		&errors));
+	CuAssertTrue(tc, zone->apex->rrsets == NULL);
+
+	/* a shorter file is not used, and leaves the zone empty, the cuts
+	 * are spread over the file and the last one is the end marker */
+	in = fopen(fn, "r");
+	CuAssertTrue(tc, in != NULL);
+	size = fread(data, 1, sizeof(data), in);
+	fclose(in);
+	CuAssertTrue(tc, size > 12 && size < sizeof(data));
+	for(len = 0; len < size; len = (len+7 < size-1 ? len+7 : len+1)) {
+		write_prefix(fn, data, len);
+		if(zonefile_read_parsed(nsd.db, zone, fn, 1234, &errors)) {
+			printf("parsed file of %u of %u bytes is read\n",
+				(unsigned)len, (unsigned)size);
+			CuAssertTrue(tc, 0);
+		}
+		CuAssertTrue(tc, zone->apex->rrsets == NULL);
+		CuAssertTrue(tc, zone->soa_rrset == NULL);
+	}
+	/* and the zone can be read after that */
+	write_prefix(fn, data, size);
+	CuAssertTrue(tc, zonefile_read_parsed(nsd.db, zone, fn, 1234,
+		&errors));
+	check_parsed_zone(tc, &nsd, zone);
+	close_zone(&nsd);
+
+	/* the errors of a zonefile that the worker could not parse */
+	zone = open_zone(&nsd, "example.com");
+	CuAssertTrue(tc, zonefile_write_parsed(fn, zone, 1234, 3));
+	CuAssertTrue(tc, zonefile_read_parsed(nsd.db, zone, fn, 1234,
+		&errors));
+	CuAssertTrue(tc, errors == 3);
+	close_zone(&nsd);
+
+	unlink(fn);
+	free(fn);
+}
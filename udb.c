@@ -18,6 +18,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 
 /* for systems without, portable definition, failed-1 and async is a flag */
 #ifndef MAP_FAILED
@@ -31,7 +32,7 @@
 static void move_xl_segment(void* base, udb_base* udb, udb_void xl,
 	udb_void n, uint64_t sz, uint64_t startseg);
 /** attempt to compact the data and move free space to the end */
-static int udb_alloc_compact(void* base, udb_alloc* alloc);
+static int udb_alloc_compact(void* base, udb_alloc* alloc, int msec);
 
 /** convert pointer to the data part to a pointer to the base of the chunk */
 static udb_void
@@ -205,7 +206,7 @@ udb_base_create_fd(const char* fname, int fd, udb_walk_relptr_func walkfunc,
 	}
 	if(r) {
 		/* and compact now, or resume compacting */
-		udb_alloc_compact(udb, udb->alloc);
+		udb_alloc_compact(udb->base, udb->alloc, 0);
 		udb_base_sync(udb, 1);
 	}
 	udb->glob_data->clean_close = 0;
@@ -1549,9 +1550,23 @@ coagulate_and_push(void* base, udb_alloc* alloc, udb_void last, int exp,
 	return last;
 }
 
-/** attempt to compact the data and move free space to the end */
-int
-udb_alloc_compact(void* base, udb_alloc* alloc)
+/** see if the time for a compaction step is up, checked every so often */
+static int
+compact_time_up(struct timeval* end, unsigned* steps)
+{
+	struct timeval now;
+	if(++(*steps) % 32 != 0)
+		return 0;
+	if(gettimeofday(&now, NULL) == -1)
+		return 0;
+	return (now.tv_sec > end->tv_sec || (now.tv_sec == end->tv_sec &&
+		now.tv_usec >= end->tv_usec));
+}
+
+/** attempt to compact the data and move free space to the end,
+ * for at most msec milliseconds, if not 0 */
+static int
+udb_alloc_compact(void* base, udb_alloc* alloc, int msec)
 {
 	udb_void last;
 	int exp, e2;
@@ -1559,10 +1574,28 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 	uint64_t at = alloc->disk->nextgrow;
 	udb_void xl_start = 0;
 	uint64_t xl_sz = 0;
+	struct timeval end;
+	unsigned steps = 0;
 	if(alloc->udb->inhibit_compact)
 		return 1;
 	alloc->udb->useful_compact = 0;
+	if(msec > 0) {
+		if(gettimeofday(&end, NULL) == -1)
+			msec = 0;
+		end.tv_sec += msec/1000;
+		end.tv_usec += (msec%1000)*1000;
+		if(end.tv_usec >= 1000000) {
+			end.tv_sec++;
+			end.tv_usec -= 1000000;
+		}
+	}
 	while(at > alloc->udb->glob_data->hsize) {
+		if(msec > 0 && compact_time_up(&end, &steps)) {
+			/* the chunks are moved one at a time, stop here and
+			 * continue at the end of the file in the next step */
+			alloc->udb->useful_compact = 1;
+			break;
+		}
 		/* grab last entry */
 		exp = (int)*((uint8_t*)UDB_REL(base, at-1));
 		if(exp == UDB_EXP_XL) {
@@ -1681,11 +1714,23 @@ udb_alloc_compact(void* base, udb_alloc* alloc)
 
 int
 udb_compact(udb_base* udb)
+{
+	return udb_compact_step(udb, 0);
+}
+
+int
+udb_compact_step(udb_base* udb, int msec)
 {
 	if(!udb) return 1;
 	if(!udb->useful_compact) return 1;
 	DEBUG(DEBUG_DBACCESS, 1, (LOG_INFO, "Compacting database..."));
-	return udb_alloc_compact(udb->base, udb->alloc);
+	return udb_alloc_compact(udb->base, udb->alloc, msec);
+}
+
+int
+udb_compact_pending(udb_base* udb)
+{
+	return udb && udb->useful_compact && !udb->inhibit_compact;
 }
 
 void udb_compact_inhibited(udb_base* udb, int inhibit)
@@ -1774,7 +1819,7 @@ int udb_alloc_free(udb_alloc* alloc, udb_void r, size_t sz)
 			alloc->udb->useful_compact = 1;
 			return 1;
 		}
-		return udb_alloc_compact(base, alloc);
+		return udb_alloc_compact(base, alloc, 0);
 	}
 	/* it is a regular chunk of 2**exp size */
 	exp = (int)fp->exp;
@@ -1821,7 +1866,7 @@ int udb_alloc_free(udb_alloc* alloc, udb_void r, size_t sz)
 		alloc->udb->useful_compact = 1;
 		return 1;
 	}
-	return udb_alloc_compact(base, alloc);
+	return udb_alloc_compact(base, alloc, 0);
 }
 
 udb_void udb_alloc_init(udb_alloc* alloc, void* d, size_t sz)
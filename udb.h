@@ -562,6 +562,23 @@ int udb_alloc_grow(udb_alloc* alloc, size_t sz, size_t num);
  */
 int udb_compact(udb_base* udb);
 
+/**
+ * compact the data like udb_compact, but stop after about msec
+ * milliseconds.  The chunks that are moved stay valid, the compaction
+ * continues with the next call.
+ * @param udb: the udb base.
+ * @param msec: time limit, 0 for no limit.
+ * @return 0 on failure (to remap the (possibly) changed udb base).
+ */
+int udb_compact_step(udb_base* udb, int msec);
+
+/**
+ * see if compaction has work left, for udb_compact_step.
+ * @param udb: the udb base, or NULL.
+ * @return true if there are deletions to compact, and not inhibited.
+ */
+int udb_compact_pending(udb_base* udb);
+
 /** 
  * set the udb to inhibit or uninhibit compaction.  Does not perform
  * the compaction itself if enabled, for that call udb_compact.
@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "xfrd-disk.h"
 #include "xfrd.h"
 #include "buffer.h"
@@ -139,31 +140,112 @@ xfrd_read_state_soa(FILE* in, const char* id_acquired,
 	return 1;
 }
 
-void
-xfrd_read_state(struct xfrd_state* xfrd)
+/* the state of a zone as it is read from the state file */
+struct xfrd_state_read {
+	uint32_t state, masnum, nextmas, round_num, timeout;
+	xfrd_soa_t soa_nsd, soa_disk, soa_notified;
+	time_t soa_nsd_acquired, soa_disk_acquired, soa_notified_acquired;
+};
+
+/* set the zone to the state that is read from the state file */
+static void
+xfrd_read_state_zone(const char* statefile, xfrd_zone_t* zone,
+	struct xfrd_state_read* r)
 {
-	const char* statefile = xfrd->nsd->options->xfrdfile;
-	FILE *in;
-	uint32_t filetime = 0;
-	uint32_t numzones, i;
-	region_type *tempregion;
+	xfrd_soa_t incoming_soa;
+	time_t incoming_acquired;
 
-	tempregion = region_create(xalloc, free);
-	if(!tempregion)
+	if(r->soa_nsd_acquired>xfrd_time()+15 ||
+		r->soa_disk_acquired>xfrd_time()+15 ||
+		r->soa_notified_acquired>xfrd_time()+15)
+	{
+		log_msg(LOG_ERR, "xfrd: statefile %s contains"
+			" times in the future for zone %s. Ignoring.",
+			statefile, zone->apex_str);
 		return;
+	}
+	zone->state = r->state;
+	zone->master_num = r->masnum;
+	zone->next_master = r->nextmas;
+	zone->round_num = r->round_num;
+	zone->timeout.tv_sec = r->timeout;
+	zone->timeout.tv_usec = 0;
+
+	/* read the zone OK, now set the master properly */
+	zone->master = acl_find_num(zone->zone_options->pattern->
+		request_xfr, zone->master_num);
+	if(!zone->master) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: masters changed for zone %s",
+			zone->apex_str));
+		zone->master = zone->zone_options->pattern->request_xfr;
+		zone->master_num = 0;
+		zone->round_num = 0;
+	}
 
-	in = fopen(statefile, "r");
-	if(!in) {
-		if(errno != ENOENT) {
-			log_msg(LOG_ERR, "xfrd: Could not open file %s for reading: %s",
-				statefile, strerror(errno));
-		} else {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: no file %s. refreshing all zones.",
-				statefile));
-		}
-		region_destroy(tempregion);
-		return;
+	/*
+	 * There is no timeout,
+	 * or there is a notification,
+	 * or there is a soa && current time is past refresh point
+	 */
+	if(r->timeout == 0 || r->soa_notified_acquired != 0 ||
+		(r->soa_disk_acquired != 0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> ntohl(r->soa_disk.refresh)))
+	{
+		zone->state = xfrd_zone_refreshing;
+		xfrd_set_refresh_now(zone);
 	}
+
+	/* There is a soa && current time is past expiry point */
+	if(r->soa_disk_acquired!=0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> ntohl(r->soa_disk.expire))
+	{
+		zone->state = xfrd_zone_expired;
+		xfrd_set_refresh_now(zone);
+	} 
+
+	/* there is a zone read and it matches what we had before */
+	if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
+		&& zone->soa_nsd.serial == r->soa_nsd.serial) {
+		xfrd_deactivate_zone(zone);
+		zone->state = r->state;
+		xfrd_set_timer(zone, r->timeout);
+	}	
+	if(zone->soa_nsd_acquired == 0 && r->soa_nsd_acquired == 0 &&
+		r->soa_disk_acquired == 0) {
+		/* continue expon backoff where we were + check now */
+		zone->fresh_xfr_timeout = r->timeout;
+	}
+
+	/* handle as an incoming SOA. */
+	incoming_soa = zone->soa_nsd;
+	incoming_acquired = zone->soa_nsd_acquired;
+	zone->soa_nsd = r->soa_nsd;
+	zone->soa_disk = r->soa_disk;
+	zone->soa_notified = r->soa_notified;
+	zone->soa_nsd_acquired = r->soa_nsd_acquired;
+	/* we had better use what we got from starting NSD, not
+	 * what we store in this file, because the actual zone
+	 * contents trumps the contents of this cache */
+	/* zone->soa_disk_acquired = soa_disk_acquired_read; */
+	zone->soa_notified_acquired = r->soa_notified_acquired;
+	if (zone->state == xfrd_zone_expired)
+	{
+		xfrd_send_expire_notification(zone);
+	}
+	xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+}
+
+/* read the text state file that older versions write */
+static void
+xfrd_read_state_text(struct xfrd_state* xfrd, FILE* in,
+	region_type* tempregion)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	uint32_t filetime = 0;
+	uint32_t numzones, i;
+
 	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC) ||
 	   !xfrd_read_check_str(in, "filetime:") ||
 	   !xfrd_read_i32(in, &filetime) ||
@@ -173,8 +255,6 @@ xfrd_read_state(struct xfrd_state* xfrd)
 	{
 		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 			statefile, (int)filetime, (long long)xfrd_time());
-		fclose(in);
-		region_destroy(tempregion);
 		return;
 	}
 
@@ -182,48 +262,37 @@ xfrd_read_state(struct xfrd_state* xfrd)
 		char *p;
 		xfrd_zone_t* zone;
 		const dname_type* dname;
-		uint32_t state, masnum, nextmas, round_num, timeout;
-		xfrd_soa_t soa_nsd_read, soa_disk_read, soa_notified_read;
-		time_t soa_nsd_acquired_read,
-			soa_disk_acquired_read, soa_notified_acquired_read;
-		xfrd_soa_t incoming_soa;
-		time_t incoming_acquired;
+		struct xfrd_state_read r;
 
 		if(nsd.signal_hint_shutdown) {
-			fclose(in);
-			region_destroy(tempregion);
 			return;
 		}
 
-		memset(&soa_nsd_read, 0, sizeof(soa_nsd_read));
-		memset(&soa_disk_read, 0, sizeof(soa_disk_read));
-		memset(&soa_notified_read, 0, sizeof(soa_notified_read));
+		memset(&r, 0, sizeof(r));
 
 		if(!xfrd_read_check_str(in, "zone:") ||
 		   !xfrd_read_check_str(in, "name:")  ||
 		   !(p=xfrd_read_token(in)) ||
 		   !(dname = dname_parse(tempregion, p)) ||
 		   !xfrd_read_check_str(in, "state:") ||
-		   !xfrd_read_i32(in, &state) || (state>2) ||
+		   !xfrd_read_i32(in, &r.state) || (r.state>2) ||
 		   !xfrd_read_check_str(in, "master:") ||
-		   !xfrd_read_i32(in, &masnum) ||
+		   !xfrd_read_i32(in, &r.masnum) ||
 		   !xfrd_read_check_str(in, "next_master:") ||
-		   !xfrd_read_i32(in, &nextmas) ||
+		   !xfrd_read_i32(in, &r.nextmas) ||
 		   !xfrd_read_check_str(in, "round_num:") ||
-		   !xfrd_read_i32(in, &round_num) ||
+		   !xfrd_read_i32(in, &r.round_num) ||
 		   !xfrd_read_check_str(in, "next_timeout:") ||
-		   !xfrd_read_i32(in, &timeout) ||
+		   !xfrd_read_i32(in, &r.timeout) ||
 		   !xfrd_read_state_soa(in, "soa_nsd_acquired:", "soa_nsd:",
-			&soa_nsd_read, &soa_nsd_acquired_read) ||
+			&r.soa_nsd, &r.soa_nsd_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_disk_acquired:", "soa_disk:",
-			&soa_disk_read, &soa_disk_acquired_read) ||
+			&r.soa_disk, &r.soa_disk_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_notify_acquired:", "soa_notify:",
-			&soa_notified_read, &soa_notified_acquired_read))
+			&r.soa_notified, &r.soa_notified_acquired))
 		{
 			log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 				statefile, (int)filetime, (long long)xfrd_time());
-			fclose(in);
-			region_destroy(tempregion);
 			return;
 		}
 
@@ -232,258 +301,400 @@ xfrd_read_state(struct xfrd_state* xfrd)
 			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: state file has info for not configured zone %s", p));
 			continue;
 		}
-
-		if(soa_nsd_acquired_read>xfrd_time()+15 ||
-			soa_disk_acquired_read>xfrd_time()+15 ||
-			soa_notified_acquired_read>xfrd_time()+15)
-		{
-			log_msg(LOG_ERR, "xfrd: statefile %s contains"
-				" times in the future for zone %s. Ignoring.",
-				statefile, zone->apex_str);
-			continue;
-		}
-		zone->state = state;
-		zone->master_num = masnum;
-		zone->next_master = nextmas;
-		zone->round_num = round_num;
-		zone->timeout.tv_sec = timeout;
-		zone->timeout.tv_usec = 0;
-
-		/* read the zone OK, now set the master properly */
-		zone->master = acl_find_num(zone->zone_options->pattern->
-			request_xfr, zone->master_num);
-		if(!zone->master) {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: masters changed for zone %s",
-				zone->apex_str));
-			zone->master = zone->zone_options->pattern->request_xfr;
-			zone->master_num = 0;
-			zone->round_num = 0;
-		}
-
-		/*
-		 * There is no timeout,
-		 * or there is a notification,
-		 * or there is a soa && current time is past refresh point
-		 */
-		if(timeout == 0 || soa_notified_acquired_read != 0 ||
-			(soa_disk_acquired_read != 0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> ntohl(soa_disk_read.refresh)))
-		{
-			zone->state = xfrd_zone_refreshing;
-			xfrd_set_refresh_now(zone);
-		}
-
-		/* There is a soa && current time is past expiry point */
-		if(soa_disk_acquired_read!=0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> ntohl(soa_disk_read.expire))
-		{
-			zone->state = xfrd_zone_expired;
-			xfrd_set_refresh_now(zone);
-		} 
-
-		/* there is a zone read and it matches what we had before */
-		if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
-			&& zone->soa_nsd.serial == soa_nsd_read.serial) {
-			xfrd_deactivate_zone(zone);
-			zone->state = state;
-			xfrd_set_timer(zone, timeout);
-		}	
-		if(zone->soa_nsd_acquired == 0 && soa_nsd_acquired_read == 0 &&
-			soa_disk_acquired_read == 0) {
-			/* continue expon backoff where we were + check now */
-			zone->fresh_xfr_timeout = timeout;
-		}
-
-		/* handle as an incoming SOA. */
-		incoming_soa = zone->soa_nsd;
-		incoming_acquired = zone->soa_nsd_acquired;
-		zone->soa_nsd = soa_nsd_read;
-		zone->soa_disk = soa_disk_read;
-		zone->soa_notified = soa_notified_read;
-		zone->soa_nsd_acquired = soa_nsd_acquired_read;
-		/* we had better use what we got from starting NSD, not
-		 * what we store in this file, because the actual zone
-		 * contents trumps the contents of this cache */
-		/* zone->soa_disk_acquired = soa_disk_acquired_read; */
-		zone->soa_notified_acquired = soa_notified_acquired_read;
-		if (zone->state == xfrd_zone_expired)
-		{
-			xfrd_send_expire_notification(zone);
-		}
-		xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+		xfrd_read_state_zone(statefile, zone, &r);
 	}
 
 	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC)) {
 		log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 			statefile, (int)filetime, (long long)xfrd_time());
-		region_destroy(tempregion);
-		fclose(in);
 		return;
 	}
 
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read %d zones from state file", (int)numzones));
-	fclose(in);
-	region_destroy(tempregion);
 }
 
-/* prints neato days hours and minutes. */
-static void
-neato_timeout(FILE* out, const char* str, time_t secs)
+/* read a SOA from a record in the binary state file, 0 on error */
+static int
+xfrd_read_rec_soa(buffer_type* b, xfrd_soa_t* soa, time_t* soatime)
 {
-	fprintf(out, "%s", str);
-	if(secs <= 0) {
-		fprintf(out, " %llds", (long long)secs);
-		return;
+	if(!buffer_available(b, 4))
+		return 0;
+	*soatime = (time_t)buffer_read_u32(b);
+	if(*soatime == 0)
+		return 1;
+	if(!buffer_available(b, 11))
+		return 0;
+	buffer_read(b, &soa->type, sizeof(soa->type));
+	buffer_read(b, &soa->klass, sizeof(soa->klass));
+	buffer_read(b, &soa->ttl, sizeof(soa->ttl));
+	buffer_read(b, &soa->rdata_count, sizeof(soa->rdata_count));
+	soa->prim_ns[0] = buffer_read_u8(b);
+	if(!buffer_available(b, soa->prim_ns[0] + 1))
+		return 0;
+	buffer_read(b, soa->prim_ns+1, soa->prim_ns[0]);
+	soa->email[0] = buffer_read_u8(b);
+	if(!buffer_available(b, soa->email[0] + 20))
+		return 0;
+	buffer_read(b, soa->email+1, soa->email[0]);
+	buffer_read(b, &soa->serial, sizeof(soa->serial));
+	buffer_read(b, &soa->refresh, sizeof(soa->refresh));
+	buffer_read(b, &soa->retry, sizeof(soa->retry));
+	buffer_read(b, &soa->expire, sizeof(soa->expire));
+	buffer_read(b, &soa->minimum, sizeof(soa->minimum));
+	return 1;
+}
+
+/* read a record of the binary state file, 0 on error */
+static int
+xfrd_read_rec(buffer_type* b, region_type* region, const dname_type** dname,
+	struct xfrd_state_read* r)
+{
+	uint8_t len;
+	uint8_t* name;
+	size_t i = 0;
+	memset(r, 0, sizeof(*r));
+	if(!buffer_available(b, 1))
+		return 0;
+	len = buffer_read_u8(b);
+	if(!buffer_available(b, len + 1 + 16) || len == 0)
+		return 0;
+	/* the labels must end with the root label at the end of the name,
+	 * before dname_make walks them */
+	name = buffer_current(b);
+	while(i < len && name[i] != 0) {
+		if((name[i] & 0xc0) != 0)
+			return 0;
+		i += name[i] + 1;
 	}
-	if(secs >= 3600*24) {
-		fprintf(out, " %lldd", (long long)(secs/(3600*24)));
-		secs = secs % (3600*24);
+	if(i != (size_t)len - 1)
+		return 0;
+	*dname = dname_make(region, name, 1);
+	if(!*dname || (*dname)->name_size != len)
+		return 0;
+	buffer_skip(b, len);
+	r->state = buffer_read_u8(b);
+	r->masnum = buffer_read_u32(b);
+	r->nextmas = buffer_read_u32(b);
+	r->round_num = buffer_read_u32(b);
+	/* the time the timeout expires, relative to now for the zone */
+	r->timeout = buffer_read_u32(b);
+	if(r->timeout != 0) {
+		if((time_t)r->timeout > xfrd_time())
+			r->timeout -= (uint32_t)xfrd_time();
+		else	r->timeout = 1;
 	}
-	if(secs >= 3600) {
-		fprintf(out, " %lldh", (long long)(secs/3600));
-		secs = secs%3600;
+	if(r->state > 2)
+		return 0;
+	return xfrd_read_rec_soa(b, &r->soa_nsd, &r->soa_nsd_acquired) &&
+		xfrd_read_rec_soa(b, &r->soa_disk, &r->soa_disk_acquired) &&
+		xfrd_read_rec_soa(b, &r->soa_notified,
+		&r->soa_notified_acquired);
+}
+
+/* last record of a zone in the binary state file */
+struct xfrd_state_last {
+	rbnode_t node; /* key is the zone */
+	uint8_t* rec;
+	uint16_t len;
+};
+
+static int
+xfrd_state_last_cmp(const void* a, const void* b)
+{
+	if(a == b)
+		return 0;
+	return (uintptr_t)a < (uintptr_t)b ? -1 : 1;
+}
+
+/* read the binary state file, the zones changed since the last full
+ * write are appended, the last record of a zone counts */
+static void
+xfrd_read_state_bin(struct xfrd_state* xfrd, uint8_t* data, size_t size,
+	region_type* tempregion)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	rbtree_t* last = rbtree_create(tempregion, &xfrd_state_last_cmp);
+	struct xfrd_state_last* l;
+	size_t pos = sizeof(XFRD_BIN_MAGIC)-1, num = 0;
+
+	/* find the last record of every zone */
+	while(pos + 2 <= size) {
+		buffer_type b;
+		const dname_type* dname;
+		struct xfrd_state_read r;
+		xfrd_zone_t* zone;
+		uint16_t len = read_uint16(data + pos);
+		if(pos + 2 + len > size) {
+			/* the end of a write that did not complete */
+			break;
+		}
+		buffer_create_from(&b, data + pos + 2, len);
+		if(!xfrd_read_rec(&b, tempregion, &dname, &r)) {
+			log_msg(LOG_ERR, "xfrd: corrupt state file %s at "
+				"offset %u", statefile, (unsigned)pos);
+			break;
+		}
+		num++;
+		zone = (xfrd_zone_t*)rbtree_search(xfrd->zones, dname);
+		if(zone) {
+			l = (struct xfrd_state_last*)rbtree_search(last, zone);
+			if(!l) {
+				l = (struct xfrd_state_last*)region_alloc(
+					tempregion, sizeof(*l));
+				l->node.key = zone;
+				(void)rbtree_insert(last, &l->node);
+			}
+			l->rec = data + pos + 2;
+			l->len = len;
+		} else {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: state file has "
+				"info for not configured zone %s",
+				dname_to_string(dname, NULL)));
+		}
+		pos += 2 + len;
 	}
-	if(secs >= 60) {
-		fprintf(out, " %lldm", (long long)(secs/60));
-		secs = secs%60;
+	if(pos != size) {
+		/* do not append after it */
+		xfrd->state_rewrite = 1;
 	}
-	if(secs > 0) {
-		fprintf(out, " %llds", (long long)secs);
+	xfrd->state_records = num;
+
+	RBTREE_FOR(l, struct xfrd_state_last*, last) {
+		buffer_type b;
+		const dname_type* dname;
+		struct xfrd_state_read r;
+		if(nsd.signal_hint_shutdown)
+			return;
+		buffer_create_from(&b, l->rec, l->len);
+		(void)xfrd_read_rec(&b, tempregion, &dname, &r);
+		xfrd_read_state_zone(statefile, (xfrd_zone_t*)l->node.key, &r);
 	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read %d zones from state file",
+		(int)last->count));
 }
 
-static void xfrd_write_dname(FILE* out, uint8_t* dname)
+void
+xfrd_read_state(struct xfrd_state* xfrd)
 {
-	uint8_t* d= dname+1;
-	uint8_t len = *d++;
-	uint8_t i;
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	FILE *in;
+	char magic[sizeof(XFRD_BIN_MAGIC)-1];
+	region_type *tempregion;
 
-	if(dname[0]<=1) {
-		fprintf(out, ".");
+	/* write the whole file at the first write, unless it is a binary
+	 * file that ends after a complete record */
+	xfrd->state_rewrite = 1;
+	tempregion = region_create(xalloc, free);
+	if(!tempregion)
 		return;
-	}
 
-	while(len)
-	{
-		assert(d - (dname+1) <= dname[0]);
-		for(i=0; i<len; i++)
-		{
-			uint8_t ch = *d++;
-			if (isalnum((unsigned char)ch) || ch == '-' || ch == '_') {
-				fprintf(out, "%c", ch);
-			} else if (ch == '.' || ch == '\\') {
-				fprintf(out, "\\%c", ch);
-			} else {
-				fprintf(out, "\\%03u", (unsigned int)ch);
-			}
+	in = fopen(statefile, "r");
+	if(!in) {
+		if(errno != ENOENT) {
+			log_msg(LOG_ERR, "xfrd: Could not open file %s for reading: %s",
+				statefile, strerror(errno));
+		} else {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: no file %s. refreshing all zones.",
+				statefile));
 		}
-		fprintf(out, ".");
-		len = *d++;
+		region_destroy(tempregion);
+		return;
+	}
+	if(fread(magic, sizeof(magic), 1, in) == 1 &&
+		memcmp(magic, XFRD_BIN_MAGIC, sizeof(magic)) == 0) {
+		struct stat st;
+		void* data;
+		if(fstat(fileno(in), &st) == -1) {
+			log_msg(LOG_ERR, "xfrd: fstat %s: %s", statefile,
+				strerror(errno));
+		} else if((data = mmap(NULL, (size_t)st.st_size, PROT_READ,
+			MAP_PRIVATE, fileno(in), 0)) == MAP_FAILED) {
+			log_msg(LOG_ERR, "xfrd: mmap %s: %s", statefile,
+				strerror(errno));
+		} else {
+			xfrd->state_rewrite = 0;
+			xfrd_read_state_bin(xfrd, (uint8_t*)data,
+				(size_t)st.st_size, tempregion);
+			munmap(data, (size_t)st.st_size);
+		}
+	} else {
+		rewind(in);
+		xfrd_read_state_text(xfrd, in, tempregion);
 	}
+	fclose(in);
+	region_destroy(tempregion);
 }
 
+/* write a SOA to a record of the binary state file */
 static void
-xfrd_write_state_soa(FILE* out, const char* id,
-	xfrd_soa_t* soa, time_t soatime, const dname_type* ATTR_UNUSED(apex))
+xfrd_write_rec_soa(buffer_type* b, xfrd_soa_t* soa, time_t soatime)
 {
-	fprintf(out, "\t%s_acquired: %d", id, (int)soatime);
-	if(!soatime) {
-		fprintf(out, "\n");
+	buffer_write_u32(b, (uint32_t)soatime);
+	if(!soatime)
 		return;
+	buffer_write(b, &soa->type, sizeof(soa->type));
+	buffer_write(b, &soa->klass, sizeof(soa->klass));
+	buffer_write(b, &soa->ttl, sizeof(soa->ttl));
+	buffer_write(b, &soa->rdata_count, sizeof(soa->rdata_count));
+	buffer_write(b, soa->prim_ns, soa->prim_ns[0]+1);
+	buffer_write(b, soa->email, soa->email[0]+1);
+	buffer_write(b, &soa->serial, sizeof(soa->serial));
+	buffer_write(b, &soa->refresh, sizeof(soa->refresh));
+	buffer_write(b, &soa->retry, sizeof(soa->retry));
+	buffer_write(b, &soa->expire, sizeof(soa->expire));
+	buffer_write(b, &soa->minimum, sizeof(soa->minimum));
+}
+
+/* write the record with the state of the zone, 0 on error */
+static int
+xfrd_write_rec(FILE* out, xfrd_zone_t* zone)
+{
+	/* length, name, fixed fields and three SOAs with two names */
+	uint8_t data[2 + MAXDOMAINLEN+1 + 17 + 3*(4 + 10 + 2*(MAXDOMAINLEN+1)
+		+ 20)];
+	buffer_type b;
+	buffer_create_from(&b, data, sizeof(data));
+	buffer_skip(&b, 2);
+	buffer_write_u8(&b, (uint8_t)zone->apex->name_size);
+	buffer_write(&b, dname_name(zone->apex), zone->apex->name_size);
+	buffer_write_u8(&b, (uint8_t)zone->state);
+	buffer_write_u32(&b, (uint32_t)zone->master_num);
+	buffer_write_u32(&b, (uint32_t)zone->next_master);
+	buffer_write_u32(&b, (uint32_t)zone->round_num);
+	if(zone->wheel_slot != -1)
+		buffer_write_u32(&b, (uint32_t)zone->wheel_time);
+	else if(zone->zone_handler_flags&EV_TIMEOUT)
+		buffer_write_u32(&b, (uint32_t)(xfrd_time() +
+			zone->timeout.tv_sec));
+	else	buffer_write_u32(&b, 0);
+	xfrd_write_rec_soa(&b, &zone->soa_nsd, zone->soa_nsd_acquired);
+	xfrd_write_rec_soa(&b, &zone->soa_disk, zone->soa_disk_acquired);
+	xfrd_write_rec_soa(&b, &zone->soa_notified,
+		zone->soa_notified_acquired);
+	buffer_write_u16_at(&b, 0, (uint16_t)(buffer_position(&b) - 2));
+	return fwrite(data, buffer_position(&b), 1, out) == 1;
+}
+
+/* write the magic and the records of all zones, 0 on error */
+static int
+xfrd_write_state_recs(struct xfrd_state* xfrd, FILE* out)
+{
+	xfrd_zone_t* zone;
+	if(fwrite(XFRD_BIN_MAGIC, sizeof(XFRD_BIN_MAGIC)-1, 1, out) != 1)
+		return 0;
+	RBTREE_FOR(zone, xfrd_zone_t*, xfrd->zones) {
+		if(!xfrd_write_rec(out, zone))
+			return 0;
 	}
-	neato_timeout(out, "\t# was", xfrd_time()-soatime);
-	fprintf(out, " ago\n");
-
-	fprintf(out, "\t%s: %u %u %u %u", id,
-		(unsigned)ntohs(soa->type), (unsigned)ntohs(soa->klass),
-		(unsigned)ntohl(soa->ttl), (unsigned)ntohs(soa->rdata_count));
-	fprintf(out, " ");
-	xfrd_write_dname(out, soa->prim_ns);
-	fprintf(out, " ");
-	xfrd_write_dname(out, soa->email);
-	fprintf(out, " %u", (unsigned)ntohl(soa->serial));
-	fprintf(out, " %u", (unsigned)ntohl(soa->refresh));
-	fprintf(out, " %u", (unsigned)ntohl(soa->retry));
-	fprintf(out, " %u", (unsigned)ntohl(soa->expire));
-	fprintf(out, " %u\n", (unsigned)ntohl(soa->minimum));
-	fprintf(out, "\t#");
-	neato_timeout(out, " refresh =", ntohl(soa->refresh));
-	neato_timeout(out, " retry =", ntohl(soa->retry));
-	neato_timeout(out, " expire =", ntohl(soa->expire));
-	neato_timeout(out, " minimum =", ntohl(soa->minimum));
-	fprintf(out, "\n");
+	return 1;
 }
 
-void
-xfrd_write_state(struct xfrd_state* xfrd)
+/* write all zones to a new state file, that replaces the old one.  If
+ * the new file cannot be created or renamed, for example because the
+ * directory is not writable, the state file is overwritten in place */
+static void
+xfrd_write_state_all(struct xfrd_state* xfrd)
 {
-	rbnode_t* p;
 	const char* statefile = xfrd->nsd->options->xfrdfile;
+	char tmpfile[1024];
 	FILE *out;
-	time_t now = xfrd_time();
 
+	snprintf(tmpfile, sizeof(tmpfile), "%s.new", statefile);
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: write file %s", statefile));
+	out = fopen(tmpfile, "w");
+	if(out) {
+		if(!xfrd_write_state_recs(xfrd, out)) {
+			log_msg(LOG_ERR, "xfrd: could not write %s: %s",
+				tmpfile, strerror(errno));
+			fclose(out);
+			unlink(tmpfile);
+			return;
+		}
+		if(fclose(out) != 0) {
+			log_msg(LOG_ERR, "xfrd: could not write %s: %s",
+				tmpfile, strerror(errno));
+			unlink(tmpfile);
+			return;
+		}
+		if(rename(tmpfile, statefile) == -1) {
+			VERBOSITY(2, (LOG_INFO, "xfrd: rename %s to %s failed: "
+				"%s, writing it in place", tmpfile, statefile,
+				strerror(errno)));
+			unlink(tmpfile);
+			out = NULL;
+		} else	goto written;
+	} else {
+		VERBOSITY(2, (LOG_INFO, "xfrd: could not open file %s for "
+			"writing: %s, writing %s in place", tmpfile,
+			strerror(errno), statefile));
+	}
+
 	out = fopen(statefile, "w");
 	if(!out) {
 		log_msg(LOG_ERR, "xfrd: Could not open file %s for writing: %s",
 				statefile, strerror(errno));
 		return;
 	}
-
-	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
-	fprintf(out, "# This file is written on exit by nsd xfr daemon.\n");
-	fprintf(out, "# This file contains slave zone information:\n");
-	fprintf(out, "# 	* timeouts (when was zone data acquired)\n");
-	fprintf(out, "# 	* state (OK, refreshing, expired)\n");
-	fprintf(out, "# 	* which master transfer to attempt next\n");
-	fprintf(out, "# The file is read on start (but not on reload) by nsd xfr daemon.\n");
-	fprintf(out, "# You can edit; but do not change statement order\n");
-	fprintf(out, "# and no fancy stuff (like quoted \"strings\").\n");
-	fprintf(out, "#\n");
-	fprintf(out, "# If you remove a zone entry, it will be refreshed.\n");
-	fprintf(out, "# This can be useful for an expired zone; it revives\n");
-	fprintf(out, "# the zone temporarily, from refresh-expiry time.\n");
-	fprintf(out, "# If you delete the file all slave zones are updated.\n");
-	fprintf(out, "#\n");
-	fprintf(out, "# Note: if you edit this file while nsd is running,\n");
-	fprintf(out, "#       it will be overwritten on exit by nsd.\n");
-	fprintf(out, "\n");
-	fprintf(out, "filetime: %lld\t# %s\n", (long long)now, ctime(&now));
-	fprintf(out, "# The number of zone entries in this file\n");
-	fprintf(out, "numzones: %d\n", (int)xfrd->zones->count);
-	fprintf(out, "\n");
-	for(p = rbtree_first(xfrd->zones); p && p!=RBTREE_NULL; p=rbtree_next(p))
-	{
-		xfrd_zone_t* zone = (xfrd_zone_t*)p;
-		fprintf(out, "zone: \tname: %s\n", zone->apex_str);
-		fprintf(out, "\tstate: %d", (int)zone->state);
-		fprintf(out, " # %s", zone->state==xfrd_zone_ok?"OK":(
-			zone->state==xfrd_zone_refreshing?"refreshing":"expired"));
-		fprintf(out, "\n");
-		fprintf(out, "\tmaster: %d\n", zone->master_num);
-		fprintf(out, "\tnext_master: %d\n", zone->next_master);
-		fprintf(out, "\tround_num: %d\n", zone->round_num);
-		fprintf(out, "\tnext_timeout: %d",
-			(zone->zone_handler_flags&EV_TIMEOUT)?(int)zone->timeout.tv_sec:0);
-		if((zone->zone_handler_flags&EV_TIMEOUT)) {
-			neato_timeout(out, "\t# =", zone->timeout.tv_sec);
-		}
-		fprintf(out, "\n");
-		xfrd_write_state_soa(out, "soa_nsd", &zone->soa_nsd,
-			zone->soa_nsd_acquired, zone->apex);
-		xfrd_write_state_soa(out, "soa_disk", &zone->soa_disk,
-			zone->soa_disk_acquired, zone->apex);
-		xfrd_write_state_soa(out, "soa_notify", &zone->soa_notified,
-			zone->soa_notified_acquired, zone->apex);
-		fprintf(out, "\n");
+	if(!xfrd_write_state_recs(xfrd, out)) {
+		log_msg(LOG_ERR, "xfrd: could not write %s: %s", statefile,
+			strerror(errno));
+		fclose(out);
+		return;
+	}
+	if(fclose(out) != 0) {
+		log_msg(LOG_ERR, "xfrd: could not write %s: %s", statefile,
+			strerror(errno));
+		return;
 	}
 
-	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
+written:
+	xfrd->state_records = xfrd->zones->count;
+	xfrd->state_rewrite = 0;
+	while(xfrd->state_dirty_first)
+		xfrd_state_clean(xfrd->state_dirty_first);
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: written %d zones to state file",
 		(int)xfrd->zones->count));
-	fclose(out);
+}
+
+void
+xfrd_write_state(struct xfrd_state* xfrd)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	FILE *out;
+	size_t num = 0;
+
+	/* rewrite the file when the records of changed zones make up more
+	 * than half of it */
+	if(xfrd->state_rewrite || xfrd->state_records + xfrd->state_dirty_num
+		> 2*xfrd->zones->count) {
+		xfrd_write_state_all(xfrd);
+		return;
+	}
+	if(!xfrd->state_dirty_first)
+		return;
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: append to file %s", statefile));
+	out = fopen(statefile, "a");
+	if(!out) {
+		log_msg(LOG_ERR, "xfrd: Could not open file %s for writing: %s",
+				statefile, strerror(errno));
+		return;
+	}
+	while(xfrd->state_dirty_first) {
+		xfrd_zone_t* zone = xfrd->state_dirty_first;
+		if(!xfrd_write_rec(out, zone))
+			break;
+		num++;
+		xfrd_state_clean(zone);
+	}
+	if(fclose(out) != 0 || xfrd->state_dirty_first) {
+		log_msg(LOG_ERR, "xfrd: could not write %s: %s", statefile,
+			strerror(errno));
+		/* a partial record is not appended to */
+		xfrd->state_rewrite = 1;
+	}
+	xfrd->state_records += num;
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: appended %d zones to state file",
+		(int)num));
 }
 
 /* return tempdirname */
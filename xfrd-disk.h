@@ -15,10 +15,15 @@ struct nsd;
 
 /* magic string to identify xfrd state file */
 #define XFRD_FILE_MAGIC "NSDXFRD1"
+/* magic string of the binary state file, that has records with the
+ * state of a zone, the records of changed zones are appended to it */
+#define XFRD_BIN_MAGIC "NSDXFRD2"
 
-/* read from state file as many zones as possible (until error/eof).*/
+/* read from state file as many zones as possible (until error/eof).
+ * Files with the text format of older versions are read too. */
 void xfrd_read_state(struct xfrd_state* xfrd);
-/* write xfrd zone state if possible */
+/* write xfrd zone state if possible, appends the changed zones, or
+ * writes all zones to a new file when the file has grown too much */
 void xfrd_write_state(struct xfrd_state* xfrd);
 
 /* create temp directory */
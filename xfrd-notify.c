@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include "xfrd-notify.h"
+#include "nsd.h"
 #include "xfrd.h"
 #include "xfrd-tcp.h"
 #include "packet.h"
@@ -54,7 +55,7 @@ notify_disable(struct notify_zone_t* zone)
 		notify_send_disable(zone);
 	}
 
-	if(xfrd->notify_udp_num == XFRD_MAX_UDP_NOTIFY) {
+	if(xfrd->notify_udp_num >= xfrd->nsd->options->xfrd_udp_notify_max) {
 		/* find next waiting and needy zone */
 		while(xfrd->notify_waiting_first) {
 			/* snip off */
@@ -304,7 +305,7 @@ notify_enable(struct notify_zone_t* zone, struct xfrd_soa* new_soa)
 	if(zone->is_waiting)
 		return;
 
-	if(xfrd->notify_udp_num < XFRD_MAX_UDP_NOTIFY) {
+	if(xfrd->notify_udp_num < xfrd->nsd->options->xfrd_udp_notify_max) {
 		setup_notify_active(zone);
 		xfrd->notify_udp_num++;
 		return;
@@ -46,7 +46,19 @@ xfrd_pipe_cmp(const void* a, const void* b)
 	return (uintptr_t)x < (uintptr_t)y ? -1 : 1;
 }
 
-xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region)
+/* sort the masters on IP address */
+static int
+xfrd_master_cmp(const void* a, const void* b)
+{
+	const struct xfrd_tcp_master* x = (struct xfrd_tcp_master*)a;
+	const struct xfrd_tcp_master* y = (struct xfrd_tcp_master*)b;
+	if(y->ip_len != x->ip_len)
+		return (int)y->ip_len - (int)x->ip_len;
+	return memcmp(&x->ip, &y->ip, x->ip_len);
+}
+
+xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region, int tcp_max,
+	int master_max)
 {
 	int i;
 	xfrd_tcp_set_t* tcp_set = region_alloc(region, sizeof(xfrd_tcp_set_t));
@@ -54,9 +66,14 @@ xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region)
 	tcp_set->tcp_count = 0;
 	tcp_set->tcp_waiting_first = 0;
 	tcp_set->tcp_waiting_last = 0;
-	for(i=0; i<XFRD_MAX_TCP; i++)
+	tcp_set->tcp_max = tcp_max;
+	tcp_set->tcp_state = (struct xfrd_tcp_pipeline**)region_alloc_array(
+		region, tcp_max, sizeof(*tcp_set->tcp_state));
+	for(i=0; i<tcp_max; i++)
 		tcp_set->tcp_state[i] = xfrd_tcp_pipeline_create(region);
 	tcp_set->pipetree = rbtree_create(region, &xfrd_pipe_cmp);
+	tcp_set->mastertree = rbtree_create(region, &xfrd_master_cmp);
+	tcp_set->master_max = master_max;
 	return tcp_set;
 }
 
@@ -253,6 +270,121 @@ tcp_zone_waiting_list_popfirst(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 	zone->tcp_waiting = 0;
 }
 
+/* the transfer limit of the master of the zone, made if it is new */
+static struct xfrd_tcp_master*
+tcp_master_find(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+{
+	struct xfrd_tcp_master key, *m;
+	rbnode_t* n;
+	key.node.key = &key;
+	key.ip_len = xfrd_acl_sockaddr_to(zone->master, &key.ip);
+	if((n = rbtree_search(set->mastertree, &key)) != NULL)
+		return (struct xfrd_tcp_master*)n->key;
+	m = (struct xfrd_tcp_master*)region_alloc_zero(xfrd->region,
+		sizeof(*m));
+	m->node.key = m;
+	memcpy(&m->ip, &key.ip, key.ip_len);
+	m->ip_len = key.ip_len;
+	m->limit = XFRD_TCP_MASTER_START;
+	if(m->limit > set->master_max)
+		m->limit = set->master_max;
+	(void)rbtree_insert(set->mastertree, &m->node);
+	return m;
+}
+
+/* a transfer from the master ended, raise or lower its limit */
+static void
+tcp_master_adapt(xfrd_tcp_set_t* set, struct xfrd_tcp_master* m, int ok)
+{
+	if(!m)
+		return;
+	if(ok) {
+		if(m->limit < set->master_max)
+			m->limit++;
+	} else if(m->lowered != xfrd_time()) {
+		/* the transfers that fail together lower it once */
+		m->limit /= 2;
+		if(m->limit < 1)
+			m->limit = 1;
+		m->lowered = xfrd_time();
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: transfers from a "
+			"master failed, limit lowered to %d", m->limit));
+	}
+}
+
+/* the zone no longer counts for the transfers of its master */
+static void
+tcp_master_release(xfrd_zone_t* zone)
+{
+	if(!zone->tcp_master || zone->tcp_master_waiting)
+		return;
+	zone->tcp_master->num_active--;
+	assert(zone->tcp_master->num_active >= 0);
+	zone->tcp_master = NULL;
+}
+
+/* add zone at the end of the waiting list of the master */
+static void
+tcp_master_waiting_add(struct xfrd_tcp_master* m, xfrd_zone_t* zone)
+{
+	zone->tcp_master = m;
+	zone->tcp_master_waiting = 1;
+	zone->tcp_waiting = 1;
+	zone->tcp_waiting_next = NULL;
+	zone->tcp_waiting_prev = m->waiting_last;
+	if(m->waiting_last)
+		m->waiting_last->tcp_waiting_next = zone;
+	else	m->waiting_first = zone;
+	m->waiting_last = zone;
+}
+
+/* start the zones that wait for the master, while the limit allows */
+static void
+tcp_master_start_waiting(xfrd_tcp_set_t* set, struct xfrd_tcp_master* m)
+{
+	/* a zone that fails to start releases the master again, the loop
+	 * that is already running continues with the next zone */
+	if(!m || m->starting)
+		return;
+	m->starting = 1;
+	while(m->waiting_first && m->num_active < m->limit) {
+		xfrd_zone_t* zone = m->waiting_first;
+		xfrd_tcp_waiting_remove(set, zone);
+		xfrd_tcp_obtain(set, zone);
+	}
+	m->starting = 0;
+}
+
+void
+xfrd_tcp_waiting_remove(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+{
+	xfrd_zone_t** first = &set->tcp_waiting_first;
+	xfrd_zone_t** last = &set->tcp_waiting_last;
+	if(!zone->tcp_waiting)
+		return;
+	if(zone->tcp_master_waiting) {
+		first = &zone->tcp_master->waiting_first;
+		last = &zone->tcp_master->waiting_last;
+	}
+	if(zone->tcp_waiting_prev)
+		zone->tcp_waiting_prev->tcp_waiting_next = zone->tcp_waiting_next;
+	else	*first = zone->tcp_waiting_next;
+	if(zone->tcp_waiting_next)
+		zone->tcp_waiting_next->tcp_waiting_prev = zone->tcp_waiting_prev;
+	else	*last = zone->tcp_waiting_prev;
+	zone->tcp_waiting_next = NULL;
+	zone->tcp_waiting_prev = NULL;
+	zone->tcp_waiting = 0;
+	if(zone->tcp_master_waiting) {
+		zone->tcp_master_waiting = 0;
+		zone->tcp_master = NULL;
+	} else {
+		struct xfrd_tcp_master* m = zone->tcp_master;
+		tcp_master_release(zone);
+		tcp_master_start_waiting(set, m);
+	}
+}
+
 /* remove zone from tcp pipe write-wait list */
 static void
 tcp_pipe_sendlist_remove(struct xfrd_tcp_pipeline* tp, xfrd_zone_t* zone)
@@ -298,6 +430,7 @@ static void
 xfrd_tcp_pipe_stop(struct xfrd_tcp_pipeline* tp)
 {
 	int i, conn = -1;
+	struct xfrd_tcp_master* m = NULL;
 	assert(tp->num_unused < ID_PIPE_NUM); /* at least one 'in-use' */
 	assert(ID_PIPE_NUM - tp->num_unused > tp->num_skip); /* at least one 'nonskip' */
 	/* need to retry for all the zones connected to it */
@@ -310,12 +443,17 @@ xfrd_tcp_pipe_stop(struct xfrd_tcp_pipeline* tp)
 			zone->tcp_waiting = 0;
 			tcp_pipe_sendlist_remove(tp, zone);
 			tcp_pipe_id_remove(tp, zone);
+			if(zone->tcp_master)
+				m = zone->tcp_master;
+			tcp_master_release(zone);
 			xfrd_set_refresh_now(zone);
 		}
 	}
 	assert(conn != -1);
+	tcp_master_adapt(xfrd->tcp_set, m, 0);
 	/* now release the entire tcp pipe */
 	xfrd_tcp_pipe_release(xfrd->tcp_set, tp, conn);
+	tcp_master_start_waiting(xfrd->tcp_set, m);
 }
 
 static void
@@ -400,15 +538,30 @@ void
 xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 {
 	struct xfrd_tcp_pipeline* tp;
+	struct xfrd_tcp_master* m;
 	assert(zone->tcp_conn == -1);
 	assert(zone->tcp_waiting == 0);
 
-	if(set->tcp_count < XFRD_MAX_TCP) {
+	/* is there room for another transfer from this master */
+	m = tcp_master_find(set, zone);
+	if(m->num_active >= m->limit) {
+		DEBUG(DEBUG_XFRD,2, (LOG_INFO, "xfrd: zone %s waits, %d "
+			"transfers from master %s", zone->apex_str,
+			m->num_active, zone->master->ip_address_spec));
+		tcp_master_waiting_add(m, zone);
+		xfrd_deactivate_zone(zone);
+		xfrd_unset_timer(zone);
+		return;
+	}
+	m->num_active++;
+	zone->tcp_master = m;
+
+	if(set->tcp_count < set->tcp_max) {
 		int i;
 		assert(!set->tcp_waiting_first);
 		set->tcp_count ++;
 		/* find a free tcp_buffer */
-		for(i=0; i<XFRD_MAX_TCP; i++) {
+		for(i=0; i<set->tcp_max; i++) {
 			if(set->tcp_state[i]->tcp_r->fd == -1) {
 				zone->tcp_conn = i;
 				break;
@@ -416,6 +569,7 @@ xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 		}
 		/** What if there is no free tcp_buffer? return; */
 		if (zone->tcp_conn < 0) {
+			tcp_master_release(zone);
 			return;
 		}
 
@@ -429,7 +583,10 @@ xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 		if(!xfrd_tcp_open(set, tp, zone)) {
 			zone->tcp_conn = -1;
 			set->tcp_count --;
+			tcp_master_release(zone);
+			tcp_master_adapt(set, m, 0);
 			xfrd_set_refresh_now(zone);
+			tcp_master_start_waiting(set, m);
 			return;
 		}
 		/* ip and ip_len set by tcp_open */
@@ -455,7 +612,7 @@ xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 		int i;
 		if(zone->zone_handler.ev_fd != -1)
 			xfrd_udp_release(zone);
-		for(i=0; i<XFRD_MAX_TCP; i++) {
+		for(i=0; i<set->tcp_max; i++) {
 			if(set->tcp_state[i] == tp)
 				zone->tcp_conn = i;
 		}
@@ -467,7 +624,7 @@ xfrd_tcp_obtain(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 
 	/* wait, at end of line */
 	DEBUG(DEBUG_XFRD,2, (LOG_INFO, "xfrd: max number of tcp "
-		"connections (%d) reached.", XFRD_MAX_TCP));
+		"connections (%d) reached.", set->tcp_max));
 	zone->tcp_waiting_next = 0;
 	zone->tcp_waiting_prev = set->tcp_waiting_last;
 	zone->tcp_waiting = 1;
@@ -853,6 +1010,7 @@ xfrd_tcp_read(struct xfrd_tcp_pipeline* tp)
 			tp->num_skip++;
 			/* fall through to remove zone from tp */
 		case xfrd_packet_transfer:
+			tcp_master_adapt(xfrd->tcp_set, zone->tcp_master, 1);
 			xfrd_tcp_release(xfrd->tcp_set, zone);
 			assert(zone->round_num == -1);
 			break;
@@ -868,6 +1026,7 @@ xfrd_tcp_read(struct xfrd_tcp_pipeline* tp)
 			/* set to skip if more packets with this ID */
 			tp->id[zone->query_id] = TCP_NULL_SKIP;
 			tp->num_skip++;
+			tcp_master_adapt(xfrd->tcp_set, zone->tcp_master, 0);
 			xfrd_tcp_release(xfrd->tcp_set, zone);
 			/* query next server */
 			xfrd_make_request(zone);
@@ -875,8 +1034,10 @@ xfrd_tcp_read(struct xfrd_tcp_pipeline* tp)
 	}
 }
 
-void
-xfrd_tcp_release(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+/* release the tcp connection of the zone, and start a zone that waits
+ * for a connection */
+static void
+tcp_release_conn(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 {
 	int conn = zone->tcp_conn;
 	struct xfrd_tcp_pipeline* tp = set->tcp_state[conn];
@@ -924,6 +1085,15 @@ xfrd_tcp_release(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
 		xfrd_tcp_pipe_release(set, tp, conn);
 }
 
+void
+xfrd_tcp_release(xfrd_tcp_set_t* set, xfrd_zone_t* zone)
+{
+	struct xfrd_tcp_master* m = zone->tcp_master;
+	tcp_release_conn(set, zone);
+	tcp_master_release(zone);
+	tcp_master_start_waiting(set, m);
+}
+
 void
 xfrd_tcp_pipe_release(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 	int conn)
@@ -946,7 +1116,7 @@ xfrd_tcp_pipe_release(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 	/* a waiting zone can use the free tcp slot (to another server) */
 	/* if that zone fails to set-up or connect, we try to start the next
 	 * waiting zone in the list */
-	while(set->tcp_count == XFRD_MAX_TCP && set->tcp_waiting_first) {
+	while(set->tcp_count == set->tcp_max && set->tcp_waiting_first) {
 		int i;
 
 		/* pop first waiting process */
@@ -960,8 +1130,12 @@ xfrd_tcp_pipe_release(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 		if(zone->zone_handler.ev_fd != -1)
 			xfrd_udp_release(zone);
 		if(!xfrd_tcp_open(set, tp, zone)) {
+			struct xfrd_tcp_master* m = zone->tcp_master;
 			zone->tcp_conn = -1;
+			tcp_master_adapt(set, m, 0);
+			tcp_master_release(zone);
 			xfrd_set_refresh_now(zone);
+			tcp_master_start_waiting(set, m);
 			/* try to start the next zone (if any) */
 			continue;
 		}
@@ -21,6 +21,7 @@ struct dname;
 struct acl_options;
 
 struct xfrd_tcp_pipeline;
+struct xfrd_tcp_master;
 typedef struct xfrd_tcp xfrd_tcp_t;
 typedef struct xfrd_tcp_set xfrd_tcp_set_t;
 /*
@@ -28,7 +29,9 @@ typedef struct xfrd_tcp_set xfrd_tcp_set_t;
  */
 struct xfrd_tcp_set {
 	/* tcp connections, each has packet and read/wr state */
-	struct xfrd_tcp_pipeline *tcp_state[XFRD_MAX_TCP];
+	struct xfrd_tcp_pipeline **tcp_state;
+	/* number of TCP connections, from xfrd-tcp-max */
+	int tcp_max;
 	/* number of TCP connections in use. */
 	int tcp_count;
 	/* TCP timeout. */
@@ -37,6 +40,43 @@ struct xfrd_tcp_set {
 	rbtree_t* pipetree;
 	/* double linked list of zones waiting for a TCP connection */
 	struct xfrd_zone *tcp_waiting_first, *tcp_waiting_last;
+	/* rbtree with the transfer limits of the masters, sorted by IP */
+	rbtree_t* mastertree;
+	/* upper bound of the limit of a master, from xfrd-tcp-master-max */
+	int master_max;
+};
+
+/* the limit of transfers at a time that a master starts with */
+#define XFRD_TCP_MASTER_START 8
+
+/*
+ * The transfers from one master (IP address and port) at a time.  The
+ * limit is raised by one for a transfer that succeeds, and halved when
+ * transfers fail or time out, at most once per second.  Zones over the
+ * limit wait in the list of the master until a transfer from it ends,
+ * they do not hold up zones that are transferred from other masters.
+ */
+struct xfrd_tcp_master {
+	/* the rbtree node, key is this structure */
+	rbnode_t node;
+	/* address of the master */
+#ifdef INET6
+	struct sockaddr_storage ip;
+#else
+	struct sockaddr_in ip;
+#endif /* INET6 */
+	socklen_t ip_len;
+	/* number of zones that are transferred from it, or wait for a
+	 * TCP connection to do so */
+	int num_active;
+	/* number of transfers it may have at a time */
+	int limit;
+	/* time the limit was last halved */
+	time_t lowered;
+	/* if the waiting zones are being started */
+	int starting;
+	/* double linked list of zones waiting for the limit */
+	struct xfrd_zone *waiting_first, *waiting_last;
 };
 
 /*
@@ -124,8 +164,10 @@ struct xfrd_tcp_pipeline {
 	uint16_t unused[ID_PIPE_NUM];
 };
 
-/* create set of tcp connections */
-xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region);
+/* create set of tcp connections, at most tcp_max, and at most
+ * master_max at a time for a master */
+xfrd_tcp_set_t* xfrd_tcp_set_create(struct region* region, int tcp_max,
+	int master_max);
 
 /* init tcp state */
 xfrd_tcp_t* xfrd_tcp_create(struct region* region, size_t bufsize);
@@ -133,6 +175,8 @@ xfrd_tcp_t* xfrd_tcp_create(struct region* region, size_t bufsize);
 void xfrd_tcp_obtain(xfrd_tcp_set_t* set, struct xfrd_zone* zone);
 /* release tcp connection for a zone (starts waiting) */
 void xfrd_tcp_release(xfrd_tcp_set_t* set, struct xfrd_zone* zone);
+/* remove a zone from the list it waits in for a tcp connection */
+void xfrd_tcp_waiting_remove(xfrd_tcp_set_t* set, struct xfrd_zone* zone);
 /* release tcp pipe entirely (does not stop the zones inside it) */
 void xfrd_tcp_pipe_release(xfrd_tcp_set_t* set, struct xfrd_tcp_pipeline* tp,
 	int conn);
@@ -68,6 +68,13 @@ static void xfrd_set_zone_state(xfrd_zone_t* zone, enum xfrd_zone_state new_zone
 static void xfrd_set_timer_retry(xfrd_zone_t* zone);
 /* set timer for refresh timeout (depends on zone_state) */
 static void xfrd_set_timer_refresh(xfrd_zone_t* zone);
+/* remove the timeout of the zone from the timer wheel */
+static void xfrd_wheel_remove(xfrd_zone_t* zone);
+/* put the zone in the list of updates for nsd if it has a disk soa that
+ * is not loaded */
+static void xfrd_update_waiting_check(xfrd_zone_t* zone);
+/* remove the zone from the list of updates for nsd */
+static void xfrd_update_waiting_remove(xfrd_zone_t* zone);
 
 /* set reload timeout */
 static void xfrd_set_reload_timeout(void);
@@ -135,6 +142,8 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	}
 	xfrd->nsd = nsd;
 	xfrd->packet = buffer_create(xfrd->region, QIOBUFSZ);
+	xfrd->xfr_rrs = buffer_create(xfrd->region, QIOBUFSZ);
+	xfrd->xfr_rrs_owner_len = 0;
 	xfrd->udp_waiting_first = NULL;
 	xfrd->udp_waiting_last = NULL;
 	xfrd->udp_use_num = 0;
@@ -144,6 +153,15 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->zonestat_safe = nsd->zonestatdesired;
 #endif
 	xfrd->activated_first = NULL;
+	xfrd->update_first = NULL;
+	xfrd->wheel = (struct xfrd_wheel*)region_alloc_zero(xfrd->region,
+		sizeof(struct xfrd_wheel));
+	xfrd->wheel->now = xfrd_time();
+	xfrd->state_dirty_first = NULL;
+	xfrd->state_dirty_num = 0;
+	xfrd->state_records = 0;
+	xfrd->state_rewrite = 1;
+	xfrd->state_timer_added = 0;
 	xfrd->ipc_pass = buffer_create(xfrd->region, QIOBUFSZ);
 	xfrd->last_task = region_alloc(xfrd->region, sizeof(*xfrd->last_task));
 	udb_ptr_init(xfrd->last_task, xfrd->nsd->task[xfrd->nsd->mytask]);
@@ -185,7 +203,8 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	daemon_remote_attach(xfrd->nsd->rc, xfrd);
 #endif
 
-	xfrd->tcp_set = xfrd_tcp_set_create(xfrd->region);
+	xfrd->tcp_set = xfrd_tcp_set_create(xfrd->region,
+		nsd->options->xfrd_tcp_max, nsd->options->xfrd_tcp_master_max);
 	xfrd->tcp_set->tcp_timeout = nsd->tcp_timeout;
 #ifndef HAVE_ARC4RANDOM
 	srandom((unsigned long) getpid() * (unsigned long) time(NULL));
@@ -323,6 +342,10 @@ xfrd_shutdown()
 	close(xfrd->ipc_handler.ev_fd); /* notifies parent we stop */
 	if(xfrd->nsd->options->xfrdfile != NULL && xfrd->nsd->options->xfrdfile[0]!=0)
 		xfrd_write_state(xfrd);
+	if(xfrd->state_timer_added) {
+		event_del(&xfrd->state_timer);
+		xfrd->state_timer_added = 0;
+	}
 	if(xfrd->reload_added) {
 		event_del(&xfrd->reload_handler);
 		xfrd->reload_added = 0;
@@ -431,11 +454,23 @@ xfrd_init_slave_zone(xfrd_state_t* xfrd, zone_options_t* zone_opt)
 	xzone->zone_handler.ev_fd = -1;
 	xzone->zone_handler_flags = 0;
 	xzone->event_added = 0;
+	xzone->wheel_slot = -1;
+	xzone->wheel_time = 0;
+	xzone->wheel_next = NULL;
+	xzone->wheel_prev = NULL;
+	xzone->state_dirty = 0;
+	xzone->state_dirty_next = NULL;
+	xzone->state_dirty_prev = NULL;
 
 	xzone->tcp_conn = -1;
 	xzone->tcp_waiting = 0;
+	xzone->tcp_master = NULL;
+	xzone->tcp_master_waiting = 0;
 	xzone->udp_waiting = 0;
 	xzone->is_activated = 0;
+	xzone->update_waiting = 0;
+	xzone->update_next = NULL;
+	xzone->update_prev = NULL;
 
 	tsig_create_record_custom(&xzone->tsig, NULL, 0, 0, 4);
 
@@ -643,15 +678,7 @@ xfrd_del_slave_zone(xfrd_state_t* xfrd, const dname_type* dname)
 	/* io */
 	if(z->tcp_waiting) {
 		/* delete from tcp waiting list */
-		if(z->tcp_waiting_prev)
-			z->tcp_waiting_prev->tcp_waiting_next =
-				z->tcp_waiting_next;
-		else xfrd->tcp_set->tcp_waiting_first = z->tcp_waiting_next;
-		if(z->tcp_waiting_next)
-			z->tcp_waiting_next->tcp_waiting_prev =
-				z->tcp_waiting_prev;
-		else xfrd->tcp_set->tcp_waiting_last = z->tcp_waiting_prev;
-		z->tcp_waiting = 0;
+		xfrd_tcp_waiting_remove(xfrd->tcp_set, z);
 	}
 	if(z->udp_waiting) {
 		/* delete from udp waiting list */
@@ -672,6 +699,9 @@ xfrd_del_slave_zone(xfrd_state_t* xfrd, const dname_type* dname)
 		xfrd_udp_release(z);
 	} else if(z->event_added)
 		event_del(&z->zone_handler);
+	xfrd_wheel_remove(z);
+	xfrd_state_clean(z);
+	xfrd_update_waiting_remove(z);
 	if(z->msg_seq_nr)
 		xfrd_unlink_xfrfile(xfrd->nsd, z->xfrfilenumber);
 
@@ -915,7 +945,7 @@ xfrd_udp_obtain(xfrd_zone_t* zone)
 		/* no tcp and udp at the same time */
 		xfrd_tcp_release(xfrd->tcp_set, zone);
 	}
-	if(xfrd->udp_use_num < XFRD_MAX_UDP) {
+	if(xfrd->udp_use_num < (size_t)xfrd->nsd->options->xfrd_udp_max) {
 		int fd;
 		xfrd->udp_use_num++;
 		fd = xfrd_send_ixfr_request_udp(zone);
@@ -924,6 +954,7 @@ xfrd_udp_obtain(xfrd_zone_t* zone)
 		else {
 			if(zone->event_added)
 				event_del(&zone->zone_handler);
+			xfrd_wheel_remove(zone);
 			event_set(&zone->zone_handler, fd,
 				EV_PERSIST|EV_READ|EV_TIMEOUT,
 				xfrd_handle_zone, zone);
@@ -1002,6 +1033,7 @@ xfrd_set_zone_state(xfrd_zone_t* zone, enum xfrd_zone_state s)
 	if(s != zone->state) {
 		enum xfrd_zone_state old = zone->state;
 		zone->state = s;
+		xfrd_state_dirty(zone);
 		if((s == xfrd_zone_expired || old == xfrd_zone_expired)
 			&& s!=old) {
 			xfrd_send_expire_notification(zone);
@@ -1025,14 +1057,223 @@ xfrd_set_refresh_now(xfrd_zone_t* zone)
 	}
 }
 
+/* add zone to the front of a list of the timer wheel */
+static void
+xfrd_wheel_link(struct xfrd_wheel* w, xfrd_zone_t* zone, int idx)
+{
+	zone->wheel_slot = idx;
+	zone->wheel_prev = NULL;
+	zone->wheel_next = w->slot[idx];
+	if(w->slot[idx])
+		w->slot[idx]->wheel_prev = zone;
+	w->slot[idx] = zone;
+}
+
+/* add zone to the end of the list of due zones */
+static void
+xfrd_wheel_link_due(struct xfrd_wheel* w, xfrd_zone_t* zone)
+{
+	zone->wheel_slot = XFRD_WHEEL_DUE;
+	zone->wheel_next = NULL;
+	zone->wheel_prev = w->due_last;
+	if(w->due_last)
+		w->due_last->wheel_next = zone;
+	else	w->slot[XFRD_WHEEL_DUE] = zone;
+	w->due_last = zone;
+}
+
+/* remove zone from its list in the timer wheel */
+static void
+xfrd_wheel_unlink(struct xfrd_wheel* w, xfrd_zone_t* zone)
+{
+	if(zone->wheel_prev)
+		zone->wheel_prev->wheel_next = zone->wheel_next;
+	else	w->slot[zone->wheel_slot] = zone->wheel_next;
+	if(zone->wheel_next)
+		zone->wheel_next->wheel_prev = zone->wheel_prev;
+	else if(zone->wheel_slot == XFRD_WHEEL_DUE)
+		w->due_last = zone->wheel_prev;
+	zone->wheel_slot = -1;
+}
+
+/* put zone in the slot for its expiry time */
+static void
+xfrd_wheel_place(struct xfrd_wheel* w, xfrd_zone_t* zone)
+{
+	time_t t = zone->wheel_time;
+	int lvl;
+	/* what is due now goes in the slot of the next second */
+	if(t <= w->now)
+		t = w->now + 1;
+	for(lvl = 0; lvl < XFRD_WHEEL_LEVELS-1; lvl++) {
+		if(t - w->now < ((time_t)1 << ((lvl+1)*XFRD_WHEEL_BITS)))
+			break;
+	}
+	/* further than the wheel goes, it is placed again when the slot
+	 * is reached */
+	if(t - w->now >= ((time_t)1 << (XFRD_WHEEL_LEVELS*XFRD_WHEEL_BITS)))
+		t = w->now + ((time_t)1 << (XFRD_WHEEL_LEVELS*XFRD_WHEEL_BITS)) - 1;
+	xfrd_wheel_link(w, zone, lvl*XFRD_WHEEL_SIZE +
+		(int)((t >> (lvl*XFRD_WHEEL_BITS)) & (XFRD_WHEEL_SIZE-1)));
+}
+
+static void
+xfrd_wheel_tick_add(struct xfrd_wheel* w)
+{
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	event_set(&w->tick, -1, EV_TIMEOUT, xfrd_handle_wheel, w);
+	if(event_base_set(xfrd->event_base, &w->tick) != 0)
+		log_msg(LOG_ERR, "xfrd wheel: event_base_set failed");
+	if(event_add(&w->tick, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd wheel: event_add failed");
+	w->tick_added = 1;
+}
+
+/* set the timeout of the zone in the timer wheel */
+static void
+xfrd_wheel_insert(xfrd_zone_t* zone, time_t t)
+{
+	struct xfrd_wheel* w = xfrd->wheel;
+	if(zone->wheel_slot != -1)
+		xfrd_wheel_unlink(w, zone);
+	else if(w->count++ == 0) {
+		/* the wheel is empty, it restarts at the current time */
+		w->now = xfrd_time();
+	}
+	zone->wheel_time = xfrd_time() + t;
+	xfrd_wheel_place(w, zone);
+	if(!w->tick_added)
+		xfrd_wheel_tick_add(w);
+}
+
+/* remove the timeout of the zone from the timer wheel */
+static void
+xfrd_wheel_remove(xfrd_zone_t* zone)
+{
+	if(zone->wheel_slot == -1)
+		return;
+	xfrd_wheel_unlink(xfrd->wheel, zone);
+	xfrd->wheel->count--;
+}
+
+/* spread the zones of a slot over the levels below */
+static void
+xfrd_wheel_cascade(struct xfrd_wheel* w, int lvl)
+{
+	int idx = lvl*XFRD_WHEEL_SIZE + (int)((w->now >>
+		(lvl*XFRD_WHEEL_BITS)) & (XFRD_WHEEL_SIZE-1));
+	while(w->slot[idx]) {
+		xfrd_zone_t* zone = w->slot[idx];
+		xfrd_wheel_unlink(w, zone);
+		xfrd_wheel_place(w, zone);
+	}
+}
+
+void
+xfrd_handle_wheel(int ATTR_UNUSED(fd), short ATTR_UNUSED(event), void* arg)
+{
+	struct xfrd_wheel* w = (struct xfrd_wheel*)arg;
+	size_t batch;
+	w->tick_added = 0;
+	while(w->now < xfrd_time()) {
+		int lvl, idx;
+		w->now++;
+		/* when a level turns around, take the next slot above */
+		for(lvl = 1; lvl < XFRD_WHEEL_LEVELS; lvl++) {
+			if((w->now & (((time_t)1 << (lvl*XFRD_WHEEL_BITS))-1))
+				!= 0)
+				break;
+			xfrd_wheel_cascade(w, lvl);
+		}
+		idx = (int)(w->now & (XFRD_WHEEL_SIZE-1));
+		while(w->slot[idx]) {
+			xfrd_zone_t* zone = w->slot[idx];
+			xfrd_wheel_unlink(w, zone);
+			if(zone->wheel_time > w->now)
+				xfrd_wheel_place(w, zone);
+			else	xfrd_wheel_link_due(w, zone);
+		}
+	}
+	/* handle the due zones, spread out if there are many */
+	batch = w->count / XFRD_WHEEL_SIZE;
+	if(batch < XFRD_WHEEL_BATCH)
+		batch = XFRD_WHEEL_BATCH;
+	while(w->slot[XFRD_WHEEL_DUE] && batch > 0) {
+		xfrd_zone_t* zone = w->slot[XFRD_WHEEL_DUE];
+		xfrd_wheel_remove(zone);
+		batch--;
+		xfrd_handle_zone(zone->zone_handler.ev_fd, EV_TIMEOUT, zone);
+	}
+	if(w->count > 0 && !w->tick_added)
+		xfrd_wheel_tick_add(w);
+}
+
+/* write the changed zones to the state file */
+static void
+xfrd_handle_state_timer(int ATTR_UNUSED(fd), short ATTR_UNUSED(event),
+	void* ATTR_UNUSED(arg))
+{
+	xfrd->state_timer_added = 0;
+	xfrd_write_state(xfrd);
+}
+
+void
+xfrd_state_dirty(xfrd_zone_t* zone)
+{
+	struct timeval tv;
+	if(zone->state_dirty || xfrd->nsd->options->xfrdfile == NULL ||
+		xfrd->nsd->options->xfrdfile[0] == 0)
+		return;
+	zone->state_dirty = 1;
+	zone->state_dirty_prev = NULL;
+	zone->state_dirty_next = xfrd->state_dirty_first;
+	if(xfrd->state_dirty_first)
+		xfrd->state_dirty_first->state_dirty_prev = zone;
+	xfrd->state_dirty_first = zone;
+	xfrd->state_dirty_num++;
+	if(xfrd->state_timer_added || xfrd->shutdown)
+		return;
+	tv.tv_sec = XFRD_STATE_WRITE_DELAY;
+	tv.tv_usec = 0;
+	event_set(&xfrd->state_timer, -1, EV_TIMEOUT,
+		xfrd_handle_state_timer, NULL);
+	if(event_base_set(xfrd->event_base, &xfrd->state_timer) != 0)
+		log_msg(LOG_ERR, "xfrd state timer: event_base_set failed");
+	if(event_add(&xfrd->state_timer, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd state timer: event_add failed");
+	xfrd->state_timer_added = 1;
+}
+
+void
+xfrd_state_clean(xfrd_zone_t* zone)
+{
+	if(!zone->state_dirty)
+		return;
+	if(zone->state_dirty_prev)
+		zone->state_dirty_prev->state_dirty_next =
+			zone->state_dirty_next;
+	else	xfrd->state_dirty_first = zone->state_dirty_next;
+	if(zone->state_dirty_next)
+		zone->state_dirty_next->state_dirty_prev =
+			zone->state_dirty_prev;
+	zone->state_dirty = 0;
+	zone->state_dirty_next = NULL;
+	zone->state_dirty_prev = NULL;
+	xfrd->state_dirty_num--;
+}
+
 void
 xfrd_unset_timer(xfrd_zone_t* zone)
 {
 	assert(zone->zone_handler.ev_fd == -1);
 	if(zone->event_added)
 		event_del(&zone->zone_handler);
+	xfrd_wheel_remove(zone);
 	zone->zone_handler_flags = 0;
 	zone->event_added = 0;
+	xfrd_state_dirty(zone);
 }
 
 void
@@ -1040,6 +1281,7 @@ xfrd_set_timer(xfrd_zone_t* zone, time_t t)
 {
 	int fd = zone->zone_handler.ev_fd;
 	int fl = ((fd == -1)?EV_TIMEOUT:zone->zone_handler_flags);
+	xfrd_state_dirty(zone);
 	/* randomize the time, within 90%-100% of original */
 	/* not later so zones cannot expire too late */
 	/* only for times far in the future */
@@ -1052,12 +1294,21 @@ xfrd_set_timer(xfrd_zone_t* zone, time_t t)
 #endif
 	}
 
-	/* keep existing flags and fd, but re-add with timeout */
-	if(zone->event_added)
-		event_del(&zone->zone_handler);
-	else	fd = -1;
 	zone->timeout.tv_sec = t;
 	zone->timeout.tv_usec = 0;
+	if(!zone->event_added || fd == -1) {
+		/* without a socket the timeout is kept in the wheel */
+		if(zone->event_added)
+			event_del(&zone->zone_handler);
+		zone->event_added = 0;
+		zone->zone_handler.ev_fd = -1;
+		zone->zone_handler_flags = EV_TIMEOUT;
+		xfrd_wheel_insert(zone, t);
+		return;
+	}
+
+	/* keep existing flags and fd, but re-add with timeout */
+	event_del(&zone->zone_handler);
 	event_set(&zone->zone_handler, fd, fl, xfrd_handle_zone, zone);
 	if(event_base_set(xfrd->event_base, &zone->zone_handler) != 0)
 		log_msg(LOG_ERR, "xfrd timer: event_base_set failed");
@@ -1071,15 +1322,19 @@ void
 xfrd_handle_incoming_soa(xfrd_zone_t* zone,
 	xfrd_soa_t* soa, time_t acquired)
 {
+	xfrd_state_dirty(zone);
 	if(soa == NULL) {
 		/* nsd no longer has a zone in memory */
 		zone->soa_nsd_acquired = 0;
+		xfrd_update_waiting_check(zone);
 		xfrd_set_zone_state(zone, xfrd_zone_refreshing);
 		xfrd_set_refresh_now(zone);
 		return;
 	}
-	if(zone->soa_nsd_acquired && soa->serial == zone->soa_nsd.serial)
+	if(zone->soa_nsd_acquired && soa->serial == zone->soa_nsd.serial) {
+		xfrd_update_waiting_check(zone);
 		return;
+	}
 
 	if(zone->soa_disk_acquired && soa->serial == zone->soa_disk.serial)
 	{
@@ -1089,6 +1344,7 @@ xfrd_handle_incoming_soa(xfrd_zone_t* zone,
 			(unsigned)ntohl(soa->serial));
 		zone->soa_nsd = zone->soa_disk;
 		zone->soa_nsd_acquired = zone->soa_disk_acquired;
+		xfrd_update_waiting_remove(zone);
 		xfrd->write_zonefile_needed = 1;
 		if(xfrd_time() - zone->soa_disk_acquired
 			< (time_t)ntohl(zone->soa_disk.refresh))
@@ -1136,6 +1392,7 @@ xfrd_handle_incoming_soa(xfrd_zone_t* zone,
 	zone->soa_disk = *soa;
 	zone->soa_nsd_acquired = acquired;
 	zone->soa_disk_acquired = acquired;
+	xfrd_update_waiting_remove(zone);
 	if(zone->soa_notified_acquired != 0 &&
 		(zone->soa_notified.serial == 0 ||
 	   	compare_serial(ntohl(zone->soa_disk.serial),
@@ -1187,7 +1444,7 @@ xfrd_udp_release(xfrd_zone_t* zone)
 	zone->zone_handler_flags = 0;
 	zone->event_added = 0;
 	/* see if there are waiting zones */
-	if(xfrd->udp_use_num == XFRD_MAX_UDP)
+	if(xfrd->udp_use_num >= (size_t)xfrd->nsd->options->xfrd_udp_max)
 	{
 		while(xfrd->udp_waiting_first) {
 			/* snip off waiting list */
@@ -1205,6 +1462,7 @@ xfrd_udp_release(xfrd_zone_t* zone)
 				if(fd != -1) {
 					if(wz->event_added)
 						event_del(&wz->zone_handler);
+					xfrd_wheel_remove(wz);
 					event_set(&wz->zone_handler, fd,
 						EV_READ|EV_TIMEOUT|EV_PERSIST,
 						xfrd_handle_zone, wz);
@@ -1514,6 +1772,197 @@ static int xfrd_parse_soa_info(buffer_type* packet, xfrd_soa_t* soa)
 }
 
 
+/* start the RRs for the transfer file of a received packet */
+static void
+xfrd_xfr_rrs_clear(void)
+{
+	buffer_clear(xfrd->xfr_rrs);
+	/* the number of RRs */
+	buffer_write_u32(xfrd->xfr_rrs, 0);
+	xfrd->xfr_rrs_owner_len = 0;
+	memset(xfrd->xfr_rrs_names, 0, sizeof(xfrd->xfr_rrs_names));
+}
+
+/* hash of a name up to the label, from the hash of the labels above it */
+static uint32_t
+xfrd_xfr_rrs_hash(uint32_t h, const uint8_t* label)
+{
+	uint8_t i;
+	for(i=0; i<=label[0]; i++)
+		h = h*33 + label[i];
+	return h;
+}
+
+/* see if the name at the position in the RRs, that may end in a
+ * compression pointer, is equal to the uncompressed name */
+static int
+xfrd_xfr_rrs_name_equal(buffer_type* out, size_t at, const uint8_t* name)
+{
+	const uint8_t* p;
+	while(1) {
+		p = buffer_at(out, at);
+		if(label_is_pointer(p)) {
+			/* the pointers go to names before them */
+			at = label_pointer_location(p);
+			continue;
+		}
+		if(p[0] != name[0] || memcmp(p+1, name+1, p[0]) != 0)
+			return 0;
+		if(p[0] == 0)
+			return 1;
+		at += p[0]+1;
+		name += name[0]+1;
+	}
+}
+
+/*
+ * Write a domain name to the RRs.  The end of it is a compression pointer
+ * to the same name earlier in the RRs, if the table of names has it.
+ * The labels that are written go in the table, if a pointer can reach
+ * them, for the names after it.
+ */
+static void
+xfrd_xfr_rrs_write_name(buffer_type* out, const dname_type* dname)
+{
+	uint32_t h[MAXDOMAINLEN];
+	size_t pos = buffer_position(out), at;
+	uint8_t i, match = 0;
+	h[0] = 0;
+	for(i=1; i<dname->label_count; i++)
+		h[i] = xfrd_xfr_rrs_hash(h[i-1], dname_label(dname, i));
+	for(i=dname->label_count-1; i>0; i--) {
+		at = xfrd->xfr_rrs_names[h[i]%XFRD_XFR_RRS_NAMES];
+		if(at != 0 && xfrd_xfr_rrs_name_equal(out, at,
+			dname_label(dname, i))) {
+			match = i;
+			break;
+		}
+	}
+	if(match) {
+		buffer_write(out, dname_name(dname),
+			dname_label_offsets(dname)[match]);
+		buffer_write_u16(out, 0xc000 | (uint16_t)at);
+	} else	buffer_write(out, dname_name(dname), dname->name_size);
+	for(i=match+1; i<dname->label_count; i++) {
+		at = pos + dname_label_offsets(dname)[i];
+		/* compression pointers have 14 bits */
+		if(at <= MAX_COMPRESSION_OFFSET)
+			xfrd->xfr_rrs_names[h[i]%XFRD_XFR_RRS_NAMES] = (uint16_t)at;
+	}
+}
+
+/*
+ * Add an RR to the RRs for the transfer file.  The owner name is
+ * stored as DIFF_OWNER_PREV if it is the owner of the RR before it.
+ * The owner and the domain names in the rdata are compressed, with
+ * pointers to the names before them.  0 on error.
+ */
+static int
+xfrd_xfr_rrs_add(const dname_type* owner, uint16_t type, uint16_t klass,
+	uint32_t ttl, rdata_atom_type* rdatas, ssize_t rdata_num)
+{
+	buffer_type* out = xfrd->xfr_rrs;
+	size_t rdlen = 0, rdpos;
+	ssize_t i;
+
+	/* the rdata must fit when the reload decompresses it */
+	for(i=0; i<rdata_num; i++) {
+		if(rdata_atom_is_domain(type, i))
+			rdlen += domain_dname(rdata_atom_domain(rdatas[i]))->
+				name_size;
+		else	rdlen += rdata_atom_size(rdatas[i]);
+	}
+	if(rdlen > MAX_RDLENGTH)
+		return 0;
+	/* the reload does not read larger parts of the transfer file */
+	if(buffer_position(out) + owner->name_size + 10 + rdlen >
+		DIFF_PART_XRRS_MAX)
+		return 0;
+
+	buffer_reserve(out, owner->name_size + 10 + rdlen);
+	if(xfrd->xfr_rrs_owner_len == owner->name_size &&
+		memcmp(xfrd->xfr_rrs_owner, dname_name(owner),
+		owner->name_size) == 0) {
+		buffer_write_u8(out, DIFF_OWNER_PREV);
+	} else {
+		xfrd->xfr_rrs_owner_len = owner->name_size;
+		memcpy(xfrd->xfr_rrs_owner, dname_name(owner),
+			owner->name_size);
+		xfrd_xfr_rrs_write_name(out, owner);
+	}
+	buffer_write_u16(out, type);
+	buffer_write_u16(out, klass);
+	buffer_write_u32(out, ttl);
+	rdpos = buffer_position(out);
+	buffer_write_u16(out, 0);
+	for(i=0; i<rdata_num; i++) {
+		if(rdata_atom_is_domain(type, i))
+			xfrd_xfr_rrs_write_name(out, domain_dname(
+				rdata_atom_domain(rdatas[i])));
+		else	buffer_write(out, rdata_atom_data(rdatas[i]),
+				rdata_atom_size(rdatas[i]));
+	}
+	buffer_write_u16_at(out, rdpos, (uint16_t)(buffer_position(out) -
+		rdpos - 2));
+	buffer_write_u32_at(out, 0, buffer_read_u32_at(out, 0)+1);
+	return 1;
+}
+
+/* parse the RR at the position in the packet, and put it in the RRs
+ * for the transfer file.  Leaves the position at the start of the
+ * rdata, and returns the type and rdata length. 0 on error. */
+static int
+xfrd_xfr_parse_rr(xfrd_zone_t* zone, buffer_type* packet, region_type* temp,
+	uint16_t* type, uint16_t* rrlen)
+{
+	const dname_type* dname;
+	domain_table_type* owners;
+	rdata_atom_type* rdatas;
+	ssize_t rdata_num;
+	uint16_t klass;
+	uint32_t ttl;
+	size_t mempos;
+
+	region_free_all(temp);
+	owners = domain_table_create(temp);
+	/* check the dname for errors */
+	dname = dname_make_from_packet(temp, packet, 1, 1);
+	if(!dname) {
+		DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr unable "
+			"to parse owner name", zone->apex_str));
+		return 0;
+	}
+	if(!buffer_available(packet, 10)) {
+		DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr hdr "
+			"too small", zone->apex_str));
+		return 0;
+	}
+	*type = buffer_read_u16(packet);
+	klass = buffer_read_u16(packet);
+	ttl = buffer_read_u32(packet);
+	*rrlen = buffer_read_u16(packet);
+	if(!buffer_available(packet, *rrlen)) {
+		DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr pkt "
+			"too small", zone->apex_str));
+		return 0;
+	}
+	mempos = buffer_position(packet);
+	rdata_num = rdata_wireformat_to_rdata_atoms(temp, owners, *type,
+		*rrlen, packet, &rdatas);
+	if(rdata_num == -1) {
+		DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr unable "
+			"to parse rdata", zone->apex_str));
+		return 0;
+	}
+	if(!xfrd_xfr_rrs_add(dname, *type, klass, ttl, rdatas, rdata_num)) {
+		DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr rdata "
+			"too long", zone->apex_str));
+		return 0;
+	}
+	buffer_set_position(packet, mempos);
+	return 1;
+}
+
 /*
  * Check the RRs in an IXFR/AXFR reply.
  * returns 0 on error, 1 on correct parseable packet.
@@ -1529,9 +1978,6 @@ xfrd_xfr_check_rrs(xfrd_zone_t* zone, buffer_type* packet, size_t count,
 	uint32_t tmp_serial = 0;
 	uint16_t type, rrlen;
 	size_t i, soapos, mempos;
-	const dname_type* dname;
-	domain_table_type* owners;
-	rdata_atom_type* rdatas;
 
 	for(i=0; i<count; ++i,++zone->msg_rr_count)
 	{
@@ -1540,37 +1986,10 @@ xfrd_xfr_check_rrs(xfrd_zone_t* zone, buffer_type* packet, size_t count,
 				"trailing garbage", zone->apex_str));
 			return 0;
 		}
-		region_free_all(temp);
-		owners = domain_table_create(temp);
-		/* check the dname for errors */
-		dname = dname_make_from_packet(temp, packet, 1, 1);
-		if(!dname) {
-			DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr unable "
-				"to parse owner name", zone->apex_str));
+		if(!xfrd_xfr_parse_rr(zone, packet, temp, &type, &rrlen))
 			return 0;
-		}
-		if(!buffer_available(packet, 10)) {
-			DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr hdr "
-				"too small", zone->apex_str));
-			return 0;
-		}
-		soapos = buffer_position(packet);
-		type = buffer_read_u16(packet);
-		(void)buffer_read_u16(packet); /* class */
-		(void)buffer_read_u32(packet); /* ttl */
-		rrlen = buffer_read_u16(packet);
-		if(!buffer_available(packet, rrlen)) {
-			DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr pkt "
-				"too small", zone->apex_str));
-			return 0;
-		}
 		mempos = buffer_position(packet);
-		if(rdata_wireformat_to_rdata_atoms(temp, owners, type, rrlen,
-			packet, &rdatas) == -1) {
-			DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr unable "
-				"to parse rdata", zone->apex_str));
-			return 0;
-		}
+		soapos = mempos - 10;
 		if(type == TYPE_SOA) {
 			/* check the SOAs */
 			buffer_set_position(packet, soapos);
@@ -1694,7 +2113,10 @@ xfrd_parse_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet,
 	size_t nscount = NSCOUNT(packet);
 	int done = 0;
 	region_type* tempregion = NULL;
+	size_t rrstart;
+	uint16_t type, rrlen;
 
+	xfrd_xfr_rrs_clear();
 	/* has to be axfr / ixfr reply */
 	if(!buffer_available(packet, QHEADERSZ)) {
 		log_msg(LOG_INFO, "packet too small");
@@ -1773,8 +2195,9 @@ xfrd_parse_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet,
 
 	tempregion = region_create(xalloc, free);
 	if(zone->msg_rr_count == 0) {
-		const dname_type* soaname = dname_make_from_packet(tempregion,
-			packet, 1, 1);
+		const dname_type* soaname;
+		rrstart = buffer_position(packet);
+		soaname = dname_make_from_packet(tempregion, packet, 1, 1);
 		if(!soaname) { /* parse failure */
 			DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s, from %s: "
 				"parse error in SOA record",
@@ -1852,6 +2275,13 @@ xfrd_parse_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet,
 		if(zone->soa_disk_acquired)
 			zone->msg_old_serial = ntohl(zone->soa_disk.serial);
 		else zone->msg_old_serial = 0;
+		/* the first SOA is in the transfer file too */
+		buffer_set_position(packet, rrstart);
+		if(!xfrd_xfr_parse_rr(zone, packet, tempregion, &type, &rrlen)) {
+			region_destroy(tempregion);
+			return xfrd_packet_bad;
+		}
+		buffer_skip(packet, rrlen);
 		ancount_todo = ancount - 1;
 	}
 
@@ -1955,7 +2385,7 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 		}
 	}
 
-	/* dump reply on disk to diff file */
+	/* write the RRs of the reply to the transfer file */
 	/* if first part, get new filenumber.  Numbers can wrap around, 64bit
 	 * is enough so we do not collide with older-transfers-in-progress */
 	if(zone->msg_seq_nr == 0)
@@ -1963,8 +2393,8 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 	diff_write_packet(dname_to_string(zone->apex,0),
 		zone->zone_options->pattern->pname,
 		zone->msg_old_serial, zone->msg_new_serial, zone->msg_seq_nr,
-		buffer_begin(packet), buffer_limit(packet), xfrd->nsd,
-		zone->xfrfilenumber);
+		buffer_begin(xfrd->xfr_rrs), buffer_position(xfrd->xfr_rrs),
+		xfrd->nsd, zone->xfrfilenumber);
 	VERBOSITY(3, (LOG_INFO,
 		"xfrd: zone %s written received XFR packet from %s with serial %u to "
 		"disk", zone->apex_str, zone->master->ip_address_spec,
@@ -2004,6 +2434,7 @@ xfrd_handle_received_xfr_packet(xfrd_zone_t* zone, buffer_type* packet)
 	/* update the disk serial no. */
 	zone->soa_disk_acquired = xfrd_time();
 	zone->soa_disk = soa;
+	xfrd_update_waiting_check(zone);
 	if(zone->soa_notified_acquired && (
 		zone->soa_notified.serial == 0 ||
 		compare_serial(htonl(zone->soa_disk.serial),
@@ -2159,6 +2590,7 @@ xfrd_handle_passed_packet(buffer_type* packet,
 static int
 xfrd_handle_incoming_notify(xfrd_zone_t* zone, xfrd_soa_t* soa)
 {
+	xfrd_state_dirty(zone);
 	if(soa && zone->soa_disk_acquired && zone->state != xfrd_zone_expired &&
 	   compare_serial(ntohl(soa->serial),ntohl(zone->soa_disk.serial)) <= 0)
 	{
@@ -2208,17 +2640,51 @@ find_same_master_notify(xfrd_zone_t* zone, int acl_num_nfy)
 	return -1;
 }
 
+static void
+xfrd_update_waiting_remove(xfrd_zone_t* zone)
+{
+	if(!zone->update_waiting)
+		return;
+	if(zone->update_prev)
+		zone->update_prev->update_next = zone->update_next;
+	else	xfrd->update_first = zone->update_next;
+	if(zone->update_next)
+		zone->update_next->update_prev = zone->update_prev;
+	zone->update_waiting = 0;
+	zone->update_next = NULL;
+	zone->update_prev = NULL;
+}
+
+static void
+xfrd_update_waiting_check(xfrd_zone_t* zone)
+{
+	/* zone has a disk soa, and no nsd soa or a different nsd soa */
+	if(zone->soa_disk_acquired == 0 || (zone->soa_nsd_acquired != 0 &&
+		zone->soa_disk.serial == zone->soa_nsd.serial)) {
+		xfrd_update_waiting_remove(zone);
+		return;
+	}
+	if(zone->update_waiting)
+		return;
+	zone->update_waiting = 1;
+	zone->update_prev = NULL;
+	zone->update_next = xfrd->update_first;
+	if(xfrd->update_first)
+		xfrd->update_first->update_prev = zone;
+	xfrd->update_first = zone;
+}
+
 void
 xfrd_check_failed_updates()
 {
 	/* see if updates have not come through */
-	xfrd_zone_t* zone;
-	RBTREE_FOR(zone, xfrd_zone_t*, xfrd->zones)
+	xfrd_zone_t* zone, *next;
+	for(zone = xfrd->update_first; zone; zone = next)
 	{
+		next = zone->update_next;
 		/* zone has a disk soa, and no nsd soa or a different nsd soa */
-		if(zone->soa_disk_acquired != 0 &&
-			(zone->soa_nsd_acquired == 0 ||
-			zone->soa_disk.serial != zone->soa_nsd.serial))
+		xfrd_update_waiting_check(zone);
+		if(zone->update_waiting)
 		{
 			if(zone->soa_disk_acquired <
 				xfrd->reload_cmd_last_sent)
@@ -2233,6 +2699,7 @@ xfrd_check_failed_updates()
 				/* revert the soa; it has not been acquired properly */
 				zone->soa_disk_acquired = zone->soa_nsd_acquired;
 				zone->soa_disk = zone->soa_nsd;
+				xfrd_update_waiting_remove(zone);
 				/* pretend we are notified with disk soa.
 				   This will cause a refetch of the data, and reload. */
 				xfrd_handle_incoming_notify(zone, &dumped_soa);
@@ -2256,7 +2723,7 @@ void
 xfrd_prepare_zones_for_reload()
 {
 	xfrd_zone_t* zone;
-	RBTREE_FOR(zone, xfrd_zone_t*, xfrd->zones)
+	for(zone = xfrd->update_first; zone; zone = zone->update_next)
 	{
 		/* zone has a disk soa, and no nsd soa or a different nsd soa */
 		if(zone->soa_disk_acquired != 0 &&
@@ -37,6 +37,10 @@ struct udb_ptr;
 typedef struct xfrd_state xfrd_state_t;
 typedef struct xfrd_zone xfrd_zone_t;
 typedef struct xfrd_soa xfrd_soa_t;
+
+/* size of the table of names for compression in the transfer file RRs */
+#define XFRD_XFR_RRS_NAMES 1024
+
 /*
  * The global state for the xfrd daemon process.
  * The time_t times are epochs in secs since 1970, absolute times.
@@ -51,12 +55,23 @@ struct xfrd_state {
 	struct xfrd_tcp_set* tcp_set;
 	/* packet buffer for udp packets */
 	struct buffer* packet;
+	/* the RRs of the received transfer packet, in the form that is
+	 * written to the transfer file, and the last owner name in them */
+	struct buffer* xfr_rrs;
+	uint8_t xfr_rrs_owner[MAXDOMAINLEN+1];
+	size_t xfr_rrs_owner_len;
+	/* where the names, and their parents, are in xfr_rrs, by hash, for
+	 * the compression pointers to them, 0 if none */
+	uint16_t xfr_rrs_names[XFRD_XFR_RRS_NAMES];
 	/* udp waiting list, double linked list */
 	struct xfrd_zone *udp_waiting_first, *udp_waiting_last;
 	/* number of udp sockets (for sending queries) in use */
 	size_t udp_use_num;
 	/* activated waiting list, double linked list */
 	struct xfrd_zone *activated_first;
+	/* zones with a disk soa that nsd has not loaded (yet), double linked
+	 * list, so that a reload does not have to look at all zones */
+	struct xfrd_zone *update_first;
 
 	/* current time is cached */
 	uint8_t got_time;
@@ -114,6 +129,58 @@ struct xfrd_state {
 	int notify_udp_num;
 	/* first and last notify_zone_t* entries waiting for a UDP socket */
 	struct notify_zone_t *notify_waiting_first, *notify_waiting_last;
+
+	/* timeouts of the zones that do not wait for a socket */
+	struct xfrd_wheel* wheel;
+
+	/* zones with changes that are not in the state file yet */
+	xfrd_zone_t* state_dirty_first;
+	size_t state_dirty_num;
+	/* number of records in the state file, and if it has to be
+	 * written again as a whole */
+	size_t state_records;
+	int state_rewrite;
+	/* timer that writes the changes to the state file */
+	struct event state_timer;
+	int state_timer_added;
+};
+
+/* seconds that changes of the zones wait before they are appended to the
+ * state file, so that a number of them is written at once */
+#define XFRD_STATE_WRITE_DELAY 10
+
+/* the timer wheel has levels of slots, a slot of a level is as long as
+ * all the slots of the level below it, the first level has 1 second slots */
+#define XFRD_WHEEL_BITS 6
+#define XFRD_WHEEL_SIZE (1<<XFRD_WHEEL_BITS)
+#define XFRD_WHEEL_LEVELS 4
+/* the list index of the zones that are due, after the slots */
+#define XFRD_WHEEL_DUE (XFRD_WHEEL_LEVELS*XFRD_WHEEL_SIZE)
+/* at least this many due zones are handled per second */
+#define XFRD_WHEEL_BATCH 128
+
+/*
+ * Hierarchical timer wheel with the zone timeouts.  One timer event
+ * advances it every second, while it has zones.  The zones in the slot
+ * of that second are handled, and when a level has turned around the
+ * next slot of the level above is spread over the levels below.  To
+ * spread the queries to the masters, at most 1/64 of the zones in the
+ * wheel, or XFRD_WHEEL_BATCH if more, are handled per second, the rest
+ * stay due for the next second.  The due zones are handled first in,
+ * first out, so that every due zone gets its turn.
+ */
+struct xfrd_wheel {
+	/* the second the wheel has advanced to */
+	time_t now;
+	/* lists of zones in the slots, the last list has the due zones */
+	struct xfrd_zone* slot[XFRD_WHEEL_DUE + 1];
+	/* the last of the due zones, they are handled in order */
+	struct xfrd_zone* due_last;
+	/* number of zones in the wheel */
+	size_t count;
+	/* timer that advances the wheel */
+	struct event tick;
+	int tick_added;
 };
 
 /*
@@ -183,6 +250,16 @@ struct xfrd_zone {
 	struct event zone_handler;
 	int zone_handler_flags;
 	int event_added;
+	/* without a socket, the timeout is in the timer wheel: the list
+	 * it is in, or -1, and the time it expires */
+	int wheel_slot;
+	time_t wheel_time;
+	xfrd_zone_t* wheel_next;
+	xfrd_zone_t* wheel_prev;
+	/* changed since it was written to the state file, list of those */
+	int state_dirty;
+	xfrd_zone_t* state_dirty_next;
+	xfrd_zone_t* state_dirty_prev;
 
 	/* tcp connection zone is using, or -1 */
 	int tcp_conn;
@@ -193,6 +270,11 @@ struct xfrd_zone {
 	xfrd_zone_t* tcp_waiting_prev;
 	/* zone is in its tcp send queue */
 	uint8_t in_tcp_send;
+	/* the transfer limit of the master that the zone counts for, or
+	 * waits for, or NULL */
+	struct xfrd_tcp_master* tcp_master;
+	/* zone waits in the list of the master, not for a connection */
+	uint8_t tcp_master_waiting;
 	/* next zone in tcp send queue */
 	xfrd_zone_t* tcp_send_next;
 	xfrd_zone_t* tcp_send_prev;
@@ -206,6 +288,10 @@ struct xfrd_zone {
 	uint8_t is_activated;
 	xfrd_zone_t* activated_next;
 	xfrd_zone_t* activated_prev;
+	/* zone is in the list of zones that wait for nsd to load them */
+	uint8_t update_waiting;
+	xfrd_zone_t* update_next;
+	xfrd_zone_t* update_prev;
 
 	/* xfr message handling data */
 	/* query id */
@@ -230,17 +316,15 @@ enum xfrd_packet_result {
 };
 
 /*
-   Division of the (portably: 1024) max number of sockets that can be open.
-   The sum of the below numbers should be below the user limit for sockets
+   Division of the (portably: 1024) max number of sockets that can be open,
+   with the xfrd-tcp-max, xfrd-udp-max and xfrd-udp-notify-max options.
+   The sum of these numbers should be below the user limit for sockets
    open, or you see errors in your logfile.
    And it should be below FD_SETSIZE, to be able to select() on replies.
    Note that also some sockets are used for writing the ixfr.db, xfrd.state
    files and for the pipes to the main parent process.
+   Each TCP connection has a 64Kb buffer preallocated.
 */
-#define XFRD_MAX_TCP 32 /* max number of TCP AXFR/IXFR concurrent connections.*/
-			/* Each entry has 64Kb buffer preallocated.*/
-#define XFRD_MAX_UDP 64 /* max number of UDP sockets at a time for IXFR */
-#define XFRD_MAX_UDP_NOTIFY 64 /* max concurrent UDP sockets for NOTIFY */
 
 extern xfrd_state_t* xfrd;
 
@@ -357,6 +441,13 @@ void xfrd_handle_notify_and_start_xfr(xfrd_zone_t* zone, xfrd_soa_t* soa);
 
 /* handle zone timeout, event */
 void xfrd_handle_zone(int fd, short event, void* arg);
+/* handle the timer wheel tick, advances the wheel to the current time */
+void xfrd_handle_wheel(int fd, short event, void* arg);
+
+/* the zone changed, it is written to the state file a little later */
+void xfrd_state_dirty(xfrd_zone_t* zone);
+/* the zone is written to the state file (or deleted) */
+void xfrd_state_clean(xfrd_zone_t* zone);
 
 const char* xfrd_pretty_time(time_t v);
 
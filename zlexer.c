@@ -0,0 +1,762 @@
+/*
+ * zlexer.c -- lexical analyzer for (DNS) zone files
+ *
+ * Copyright (c) 2001-2006, NLnet Labs. All rights reserved
+ *
+ * See LICENSE for the license.
+ *
+ * The scanner works on the zone file in a buffer, that is read in
+ * chunks of ZLEXER_CHUNK.  A token that runs to the end of the buffer is
+ * scanned again after the rest of it is read.  The file is not mmapped,
+ * because if it is truncated while it is parsed, access to the mapped
+ * pages past the end raises SIGBUS.  Comments, words and quoted strings
+ * are skipped with memchr and a table of character classes, instead of
+ * a character at a time through stdio.  The tokens are the same as the
+ * flex scanner that it replaces returned, with the longest match rules
+ * of that scanner, so zparser.y and the zparser_conv functions get the
+ * same input.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "zonec.h"
+#include "dname.h"
+#include "zparser.h"
+
+#if 0
+#define LEXOUT(s)  printf s /* used ONLY when debugging */
+#else
+#define LEXOUT(s)
+#endif
+
+enum lexer_state {
+	EXPECT_OWNER,
+	PARSING_OWNER,
+	PARSING_TTL_CLASS_TYPE,
+	PARSING_RDATA
+};
+
+/* size of the reads from a zone file */
+#define ZLEXER_CHUNK (1024*1024)
+
+/* Input of the scanner, a zone file, include file or string. */
+struct zlexer_buffer {
+	/* the text and its length */
+	const char* data;
+	size_t size;
+	/* current position in the text */
+	size_t pos;
+	/* how data was obtained, so that it can be released */
+	enum { ZLEXER_STRING, ZLEXER_FILE } kind;
+	/* for a file: the allocated size of data, the file, -1 at the end
+	 * of the file, the file offset of data, and the file size or 0 */
+	size_t max;
+	int fd;
+	size_t offset;
+	size_t filesize;
+};
+
+/* Character classes. */
+#define ZL_WORD   0x01 /* can be in a word (not space, newline, ();.) */
+#define ZL_START  0x02 /* can start a word (also not " and $) */
+#define ZL_PLAIN  0x04 /* ordinary word character (also not \) */
+static uint8_t zlexer_class[256];
+static int zlexer_class_done = 0;
+
+static struct zlexer_buffer zonefile_buffer;
+static struct zlexer_buffer string_buffer;
+static struct zlexer_buffer* current = NULL;
+static struct zlexer_buffer* oldstate = NULL;
+
+static struct zlexer_buffer* include_stack[MAXINCLUDES];
+static zparser_type zparser_stack[MAXINCLUDES];
+static int include_stack_ptr = 0;
+
+static int paren_open = 0;
+static enum lexer_state lexer_state = EXPECT_OWNER;
+
+static int parse_token(int token, const char *text, size_t len,
+	enum lexer_state *lexer_state);
+
+static void
+zlexer_class_setup(void)
+{
+	int c;
+	for(c = 0; c < 256; c++) {
+		if(c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+			c == '(' || c == ')' || c == ';' || c == '.')
+			continue;
+		zlexer_class[c] = ZL_WORD;
+		if(c != '"' && c != '$')
+			zlexer_class[c] |= ZL_START;
+		if(c != '\\')
+			zlexer_class[c] |= ZL_PLAIN;
+	}
+	zlexer_class_done = 1;
+}
+
+/* read once into the free part of the buffer, returns as read(2) */
+static ssize_t
+zlexer_buffer_read(struct zlexer_buffer* buf)
+{
+	ssize_t r;
+	while((r = read(buf->fd, (char*)buf->data+buf->size,
+		buf->max-buf->size)) == -1 &&
+		(errno == EINTR || errno == EAGAIN))
+		;
+	if(r > 0)
+		buf->size += (size_t)r;
+	return r;
+}
+
+static void
+zlexer_buffer_eof(struct zlexer_buffer* buf)
+{
+	if(buf->fd > 0)
+		close(buf->fd);
+	buf->fd = -1;
+}
+
+/*
+ * Open a file and read the first chunk into the buffer.  "-" is stdin.
+ * Returns 0 on failure with errno set.
+ */
+static int
+zlexer_buffer_open(struct zlexer_buffer* buf, const char* filename)
+{
+	struct stat st;
+	ssize_t r;
+	int e;
+
+	if(!zlexer_class_done)
+		zlexer_class_setup();
+	if(strcmp(filename, "-") == 0)
+		buf->fd = 0;
+	else if((buf->fd = open(filename, O_RDONLY)) == -1)
+		return 0;
+	buf->kind = ZLEXER_FILE;
+	buf->pos = 0;
+	buf->size = 0;
+	buf->offset = 0;
+	buf->filesize = 0;
+	buf->max = ZLEXER_CHUNK;
+	/* one more than the size, so that the end of a small file is seen
+	 * without growing the buffer */
+	if(fstat(buf->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		buf->filesize = (size_t)st.st_size;
+		if(buf->filesize < buf->max)
+			buf->max = buf->filesize + 1;
+	}
+	buf->data = (char*)xalloc(buf->max);
+	while(buf->size < buf->max && (r = zlexer_buffer_read(buf)) != 0) {
+		if(r == -1) {
+			e = errno;
+			zlexer_buffer_eof(buf);
+			free((void*)buf->data);
+			buf->data = NULL;
+			errno = e;
+			return 0;
+		}
+	}
+	if(buf->size < buf->max)
+		zlexer_buffer_eof(buf);
+	return 1;
+}
+
+/*
+ * The token at the position runs to the end of the buffer, read more
+ * of the file.  The text from the position, and the character before
+ * it to see the start of a line, moves to the front, and the buffer
+ * grows if that leaves less than half of it free.  Returns 0 if there
+ * is no more text, and the buffer is not changed, else the text has
+ * moved and is scanned again.
+ */
+static int
+zlexer_more(struct zlexer_buffer* buf)
+{
+	size_t keep;
+	ssize_t r;
+	if(buf->kind != ZLEXER_FILE || buf->fd == -1)
+		return 0;
+	keep = (buf->pos > 0 ? buf->pos-1 : 0);
+	memmove((char*)buf->data, buf->data+keep, buf->size-keep);
+	buf->offset += keep;
+	buf->size -= keep;
+	buf->pos -= keep;
+	if(buf->max - buf->size < buf->max/2) {
+		buf->max *= 2;
+		buf->data = (char*)xrealloc((char*)buf->data, buf->max);
+	}
+	r = zlexer_buffer_read(buf);
+	if(r == -1)
+		zc_error("error reading %s: %s", parser->filename,
+			strerror(errno));
+	if(r <= 0)
+		zlexer_buffer_eof(buf);
+	return 1;
+}
+
+static void
+zlexer_buffer_close(struct zlexer_buffer* buf)
+{
+	if(buf->kind == ZLEXER_FILE) {
+		zlexer_buffer_eof(buf);
+		free((void*)buf->data);
+	}
+	buf->data = NULL;
+	buf->size = 0;
+	buf->pos = 0;
+	buf->kind = ZLEXER_STRING;
+}
+
+/*
+ * Saves the file specific variables on the include stack.
+ */
+static void
+push_parser_state(struct zlexer_buffer* input)
+{
+	zparser_stack[include_stack_ptr].filename = parser->filename;
+	zparser_stack[include_stack_ptr].line = parser->line;
+	zparser_stack[include_stack_ptr].origin = parser->origin;
+	include_stack[include_stack_ptr] = current;
+	current = input;
+	++include_stack_ptr;
+}
+
+/*
+ * Restores the file specific variables from the include stack.
+ */
+static void
+pop_parser_state(void)
+{
+	--include_stack_ptr;
+	parser->filename = zparser_stack[include_stack_ptr].filename;
+	parser->line = zparser_stack[include_stack_ptr].line;
+	parser->origin = zparser_stack[include_stack_ptr].origin;
+	zlexer_buffer_close(current);
+	free(current);
+	current = include_stack[include_stack_ptr];
+}
+
+int
+zlexer_open(const char* filename)
+{
+	if(!zlexer_buffer_open(&zonefile_buffer, filename))
+		return 0;
+	current = &zonefile_buffer;
+	paren_open = 0;
+	lexer_state = EXPECT_OWNER;
+	return 1;
+}
+
+void
+zlexer_close(void)
+{
+	/* an error may have stopped the parse inside an include file */
+	while(include_stack_ptr > 0)
+		pop_parser_state();
+	zlexer_buffer_close(&zonefile_buffer);
+	current = NULL;
+}
+
+int
+zlexer_percentage(void)
+{
+	uint64_t pos, size;
+	if(!current)
+		return 0;
+	pos = (uint64_t)current->pos;
+	size = (uint64_t)current->size;
+	if(current->kind == ZLEXER_FILE) {
+		/* stdin has no size */
+		pos += (uint64_t)current->offset;
+		size = (uint64_t)current->filesize;
+	}
+	if(size == 0)
+		return 0;
+	if(pos > size)
+		return 100;
+	return (int)(pos*(uint64_t)100/size);
+}
+
+/* Start string scan */
+void
+parser_push_stringbuf(char* str)
+{
+	if(!zlexer_class_done)
+		zlexer_class_setup();
+	oldstate = current;
+	string_buffer.data = str;
+	string_buffer.size = strlen(str);
+	string_buffer.pos = 0;
+	string_buffer.kind = ZLEXER_STRING;
+	string_buffer.fd = -1;
+	current = &string_buffer;
+}
+
+void
+parser_pop_stringbuf(void)
+{
+	current = oldstate;
+	oldstate = NULL;
+}
+
+/* count the newlines in a quoted string or bitlabel */
+static void
+zlexer_count_lines(const char* p, const char* end)
+{
+	while((p = memchr(p, '\n', (size_t)(end-p))) != NULL) {
+		++parser->line;
+		p++;
+	}
+}
+
+/*
+ * Length of the word at p.  This is the longest match of the flex rule
+ * {ZONESTR}({CHARSTR})*, where a backslash is an ordinary character or
+ * escapes the next character, also a newline, whichever is longer.
+ * Positions that can be reached are followed two at a time, r0 for the
+ * current position and r1 for the next one.
+ */
+static size_t
+zlexer_word(const char* start, const char* end)
+{
+	const char* p = start, *last = start;
+	int r0 = 1, r1 = 0, r2;
+	uint8_t cl = ZL_START;
+	while(p < end && (r0 || r1)) {
+		if(r0 && !r1 && p != start) {
+			/* the common case, skip ordinary characters */
+			while(p < end && (zlexer_class[(uint8_t)*p]&ZL_PLAIN))
+				p++;
+			last = p;
+			if(p == end)
+				break;
+		}
+		r2 = 0;
+		if(r0) {
+			last = p;
+			if(zlexer_class[(uint8_t)*p]&cl)
+				r1 = 1;
+			if(*p == '\\' && p+1 < end)
+				r2 = 1;
+		}
+		cl = ZL_WORD;
+		p++;
+		r0 = r1;
+		r1 = r2;
+	}
+	if(r0)
+		last = p;
+	return (size_t)(last - start);
+}
+
+/*
+ * Handles the rest of the line after $INCLUDE, from p up to the
+ * newline at eol, that is not consumed.
+ */
+static void
+zlexer_include(const char* p, const char* eol)
+{
+	char *text, *tmp;
+	domain_type *origin = parser->origin;
+	int error_occurred = parser->error_occurred;
+
+	if (include_stack_ptr >= MAXINCLUDES ) {
+		zc_error("includes nested too deeply, skipped (>%d)",
+			 MAXINCLUDES);
+		parser->error_occurred = error_occurred;
+		return;
+	}
+	text = (char*)xalloc((size_t)(eol-p)+1);
+	memcpy(text, p, (size_t)(eol-p));
+	text[eol-p] = 0;
+
+	/* Remove trailing comment.  */
+	tmp = strrchr(text, ';');
+	if (tmp) {
+		*tmp = '\0';
+	}
+	strip_string(text);
+
+	/* Parse origin for include file.  */
+	tmp = strrchr(text, ' ');
+	if (!tmp) {
+		tmp = strrchr(text, '\t');
+	}
+	if (tmp) {
+		const dname_type *dname;
+
+		/* split the original text */
+		*tmp = '\0';
+		strip_string(text);
+
+		dname = dname_parse(parser->region, tmp + 1);
+		if (!dname) {
+			zc_error("incorrect include origin '%s'",
+				 tmp + 1);
+		} else if (*(tmp + strlen(tmp + 1)) != '.') {
+			zc_error("$INCLUDE directive requires absolute domain name");
+		} else {
+			origin = domain_table_insert(
+				parser->db->domains, dname);
+		}
+	}
+
+	if (strlen(text) == 0) {
+		zc_error("missing file name in $INCLUDE directive");
+	} else {
+		struct zlexer_buffer* input = (struct zlexer_buffer*)xalloc(
+			sizeof(*input));
+		if(!zlexer_buffer_open(input, text)) {
+			zc_error("cannot open include file '%s': %s",
+				 text, strerror(errno));
+			free(input);
+		} else {
+			/* Initialize parser for include file.  */
+			char *filename = region_strdup(parser->region, text);
+			push_parser_state(input);
+			parser->filename = filename;
+			parser->line = 1;
+			parser->origin = origin;
+			lexer_state = EXPECT_OWNER;
+		}
+	}
+	free(text);
+	parser->error_occurred = error_occurred;
+}
+
+/*
+ * Handles a directive at the start of a line, the text from p up to q
+ * is $ and the letters after it.  Returns the token or 0 to continue.
+ */
+static int
+zlexer_directive(const char* p, const char* q, const char* end)
+{
+	size_t len = (size_t)(q-p);
+	if(len == 4 && strncasecmp(p, "$TTL", 4) == 0) {
+		current->pos = (size_t)(q - current->data);
+		lexer_state = PARSING_RDATA;
+		return DOLLAR_TTL;
+	}
+	if(len == 7 && strncasecmp(p, "$ORIGIN", 7) == 0) {
+		current->pos = (size_t)(q - current->data);
+		lexer_state = PARSING_RDATA;
+		return DOLLAR_ORIGIN;
+	}
+	if(len == 8 && strncasecmp(p, "$INCLUDE", 8) == 0) {
+		const char* eol;
+		if(q == end || *q == '\n') {
+			int error_occurred = parser->error_occurred;
+			zc_error("missing file name in $INCLUDE directive");
+			++parser->line;
+			parser->error_occurred = error_occurred;
+			current->pos = (size_t)(q - current->data) +
+				(q == end ? 0 : 1);
+			return 0;
+		}
+		eol = memchr(q, '\n', (size_t)(end-q));
+		if(!eol)
+			eol = end;
+		/* the include file is pushed, continue after this line in
+		 * this file when it is done */
+		current->pos = (size_t)(eol - current->data);
+		zlexer_include(q, eol);
+		return 0;
+	}
+	zc_warning("Unknown directive: %.*s", (int)len, p);
+	current->pos = (size_t)(q - current->data);
+	return 0;
+}
+
+int
+yylex(void)
+{
+	const char *p, *q, *end;
+	size_t len;
+	int token;
+
+	while(current) {
+		p = current->data + current->pos;
+		end = current->data + current->size;
+		if(p == end) {
+			if(zlexer_more(current))
+				continue;
+			if(include_stack_ptr == 0) {
+				/* the last line has no newline, end it, so
+				 * that the RR on it is not a syntax error */
+				if(lexer_state != EXPECT_OWNER && !paren_open) {
+					lexer_state = EXPECT_OWNER;
+					LEXOUT(("NL\n"));
+					return NL;
+				}
+				return 0;
+			}
+			pop_parser_state();
+			continue;
+		}
+		switch(*p) {
+		case ' ':
+		case '\t':
+			q = p+1;
+			while(q < end && (*q == ' ' || *q == '\t'))
+				q++;
+			if(q == end && zlexer_more(current))
+				continue;
+			if(q < end && *q == ';') {
+				p = q;
+				goto comment;
+			}
+			current->pos = (size_t)(q - current->data);
+			if (!paren_open && lexer_state == EXPECT_OWNER) {
+				lexer_state = PARSING_TTL_CLASS_TYPE;
+				LEXOUT(("PREV "));
+				return PREV;
+			}
+			if (lexer_state == PARSING_OWNER) {
+				lexer_state = PARSING_TTL_CLASS_TYPE;
+			}
+			LEXOUT(("SP "));
+			return SP;
+		case ';':
+		comment:
+			q = memchr(p, '\n', (size_t)(end-p));
+			current->pos = (size_t)((q?q:end) - current->data);
+			if(!q && zlexer_more(current)) {
+				/* the rest of the comment is read */
+				p = current->data + current->pos;
+				end = current->data + current->size;
+				goto comment;
+			}
+			continue;
+		case '\n':
+		case '\r':
+			current->pos++;
+			++parser->line;
+			if (!paren_open) {
+				lexer_state = EXPECT_OWNER;
+				LEXOUT(("NL\n"));
+				return NL;
+			}
+			LEXOUT(("SP "));
+			return SP;
+		case '(':
+			current->pos++;
+			if (paren_open) {
+				zc_error("nested parentheses");
+				return 0;
+			}
+			LEXOUT(("( "));
+			paren_open = 1;
+			return SP;
+		case ')':
+			current->pos++;
+			if (!paren_open) {
+				zc_error("closing parentheses without opening parentheses");
+				return 0;
+			}
+			LEXOUT((") "));
+			paren_open = 0;
+			return SP;
+		case '.':
+			current->pos++;
+			LEXOUT((". "));
+			return parse_token('.', p, 1, &lexer_state);
+		case '"':
+			/* Quoted strings.  Strip leading and ending quotes.  */
+			LEXOUT(("\" "));
+			for(q = p+1; q < end && *q != '"'; q++) {
+				if(*q == '\\' && q+1 < end && q[1] != '\n')
+					q++;
+			}
+			if(q == end && zlexer_more(current))
+				continue;
+			zlexer_count_lines(p+1, q);
+			if(q == end) {
+				zc_error("EOF inside quoted string");
+				current->pos = current->size;
+				return 0;
+			}
+			current->pos = (size_t)(q+1 - current->data);
+			LEXOUT(("STR \" "));
+			return parse_token(STR, p+1, (size_t)(q-(p+1)),
+				&lexer_state);
+		case '$':
+			if(current->pos == 0 || p[-1] == '\n') {
+				/* a directive is handled a line at a time */
+				if(!memchr(p, '\n', (size_t)(end-p)) &&
+					zlexer_more(current))
+					continue;
+				q = p+1;
+				while(q < end && isalpha((unsigned char)*q))
+					q++;
+				if(q > p+1) {
+					if((token = zlexer_directive(p, q, end)))
+						return token;
+					continue;
+				}
+			}
+			current->pos++;
+			zc_error("unknown character '%c' (\\%03d) seen - is this a zonefile?",
+				 (int) p[0], (int) p[0]);
+			continue;
+		default:
+			break;
+		}
+
+		len = zlexer_word(p, end);
+		/* the word is decided by the character after it, and the
+		 * one after that after a backslash */
+		if((size_t)(end-p) <= len+2 && zlexer_more(current))
+			continue;
+		if(p[0] == '\\' && len == 2 && p[1] == '[') {
+			/* Bitlabels.  Strip leading and ending brackets.  */
+			for(q = p+2; q < end && *q != ']'; q++) {
+				if(*q == '\\' && q+1 < end && q[1] != '\n')
+					q++;
+			}
+			if(q == end && zlexer_more(current))
+				continue;
+			zlexer_count_lines(p+2, q);
+			if(q == end) {
+				zc_error("EOF inside bitlabel");
+				current->pos = current->size;
+				return 0;
+			}
+			current->pos = (size_t)(q+1 - current->data);
+			return parse_token(BITLAB, p+2, (size_t)(q-(p+2)),
+				&lexer_state);
+		}
+		current->pos += len;
+		if(p[0] == '@' && len == 1) {
+			LEXOUT(("@ "));
+			return parse_token('@', p, len, &lexer_state);
+		}
+		if(p[0] == '\\' && len == 2 && p[1] == '#') {
+			LEXOUT(("\\# "));
+			return parse_token(URR, p, len, &lexer_state);
+		}
+		/* Any allowed word.  */
+		return parse_token(STR, p, len, &lexer_state);
+	}
+	return 0;
+}
+
+/*
+ * Analyze "word" to see if it matches an RR type, possibly by using
+ * the "TYPExxx" notation.  If it matches, the corresponding token is
+ * returned and the TYPE parameter is set to the RR type value.
+ */
+static int
+rrtype_to_token(const char *word, uint16_t *type)
+{
+	uint16_t t = rrtype_from_string(word);
+	if (t != 0) {
+		rrtype_descriptor_type *entry = rrtype_descriptor_by_type(t);
+		*type = t;
+		return entry->token;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Remove \DDD constructs from the input. See RFC 1035, section 5.1.
+ */
+static size_t
+zoctet(char *text)
+{
+	/*
+	 * s follows the string, p lags behind and rebuilds the new
+	 * string
+	 */
+	char *s;
+	char *p;
+
+	for (s = p = text; *s; ++s, ++p) {
+		assert(p <= s);
+		if (s[0] != '\\') {
+			/* Ordinary character.  */
+			*p = *s;
+		} else if (isdigit((unsigned char)s[1]) && isdigit((unsigned char)s[2]) && isdigit((unsigned char)s[3])) {
+			/* \DDD escape.  */
+			int val = (hexdigit_to_int(s[1]) * 100 +
+				   hexdigit_to_int(s[2]) * 10 +
+				   hexdigit_to_int(s[3]));
+			if (0 <= val && val <= 255) {
+				s += 3;
+				*p = val;
+			} else {
+				zc_warning("text escape \\DDD overflow");
+				*p = *++s;
+			}
+		} else if (s[1] != '\0') {
+			/* \X where X is any character, keep X.  */
+			*p = *++s;
+		} else {
+			/* Trailing backslash, ignore it.  */
+			zc_warning("trailing backslash ignored");
+			--p;
+		}
+	}
+	*p = '\0';
+	return p - text;
+}
+
+static int
+parse_token(int token, const char *text, size_t len,
+	enum lexer_state *lexer_state)
+{
+	char *str = (char*)region_alloc(parser->rr_region, len+1);
+	memcpy(str, text, len);
+	str[len] = 0;
+
+	if (*lexer_state == EXPECT_OWNER) {
+		*lexer_state = PARSING_OWNER;
+	} else if (*lexer_state == PARSING_TTL_CLASS_TYPE) {
+		const char *t;
+		int token;
+		uint16_t rrclass;
+
+		/* type */
+		token = rrtype_to_token(str, &yylval.type);
+		if (token != 0) {
+			*lexer_state = PARSING_RDATA;
+			LEXOUT(("%d[%s] ", token, str));
+			return token;
+		}
+
+		/* class */
+		rrclass = rrclass_from_string(str);
+		if (rrclass != 0) {
+			yylval.klass = rrclass;
+			LEXOUT(("CLASS "));
+			return T_RRCLASS;
+		}
+
+		/* ttl */
+		yylval.ttl = strtottl(str, &t);
+		if (*t == '\0') {
+			LEXOUT(("TTL "));
+			return T_TTL;
+		}
+	}
+
+	LEXOUT(("%d[%s] ", token, str));
+	len = zoctet(str);
+
+	yylval.data.str = str;
+	yylval.data.len = len;
+
+	return token;
+}
@@ -1323,11 +1323,11 @@ zone_open(const char *filename, uint32_t ttl, uint16_t klass,
 	  const dname_type *origin)
 {
 	/* Open the zone file... */
+	if (!zlexer_open(filename)) {
+		return 0;
+	}
 	if (strcmp(filename, "-") == 0) {
-		yyin = stdin;
 		filename = "<stdin>";
-	} else if (!(yyin = fopen(filename, "r"))) {
-		return 0;
 	}
 
 	zparser_init(filename, ttl, klass, origin);
@@ -1496,14 +1496,10 @@ process_rr(void)
 		apex_rrset_checks(parser->db, rrset, rr->owner);
 
 	if(parser->line % ZONEC_PCT_COUNT == 0 && time(NULL) > startzonec + ZONEC_PCT_TIME) {
-		struct stat buf;
 		startzonec = time(NULL);
-		buf.st_size = 0;
-		fstat(fileno(yyin), &buf);
-		if(buf.st_size == 0) buf.st_size = 1;
 		VERBOSITY(1, (LOG_INFO, "parse %s %d %%",
 			parser->current_zone->opts->name,
-			(int)((uint64_t)ftell(yyin)*(uint64_t)100/(uint64_t)buf.st_size)));
+			zlexer_percentage()));
 	}
 	++totalrrs;
 	return 1;
@@ -1613,7 +1609,7 @@ zonec_read(const char* name, const char* zonefile, zone_type* zone)
 			parser->current_zone->soa_rrset->rrs[0].owner));
 	}
 
-	fclose(yyin);
+	zlexer_close();
 	if(!zone_is_slave(zone->opts))
 		check_dname(zone);
 
@@ -1650,8 +1646,6 @@ zonec_desetup_parser(void)
 		/* removed when parser->region(=db->region) is destroyed:
 		 * region_recycle(parser->region, (void*)error_dname, 1);
 		 * region_recycle(parser->region, (void*)error_domain, 1); */
-		/* clear memory for exit, but this is not portable to
-		 * other versions of lex. yylex_destroy(); */
 	}
 }
 
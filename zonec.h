@@ -59,9 +59,6 @@ struct zparser {
 
 extern zparser_type *parser;
 
-/* used in zonec.lex */
-extern FILE *yyin;
-
 /*
  * Used to mark bad domains and domain names.  Do not dereference
  * these pointers!
@@ -71,9 +68,14 @@ extern domain_type *error_domain;
 
 int yyparse(void);
 int yylex(void);
-int yylex_destroy(void);
 /*int yyerror(const char *s);*/
-void yyrestart(FILE *);
+
+/* zone file scanner, zlexer.c.  Opens the file ("-" is stdin), 0 on
+ * failure with errno set. */
+int zlexer_open(const char* filename);
+void zlexer_close(void);
+/* percentage of the current (include) file that has been scanned */
+int zlexer_percentage(void);
 
 void zc_warning(const char *fmt, ...) ATTR_FORMAT(printf, 1, 2);
 void zc_warning_prev_line(const char *fmt, ...) ATTR_FORMAT(printf, 1, 2);